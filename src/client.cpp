@@ -1,104 +1,62 @@
-#include <grpcpp/grpcpp.h>
+#include "client/AsyncKVClient.h"
+#include <atomic>
 #include <iostream>
-#include <kvstore.grpc.pb.h>
-#include <kvstore.pb.h>
-#include <memory>
 #include <string>
 
-using grpc::Channel;
-using grpc::ClientContext;
-using grpc::Status;
+using kvstore::AsyncKVClient;
 using kvstore::DeleteRequest;
-using kvstore::DeleteResponse;
 using kvstore::GetRequest;
-using kvstore::GetResponse;
-using kvstore::KeyValueStore;
 using kvstore::PutRequest;
-using kvstore::PutResponse;
-
-class KeyValueStoreClient {
-public:
-  KeyValueStoreClient(std::shared_ptr<Channel> channel)
-      : stub_(KeyValueStore::NewStub(channel)) {}
-
-  bool Put(const std::string &key, const std::string &value) {
-    PutRequest request;
-    request.set_key(key);
-    request.set_value(value);
-
-    PutResponse response;
-    ClientContext context;
-
-    Status status = stub_->Put(&context, request, &response);
-    if (status.ok()) {
-      return response.success();
-    } else {
-      std::cout << "Put failed: " << status.error_code() << ": "
-                << status.error_message() << std::endl;
-      return false;
-    }
-  }
-
-  bool Get(const std::string &key, std::string *value) {
-    GetRequest request;
-    request.set_key(key);
-
-    GetResponse response;
-    ClientContext context;
-
-    Status status = stub_->Get(&context, request, &response);
-    if (status.ok()) {
-      if (response.found()) {
-        *value = response.value();
-        return true;
-      } else {
-        std::cout << "Key not found." << std::endl;
-        return false;
-      }
-    } else {
-      std::cout << "Get failed: " << status.error_code() << ": "
-                << status.error_message() << std::endl;
-      return false;
-    }
-  }
-
-  bool Delete(const std::string &key) {
-    DeleteRequest request;
-    request.set_key(key);
-
-    DeleteResponse response;
-    ClientContext context;
-
-    Status status = stub_->Delete(&context, request, &response);
-    if (status.ok()) {
-      return response.success();
-    } else {
-      std::cout << "Delete failed: " << status.error_code() << ": "
-                << status.error_message() << std::endl;
-      return false;
-    }
-  }
-
-private:
-  std::unique_ptr<KeyValueStore::Stub> stub_;
-};
 
+// Example usage of AsyncKVClient: a round trip through futures, then a
+// burst of callback-driven Puts kept in flight together.
 int main(int argc, char **argv) {
-  std::string target_address("localhost:50051");
-  KeyValueStoreClient client(
-      grpc::CreateChannel(target_address, grpc::InsecureChannelCredentials()));
-
-  // Example usage
-  std::string value;
-  if (client.Put("key1", "value1")) {
-    std::cout << "Put successful." << std::endl;
-  }
-  if (client.Get("key1", &value)) {
-    std::cout << "Get successful: " << value << std::endl;
+  AsyncKVClient::Options options;
+  options.target = argc > 1 ? argv[1] : "localhost:50051";
+  options.default_timeout = std::chrono::seconds(5);
+  AsyncKVClient client(options);
+
+  PutRequest put;
+  put.set_key("key1");
+  put.set_value("value1");
+  auto put_reply = client.Put(put).get();
+  if (!put_reply.ok()) {
+    std::cerr << "Put failed: " << put_reply.status.error_code() << ": "
+              << put_reply.status.error_message() << std::endl;
+    return 1;
   }
-  if (client.Delete("key1")) {
+  std::cout << "Put successful." << std::endl;
+
+  GetRequest get;
+  get.set_key("key1");
+  auto get_reply = client.Get(get).get();
+  if (get_reply.ok() && get_reply.response.found())
+    std::cout << "Get successful: " << get_reply.response.value()
+              << std::endl;
+  else
+    std::cout << "Key not found." << std::endl;
+
+  DeleteRequest del;
+  del.set_key("key1");
+  if (client.Delete(del).get().ok())
     std::cout << "Delete successful." << std::endl;
-  }
 
+  const int burst = 1000;
+  std::atomic<int> failed{0};
+  std::promise<void> all_done;
+  std::atomic<int> remaining{burst};
+  for (int i = 0; i < burst; ++i) {
+    put.set_key("burst-" + std::to_string(i));
+    client.Put(put, [&](const grpc::Status &status,
+                        kvstore::PutResponse &response) {
+      if (!status.ok() || !response.success())
+        ++failed;
+      if (--remaining == 0)
+        all_done.set_value();
+    });
+  }
+  all_done.get_future().wait();
+  std::cout << burst - failed << " of " << burst << " pipelined Puts succeeded."
+            << std::endl;
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,84 @@
+#include "client/AsyncKVClient.h"
+
+#include <algorithm>
+
+namespace kvstore {
+
+namespace {
+
+// Set on the client's CQ threads, whose callbacks must never block.
+thread_local bool on_cq_thread = false;
+
+} // namespace
+
+AsyncKVClient::AsyncKVClient(Options options) : options_(std::move(options)) {
+  size_t channels = std::max<size_t>(1, options_.channels);
+  for (size_t i = 0; i < channels; ++i) {
+    // Channels with identical arguments share one subchannel (and so one
+    // connection); a distinct argument gives each its own.
+    grpc::ChannelArguments args;
+    args.SetInt("kvstore.channel_index", static_cast<int>(i));
+    stubs_.push_back(KeyValueStore::NewStub(grpc::CreateCustomChannel(
+        options_.target, grpc::InsecureChannelCredentials(), args)));
+  }
+  size_t threads = std::max<size_t>(1, options_.cq_threads);
+  for (size_t i = 0; i < threads; ++i)
+    cqs_.push_back(std::make_unique<grpc::CompletionQueue>());
+  for (auto &cq : cqs_)
+    threads_.emplace_back([this, cq = cq.get()]() { Poll(cq); });
+}
+
+AsyncKVClient::~AsyncKVClient() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closing_ = true;
+    for (CallBase *call : calls_)
+      call->ctx.TryCancel();
+    slot_freed_.wait(lock, [this]() { return in_flight_ == 0; });
+  }
+  for (auto &cq : cqs_)
+    cq->Shutdown();
+  for (auto &thread : threads_)
+    thread.join();
+}
+
+grpc::Status AsyncKVClient::Admit() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (in_flight_ >= options_.max_in_flight && !closing_) {
+    if (on_cq_thread || !options_.block_when_full)
+      return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                          "too many calls in flight");
+    slot_freed_.wait(lock, [this]() {
+      return in_flight_ < options_.max_in_flight || closing_;
+    });
+  }
+  // Only callbacks can still be starting calls once closing.
+  if (closing_)
+    return grpc::Status(grpc::StatusCode::CANCELLED, "client is closing");
+  ++in_flight_;
+  return grpc::Status::OK;
+}
+
+void AsyncKVClient::Register(CallBase *call) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  calls_.insert(call);
+}
+
+void AsyncKVClient::Poll(grpc::CompletionQueue *cq) {
+  on_cq_thread = true;
+  void *tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    std::unique_ptr<CallBase> call(static_cast<CallBase *>(tag));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      calls_.erase(call.get());
+      --in_flight_;
+    }
+    // notify_all: the destructor may be waiting alongside callers.
+    slot_freed_.notify_all();
+    call->Complete(ok);
+  }
+}
+
+} // namespace kvstore
@@ -0,0 +1,192 @@
+#ifndef ASYNC_KV_CLIENT_H
+#define ASYNC_KV_CLIENT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <grpcpp/grpcpp.h>
+#include <kvstore.grpc.pb.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Asynchronous client for the KeyValueStore service.
+//
+// Every call returns immediately. Its result is delivered either to a
+// callback, run on one of the client's completion-queue threads, or
+// through a std::future. Calls are spread round-robin over a pool of
+// channels, each its own HTTP/2 connection, so one application thread
+// can keep thousands of requests in flight without queueing them all
+// behind a single connection's stream limit.
+//
+// At most max_in_flight calls are outstanding. A call beyond that blocks
+// its caller until one completes (or fails with RESOURCE_EXHAUSTED when
+// block_when_full is off). Callbacks are never blocked: one that issues a
+// call while the client is full gets RESOURCE_EXHAUSTED. A call's slot is
+// released before its callback runs, so a callback may always chain one
+// follow-up call.
+//
+// Callbacks run on the CQ threads and must not block. A callback may
+// move the response out. Destroying the client cancels outstanding calls
+// (their callbacks see CANCELLED) and waits for them; it must not race
+// with calls from other application threads.
+class AsyncKVClient {
+public:
+  struct Options {
+    std::string target = "localhost:50051";
+    size_t channels = 4;
+    size_t cq_threads = 1;
+    size_t max_in_flight = 4096;
+    bool block_when_full = true;
+    // Applied to calls that don't set their own; zero means none.
+    std::chrono::milliseconds default_timeout{0};
+  };
+
+  struct CallOptions {
+    // Overrides Options::default_timeout; zero means no deadline.
+    std::optional<std::chrono::milliseconds> timeout;
+  };
+
+  template <typename Response> struct Reply {
+    grpc::Status status;
+    Response response;
+    bool ok() const { return status.ok(); }
+  };
+
+  template <typename Response>
+  using Callback = std::function<void(const grpc::Status &, Response &)>;
+
+  explicit AsyncKVClient(Options options);
+  ~AsyncKVClient();
+
+  AsyncKVClient(const AsyncKVClient &) = delete;
+  AsyncKVClient &operator=(const AsyncKVClient &) = delete;
+
+#define KVSTORE_CLIENT_RPC(Name)                                               \
+  void Name(const Name##Request &request, Callback<Name##Response> done,       \
+            const CallOptions &options = {}) {                                 \
+    Start<Name##Request, Name##Response>(                                      \
+        &KeyValueStore::Stub::PrepareAsync##Name, request, std::move(done),    \
+        options);                                                              \
+  }                                                                            \
+  std::future<Reply<Name##Response>> Name(const Name##Request &request,        \
+                                          const CallOptions &options = {}) {   \
+    return StartFuture<Name##Request, Name##Response>(                         \
+        &KeyValueStore::Stub::PrepareAsync##Name, request, options);           \
+  }
+
+  KVSTORE_CLIENT_RPC(Put)
+  KVSTORE_CLIENT_RPC(Get)
+  KVSTORE_CLIENT_RPC(Delete)
+  KVSTORE_CLIENT_RPC(MultiGet)
+  KVSTORE_CLIENT_RPC(MultiPut)
+  KVSTORE_CLIENT_RPC(MultiDelete)
+  KVSTORE_CLIENT_RPC(Stats)
+
+#undef KVSTORE_CLIENT_RPC
+
+  // Calls started but not yet completed.
+  size_t InFlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_flight_;
+  }
+
+private:
+  template <typename Request, typename Response>
+  using Prepare = std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> (
+      KeyValueStore::Stub::*)(grpc::ClientContext *, const Request &,
+                              grpc::CompletionQueue *);
+
+  // The tag of a call on its CQ.
+  class CallBase {
+  public:
+    virtual ~CallBase() = default;
+    virtual void Complete(bool ok) = 0;
+    grpc::ClientContext ctx;
+    grpc::Status status;
+  };
+
+  template <typename Response> class Call : public CallBase {
+  public:
+    explicit Call(Callback<Response> done) : done_(std::move(done)) {}
+    void Complete(bool ok) override {
+      if (!ok && status.ok())
+        status = grpc::Status(grpc::StatusCode::UNKNOWN, "call failed");
+      done_(status, response);
+    }
+    Response response;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader;
+
+  private:
+    Callback<Response> done_;
+  };
+
+  template <typename Request, typename Response>
+  void Start(Prepare<Request, Response> prepare, const Request &request,
+             Callback<Response> done, const CallOptions &options) {
+    grpc::Status admitted = Admit();
+    if (!admitted.ok()) {
+      Response empty;
+      done(admitted, empty);
+      return;
+    }
+    auto *call = new Call<Response>(std::move(done));
+    auto timeout = options.timeout.value_or(options_.default_timeout);
+    if (timeout.count() > 0)
+      call->ctx.set_deadline(std::chrono::system_clock::now() + timeout);
+    size_t pick = next_.fetch_add(1, std::memory_order_relaxed);
+    grpc::CompletionQueue *cq = cqs_[pick % cqs_.size()].get();
+    Register(call);
+    call->reader = (stubs_[pick % stubs_.size()].get()->*prepare)(
+        &call->ctx, request, cq);
+    call->reader->StartCall();
+    call->reader->Finish(&call->response, &call->status, call);
+  }
+
+  template <typename Request, typename Response>
+  std::future<Reply<Response>> StartFuture(Prepare<Request, Response> prepare,
+                                           const Request &request,
+                                           const CallOptions &options) {
+    auto promise = std::make_shared<std::promise<Reply<Response>>>();
+    auto future = promise->get_future();
+    Start<Request, Response>(
+        prepare, request,
+        [promise](const grpc::Status &status, Response &response) {
+          promise->set_value({status, std::move(response)});
+        },
+        options);
+    return future;
+  }
+
+  // Takes an in-flight slot, waiting for one if allowed; otherwise
+  // returns why the call can't start.
+  grpc::Status Admit();
+  void Register(CallBase *call);
+  void Poll(grpc::CompletionQueue *cq);
+
+  const Options options_;
+  std::vector<std::unique_ptr<KeyValueStore::Stub>> stubs_;
+  std::vector<std::unique_ptr<grpc::CompletionQueue>> cqs_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_{0};
+
+  mutable std::mutex mutex_;
+  std::condition_variable slot_freed_;
+  size_t in_flight_ = 0;
+  bool closing_ = false;
+  std::unordered_set<CallBase *> calls_; // for cancellation on shutdown
+};
+
+} // namespace kvstore
+
+#endif // ASYNC_KV_CLIENT_H
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kvstore {
+
+// Consistent-hash ring with virtual nodes.
+//
+// Each node owns `vnodes` points on a 64-bit ring, and a key belongs to
+// the node with the first point at or after the key's hash. Points depend
+// only on the node's name, so adding or removing one node moves just the
+// keys on the arcs it gains or loses (about 1/N of them); every other key
+// keeps its owner. More virtual nodes even out the arcs: 160 keeps each
+// node's share within roughly 10% of the mean.
+class HashRing {
+public:
+  explicit HashRing(std::vector<std::string> nodes = {}, size_t vnodes = 160)
+      : nodes_(std::move(nodes)) {
+    // Sorted and deduplicated, so the ring doesn't depend on the order
+    // the nodes were listed in.
+    std::sort(nodes_.begin(), nodes_.end());
+    nodes_.erase(std::unique(nodes_.begin(), nodes_.end()), nodes_.end());
+    vnodes = std::max<size_t>(1, vnodes);
+    points_.reserve(nodes_.size() * vnodes);
+    for (size_t n = 0; n < nodes_.size(); ++n)
+      for (size_t v = 0; v < vnodes; ++v)
+        points_.push_back({hash(nodes_[n] + "#" + std::to_string(v)),
+                           static_cast<uint32_t>(n)});
+    // Ties go to the smaller name, so every client agrees.
+    std::sort(points_.begin(), points_.end(),
+              [](const Point &a, const Point &b) {
+                return a.hash != b.hash ? a.hash < b.hash : a.node < b.node;
+              });
+  }
+
+  const std::vector<std::string> &nodes() const { return nodes_; }
+  bool empty() const { return nodes_.empty(); }
+
+  // Index into nodes() of the node that owns key. The ring must not be
+  // empty.
+  size_t nodeFor(std::string_view key) const {
+    uint64_t h = hash(key);
+    auto it = std::lower_bound(
+        points_.begin(), points_.end(), h,
+        [](const Point &p, uint64_t value) { return p.hash < value; });
+    if (it == points_.end())
+      it = points_.begin();
+    return it->node;
+  }
+
+  // FNV-1a finalised with the murmur3 mix. Unlike std::hash it is the
+  // same in every process and build, which clients sharing a ring need.
+  static uint64_t hash(std::string_view data) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : data) {
+      h ^= c;
+      h *= 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+private:
+  struct Point {
+    uint64_t hash;
+    uint32_t node;
+  };
+
+  std::vector<std::string> nodes_;
+  std::vector<Point> points_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,258 @@
+#include "client/ShardedKVClient.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace kvstore {
+
+namespace {
+
+// How each batch RPC is split into per-server parts and merged back.
+
+int batchSize(const MultiGetRequest &r) { return r.keys_size(); }
+int batchSize(const MultiPutRequest &r) { return r.entries_size(); }
+int batchSize(const MultiDeleteRequest &r) { return r.keys_size(); }
+
+const std::string &keyAt(const MultiGetRequest &r, int i) { return r.keys(i); }
+const std::string &keyAt(const MultiPutRequest &r, int i) {
+  return r.entries(i).key();
+}
+const std::string &keyAt(const MultiDeleteRequest &r, int i) {
+  return r.keys(i);
+}
+
+void append(MultiGetRequest &part, const MultiGetRequest &r, int i) {
+  part.add_keys(r.keys(i));
+}
+void append(MultiPutRequest &part, const MultiPutRequest &r, int i) {
+  *part.add_entries() = r.entries(i);
+}
+void append(MultiDeleteRequest &part, const MultiDeleteRequest &r, int i) {
+  part.add_keys(r.keys(i));
+}
+
+void prepare(MultiGetResponse &merged, int n) {
+  for (int i = 0; i < n; ++i)
+    merged.add_values();
+  merged.mutable_found()->Resize(n, false);
+}
+void prepare(MultiPutResponse &merged, int) { merged.set_success(true); }
+void prepare(MultiDeleteResponse &merged, int n) {
+  merged.mutable_deleted()->Resize(n, false);
+}
+
+// positions[j] is where the part's j-th result goes in the merged reply.
+void merge(MultiGetResponse &merged, MultiGetResponse &part,
+           const std::vector<int> &positions) {
+  int n = std::min(part.values_size(), part.found_size());
+  for (int j = 0; j < n && j < static_cast<int>(positions.size()); ++j) {
+    merged.mutable_values(positions[j])->swap(*part.mutable_values(j));
+    merged.set_found(positions[j], part.found(j));
+  }
+}
+void merge(MultiPutResponse &merged, MultiPutResponse &part,
+           const std::vector<int> &) {
+  if (!part.success())
+    merged.set_success(false);
+}
+void merge(MultiDeleteResponse &merged, MultiDeleteResponse &part,
+           const std::vector<int> &positions) {
+  for (int j = 0; j < part.deleted_size() &&
+                  j < static_cast<int>(positions.size());
+       ++j)
+    merged.set_deleted(positions[j], part.deleted(j));
+}
+
+// The merged reply of one split batch, filled in as its parts complete.
+template <typename Response> struct Gather {
+  std::mutex mutex;
+  size_t pending = 0;
+  grpc::Status status;
+  Response merged;
+  AsyncKVClient::Callback<Response> done;
+};
+
+} // namespace
+
+ShardedKVClient::ShardedKVClient(Options options)
+    : options_(std::move(options)) {
+  SetEndpoints(options_.endpoints);
+  reaper_ = std::thread([this]() { ReapLoop(); });
+}
+
+ShardedKVClient::~ShardedKVClient() {
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  reap_cv_.notify_all();
+  reaper_.join();
+}
+
+void ShardedKVClient::SetEndpoints(std::vector<std::string> endpoints) {
+  HashRing ring(std::move(endpoints), options_.vnodes);
+  std::vector<std::shared_ptr<AsyncKVClient>> idle;
+  {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    std::unordered_map<std::string, std::shared_ptr<AsyncKVClient>> current;
+    for (size_t i = 0; i < shards_.size(); ++i)
+      current.emplace(ring_.nodes()[i], std::move(shards_[i]));
+    std::vector<std::shared_ptr<AsyncKVClient>> shards;
+    for (const auto &endpoint : ring.nodes()) {
+      auto it = current.find(endpoint);
+      if (it != current.end()) {
+        shards.push_back(std::move(it->second));
+        current.erase(it);
+      } else {
+        AsyncKVClient::Options client = options_.client;
+        client.target = endpoint;
+        shards.push_back(std::make_shared<AsyncKVClient>(client));
+      }
+    }
+    for (auto &removed : current)
+      retired_.push_back(std::move(removed.second));
+    ring_ = std::move(ring);
+    shards_ = std::move(shards);
+    TakeIdle(idle);
+  }
+  reap_cv_.notify_all();
+  // idle's clients shut down here, outside the lock.
+}
+
+void ShardedKVClient::TakeIdle(
+    std::vector<std::shared_ptr<AsyncKVClient>> &idle) {
+  // Callers copy a client out under the shared lock, so one held only by
+  // retired_ can't be reached; once its calls are done it can go.
+  for (auto it = retired_.begin(); it != retired_.end();) {
+    if (it->use_count() == 1 && (*it)->InFlight() == 0) {
+      idle.push_back(std::move(*it));
+      it = retired_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Runs on reaper_, so a client is never shut down from one of its own
+// callbacks.
+void ShardedKVClient::ReapLoop() {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  while (!stopping_) {
+    if (retired_.empty())
+      reap_cv_.wait(lock);
+    else
+      reap_cv_.wait_for(lock, options_.reap_interval);
+    std::vector<std::shared_ptr<AsyncKVClient>> idle;
+    TakeIdle(idle);
+    if (idle.empty())
+      continue;
+    lock.unlock();
+    idle.clear();
+    lock.lock();
+  }
+}
+
+size_t ShardedKVClient::Retired() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return retired_.size();
+}
+
+std::vector<std::string> ShardedKVClient::Endpoints() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return ring_.nodes();
+}
+
+std::string ShardedKVClient::EndpointFor(std::string_view key) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return ring_.empty() ? std::string() : ring_.nodes()[ring_.nodeFor(key)];
+}
+
+std::shared_ptr<AsyncKVClient>
+ShardedKVClient::ShardFor(std::string_view key) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return ring_.empty() ? nullptr : shards_[ring_.nodeFor(key)];
+}
+
+template <typename Request, typename Response>
+void ShardedKVClient::Scatter(const Request &request, Callback<Response> done,
+                              const CallOptions &options,
+                              Send<Request, Response> send) {
+  int n = batchSize(request);
+  std::vector<size_t> owner(n);
+  std::vector<std::shared_ptr<AsyncKVClient>> shards;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (!ring_.empty()) {
+      for (int i = 0; i < n; ++i)
+        owner[i] = ring_.nodeFor(keyAt(request, i));
+      shards = shards_;
+    }
+  }
+  if (shards.empty()) {
+    NoEndpoints(done);
+    return;
+  }
+
+  std::vector<Request> parts(shards.size());
+  std::vector<std::vector<int>> positions(shards.size());
+  for (int i = 0; i < n; ++i) {
+    append(parts[owner[i]], request, i);
+    positions[owner[i]].push_back(i);
+  }
+  auto gather = std::make_shared<Gather<Response>>();
+  prepare(gather->merged, n);
+  gather->done = std::move(done);
+  for (const auto &p : positions)
+    gather->pending += !p.empty();
+  if (gather->pending == 0) {
+    gather->done(gather->status, gather->merged);
+    return;
+  }
+
+  for (size_t s = 0; s < shards.size(); ++s) {
+    if (positions[s].empty())
+      continue;
+    auto finish = [gather, at = std::move(positions[s])](
+                      const grpc::Status &status, Response &response) {
+      bool last;
+      {
+        std::lock_guard<std::mutex> lock(gather->mutex);
+        if (!status.ok()) {
+          if (gather->status.ok())
+            gather->status = status;
+        } else {
+          merge(gather->merged, response, at);
+          if (gather->merged.error().empty())
+            gather->merged.set_error(response.error());
+        }
+        last = --gather->pending == 0;
+      }
+      if (last)
+        gather->done(gather->status, gather->merged);
+    };
+    ((*shards[s]).*send)(parts[s], std::move(finish), options);
+  }
+}
+
+void ShardedKVClient::MultiGet(const MultiGetRequest &request,
+                               Callback<MultiGetResponse> done,
+                               const CallOptions &options) {
+  Scatter<MultiGetRequest, MultiGetResponse>(request, std::move(done),
+                                             options, &AsyncKVClient::MultiGet);
+}
+
+void ShardedKVClient::MultiPut(const MultiPutRequest &request,
+                               Callback<MultiPutResponse> done,
+                               const CallOptions &options) {
+  Scatter<MultiPutRequest, MultiPutResponse>(request, std::move(done),
+                                             options, &AsyncKVClient::MultiPut);
+}
+
+void ShardedKVClient::MultiDelete(const MultiDeleteRequest &request,
+                                  Callback<MultiDeleteResponse> done,
+                                  const CallOptions &options) {
+  Scatter<MultiDeleteRequest, MultiDeleteResponse>(
+      request, std::move(done), options, &AsyncKVClient::MultiDelete);
+}
+
+} // namespace kvstore
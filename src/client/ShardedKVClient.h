@@ -0,0 +1,141 @@
+#ifndef SHARDED_KV_CLIENT_H
+#define SHARDED_KV_CLIENT_H
+
+#include "client/AsyncKVClient.h"
+#include "client/HashRing.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace kvstore {
+
+// Client for a keyspace spread over several KeyValueStore servers.
+//
+// Keys are placed on a HashRing of the server endpoints, and each server
+// is reached through its own AsyncKVClient built from Options::client, so
+// the in-flight limit and channel pool are per server. Single-key calls
+// go to the key's owner. Batch calls are split by owner, the parts are
+// sent in parallel and their results merged back into one positional
+// reply; if any part fails the whole call reports the first failure.
+//
+// SetEndpoints changes membership. Only keys on the arcs that change hands
+// get a new owner, and nothing is migrated: moving the data, if needed,
+// is up to the caller. Calls already sent to a removed server still
+// complete; a background thread checks every reap_interval and shuts the
+// removed server's client down once they have. SetEndpoints must not be
+// called from a callback.
+class ShardedKVClient {
+public:
+  struct Options {
+    std::vector<std::string> endpoints;
+    size_t vnodes = 160;
+    // Options for each server's client; target is set per endpoint.
+    AsyncKVClient::Options client;
+    std::chrono::milliseconds reap_interval{100};
+  };
+
+  using CallOptions = AsyncKVClient::CallOptions;
+  template <typename Response> using Reply = AsyncKVClient::Reply<Response>;
+  template <typename Response>
+  using Callback = AsyncKVClient::Callback<Response>;
+
+  explicit ShardedKVClient(Options options);
+  ~ShardedKVClient();
+
+  ShardedKVClient(const ShardedKVClient &) = delete;
+  ShardedKVClient &operator=(const ShardedKVClient &) = delete;
+
+  // Replaces the set of servers. Clients for servers that stay are kept,
+  // along with their connections.
+  void SetEndpoints(std::vector<std::string> endpoints);
+  std::vector<std::string> Endpoints() const;
+  // The endpoint that owns key; empty when there are no endpoints.
+  std::string EndpointFor(std::string_view key) const;
+  // Clients of removed servers not yet shut down.
+  size_t Retired() const;
+
+#define KVSTORE_SHARDED_FUTURE(Name)                                           \
+  std::future<Reply<Name##Response>> Name(const Name##Request &request,        \
+                                          const CallOptions &options = {}) {   \
+    auto promise = std::make_shared<std::promise<Reply<Name##Response>>>();    \
+    auto future = promise->get_future();                                       \
+    Name(                                                                      \
+        request,                                                               \
+        [promise](const grpc::Status &status, Name##Response &response) {      \
+          promise->set_value({status, std::move(response)});                   \
+        },                                                                     \
+        options);                                                              \
+    return future;                                                             \
+  }
+
+#define KVSTORE_SHARDED_RPC(Name)                                              \
+  void Name(const Name##Request &request, Callback<Name##Response> done,       \
+            const CallOptions &options = {}) {                                 \
+    if (auto shard = ShardFor(request.key()))                                  \
+      shard->Name(request, std::move(done), options);                          \
+    else                                                                       \
+      NoEndpoints(done);                                                       \
+  }                                                                            \
+  KVSTORE_SHARDED_FUTURE(Name)
+
+#define KVSTORE_SHARDED_BATCH(Name)                                            \
+  void Name(const Name##Request &request, Callback<Name##Response> done,       \
+            const CallOptions &options = {});                                  \
+  KVSTORE_SHARDED_FUTURE(Name)
+
+  KVSTORE_SHARDED_RPC(Put)
+  KVSTORE_SHARDED_RPC(Get)
+  KVSTORE_SHARDED_RPC(Delete)
+  KVSTORE_SHARDED_BATCH(MultiGet)
+  KVSTORE_SHARDED_BATCH(MultiPut)
+  KVSTORE_SHARDED_BATCH(MultiDelete)
+
+#undef KVSTORE_SHARDED_BATCH
+#undef KVSTORE_SHARDED_RPC
+#undef KVSTORE_SHARDED_FUTURE
+
+private:
+  template <typename Request, typename Response>
+  using Send = void (AsyncKVClient::*)(const Request &, Callback<Response>,
+                                       const CallOptions &);
+
+  std::shared_ptr<AsyncKVClient> ShardFor(std::string_view key) const;
+
+  // Moves the retired clients that can be shut down to idle. Callers hold
+  // mutex_.
+  void TakeIdle(std::vector<std::shared_ptr<AsyncKVClient>> &idle);
+  void ReapLoop();
+
+  template <typename Request, typename Response>
+  void Scatter(const Request &request, Callback<Response> done,
+               const CallOptions &options, Send<Request, Response> send);
+
+  template <typename Response>
+  static void NoEndpoints(Callback<Response> &done) {
+    Response empty;
+    done(grpc::Status(grpc::StatusCode::UNAVAILABLE, "no endpoints"), empty);
+  }
+
+  const Options options_;
+
+  mutable std::shared_mutex mutex_;
+  HashRing ring_;
+  // shards_[i] talks to ring_.nodes()[i].
+  std::vector<std::shared_ptr<AsyncKVClient>> shards_;
+  // Clients of removed servers, kept until their last calls complete.
+  std::vector<std::shared_ptr<AsyncKVClient>> retired_;
+  std::condition_variable_any reap_cv_;
+  bool stopping_ = false;
+  std::thread reaper_;
+};
+
+} // namespace kvstore
+
+#endif // SHARDED_KV_CLIENT_H
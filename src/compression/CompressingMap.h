@@ -0,0 +1,212 @@
+#pragma once
+
+#include "compression/CompressionStats.h"
+#include "compression/ValueCodec.h"
+#include "map/IConcurrentMap.h"
+#include "metrics/PerThread.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Compresses values on their way into any engine and decompresses them on
+// the way out, using a ValueCodec. Everything below this layer (eviction
+// budgets, the write-ahead log, snapshots, the change log and so
+// replicas) sees only the smaller stored form. Every value, compressed or
+// not, carries the codec's one-byte header, so enable it only on a fresh
+// store, and give every server that reads the same data (after a
+// restart, or as a replica) compression with the same dictionary.
+//
+// getCompressed() hands out a value still compressed, for clients that
+// decompress it themselves. Each thread counts its own work, so stats()
+// only merges.
+class CompressingMap : public IConcurrentMap {
+public:
+  using Stats = CompressionStats;
+
+  CompressingMap(std::shared_ptr<IConcurrentMap> store,
+                 ValueCodec::Options options)
+      : store_(std::move(store)), codec_(std::move(options)) {}
+
+  const ValueCodec &codec() const { return codec_; }
+
+  bool put(std::string_view key, std::string_view value) override {
+    return store_->put(key, encode(value));
+  }
+
+  bool putExpiring(std::string_view key, std::string_view value,
+                   std::chrono::milliseconds ttl) override {
+    return store_->putExpiring(key, encode(value), ttl);
+  }
+
+  bool expiresKeys() const override { return store_->expiresKeys(); }
+
+  bool get(std::string_view key, std::string &value) const override {
+    thread_local std::string stored;
+    return store_->get(key, stored) && decode(stored, value);
+  }
+
+  // Reads key without decompressing it: `payload` gets the codec's output
+  // (the value itself for Codec::kNone) and raw_size the value's size.
+  bool getCompressed(std::string_view key, std::string &payload,
+                     Codec &codec, uint64_t &raw_size) const {
+    if (!store_->get(key, payload))
+      return false;
+    ValueCodec::Frame frame;
+    if (!ValueCodec::parse(payload, frame)) {
+      bump(counters_.local().corrupt, 1);
+      return false;
+    }
+    codec = frame.codec;
+    raw_size = frame.raw_size;
+    payload.erase(0, payload.size() - frame.payload.size());
+    bump(counters_.local().passed_through, 1);
+    return true;
+  }
+
+  bool remove(std::string_view key) override { return store_->remove(key); }
+
+  size_t size() const override { return store_->size(); }
+
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    thread_local std::string value;
+    store_->multiGet(keys, [&](size_t i, std::string_view stored) {
+      if (decode(stored, value))
+        found(i, value);
+    });
+  }
+
+  size_t multiPut(const EntryList &entries) override {
+    thread_local std::vector<std::string> stored;
+    thread_local EntryList encoded;
+    if (stored.size() < entries.size())
+      stored.resize(entries.size());
+    encoded.clear();
+    for (size_t i = 0; i < entries.size(); ++i) {
+      encode(entries[i].second, stored[i]);
+      encoded.emplace_back(entries[i].first, stored[i]);
+    }
+    return store_->multiPut(encoded);
+  }
+
+  void multiRemove(const KeyList &keys, const IndexVisitor &removed) override {
+    store_->multiRemove(keys, removed);
+  }
+
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    return store_->scan(start, end, prefix, decoded(visit));
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    store_->forEach(decoded(visit));
+  }
+
+  void reserve(size_t count) override { store_->reserve(count); }
+
+  Stats stats() const {
+    Stats stats;
+    counters_.forEach([&](const Counters &from) {
+      auto add = [](uint64_t &to, const std::atomic<uint64_t> &counter) {
+        to += counter.load(std::memory_order_relaxed);
+      };
+      add(stats.compressed, from.compressed);
+      add(stats.uncompressed, from.uncompressed);
+      add(stats.raw_bytes, from.raw_bytes);
+      add(stats.stored_bytes, from.stored_bytes);
+      add(stats.compress_ns, from.compress_ns);
+      add(stats.decompressed, from.decompressed);
+      add(stats.decompress_ns, from.decompress_ns);
+      add(stats.passed_through, from.passed_through);
+      add(stats.corrupt, from.corrupt);
+    });
+    return stats;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // Written only by the owning thread.
+  struct Counters {
+    std::atomic<uint64_t> compressed{0};
+    std::atomic<uint64_t> uncompressed{0};
+    std::atomic<uint64_t> raw_bytes{0};
+    std::atomic<uint64_t> stored_bytes{0};
+    std::atomic<uint64_t> compress_ns{0};
+    std::atomic<uint64_t> decompressed{0};
+    std::atomic<uint64_t> decompress_ns{0};
+    std::atomic<uint64_t> passed_through{0};
+    std::atomic<uint64_t> corrupt{0};
+  };
+
+  static void bump(std::atomic<uint64_t> &counter, uint64_t by) {
+    counter.store(counter.load(std::memory_order_relaxed) + by,
+                  std::memory_order_relaxed);
+  }
+
+  static uint64_t nanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start)
+        .count();
+  }
+
+  // Values below the threshold skip the clock: their encoding is a copy.
+  void encode(std::string_view value, std::string &stored) const {
+    Counters &counters = counters_.local();
+    if (value.size() < codec_.minBytes()) {
+      codec_.encode(value, stored);
+      bump(counters.uncompressed, 1);
+    } else {
+      Clock::time_point start = Clock::now();
+      Codec codec = codec_.encode(value, stored);
+      bump(counters.compress_ns, nanosSince(start));
+      bump(codec == Codec::kNone ? counters.uncompressed : counters.compressed,
+           1);
+    }
+    bump(counters.raw_bytes, value.size());
+    bump(counters.stored_bytes, stored.size());
+  }
+
+  std::string_view encode(std::string_view value) const {
+    thread_local std::string stored;
+    encode(value, stored);
+    return stored;
+  }
+
+  bool decode(std::string_view stored, std::string &value) const {
+    ValueCodec::Frame frame;
+    bool ok = ValueCodec::parse(stored, frame);
+    if (ok && frame.codec == Codec::kNone) {
+      value.assign(frame.payload.data(), frame.payload.size());
+    } else if (ok) {
+      Counters &counters = counters_.local();
+      Clock::time_point start = Clock::now();
+      ok = codec_.decompress(frame.codec, frame.payload, frame.raw_size,
+                             value);
+      bump(counters.decompress_ns, nanosSince(start));
+      bump(counters.decompressed, 1);
+    }
+    if (!ok)
+      bump(counters_.local().corrupt, 1);
+    return ok;
+  }
+
+  ScanVisitor decoded(const ScanVisitor &visit) const {
+    return [this, &visit](std::string_view key, std::string_view stored) {
+      thread_local std::string value;
+      return !decode(stored, value) || visit(key, value);
+    };
+  }
+
+  std::shared_ptr<IConcurrentMap> store_;
+  ValueCodec codec_;
+  mutable PerThread<Counters> counters_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+namespace kvstore {
+
+// Counters of a CompressingMap, merged over its threads. Kept apart from
+// the map so metrics code can report them without the codec libraries.
+struct CompressionStats {
+  uint64_t compressed = 0;   // values written compressed
+  uint64_t uncompressed = 0; // written as is: too short or incompressible
+  uint64_t raw_bytes = 0;    // value bytes written
+  uint64_t stored_bytes = 0; // what they took once encoded
+  uint64_t compress_ns = 0;
+  uint64_t decompressed = 0;
+  uint64_t decompress_ns = 0;
+  uint64_t passed_through = 0; // values read by getCompressed()
+  uint64_t corrupt = 0;        // stored values that failed to decode
+
+  double savedBytesPerValue() const {
+    uint64_t values = compressed + uncompressed;
+    return values ? (static_cast<double>(raw_bytes) - stored_bytes) / values
+                  : 0;
+  }
+};
+
+} // namespace kvstore
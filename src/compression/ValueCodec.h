@@ -0,0 +1,333 @@
+#pragma once
+
+#include <cstdint>
+#include <lz4.h>
+#include <memory>
+#include <snappy.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <zstd.h>
+
+namespace kvstore {
+
+// How a stored value is encoded. The numbering matches the Compression
+// enum in kvstore.proto, which Get uses to pass values through.
+enum class Codec : uint8_t {
+  kNone = 0,
+  kLz4 = 1,
+  kZstd = 2,
+  kSnappy = 3,
+  kZstdDict = 4, // zstd with a trained dictionary
+};
+
+inline const char *codecName(Codec codec) {
+  switch (codec) {
+  case Codec::kNone:
+    return "none";
+  case Codec::kLz4:
+    return "lz4";
+  case Codec::kZstd:
+    return "zstd";
+  case Codec::kSnappy:
+    return "snappy";
+  case Codec::kZstdDict:
+    return "zstd_dict";
+  }
+  return "unknown";
+}
+
+// Compresses values into a self-describing stored form and back. A stored
+// value starts with a codec byte. kNone is followed by the value as is;
+// the others by the uncompressed size as a varint and then the codec's
+// payload, so any ValueCodec can read what another one wrote, whatever
+// codec it is configured with (dictionary frames need the same
+// dictionary).
+//
+// Values shorter than min_bytes, and values that don't get smaller, are
+// stored with kNone, which costs one byte. Safe to use from many threads:
+// zstd contexts are per thread and dictionaries are read-only.
+class ValueCodec {
+public:
+  struct Options {
+    Codec codec = Codec::kLz4;
+    size_t min_bytes = 256;
+    int zstd_level = 3;
+    // A zstd dictionary (e.g. from `zstd --train`). With kZstd, values
+    // are compressed against it as kZstdDict.
+    std::string dictionary;
+  };
+
+  // A stored value taken apart: the codec, the uncompressed size and the
+  // codec's payload (the value itself for kNone).
+  struct Frame {
+    Codec codec = Codec::kNone;
+    uint64_t raw_size = 0;
+    std::string_view payload;
+  };
+
+  static Codec parseCodec(const std::string &name) {
+    if (name == "none")
+      return Codec::kNone;
+    if (name == "lz4")
+      return Codec::kLz4;
+    if (name == "zstd")
+      return Codec::kZstd;
+    if (name == "snappy")
+      return Codec::kSnappy;
+    throw std::runtime_error("Unknown compression codec: " + name);
+  }
+
+  explicit ValueCodec(Options options) : options_(std::move(options)) {
+    if (options_.dictionary.empty()) {
+      if (options_.codec == Codec::kZstdDict)
+        throw std::runtime_error("zstd_dict needs a dictionary");
+      return;
+    }
+    cdict_.reset(ZSTD_createCDict(options_.dictionary.data(),
+                                  options_.dictionary.size(),
+                                  options_.zstd_level));
+    ddict_.reset(ZSTD_createDDict(options_.dictionary.data(),
+                                  options_.dictionary.size()));
+    if (!cdict_ || !ddict_)
+      throw std::runtime_error("Bad zstd dictionary");
+    if (options_.codec == Codec::kZstd)
+      options_.codec = Codec::kZstdDict;
+  }
+
+  // The codec values at least min_bytes long are compressed with.
+  Codec codec() const { return options_.codec; }
+  size_t minBytes() const { return options_.min_bytes; }
+
+  // Replaces `out` with the stored form of `value`. Returns the codec it
+  // chose.
+  Codec encode(std::string_view value, std::string &out) const {
+    Codec codec = value.size() < options_.min_bytes ? Codec::kNone
+                                                    : options_.codec;
+    if (codec != Codec::kNone) {
+      size_t header = 1 + writeVarint(value.size(), nullptr);
+      out.resize(header + maxCompressedSize(codec, value.size()));
+      out[0] = static_cast<char>(codec);
+      writeVarint(value.size(), &out[1]);
+      size_t size = compress(codec, value, &out[header], out.size() - header);
+      // Incompressible values are kept as they are.
+      if (size > 0 && header + size < 1 + value.size()) {
+        out.resize(header + size);
+        return codec;
+      }
+    }
+    out.resize(1 + value.size());
+    out[0] = static_cast<char>(Codec::kNone);
+    value.copy(&out[1], value.size());
+    return Codec::kNone;
+  }
+
+  // Replaces `out` with the value `stored` encodes. Returns false if it is
+  // malformed or needs a dictionary this codec doesn't have.
+  bool decode(std::string_view stored, std::string &out) const {
+    Frame frame;
+    if (!parse(stored, frame))
+      return false;
+    if (frame.codec == Codec::kNone) {
+      out.assign(frame.payload.data(), frame.payload.size());
+      return true;
+    }
+    return decompress(frame.codec, frame.payload, frame.raw_size, out);
+  }
+
+  // Replaces `out` with the `raw_size` bytes a codec's payload holds, as a
+  // client does with a value Get passed through. A raw_size the payload
+  // can't expand to is rejected before anything is allocated.
+  bool decompress(Codec codec, std::string_view payload, uint64_t raw_size,
+                  std::string &out) const {
+    if (!plausible(codec, payload, raw_size))
+      return false;
+    out.resize(raw_size);
+    char *dst = out.empty() ? nullptr : &out[0];
+    switch (codec) {
+    case Codec::kNone:
+      if (payload.size() != raw_size)
+        return false;
+      payload.copy(dst, payload.size());
+      return true;
+    case Codec::kLz4:
+      return raw_size <= static_cast<uint64_t>(LZ4_MAX_INPUT_SIZE) &&
+             LZ4_decompress_safe(payload.data(), dst,
+                                 static_cast<int>(payload.size()),
+                                 static_cast<int>(raw_size)) ==
+                 static_cast<int>(raw_size);
+    case Codec::kZstd:
+      return zstdDone(ZSTD_decompressDCtx(zstdContexts().d, dst, raw_size,
+                                          payload.data(), payload.size()),
+                      raw_size);
+    case Codec::kZstdDict:
+      return ddict_ &&
+             zstdDone(ZSTD_decompress_usingDDict(
+                          zstdContexts().d, dst, raw_size, payload.data(),
+                          payload.size(), ddict_.get()),
+                      raw_size);
+    case Codec::kSnappy: {
+      size_t length = 0;
+      return snappy::GetUncompressedLength(payload.data(), payload.size(),
+                                           &length) &&
+             length == raw_size &&
+             snappy::RawUncompress(payload.data(), payload.size(), dst);
+    }
+    }
+    return false;
+  }
+
+  // Splits a stored value into its parts without decompressing it.
+  static bool parse(std::string_view stored, Frame &frame) {
+    if (stored.empty() ||
+        static_cast<uint8_t>(stored[0]) > static_cast<uint8_t>(kLastCodec))
+      return false;
+    frame.codec = static_cast<Codec>(stored[0]);
+    size_t pos = 1;
+    if (frame.codec == Codec::kNone) {
+      frame.raw_size = stored.size() - 1;
+    } else {
+      frame.raw_size = 0;
+      for (int shift = 0;; shift += 7) {
+        if (pos == stored.size() || shift > 63)
+          return false;
+        uint8_t byte = static_cast<uint8_t>(stored[pos++]);
+        frame.raw_size |= uint64_t{byte & 0x7fu} << shift;
+        if (byte < 0x80)
+          break;
+      }
+    }
+    frame.payload = stored.substr(pos);
+    return true;
+  }
+
+private:
+  static constexpr Codec kLastCodec = Codec::kZstdDict;
+
+  struct CDictDeleter {
+    void operator()(ZSTD_CDict *dict) const { ZSTD_freeCDict(dict); }
+  };
+  struct DDictDeleter {
+    void operator()(ZSTD_DDict *dict) const { ZSTD_freeDDict(dict); }
+  };
+
+  struct ZstdContexts {
+    ZSTD_CCtx *c = ZSTD_createCCtx();
+    ZSTD_DCtx *d = ZSTD_createDCtx();
+    ~ZstdContexts() {
+      ZSTD_freeCCtx(c);
+      ZSTD_freeDCtx(d);
+    }
+  };
+
+  static ZstdContexts &zstdContexts() {
+    thread_local ZstdContexts contexts;
+    return contexts;
+  }
+
+  // Whether `payload` can decompress to `raw_size` bytes: within the
+  // codec's best compression ratio and, where the payload records its
+  // size, equal to it. The size comes from stored data or a client, so it
+  // is checked before it is used to size a buffer.
+  static bool plausible(Codec codec, std::string_view payload,
+                        uint64_t raw_size) {
+    uint64_t n = payload.size();
+    switch (codec) {
+    case Codec::kNone:
+      return n == raw_size;
+    case Codec::kLz4:
+      // A match of 255 more bytes per extra length byte at best.
+      return raw_size <= static_cast<uint64_t>(LZ4_MAX_INPUT_SIZE) &&
+             raw_size / 255 <= n;
+    case Codec::kZstd:
+    case Codec::kZstdDict:
+      // A 128 KB block as a 4-byte RLE block at best.
+      return raw_size >> 16 <= n &&
+             ZSTD_getFrameContentSize(payload.data(), payload.size()) ==
+                 raw_size;
+    case Codec::kSnappy: {
+      // A 64-byte copy per 3-byte op at best.
+      size_t length = 0;
+      return raw_size / 32 <= n &&
+             snappy::GetUncompressedLength(payload.data(), payload.size(),
+                                           &length) &&
+             length == raw_size;
+    }
+    }
+    return false;
+  }
+
+  static bool zstdDone(size_t result, uint64_t raw_size) {
+    return !ZSTD_isError(result) && result == raw_size;
+  }
+
+  // Writes `value` as a varint to `out` unless it is null. Returns the
+  // length.
+  static size_t writeVarint(uint64_t value, char *out) {
+    size_t length = 1;
+    for (; value >= 0x80; value >>= 7, ++length)
+      if (out)
+        *out++ = static_cast<char>(value | 0x80);
+    if (out)
+      *out = static_cast<char>(value);
+    return length;
+  }
+
+  static size_t maxCompressedSize(Codec codec, size_t size) {
+    switch (codec) {
+    case Codec::kLz4:
+      if (size > static_cast<size_t>(LZ4_MAX_INPUT_SIZE))
+        return 0;
+      return static_cast<size_t>(LZ4_compressBound(static_cast<int>(size)));
+    case Codec::kZstd:
+    case Codec::kZstdDict:
+      return ZSTD_compressBound(size);
+    case Codec::kSnappy:
+      return snappy::MaxCompressedLength(size);
+    case Codec::kNone:
+      break;
+    }
+    return 0;
+  }
+
+  // Compresses into dst. Returns the payload size, or 0 on failure.
+  size_t compress(Codec codec, std::string_view value, char *dst,
+                  size_t capacity) const {
+    if (capacity == 0)
+      return 0;
+    switch (codec) {
+    case Codec::kLz4: {
+      int size = LZ4_compress_default(value.data(), dst,
+                                      static_cast<int>(value.size()),
+                                      static_cast<int>(capacity));
+      return size > 0 ? static_cast<size_t>(size) : 0;
+    }
+    case Codec::kZstd: {
+      size_t size = ZSTD_compressCCtx(zstdContexts().c, dst, capacity,
+                                      value.data(), value.size(),
+                                      options_.zstd_level);
+      return ZSTD_isError(size) ? 0 : size;
+    }
+    case Codec::kZstdDict: {
+      size_t size =
+          ZSTD_compress_usingCDict(zstdContexts().c, dst, capacity,
+                                   value.data(), value.size(), cdict_.get());
+      return ZSTD_isError(size) ? 0 : size;
+    }
+    case Codec::kSnappy: {
+      size_t size = 0;
+      snappy::RawCompress(value.data(), value.size(), dst, &size);
+      return size;
+    }
+    case Codec::kNone:
+      break;
+    }
+    return 0;
+  }
+
+  Options options_;
+  std::unique_ptr<ZSTD_CDict, CDictDeleter> cdict_;
+  std::unique_ptr<ZSTD_DDict, DDictDeleter> ddict_;
+};
+
+} // namespace kvstore
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "IMap.h"
+#include <atomic>
 #include <boost/container/flat_map.hpp>
 #include <map>
+#include <mutex>
 
 namespace kvstore {
 
@@ -13,10 +15,18 @@ public:
   }
 
   bool insert(const K &key, const V &value) override {
-    return map_.insert(std::make_pair(key, value)).second;
+    bool inserted = map_.insert(std::make_pair(key, value)).second;
+    if (inserted)
+      stale_ = true;
+    return inserted;
   }
 
-  bool remove(const K &key) override { return map_.erase(key) > 0; }
+  bool remove(const K &key) override {
+    bool removed = map_.erase(key) > 0;
+    if (removed)
+      stale_ = true;
+    return removed;
+  }
 
   bool get(const K &key, V &value) const override {
     auto it = map_.find(key);
@@ -33,32 +43,55 @@ public:
 
   size_t size() const override { return map_.size(); }
 
-  void clear() override { map_.clear(); }
+  void clear() override {
+    map_.clear();
+    stale_ = true;
+  }
 
-  // Ordered map operations
-  typename IMap<K, V>::iterator begin() const override {
-    // Convert boost::container::flat_map iterator to std::map iterator
-    std::map<K, V> temp_map(map_.begin(), map_.end());
-    return temp_map.begin();
+  // Walks the flat map itself; StripedMap iterates through this.
+  bool forEach(const typename IMap<K, V>::Visitor &visit) const override {
+    for (const auto &entry : map_)
+      if (!visit(entry.first, entry.second))
+        return false;
+    return true;
   }
 
-  typename IMap<K, V>::iterator end() const override {
-    std::map<K, V> temp_map(map_.begin(), map_.end());
-    return temp_map.end();
+  // Ordered map operations. IMap iterators are std::map iterators, so
+  // these go through a std::map copy of the flat map, built on first use
+  // and rebuilt only after a modification; iterators stay valid until the
+  // next one. Prefer forEach(), which needs no copy.
+  typename IMap<K, V>::iterator begin() const override {
+    return view().begin();
   }
 
+  typename IMap<K, V>::iterator end() const override { return view().end(); }
+
   typename IMap<K, V>::iterator lower_bound(const K &key) const override {
-    std::map<K, V> temp_map(map_.begin(), map_.end());
-    return temp_map.lower_bound(key);
+    return view().lower_bound(key);
   }
 
   typename IMap<K, V>::iterator upper_bound(const K &key) const override {
-    std::map<K, V> temp_map(map_.begin(), map_.end());
-    return temp_map.upper_bound(key);
+    return view().upper_bound(key);
   }
 
 private:
+  // Concurrent const callers (e.g. StripedMap readers under a shared lock)
+  // may race to rebuild the copy, so the rebuild is serialized.
+  const std::map<K, V> &view() const {
+    if (stale_.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(view_mutex_);
+      if (stale_.load(std::memory_order_relaxed)) {
+        view_ = std::map<K, V>(map_.begin(), map_.end());
+        stale_.store(false, std::memory_order_release);
+      }
+    }
+    return view_;
+  }
+
   boost::container::flat_map<K, V> map_;
+  mutable std::map<K, V> view_;
+  mutable std::atomic<bool> stale_{false};
+  mutable std::mutex view_mutex_;
 };
 
 } // namespace kvstore
\ No newline at end of file
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "IConcurrentMap.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Bounds the memory of any engine by evicting keys, so the server can run
+// as a cache. Keys are split over independent shards, each owning
+// max_bytes / shards of the budget and its own eviction metadata, so no
+// lock is shared by all CQ threads.
+//
+// The default policy is S3-FIFO (Yang et al., SOSP '23). New keys enter a
+// small FIFO holding ~10% of the shard's bytes; a key read at least twice
+// while there is promoted to the main FIFO, anything else is evicted and
+// remembered as a 64-bit fingerprint in a ghost FIFO. A key that comes back
+// while its fingerprint is still in the ghost goes straight to main. Main
+// is a FIFO with reinsertion: keys read since they were last examined get
+// another round, the rest are evicted. One-hit wonders and scans therefore
+// churn through the small queue without displacing the hot set.
+//
+// A hit only bumps a 2-bit counter. It takes the shard lock with try_lock
+// and drops the bump when the shard is busy, so reads never wait on a
+// writer that is evicting; the policy just sees slightly fewer hits. LRU
+// (for comparison) has to move the key on every hit and locks always.
+//
+// Memory is accounted as cost(): the key twice (the engine's copy and the
+// one kept here), the value and kEntryOverhead bytes, an estimate of the
+// engine's and this map's per-entry cost. Writes apply to the engine and
+// the metadata under the shard lock, so the two always agree on which keys
+// are resident.
+//
+// A write whose cost exceeds its shard's share of max_bytes is rejected
+// rather than stored: it would evict the whole shard and then itself. The
+// key's old value is dropped too, so a read can't return it, and the write
+// is counted in Stats::rejected. Configure fewer shards when values come
+// close to max_bytes / shards.
+class EvictingMap : public IConcurrentMap {
+public:
+  enum class Policy { kS3Fifo, kLru };
+
+  struct Options {
+    size_t max_bytes = size_t{1} << 30;
+    Policy policy = Policy::kS3Fifo;
+    size_t shards = 64;
+  };
+
+  struct Stats {
+    uint64_t evictions = 0;
+    uint64_t rejected = 0;
+    uint64_t used_bytes = 0;
+  };
+
+  // Per-key cost added to the key and value sizes.
+  static constexpr size_t kEntryOverhead = 96;
+
+  static size_t cost(std::string_view key, std::string_view value) {
+    return 2 * key.size() + value.size() + kEntryOverhead;
+  }
+
+  static Policy parsePolicy(const std::string &name) {
+    if (name == "s3fifo")
+      return Policy::kS3Fifo;
+    if (name == "lru")
+      return Policy::kLru;
+    throw std::runtime_error("Unknown eviction policy: " + name);
+  }
+
+  EvictingMap(std::shared_ptr<IConcurrentMap> store, Options options)
+      : store_(std::move(store)), options_(options),
+        shards_(std::max<size_t>(1, options_.shards)) {
+    size_t per_shard = options_.max_bytes / shards_.size();
+    for (auto &shard : shards_) {
+      shard.capacity = per_shard;
+      shard.small_capacity = std::max<size_t>(per_shard / 10, 1);
+    }
+  }
+
+  bool put(std::string_view key, std::string_view value) override {
+    Shard &shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t bytes = cost(key, value);
+    if (bytes > shard.capacity) {
+      auto it = shard.index.find(key);
+      if (it != shard.index.end()) {
+        forget(shard, it);
+        store_->remove(key);
+      }
+      ++shard.rejected;
+      return false;
+    }
+    bool inserted = store_->put(key, value);
+    admit(shard, key, bytes);
+    return inserted;
+  }
+
+  bool get(std::string_view key, std::string &value) const override {
+    if (!store_->get(key, value))
+      return false;
+    touch(key);
+    return true;
+  }
+
+  bool sharesRecords() const override { return store_->sharesRecords(); }
+  RecordPtr getRecord(std::string_view key) const override {
+    RecordPtr record = store_->getRecord(key);
+    if (record)
+      touch(key);
+    return record;
+  }
+
+  bool remove(std::string_view key) override {
+    Shard &shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end())
+      forget(shard, it);
+    return store_->remove(key);
+  }
+
+  size_t size() const override { return store_->size(); }
+
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    store_->multiGet(keys, [&](size_t i, std::string_view value) {
+      touch(keys[i]);
+      found(i, value);
+    });
+  }
+
+  // Scans don't count as hits, so they can't promote cold keys.
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    return store_->scan(start, end, prefix, visit);
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    store_->forEach(visit);
+  }
+
+  void reserve(size_t count) override { store_->reserve(count); }
+
+  Stats stats() const {
+    Stats stats;
+    for (const auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      stats.evictions += shard.evictions;
+      stats.rejected += shard.rejected;
+      stats.used_bytes += shard.small_bytes + shard.main_bytes;
+    }
+    return stats;
+  }
+
+private:
+  static constexpr uint8_t kMaxFreq = 3;
+
+  struct Entry;
+  using Queue = std::list<Entry *>;
+
+  struct Entry {
+    std::string key;
+    size_t bytes = 0;
+    uint8_t freq = 0;
+    bool in_main = false;
+    Queue::iterator pos;
+  };
+
+  // Keyed by a view of the entry's own key, so lookups by string_view
+  // don't build a string.
+  using Index = std::unordered_map<std::string_view, std::unique_ptr<Entry>>;
+
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    size_t capacity = 0;
+    size_t small_capacity = 0;
+    Index index;
+    Queue small; // S3-FIFO only
+    Queue main;  // the LRU list under kLru, most recent at the back
+    size_t small_bytes = 0;
+    size_t main_bytes = 0;
+    // Fingerprints of keys evicted from small. The FIFO can hold stale
+    // copies of a fingerprint that was readmitted; the count makes sure
+    // only the last copy leaves the set.
+    std::unordered_map<uint64_t, uint32_t> ghost;
+    std::deque<uint64_t> ghost_fifo;
+    uint64_t evictions = 0;
+    uint64_t rejected = 0;
+  };
+
+  static uint64_t fingerprint(std::string_view key) {
+    return static_cast<uint64_t>(std::hash<std::string_view>{}(key));
+  }
+
+  Shard &shardFor(std::string_view key) const {
+    // Different bits from the engine's own shard or stripe choice.
+    return shards_[(fingerprint(key) >> 20) % shards_.size()];
+  }
+
+  void touch(std::string_view key) const {
+    Shard &shard = shardFor(key);
+    if (options_.policy == Policy::kLru) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto it = shard.index.find(key);
+      if (it != shard.index.end())
+        shard.main.splice(shard.main.end(), shard.main, it->second->pos);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+      return;
+    auto it = shard.index.find(key);
+    if (it != shard.index.end() && it->second->freq < kMaxFreq)
+      ++it->second->freq;
+  }
+
+  // Records a write of `bytes` for `key`, then evicts until the shard fits.
+  void admit(Shard &shard, std::string_view key, size_t bytes) {
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      Entry &entry = *it->second;
+      (entry.in_main ? shard.main_bytes : shard.small_bytes) -= entry.bytes;
+      entry.bytes = bytes;
+      (entry.in_main ? shard.main_bytes : shard.small_bytes) += bytes;
+      if (options_.policy == Policy::kLru)
+        shard.main.splice(shard.main.end(), shard.main, entry.pos);
+      else if (entry.freq < kMaxFreq)
+        ++entry.freq;
+    } else {
+      auto owned = std::make_unique<Entry>();
+      Entry &entry = *owned;
+      entry.key.assign(key);
+      entry.bytes = bytes;
+      entry.in_main =
+          options_.policy == Policy::kLru || takeGhost(shard, key);
+      Queue &queue = entry.in_main ? shard.main : shard.small;
+      entry.pos = queue.insert(queue.end(), &entry);
+      shard.index.emplace(entry.key, std::move(owned));
+      (entry.in_main ? shard.main_bytes : shard.small_bytes) += bytes;
+    }
+    while (shard.small_bytes + shard.main_bytes > shard.capacity &&
+           !shard.index.empty())
+      evictOne(shard);
+  }
+
+  bool takeGhost(Shard &shard, std::string_view key) {
+    auto it = shard.ghost.find(fingerprint(key));
+    if (it == shard.ghost.end())
+      return false;
+    if (--it->second == 0)
+      shard.ghost.erase(it);
+    // Its FIFO copy is now stale and is skipped when it reaches the front.
+    return true;
+  }
+
+  void addGhost(Shard &shard, std::string_view key) {
+    uint64_t print = fingerprint(key);
+    ++shard.ghost[print];
+    shard.ghost_fifo.push_back(print);
+    // The ghost remembers about as many keys as main holds.
+    size_t limit = std::max<size_t>(shard.main.size(), 64);
+    while (shard.ghost_fifo.size() > limit) {
+      auto it = shard.ghost.find(shard.ghost_fifo.front());
+      if (it != shard.ghost.end() && --it->second == 0)
+        shard.ghost.erase(it);
+      shard.ghost_fifo.pop_front();
+    }
+  }
+
+  void evictOne(Shard &shard) {
+    if (options_.policy == Policy::kLru) {
+      drop(shard, *shard.main.front());
+      return;
+    }
+    if (shard.small_bytes >= shard.small_capacity || shard.main.empty())
+      evictSmall(shard);
+    else
+      evictMain(shard);
+  }
+
+  // Promotes keys that were read while in small until one is evicted or
+  // small runs empty.
+  void evictSmall(Shard &shard) {
+    while (!shard.small.empty()) {
+      Entry &entry = *shard.small.front();
+      if (entry.freq > 1) {
+        shard.small.pop_front();
+        shard.small_bytes -= entry.bytes;
+        entry.in_main = true;
+        entry.freq = 0;
+        entry.pos = shard.main.insert(shard.main.end(), &entry);
+        shard.main_bytes += entry.bytes;
+        continue;
+      }
+      addGhost(shard, entry.key);
+      drop(shard, entry);
+      return;
+    }
+    evictMain(shard);
+  }
+
+  // Reinserts keys read since their last pass, aging them, until one with
+  // no reads left reaches the front. Terminates because every pass over a
+  // key lowers its count.
+  void evictMain(Shard &shard) {
+    while (!shard.main.empty()) {
+      Entry &entry = *shard.main.front();
+      if (entry.freq > 0) {
+        --entry.freq;
+        shard.main.splice(shard.main.end(), shard.main, entry.pos);
+        continue;
+      }
+      drop(shard, entry);
+      return;
+    }
+  }
+
+  void drop(Shard &shard, Entry &entry) {
+    store_->remove(entry.key);
+    forget(shard, shard.index.find(entry.key));
+    ++shard.evictions;
+  }
+
+  void forget(Shard &shard, Index::iterator it) {
+    Entry &entry = *it->second;
+    if (entry.in_main) {
+      shard.main.erase(entry.pos);
+      shard.main_bytes -= entry.bytes;
+    } else {
+      shard.small.erase(entry.pos);
+      shard.small_bytes -= entry.bytes;
+    }
+    shard.index.erase(it);
+  }
+
+  std::shared_ptr<IConcurrentMap> store_;
+  Options options_;
+  mutable std::vector<Shard> shards_;
+};
+
+} // namespace kvstore
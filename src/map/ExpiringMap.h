@@ -0,0 +1,330 @@
+#pragma once
+
+#include "IConcurrentMap.h"
+#include "TimingWheel.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Adds per-key TTLs to any engine. Every value is stored behind an 8-byte
+// header holding its absolute expiry time in wall-clock milliseconds (0 for
+// keys that never expire), so deadlines survive the write-ahead log and
+// snapshots along with the value.
+//
+// Expiry is lazy and active. Reads hide keys whose deadline has passed.
+// Each key with a TTL is also scheduled on one of several sharded timing
+// wheels, and a background thread advances the wheels once per tick and
+// deletes the keys that came due. It deletes at most max_expired_per_slice
+// keys at a time and pauses between slices, so a burst of expiries never
+// holds an engine lock or a CPU for long. The CQ threads only pay for one
+// clock read per Get of a TTL key and, on Puts with a TTL, an O(1)
+// schedule under a shard lock.
+//
+// A write and the expiry of the same key are serialized on a stripe lock,
+// so the expiry thread re-checks the stored deadline before it deletes and
+// never removes a value that was rewritten in the meantime.
+//
+// The layer marks a store as holding headers with the kFormatKey entry,
+// written when it first opens an empty store. It refuses a store that has
+// entries but no marker: their values were written without the header,
+// and reading their first bytes as deadlines would expire them at random.
+class ExpiringMap : public IConcurrentMap {
+public:
+  using Clock = std::chrono::system_clock;
+
+  struct Options {
+    std::chrono::milliseconds tick{10};
+    size_t wheel_shards = 16;
+    size_t max_expired_per_slice = 256;
+    std::chrono::microseconds slice_pause{200};
+    // Off for stores that may drop the marker, such as an evicting cache;
+    // values too short for a header are then skipped as absent.
+    bool verify_format = true;
+  };
+
+  // Hidden from reads, scans and deletes through this layer.
+  static constexpr std::string_view kFormatKey{"\xff\xff" "expiring\0", 11};
+
+  struct Stats {
+    uint64_t expired = 0;   // deleted by the expiry thread
+    uint64_t scheduled = 0; // wheel entries still pending
+  };
+
+  // Checks the store's format marker (see above), schedules the deadlines
+  // already in `store` (e.g. after recovery), then starts the expiry
+  // thread. Throws std::runtime_error on a store written without TTLs.
+  ExpiringMap(std::shared_ptr<IConcurrentMap> store, Options options)
+      : store_(std::move(store)), options_(options),
+        shards_(std::max<size_t>(1, options_.wheel_shards)) {
+    std::string marker;
+    if (!store_->get(kFormatKey, marker)) {
+      bool empty = true;
+      store_->forEach([&](std::string_view, std::string_view) {
+        empty = false;
+        return false;
+      });
+      if (!empty && options_.verify_format)
+        throw std::runtime_error(
+            "Store holds values written without TTL headers; enable TTLs "
+            "only on a fresh store");
+      write(kFormatKey, {}, 0);
+    }
+    uint64_t now = currentTick();
+    for (auto &shard : shards_)
+      shard.wheel = std::make_unique<TimingWheel<std::string>>(now);
+    store_->forEach([&](std::string_view key, std::string_view value) {
+      uint64_t deadline = deadlineOf(value);
+      if (deadline != 0)
+        schedule(key, deadline);
+      return true;
+    });
+    expirer_ = std::thread([this]() { expireLoop(); });
+  }
+
+  ExpiringMap(const ExpiringMap &) = delete;
+  ExpiringMap &operator=(const ExpiringMap &) = delete;
+
+  ~ExpiringMap() override {
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex_);
+      stopping_ = true;
+    }
+    stop_cv_.notify_one();
+    expirer_.join();
+  }
+
+  bool put(std::string_view key, std::string_view value) override {
+    return write(key, value, 0);
+  }
+
+  bool putExpiring(std::string_view key, std::string_view value,
+                   std::chrono::milliseconds ttl) override {
+    if (ttl.count() <= 0)
+      return write(key, value, 0);
+    uint64_t deadline = nowMs() + static_cast<uint64_t>(ttl.count());
+    bool inserted = write(key, value, deadline);
+    schedule(key, deadline);
+    return inserted;
+  }
+
+  bool expiresKeys() const override { return true; }
+
+  bool get(std::string_view key, std::string &value) const override {
+    if (key == kFormatKey || !store_->get(key, value) || malformed(value) ||
+        expired(value))
+      return false;
+    value.erase(0, kHeaderSize);
+    return true;
+  }
+
+  // An expired key that is still stored counts as absent.
+  bool remove(std::string_view key) override {
+    if (key == kFormatKey)
+      return false;
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    std::string value;
+    if (!store_->get(key, value))
+      return false;
+    store_->remove(key);
+    return !expired(value);
+  }
+
+  // Includes the format marker.
+  size_t size() const override { return store_->size(); }
+
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    uint64_t now = nowMs();
+    store_->multiGet(keys, [&](size_t i, std::string_view value) {
+      if (keys[i] != kFormatKey && !malformed(value) && !expired(value, now))
+        found(i, value.substr(kHeaderSize));
+    });
+  }
+
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    return store_->scan(start, end, prefix, live(visit));
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    store_->forEach(live(visit));
+  }
+
+  void reserve(size_t count) override { store_->reserve(count); }
+
+  Stats stats() const {
+    Stats stats;
+    stats.expired = expired_.load(std::memory_order_relaxed);
+    for (const auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      stats.scheduled += shard.wheel->size();
+    }
+    return stats;
+  }
+
+  // Runs one expiry pass now instead of waiting for the next tick.
+  void expireNow() {
+    std::vector<std::string> due;
+    collectDue(due);
+    expire(due);
+  }
+
+private:
+  static constexpr size_t kHeaderSize = 8;
+  static constexpr size_t kStripes = 256;
+
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    std::unique_ptr<TimingWheel<std::string>> wheel;
+  };
+
+  static uint64_t nowMs() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now().time_since_epoch())
+            .count());
+  }
+
+  static uint64_t deadlineOf(std::string_view stored) {
+    uint64_t deadline = 0;
+    if (stored.size() >= kHeaderSize)
+      std::memcpy(&deadline, stored.data(), kHeaderSize);
+    return deadline;
+  }
+
+  // Too short for the header, so not written by this layer.
+  static bool malformed(std::string_view stored) {
+    return stored.size() < kHeaderSize;
+  }
+
+  static bool expired(std::string_view stored, uint64_t now) {
+    uint64_t deadline = deadlineOf(stored);
+    return deadline != 0 && deadline <= now;
+  }
+
+  // Reads the clock only for keys that have a deadline.
+  static bool expired(std::string_view stored) {
+    uint64_t deadline = deadlineOf(stored);
+    return deadline != 0 && deadline <= nowMs();
+  }
+
+  static ScanVisitor live(const ScanVisitor &visit) {
+    uint64_t now = nowMs();
+    return [&visit, now](std::string_view key, std::string_view value) {
+      return key == kFormatKey || malformed(value) || expired(value, now) ||
+             visit(key, value.substr(kHeaderSize));
+    };
+  }
+
+  // Deadlines round up and the current tick rounds down, so a key never
+  // comes due before its deadline; one that did would be skipped by the
+  // re-check in expire() and then never deleted.
+  uint64_t tickOf(uint64_t ms) const {
+    uint64_t tick = static_cast<uint64_t>(options_.tick.count());
+    return (ms + tick - 1) / tick;
+  }
+
+  uint64_t currentTick() const {
+    return nowMs() / static_cast<uint64_t>(options_.tick.count());
+  }
+
+  std::mutex &stripeFor(std::string_view key) {
+    return stripes_[std::hash<std::string_view>{}(key) % kStripes].mutex;
+  }
+
+  Shard &shardFor(std::string_view key) {
+    // Different bits from the stripe choice, so both spread evenly.
+    size_t h = std::hash<std::string_view>{}(key);
+    return shards_[(h >> 16) % shards_.size()];
+  }
+
+  bool write(std::string_view key, std::string_view value,
+             uint64_t deadline) {
+    thread_local std::string stored;
+    stored.resize(kHeaderSize);
+    std::memcpy(stored.data(), &deadline, kHeaderSize);
+    stored.append(value);
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    return store_->put(key, stored);
+  }
+
+  void schedule(std::string_view key, uint64_t deadline) {
+    Shard &shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.wheel->schedule(tickOf(deadline), std::string(key));
+  }
+
+  void collectDue(std::vector<std::string> &due) {
+    uint64_t now = currentTick();
+    for (auto &shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.wheel->advance(now, due);
+    }
+  }
+
+  // Deletes the due keys whose stored deadline has really passed; entries
+  // left behind by an overwrite or a delete are skipped.
+  void expire(const std::vector<std::string> &due) {
+    std::string value;
+    size_t in_slice = 0;
+    for (const auto &key : due) {
+      if (in_slice == options_.max_expired_per_slice) {
+        in_slice = 0;
+        std::unique_lock<std::mutex> lock(stop_mutex_);
+        if (stop_cv_.wait_for(lock, options_.slice_pause,
+                              [&]() { return stopping_; }))
+          return;
+      }
+      std::lock_guard<std::mutex> lock(stripeFor(key));
+      if (store_->get(key, value) && expired(value)) {
+        store_->remove(key);
+        expired_.fetch_add(1, std::memory_order_relaxed);
+        ++in_slice;
+      }
+    }
+  }
+
+  void expireLoop() {
+    std::vector<std::string> due;
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    while (!stop_cv_.wait_for(lock, options_.tick,
+                              [&]() { return stopping_; })) {
+      lock.unlock();
+      due.clear();
+      collectDue(due);
+      expire(due);
+      lock.lock();
+    }
+  }
+
+  std::shared_ptr<IConcurrentMap> store_;
+  Options options_;
+  std::array<Stripe, kStripes> stripes_;
+  std::vector<Shard> shards_;
+  std::atomic<uint64_t> expired_{0};
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_ = false;
+  std::thread expirer_;
+};
+
+} // namespace kvstore
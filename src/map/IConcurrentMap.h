@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Record.h"
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Thread-safe key/value engine used by AsyncKVServer. Unlike IMap, every
+// implementation must tolerate concurrent calls from all CQ threads. Keys are
+// taken as string_view so callers can look up straight from the request
+// buffer; get() copies into the caller's string and does not allocate when
+// that string already has enough capacity.
+class IConcurrentMap {
+public:
+  virtual ~IConcurrentMap() = default;
+
+  // Inserts the key or overwrites its value. Returns true if the key was new.
+  virtual bool put(std::string_view key, std::string_view value) = 0;
+  virtual bool get(std::string_view key, std::string &value) const = 0;
+  virtual bool remove(std::string_view key) = 0;
+  virtual size_t size() const = 0;
+
+  // Like put(), but the key disappears `ttl` from now. Only engines that
+  // report expiresKeys() honour the TTL (see ExpiringMap); the default
+  // ignores it.
+  virtual bool putExpiring(std::string_view key, std::string_view value,
+                           std::chrono::milliseconds ttl) {
+    return put(key, value);
+  }
+  virtual bool expiresKeys() const { return false; }
+
+  // Like get(), but shares the stored Record instead of copying the value
+  // out of it, so a reader can hold a large value for as long as it needs
+  // (e.g. while gRPC sends it) while writers replace it. Returns null if
+  // the key is absent. Only engines that keep values verbatim in Records
+  // report sharesRecords(), and only layers that store values unchanged
+  // pass it on; elsewhere getRecord() always returns null.
+  virtual bool sharesRecords() const { return false; }
+  virtual RecordPtr getRecord(std::string_view key) const { return nullptr; }
+
+  // Batch operations. Results are reported by position in the request, so
+  // an engine may reorder the work (e.g. sort the keys to walk an ordered
+  // index once, or group them by lock). The defaults loop over the
+  // single-key calls.
+  using KeyList = std::vector<std::string_view>;
+  using EntryList = std::vector<std::pair<std::string_view, std::string_view>>;
+  using IndexVisitor = std::function<void(size_t index)>;
+  using ValueVisitor =
+      std::function<void(size_t index, std::string_view value)>;
+
+  // Calls found(i, value) for every keys[i] that is present. The value is
+  // only valid for the duration of the call.
+  virtual void multiGet(const KeyList &keys, const ValueVisitor &found) const {
+    std::string value;
+    for (size_t i = 0; i < keys.size(); ++i)
+      if (get(keys[i], value))
+        found(i, value);
+  }
+
+  // Applies the entries as if in order, so a later duplicate key wins.
+  // Returns how many keys were new.
+  virtual size_t multiPut(const EntryList &entries) {
+    size_t inserted = 0;
+    for (const auto &[key, value] : entries)
+      inserted += put(key, value);
+    return inserted;
+  }
+
+  // Calls removed(i) for every keys[i] that was present.
+  virtual void multiRemove(const KeyList &keys, const IndexVisitor &removed) {
+    for (size_t i = 0; i < keys.size(); ++i)
+      if (remove(keys[i]))
+        removed(i);
+  }
+
+  // Returns false to stop a scan.
+  using ScanVisitor =
+      std::function<bool(std::string_view key, std::string_view value)>;
+
+  // Visits, in key order, every key >= start that starts with prefix and is
+  // < end (an empty end means unbounded), until visit returns false. Key and
+  // value are only valid for the duration of the call. Returns false
+  // without visiting anything if the engine keeps no key order.
+  virtual bool scan(std::string_view start, std::string_view end,
+                    std::string_view prefix, const ScanVisitor &visit) const {
+    return false;
+  }
+
+  // Visits every entry, in key order only if the engine is ordered, until
+  // visit returns false. Concurrent writes may or may not be seen.
+  virtual void forEach(const ScanVisitor &visit) const {
+    scan({}, {}, {}, visit);
+  }
+
+  // Hint that about `count` keys are about to be loaded.
+  virtual void reserve(size_t count) {}
+};
+
+} // namespace kvstore
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <iterator>
 #include <map>
 #include <memory>
@@ -13,6 +14,7 @@ public:
   // boost::container::flat_map
   using value_type = std::pair<const K, V>;
   using iterator = typename std::map<K, V>::const_iterator;
+  using Visitor = std::function<bool(const K &, const V &)>;
 
   virtual ~IMap() = default;
 
@@ -29,6 +31,16 @@ public:
   virtual iterator end() const = 0;
   virtual iterator lower_bound(const K &key) const = 0;
   virtual iterator upper_bound(const K &key) const = 0;
+
+  // Visits every entry in key order until visit returns false, and returns
+  // false if it did. Engines whose storage isn't a std::map override this
+  // to walk it directly.
+  virtual bool forEach(const Visitor &visit) const {
+    for (auto it = begin(); it != end(); ++it)
+      if (!visit(it->first, it->second))
+        return false;
+    return true;
+  }
 };
 
 } // namespace kvstore
\ No newline at end of file
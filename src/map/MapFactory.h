@@ -1,11 +1,18 @@
 #pragma once
 
 #include "BoostMap.h"
+#include "IConcurrentMap.h"
 #include "IMap.h"
+#include "ShardedHashMap.h"
+#include "SkipListMap.h"
 #include "StdMap.h"
+#include "StripedMap.h"
+#include "storage/LsmMap.h"
+#include <chrono>
 #include <memory>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <type_traits>
 
 namespace kvstore {
 
@@ -27,6 +34,65 @@ public:
 
     throw std::runtime_error("Unknown map type: " + map_type);
   }
+
+  // Builds the thread-safe engine the server runs on. "skiplist",
+  // "sharded_hash" and "lsm" are natively concurrent; the single-threaded
+  // IMap types are wrapped in a StripedMap.
+  static std::unique_ptr<IConcurrentMap>
+  createConcurrentMap(const nlohmann::json &config) {
+    static_assert(std::is_same<K, std::string>::value &&
+                      std::is_same<V, std::string>::value,
+                  "Concurrent maps store string keys and values");
+    std::string map_type = config["map_type"];
+
+    if (map_type == "skiplist") {
+      return std::make_unique<SkipListMap>();
+    } else if (map_type == "sharded_hash") {
+      const auto &options = config["map_options"]["sharded_hash"];
+      return std::make_unique<ShardedHashMap>(
+          options["num_shards"].get<size_t>(),
+          options["initial_capacity"].get<size_t>(),
+          options["load_factor"].get<float>());
+    } else if (map_type == "lsm") {
+      const auto &options = config["map_options"]["lsm"];
+      LsmMap::Options lsm;
+      lsm.dir = options.value("dir", lsm.dir);
+      lsm.memtable_bytes =
+          options.value("memtable_mb", lsm.memtable_bytes >> 20) << 20;
+      lsm.max_immutable_memtables = options.value(
+          "max_immutable_memtables", lsm.max_immutable_memtables);
+      lsm.l0_compaction_trigger =
+          options.value("l0_compaction_trigger", lsm.l0_compaction_trigger);
+      lsm.l0_stop_writes_trigger =
+          options.value("l0_stop_writes_trigger", lsm.l0_stop_writes_trigger);
+      lsm.base_level_bytes =
+          options.value("base_level_mb", lsm.base_level_bytes >> 20) << 20;
+      lsm.size_multiplier =
+          options.value("size_multiplier", lsm.size_multiplier);
+      lsm.target_table_bytes =
+          options.value("target_table_mb", lsm.target_table_bytes >> 20)
+          << 20;
+      lsm.block_size = options.value("block_size", lsm.block_size);
+      lsm.bloom_bits_per_key =
+          options.value("bloom_bits_per_key", lsm.bloom_bits_per_key);
+      // The engine logs its memtables itself, under the server's wal keys.
+      const auto wal = config.value("wal", nlohmann::json::object());
+      lsm.wal.durability = WriteAheadLog::parseDurability(
+          wal.value("durability", "none"));
+      lsm.wal.batch_window =
+          std::chrono::microseconds(wal.value("batch_window_us", 0));
+      lsm.wal.max_batch_bytes =
+          wal.value("max_batch_bytes", lsm.wal.max_batch_bytes);
+      return std::make_unique<LsmMap>(lsm);
+    }
+
+    // Validate the IMap type once up front so an unknown type throws here.
+    createMap(config);
+    const auto &options = config["map_options"]["striped"];
+    return std::make_unique<StripedMap>(
+        options["num_stripes"].get<size_t>(),
+        [config]() { return createMap(config); });
+  }
 };
 
-} // namespace kvstore
\ No newline at end of file
+} // namespace kvstore
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "SlabAllocator.h"
+#include <atomic>
+#include <boost/intrusive_ptr.hpp>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+
+namespace kvstore {
+
+// Immutable key/value pair stored in a single allocation: a small header
+// followed by the key bytes and then the value bytes. Records are
+// intrusively reference counted so engines can swap them atomically while
+// readers still hold the previous one. Storage comes from the global
+// SlabAllocator (or plain operator new when slabs are disabled). Keys and
+// values are limited to 4 GiB each; create() throws std::length_error past
+// that.
+class Record {
+public:
+  // Returns a record with a reference count of one.
+  static const Record *create(std::string_view key, std::string_view value) {
+    checkSizes(key.size(), value.size());
+    size_t size = sizeof(Record) + key.size() + value.size();
+    uint8_t size_class =
+        SlabAllocator::enabled() ? SlabAllocator::sizeClass(size) : 0;
+    void *mem = SlabAllocator::global().allocate(size, size_class);
+    return new (mem) Record(key, value, size_class);
+  }
+
+  // Like create(), but the value's `value_size` bytes are written in place
+  // by fill(char *value), so a value assembled from pieces is copied once.
+  // Returns null, having freed the record, if fill returns false.
+  template <typename Fill>
+  static const Record *create(std::string_view key, size_t value_size,
+                              Fill &&fill) {
+    checkSizes(key.size(), value_size);
+    size_t size = sizeof(Record) + key.size() + value_size;
+    uint8_t size_class =
+        SlabAllocator::enabled() ? SlabAllocator::sizeClass(size) : 0;
+    void *mem = SlabAllocator::global().allocate(size, size_class);
+    Record *record = new (mem) Record(key, {}, size_class);
+    record->value_size_ = static_cast<uint32_t>(value_size);
+    if (!fill(record->data() + key.size())) {
+      record->release();
+      return nullptr;
+    }
+    return record;
+  }
+
+  std::string_view key() const { return {data(), key_size_}; }
+  std::string_view value() const { return {data() + key_size_, value_size_}; }
+
+  void addRef() const { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  void release() const {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      size_t size = sizeof(Record) + key_size_ + value_size_;
+      uint8_t size_class = size_class_;
+      this->~Record();
+      SlabAllocator::global().deallocate(const_cast<Record *>(this), size,
+                                         size_class);
+    }
+  }
+
+private:
+  static void checkSizes(size_t key_size, size_t value_size) {
+    constexpr size_t kMax = std::numeric_limits<uint32_t>::max();
+    if (key_size > kMax || value_size > kMax)
+      throw std::length_error("record key or value larger than 4 GiB");
+  }
+
+  Record(std::string_view key, std::string_view value, uint8_t size_class)
+      : refs_(1), key_size_(static_cast<uint32_t>(key.size())),
+        value_size_(static_cast<uint32_t>(value.size())),
+        size_class_(size_class) {
+    std::memcpy(data(), key.data(), key.size());
+    std::memcpy(data() + key.size(), value.data(), value.size());
+  }
+
+  char *data() const {
+    return reinterpret_cast<char *>(const_cast<Record *>(this + 1));
+  }
+
+  mutable std::atomic<uint32_t> refs_;
+  uint32_t key_size_;
+  uint32_t value_size_;
+  uint8_t size_class_;
+};
+
+inline void intrusive_ptr_add_ref(const Record *r) { r->addRef(); }
+inline void intrusive_ptr_release(const Record *r) { r->release(); }
+
+using RecordPtr = boost::intrusive_ptr<const Record>;
+
+} // namespace kvstore
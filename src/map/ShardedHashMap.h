@@ -0,0 +1,327 @@
+#pragma once
+
+#include "IConcurrentMap.h"
+#include "Record.h"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kvstore {
+
+// Unordered engine for point lookups. Keys are spread over a power-of-two
+// number of shards by hash; each shard is an open-addressing table with
+// linear probing guarded by its own reader/writer lock, so Gets on
+// different shards never contend and Gets on the same shard share the lock.
+// Each occupied slot points at a Record holding key and value contiguously.
+// The load factor must lie strictly between 0 and 1: probing relies on a
+// free slot, and growth on the table filling up.
+class ShardedHashMap : public IConcurrentMap {
+public:
+  explicit ShardedHashMap(size_t num_shards = 64,
+                          size_t initial_capacity = 1024,
+                          float max_load_factor = 0.75f)
+      : max_load_factor_(max_load_factor) {
+    if (!(max_load_factor > 0.0f && max_load_factor < 1.0f))
+      throw std::invalid_argument(
+          "ShardedHashMap load factor must be between 0 and 1, exclusive");
+    size_t shards = roundUpPow2(num_shards);
+    shard_mask_ = shards - 1;
+    shard_bits_ = log2(shards);
+    size_t per_shard =
+        roundUpPow2(std::max<size_t>(initial_capacity / shards, 8));
+    shards_ = std::make_unique<Shard[]>(shards);
+    for (size_t i = 0; i < shards; ++i)
+      shards_[i].slots.resize(per_shard);
+  }
+
+  bool put(std::string_view key, std::string_view value) override {
+    uint64_t h = hash(key);
+    // Built before taking the lock; after a swap it holds the old record,
+    // which is then released once the lock is dropped.
+    RecordPtr record(Record::create(key, value), false);
+    Shard &shard = shardFor(h);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return putLocked(shard, h, record);
+  }
+
+  bool get(std::string_view key, std::string &value) const override {
+    uint64_t h = hash(key);
+    const Shard &shard = shardFor(h);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    size_t idx = find(shard, h, key);
+    if (idx == kNotFound)
+      return false;
+    value.assign(shard.slots[idx].record->value());
+    return true;
+  }
+
+  bool sharesRecords() const override { return true; }
+
+  RecordPtr getRecord(std::string_view key) const override {
+    uint64_t h = hash(key);
+    const Shard &shard = shardFor(h);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    size_t idx = find(shard, h, key);
+    return idx == kNotFound ? nullptr : shard.slots[idx].record;
+  }
+
+  bool remove(std::string_view key) override {
+    uint64_t h = hash(key);
+    RecordPtr removed; // released after the lock is dropped
+    Shard &shard = shardFor(h);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return removeLocked(shard, h, key, removed);
+  }
+
+  size_t size() const override {
+    size_t total = 0;
+    for (size_t i = 0; i <= shard_mask_; ++i) {
+      std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+      total += shards_[i].size;
+    }
+    return total;
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    for (size_t i = 0; i <= shard_mask_; ++i) {
+      const Shard &shard = shards_[i];
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (const Slot &slot : shard.slots)
+        if (slot.state == Slot::kFull &&
+            !visit(slot.record->key(), slot.record->value()))
+          return;
+    }
+  }
+
+  // Grows every shard up front so a bulk load never rehashes.
+  void reserve(size_t count) override {
+    size_t per_shard = count / (shard_mask_ + 1) + 1;
+    for (size_t i = 0; i <= shard_mask_; ++i) {
+      Shard &shard = shards_[i];
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      size_t capacity = shard.slots.size();
+      while (per_shard > capacity * max_load_factor_)
+        capacity *= 2;
+      if (capacity != shard.slots.size())
+        rebuild(shard, capacity);
+    }
+  }
+
+  size_t shardCount() const { return shard_mask_ + 1; }
+
+  // Batches are grouped by shard so each shard lock is taken once per batch
+  // rather than once per key.
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    std::vector<uint64_t> hashes(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+      hashes[i] = hash(keys[i]);
+    forEachShard(hashes, [&](Shard &shard, const uint32_t *begin,
+                             const uint32_t *end) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (const uint32_t *i = begin; i != end; ++i) {
+        size_t idx = find(shard, hashes[*i], keys[*i]);
+        if (idx != kNotFound)
+          found(*i, shard.slots[idx].record->value());
+      }
+    });
+  }
+
+  size_t multiPut(const EntryList &entries) override {
+    std::vector<uint64_t> hashes(entries.size());
+    // Hold the new records, then the replaced ones, so nothing is freed
+    // under a shard lock.
+    std::vector<RecordPtr> records(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      hashes[i] = hash(entries[i].first);
+      records[i] = RecordPtr(
+          Record::create(entries[i].first, entries[i].second), false);
+    }
+    size_t inserted = 0;
+    forEachShard(hashes, [&](Shard &shard, const uint32_t *begin,
+                             const uint32_t *end) {
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for (const uint32_t *i = begin; i != end; ++i)
+        inserted += putLocked(shard, hashes[*i], records[*i]);
+    });
+    return inserted;
+  }
+
+  void multiRemove(const KeyList &keys, const IndexVisitor &removed) override {
+    std::vector<uint64_t> hashes(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+      hashes[i] = hash(keys[i]);
+    std::vector<RecordPtr> records(keys.size());
+    std::vector<uint32_t> hits;
+    forEachShard(hashes, [&](Shard &shard, const uint32_t *begin,
+                             const uint32_t *end) {
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for (const uint32_t *i = begin; i != end; ++i)
+        if (removeLocked(shard, hashes[*i], keys[*i], records[*i]))
+          hits.push_back(*i);
+    });
+    // Report outside the locks.
+    for (uint32_t i : hits)
+      removed(i);
+  }
+
+private:
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+  struct Slot {
+    enum State : uint8_t { kEmpty, kFull, kTombstone };
+    State state = kEmpty;
+    uint64_t hash = 0;
+    RecordPtr record;
+  };
+
+  // Padded to a cache line so neighbouring shard locks don't false-share.
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mutex;
+    std::vector<Slot> slots;
+    size_t size = 0;
+    size_t tombstones = 0;
+  };
+
+  static uint64_t hash(std::string_view key) {
+    // Finalise std::hash with a murmur3 mix so both the shard bits (high) and
+    // the slot bits (low) are well distributed.
+    uint64_t h = std::hash<std::string_view>{}(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  static size_t roundUpPow2(size_t n) {
+    size_t p = 1;
+    while (p < n)
+      p <<= 1;
+    return p;
+  }
+
+  static unsigned log2(size_t pow2) {
+    unsigned bits = 0;
+    while ((size_t{1} << bits) < pow2)
+      ++bits;
+    return bits;
+  }
+
+  Shard &shardFor(uint64_t h) const {
+    return shards_[shard_bits_ == 0 ? 0 : (h >> (64 - shard_bits_))];
+  }
+
+  static size_t find(const Shard &shard, uint64_t h, std::string_view key) {
+    size_t mask = shard.slots.size() - 1;
+    for (size_t idx = h & mask;; idx = (idx + 1) & mask) {
+      const Slot &slot = shard.slots[idx];
+      if (slot.state == Slot::kEmpty)
+        return kNotFound;
+      if (slot.state == Slot::kFull && slot.hash == h &&
+          slot.record->key() == key)
+        return idx;
+    }
+  }
+
+  // Installs record for its key; on overwrite `record` is left holding the
+  // previous one. Caller holds the shard lock exclusively.
+  bool putLocked(Shard &shard, uint64_t h, RecordPtr &record) {
+    size_t idx = find(shard, h, record->key());
+    if (idx != kNotFound) {
+      shard.slots[idx].record.swap(record);
+      return false;
+    }
+    if ((shard.size + shard.tombstones + 1) >
+        shard.slots.size() * max_load_factor_)
+      rehash(shard);
+    Slot &slot = shard.slots[insertPosition(shard, h)];
+    if (slot.state == Slot::kTombstone)
+      --shard.tombstones;
+    slot.state = Slot::kFull;
+    slot.hash = h;
+    slot.record = std::move(record);
+    ++shard.size;
+    return true;
+  }
+
+  // Moves the removed record into `removed` so the caller can release it
+  // after unlocking. Caller holds the shard lock exclusively.
+  static bool removeLocked(Shard &shard, uint64_t h, std::string_view key,
+                           RecordPtr &removed) {
+    size_t idx = find(shard, h, key);
+    if (idx == kNotFound)
+      return false;
+    Slot &slot = shard.slots[idx];
+    slot.state = Slot::kTombstone;
+    removed.swap(slot.record);
+    --shard.size;
+    ++shard.tombstones;
+    return true;
+  }
+
+  // Calls fn(shard, begin, end) once per shard touched by a batch, with the
+  // batch positions that hash to it in request order.
+  template <typename Fn>
+  void forEachShard(const std::vector<uint64_t> &hashes, Fn fn) const {
+    std::vector<uint32_t> order(hashes.size());
+    for (size_t i = 0; i < order.size(); ++i)
+      order[i] = static_cast<uint32_t>(i);
+    auto shard_of = [&](uint32_t i) { return &shardFor(hashes[i]); };
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return shard_of(a) < shard_of(b);
+    });
+    for (size_t begin = 0, end; begin < order.size(); begin = end) {
+      Shard *shard = shard_of(order[begin]);
+      for (end = begin + 1; end < order.size() && shard_of(order[end]) == shard;
+           ++end) {
+      }
+      fn(*shard, order.data() + begin, order.data() + end);
+    }
+  }
+
+  // Caller has already checked the key is absent.
+  static size_t insertPosition(const Shard &shard, uint64_t h) {
+    size_t mask = shard.slots.size() - 1;
+    for (size_t idx = h & mask;; idx = (idx + 1) & mask) {
+      if (shard.slots[idx].state != Slot::kFull)
+        return idx;
+    }
+  }
+
+  void rehash(Shard &shard) {
+    // Grow only when live entries need the room; otherwise rebuilding at the
+    // same capacity is enough to flush tombstones left by deletes.
+    size_t capacity = shard.slots.size();
+    if ((shard.size + 1) > capacity * max_load_factor_ / 2)
+      capacity *= 2;
+    rebuild(shard, capacity);
+  }
+
+  // Reinserts every live entry into a table of `capacity` slots.
+  void rebuild(Shard &shard, size_t capacity) {
+    std::vector<Slot> old(capacity);
+    old.swap(shard.slots);
+    shard.tombstones = 0;
+    for (Slot &slot : old) {
+      if (slot.state != Slot::kFull)
+        continue;
+      Slot &dst = shard.slots[insertPosition(shard, slot.hash)];
+      dst.state = Slot::kFull;
+      dst.hash = slot.hash;
+      dst.record = std::move(slot.record);
+    }
+  }
+
+  float max_load_factor_;
+  size_t shard_mask_;
+  unsigned shard_bits_;
+  std::unique_ptr<Shard[]> shards_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "IConcurrentMap.h"
+#include "Record.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <folly/ConcurrentSkipList.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Skip-list element. A linked entry owns one reference to its current
+// Record, which Put swaps in place so an overwrite never unlinks the node.
+// A probe entry carries only a borrowed key for find()/erase(), so lookups
+// never copy or allocate.
+class SkipListEntry {
+public:
+  SkipListEntry() = default;
+  explicit SkipListEntry(const Record *record) : record_(record) {}
+
+  static SkipListEntry probe(std::string_view key) {
+    SkipListEntry entry;
+    entry.probe_ = key;
+    return entry;
+  }
+
+  SkipListEntry(const SkipListEntry &other)
+      : record_(other.record()), probe_(other.probe_) {
+    if (const Record *r = record_.load(std::memory_order_relaxed))
+      r->addRef();
+  }
+
+  SkipListEntry(SkipListEntry &&other) noexcept
+      : record_(other.take()), probe_(other.probe_) {}
+
+  SkipListEntry &operator=(const SkipListEntry &) = delete;
+
+  ~SkipListEntry() {
+    if (const Record *r = record_.load(std::memory_order_relaxed))
+      r->release();
+  }
+
+  std::string_view key() const {
+    const Record *r = record();
+    return r ? r->key() : probe_;
+  }
+
+  const Record *record() const {
+    return record_.load(std::memory_order_acquire);
+  }
+
+  // Installs `record` (transferring its reference) and returns the previous
+  // one, whose reference now belongs to the caller.
+  const Record *exchange(const Record *record) const {
+    return record_.exchange(record, std::memory_order_acq_rel);
+  }
+
+  // Gives up ownership of the record without releasing it.
+  const Record *take() {
+    return record_.exchange(nullptr, std::memory_order_relaxed);
+  }
+
+private:
+  mutable std::atomic<const Record *> record_{nullptr};
+  std::string_view probe_;
+};
+
+struct KeyValueComparator {
+  bool operator()(const SkipListEntry &a, const SkipListEntry &b) const {
+    return a.key() < b.key();
+  }
+};
+
+// Ordered engine backed by folly's lock-free skip list.
+class SkipListMap : public IConcurrentMap {
+public:
+  using SkipList = folly::ConcurrentSkipList<SkipListEntry, KeyValueComparator>;
+  using SkipListPtr = std::shared_ptr<SkipList>;
+
+  SkipListMap() : list_(SkipList::createInstance()) {}
+
+  ~SkipListMap() override {
+    for (Slot &slot : slots_)
+      for (const Retired &retired : slot.retired)
+        retired.record->release();
+  }
+
+  bool put(std::string_view key, std::string_view value) override {
+    Accessor accessor(*this);
+    return upsert(accessor, key, value);
+  }
+
+  bool get(std::string_view key, std::string &value) const override {
+    Accessor accessor(*this);
+    auto it = accessor->find(SkipListEntry::probe(key));
+    if (it == accessor->end())
+      return false;
+    value.assign(it->record()->value());
+    return true;
+  }
+
+  bool sharesRecords() const override { return true; }
+
+  // The reference is taken under the accessor, before a concurrent Put can
+  // retire the record.
+  RecordPtr getRecord(std::string_view key) const override {
+    Accessor accessor(*this);
+    auto it = accessor->find(SkipListEntry::probe(key));
+    if (it == accessor->end())
+      return nullptr;
+    return RecordPtr(it->record());
+  }
+
+  bool remove(std::string_view key) override {
+    Accessor accessor(*this);
+    return accessor->erase(SkipListEntry::probe(key)) > 0;
+  }
+
+  size_t size() const override { return list_->size(); }
+
+  // Batches run under a single accessor with the keys sorted, so a batch
+  // touches the list in key order. Gets go through a Skipper, which resumes
+  // each search from the previous position instead of from the head.
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    Accessor accessor(*this);
+    SkipList::Skipper skipper(*accessor);
+    for (uint32_t i : sortedOrder(keys.size(), [&](size_t i) {
+           return keys[i];
+         })) {
+      if (skipper.to(SkipListEntry::probe(keys[i])))
+        found(i, skipper->record()->value());
+    }
+  }
+
+  size_t multiPut(const EntryList &entries) override {
+    Accessor accessor(*this);
+    size_t inserted = 0;
+    for (uint32_t i : sortedOrder(entries.size(), [&](size_t i) {
+           return entries[i].first;
+         }))
+      inserted += upsert(accessor, entries[i].first, entries[i].second);
+    return inserted;
+  }
+
+  void multiRemove(const KeyList &keys, const IndexVisitor &removed) override {
+    Accessor accessor(*this);
+    for (uint32_t i : sortedOrder(keys.size(), [&](size_t i) {
+           return keys[i];
+         })) {
+      if (accessor->erase(SkipListEntry::probe(keys[i])) > 0)
+        removed(i);
+    }
+  }
+
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    Accessor accessor(*this);
+    auto from = SkipListEntry::probe(std::max(start, prefix));
+    for (auto it = accessor->lower_bound(from); it != accessor->end(); ++it) {
+      const Record *record = it->record();
+      std::string_view key = record->key();
+      // Keys sharing a prefix are contiguous, so the first miss ends it.
+      if ((!end.empty() && key >= end) ||
+          key.substr(0, prefix.size()) != prefix)
+        break;
+      if (!visit(key, record->value()))
+        break;
+    }
+    return true;
+  }
+
+private:
+  // Retire lists are sharded by thread, and threads share a slot once
+  // there are more than kSlots of them.
+  static constexpr size_t kSlots = 16;
+  // A slot tries to free its retired records every kReclaimBatch retires.
+  static constexpr size_t kReclaimBatch = 64;
+
+  struct Retired {
+    uint64_t epoch; // epoch_ when the record was unlinked
+    const Record *record;
+  };
+
+  // Accessors active in this slot's threads, counted by epoch parity, and
+  // the records those threads retired, in epoch order.
+  struct alignas(64) Slot {
+    std::atomic<int64_t> active[2] = {{0}, {0}};
+    std::mutex mutex;
+    std::vector<Retired> retired;
+  };
+
+  // Wraps the folly accessor with a registration in the current epoch.
+  // Records replaced by Put may still be under a concurrent reader's
+  // comparator, so one is released only once every accessor that could
+  // have seen it is gone — the rule folly applies to erased nodes, kept
+  // per epoch so steady traffic does not hold back every record.
+  class Accessor {
+  public:
+    explicit Accessor(const SkipListMap &map)
+        : active_(map.enter()), accessor_(map.list_) {}
+
+    ~Accessor() { active_.fetch_sub(1, std::memory_order_release); }
+
+    SkipList::Accessor *operator->() { return &accessor_; }
+    SkipList::Accessor &operator*() { return accessor_; }
+
+  private:
+    std::atomic<int64_t> &active_;
+    SkipList::Accessor accessor_;
+  };
+
+  // Upsert in a single traversal: insert() either links a new node or hands
+  // back the existing one, whose record is then replaced atomically.
+  bool upsert(Accessor &accessor, std::string_view key,
+              std::string_view value) {
+    SkipListEntry entry(Record::create(key, value));
+    auto ret = accessor->insert(std::move(entry));
+    if (ret.second)
+      return true;
+    retire(ret.first->exchange(entry.take()));
+    return false;
+  }
+
+  // Batch positions in ascending key order; equal keys keep request order
+  // so the last duplicate in a MultiPut wins.
+  template <typename KeyAt>
+  static std::vector<uint32_t> sortedOrder(size_t n, KeyAt key_at) {
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; ++i)
+      order[i] = static_cast<uint32_t>(i);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) {
+                       return key_at(a) < key_at(b);
+                     });
+    return order;
+  }
+
+  static size_t threadSlot() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t slot =
+        next.fetch_add(1, std::memory_order_relaxed) % kSlots;
+    return slot;
+  }
+
+  // Registers an accessor in the current epoch and returns the counter to
+  // drop when it ends. Re-checks the epoch after counting itself, so an
+  // accessor is never counted under an epoch that has already moved on.
+  std::atomic<int64_t> &enter() const {
+    Slot &slot = slots_[threadSlot()];
+    for (;;) {
+      uint64_t epoch = epoch_.load();
+      std::atomic<int64_t> &active = slot.active[epoch & 1];
+      active.fetch_add(1);
+      if (epoch_.load() == epoch)
+        return active;
+      active.fetch_sub(1);
+    }
+  }
+
+  // Called with the record already unlinked. The epoch is read under the
+  // slot's mutex so each retire list stays in epoch order.
+  void retire(const Record *record) {
+    Slot &slot = slots_[threadSlot()];
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    slot.retired.push_back({epoch_.load(), record});
+    if (slot.retired.size() % kReclaimBatch == 0)
+      reclaim(slot);
+  }
+
+  // Accessors only ever run in the current epoch or the one before it, so
+  // a record retired two epochs ago is out of every reader's reach.
+  // Callers hold slot.mutex.
+  void reclaim(Slot &slot) {
+    uint64_t epoch = tryAdvance();
+    auto end = std::find_if(
+        slot.retired.begin(), slot.retired.end(),
+        [&](const Retired &retired) { return retired.epoch + 2 > epoch; });
+    for (auto it = slot.retired.begin(); it != end; ++it)
+      it->record->release();
+    // erase() keeps the vector's capacity for the next batch.
+    slot.retired.erase(slot.retired.begin(), end);
+  }
+
+  // Moves the epoch on once no accessor is left in the one before it, and
+  // returns the current epoch.
+  uint64_t tryAdvance() {
+    uint64_t epoch = epoch_.load();
+    for (const Slot &slot : slots_)
+      if (slot.active[(epoch + 1) & 1].load() != 0)
+        return epoch;
+    epoch_.compare_exchange_strong(epoch, epoch + 1);
+    return epoch_.load();
+  }
+
+  SkipListPtr list_;
+  std::atomic<uint64_t> epoch_{0};
+  mutable std::array<Slot, kSlots> slots_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace kvstore {
+
+// Size-class slab allocator for Record payloads. Blocks are carved out of
+// large arena pages; each size class keeps a global free list, and every
+// thread keeps a small per-class cache in front of it so the common
+// allocate/free pair touches no shared state. Requests larger than the
+// biggest class fall through to operator new. Pages are never returned to
+// the system: memory freed by one class is reused only by that class, which
+// is what bytes_wasted and fragmentationRatio() make visible.
+class SlabAllocator {
+public:
+  static constexpr size_t kPageSize = 1 << 20;
+  static constexpr size_t kNumClasses = 24;
+  // Class 0 means "not from a slab". Sizes grow by roughly 1.25x.
+  static constexpr std::array<uint32_t, kNumClasses> kClassSizes = {
+      0,   16,  32,  48,   64,   80,   96,   128,  160,  192,  256,  320,
+      384, 448, 512, 640,  768,  1024, 1280, 1536, 2048, 2560, 3072, 4096};
+  static constexpr size_t kMaxSlabSize = kClassSizes[kNumClasses - 1];
+
+  struct Stats {
+    size_t bytes_used = 0;      // bytes callers asked for, still live
+    size_t bytes_allocated = 0; // size-class bytes handed out, still live
+    size_t bytes_reserved = 0;  // arena pages plus live large blocks
+    size_t bytes_wasted = 0;    // reserved - used
+    size_t bytes_large = 0;     // live blocks served by operator new
+    size_t pages = 0;
+    double fragmentationRatio() const {
+      return bytes_used == 0 ? 0.0
+                             : static_cast<double>(bytes_reserved) / bytes_used;
+    }
+  };
+
+  // Process-wide instance used by Record. Never destroyed, so blocks may be
+  // freed safely during static destruction.
+  static SlabAllocator &global() {
+    static SlabAllocator *instance = new SlabAllocator();
+    return *instance;
+  }
+
+  // Record allocations bypass the slabs entirely when disabled.
+  static void setEnabled(bool enabled) {
+    enabled_flag().store(enabled, std::memory_order_relaxed);
+  }
+  static bool enabled() {
+    return enabled_flag().load(std::memory_order_relaxed);
+  }
+
+  // Sets enabled() for its lifetime, then restores the previous setting.
+  class ScopedEnabled {
+  public:
+    explicit ScopedEnabled(bool enabled) : previous_(SlabAllocator::enabled()) {
+      setEnabled(enabled);
+    }
+    ~ScopedEnabled() { setEnabled(previous_); }
+    ScopedEnabled(const ScopedEnabled &) = delete;
+    ScopedEnabled &operator=(const ScopedEnabled &) = delete;
+
+  private:
+    bool previous_;
+  };
+
+  static uint8_t sizeClass(size_t size) {
+    if (size > kMaxSlabSize)
+      return 0;
+    auto it = std::lower_bound(kClassSizes.begin() + 1, kClassSizes.end(),
+                               static_cast<uint32_t>(size));
+    return static_cast<uint8_t>(it - kClassSizes.begin());
+  }
+
+  // Returns a block of at least `size` bytes. `size_class` must be
+  // sizeClass(size); pass it back unchanged to deallocate().
+  void *allocate(size_t size, uint8_t size_class) {
+    ThreadCache *cache = threadCache();
+    if (!cache)
+      return allocateUncached(size, size_class);
+    cache->used.fetch_add(size, std::memory_order_relaxed);
+    if (size_class == 0) {
+      cache->large.fetch_add(size, std::memory_order_relaxed);
+      return ::operator new(size);
+    }
+    cache->allocated.fetch_add(kClassSizes[size_class],
+                               std::memory_order_relaxed);
+    auto &local = cache->free[size_class];
+    if (local.empty())
+      refill(size_class, local);
+    void *block = local.back();
+    local.pop_back();
+    return block;
+  }
+
+  void deallocate(void *block, size_t size, uint8_t size_class) {
+    ThreadCache *cache = threadCache();
+    if (!cache)
+      return deallocateUncached(block, size, size_class);
+    cache->used.fetch_sub(size, std::memory_order_relaxed);
+    if (size_class == 0) {
+      cache->large.fetch_sub(size, std::memory_order_relaxed);
+      ::operator delete(block);
+      return;
+    }
+    cache->allocated.fetch_sub(kClassSizes[size_class],
+                               std::memory_order_relaxed);
+    auto &local = cache->free[size_class];
+    local.push_back(block);
+    if (local.size() >= 2 * kBatch)
+      flush(size_class, local, kBatch);
+  }
+
+  Stats stats() const {
+    Stats s;
+    int64_t used = retired_used_.load(std::memory_order_relaxed);
+    int64_t allocated = retired_allocated_.load(std::memory_order_relaxed);
+    int64_t large = retired_large_.load(std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(caches_mutex_);
+      for (const ThreadCache *cache : caches_) {
+        used += cache->used.load(std::memory_order_relaxed);
+        allocated += cache->allocated.load(std::memory_order_relaxed);
+        large += cache->large.load(std::memory_order_relaxed);
+      }
+    }
+    s.pages = pages_.load(std::memory_order_relaxed);
+    s.bytes_used = static_cast<size_t>(std::max<int64_t>(used, 0));
+    s.bytes_allocated = static_cast<size_t>(std::max<int64_t>(allocated, 0));
+    s.bytes_large = static_cast<size_t>(std::max<int64_t>(large, 0));
+    s.bytes_reserved = s.pages * kPageSize + s.bytes_large;
+    s.bytes_wasted =
+        s.bytes_reserved > s.bytes_used ? s.bytes_reserved - s.bytes_used : 0;
+    return s;
+  }
+
+private:
+  // Blocks moved between a thread cache and the global free list at a time.
+  static constexpr size_t kBatch = 32;
+
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  struct alignas(64) SizeClass {
+    std::mutex mutex;
+    FreeBlock *free = nullptr;
+    char *cursor = nullptr; // next uncarved byte of the current page
+    char *limit = nullptr;
+  };
+
+  // Byte counters are written only by the owning thread; they are atomics
+  // so stats() may read them from another thread.
+  struct ThreadCache {
+    std::array<std::vector<void *>, kNumClasses> free;
+    std::atomic<int64_t> used{0};
+    std::atomic<int64_t> allocated{0};
+    std::atomic<int64_t> large{0};
+
+    ThreadCache() { global().registerCache(this); }
+    ~ThreadCache() {
+      SlabAllocator &slab = global();
+      for (uint8_t c = 1; c < kNumClasses; ++c)
+        slab.flush(c, free[c], free[c].size());
+      slab.unregisterCache(this);
+      cacheDestroyed() = true;
+    }
+  };
+
+  SlabAllocator() = default;
+
+  static std::atomic<bool> &enabled_flag() {
+    static std::atomic<bool> flag{true};
+    return flag;
+  }
+
+  // Null once this thread's cache has been destroyed: records freed later
+  // in thread or process teardown (e.g. by static objects after exit())
+  // go straight to the global lists instead.
+  static ThreadCache *threadCache() {
+    if (cacheDestroyed())
+      return nullptr;
+    thread_local ThreadCache cache;
+    return &cache;
+  }
+
+  // Trivially destructible, so still readable after the cache is gone.
+  static bool &cacheDestroyed() {
+    thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  void *allocateUncached(size_t size, uint8_t size_class) {
+    retired_used_.fetch_add(size, std::memory_order_relaxed);
+    if (size_class == 0) {
+      retired_large_.fetch_add(size, std::memory_order_relaxed);
+      return ::operator new(size);
+    }
+    retired_allocated_.fetch_add(kClassSizes[size_class],
+                                 std::memory_order_relaxed);
+    std::vector<void *> local;
+    refill(size_class, local);
+    void *block = local.back();
+    local.pop_back();
+    flush(size_class, local, local.size());
+    return block;
+  }
+
+  void deallocateUncached(void *block, size_t size, uint8_t size_class) {
+    retired_used_.fetch_sub(size, std::memory_order_relaxed);
+    if (size_class == 0) {
+      retired_large_.fetch_sub(size, std::memory_order_relaxed);
+      ::operator delete(block);
+      return;
+    }
+    retired_allocated_.fetch_sub(kClassSizes[size_class],
+                                 std::memory_order_relaxed);
+    std::vector<void *> local{block};
+    flush(size_class, local, 1);
+  }
+
+  void registerCache(ThreadCache *cache) {
+    std::lock_guard<std::mutex> lock(caches_mutex_);
+    caches_.push_back(cache);
+  }
+
+  void unregisterCache(ThreadCache *cache) {
+    std::lock_guard<std::mutex> lock(caches_mutex_);
+    retired_used_ += cache->used.load();
+    retired_allocated_ += cache->allocated.load();
+    retired_large_ += cache->large.load();
+    caches_.erase(std::find(caches_.begin(), caches_.end(), cache));
+  }
+
+  void refill(uint8_t size_class, std::vector<void *> &local) {
+    SizeClass &sc = classes_[size_class];
+    size_t block_size = kClassSizes[size_class];
+    std::lock_guard<std::mutex> lock(sc.mutex);
+    while (local.size() < kBatch && sc.free != nullptr) {
+      local.push_back(sc.free);
+      sc.free = sc.free->next;
+    }
+    while (local.size() < kBatch) {
+      if (static_cast<size_t>(sc.limit - sc.cursor) < block_size) {
+        sc.cursor = static_cast<char *>(::operator new(kPageSize));
+        sc.limit = sc.cursor + kPageSize;
+        pages_.fetch_add(1, std::memory_order_relaxed);
+      }
+      local.push_back(sc.cursor);
+      sc.cursor += block_size;
+    }
+  }
+
+  void flush(uint8_t size_class, std::vector<void *> &local, size_t count) {
+    if (count == 0)
+      return;
+    SizeClass &sc = classes_[size_class];
+    std::lock_guard<std::mutex> lock(sc.mutex);
+    for (size_t i = 0; i < count; ++i) {
+      auto *block = static_cast<FreeBlock *>(local.back());
+      local.pop_back();
+      block->next = sc.free;
+      sc.free = block;
+    }
+  }
+
+  std::array<SizeClass, kNumClasses> classes_;
+  std::atomic<size_t> pages_{0};
+
+  mutable std::mutex caches_mutex_;
+  std::vector<ThreadCache *> caches_;
+  std::atomic<int64_t> retired_used_{0};
+  std::atomic<int64_t> retired_allocated_{0};
+  std::atomic<int64_t> retired_large_{0};
+};
+
+} // namespace kvstore
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "IConcurrentMap.h"
+#include "IMap.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kvstore {
+
+// Concurrency adapter for the single-threaded IMap engines. Keys are hashed
+// onto a fixed set of stripes, each owning its own sub-map behind a
+// reader/writer lock, so writers on different stripes proceed in parallel
+// and readers on the same stripe share the lock. IMap is keyed by
+// std::string, so keys are materialised per call (free for SSO-sized keys).
+class StripedMap : public IConcurrentMap {
+public:
+  using Map = IMap<std::string, std::string>;
+  using MapBuilder = std::function<std::unique_ptr<Map>()>;
+
+  StripedMap(size_t num_stripes, const MapBuilder &builder)
+      : stripes_(num_stripes == 0 ? 1 : num_stripes) {
+    for (auto &stripe : stripes_)
+      stripe.map = builder();
+  }
+
+  bool put(std::string_view key, std::string_view value) override {
+    std::string k(key), v(value);
+    Stripe &stripe = stripeFor(key);
+    std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+    if (stripe.map->insert(k, v))
+      return true;
+    // IMap::insert never overwrites, so replace the existing entry.
+    stripe.map->remove(k);
+    stripe.map->insert(k, v);
+    return false;
+  }
+
+  bool get(std::string_view key, std::string &value) const override {
+    std::string k(key);
+    const Stripe &stripe = stripeFor(key);
+    std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+    return stripe.map->get(k, value);
+  }
+
+  bool remove(std::string_view key) override {
+    std::string k(key);
+    Stripe &stripe = stripeFor(key);
+    std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+    return stripe.map->remove(k);
+  }
+
+  size_t size() const override {
+    size_t total = 0;
+    for (const auto &stripe : stripes_) {
+      std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+      total += stripe.map->size();
+    }
+    return total;
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    Map::Visitor each = [&](const std::string &key, const std::string &value) {
+      return visit(key, value);
+    };
+    for (const auto &stripe : stripes_) {
+      std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+      if (!stripe.map->forEach(each))
+        return;
+    }
+  }
+
+  size_t stripeCount() const { return stripes_.size(); }
+
+private:
+  // Padded to a cache line so neighbouring stripe locks don't false-share.
+  struct alignas(64) Stripe {
+    mutable std::shared_mutex mutex;
+    std::unique_ptr<Map> map;
+  };
+
+  Stripe &stripeFor(std::string_view key) {
+    return stripes_[std::hash<std::string_view>{}(key) % stripes_.size()];
+  }
+
+  const Stripe &stripeFor(std::string_view key) const {
+    return stripes_[std::hash<std::string_view>{}(key) % stripes_.size()];
+  }
+
+  std::vector<Stripe> stripes_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Hierarchical timing wheel over absolute tick numbers. Level l has 64
+// slots of 64^l ticks each, so four levels cover 64^4 ticks (about 194
+// days at 1 ms) with O(1) scheduling; later deadlines wait in an overflow
+// list. An item sits at the highest 6-bit digit where its deadline differs
+// from the current tick, and is cascaded one level down each time the
+// wheel reaches that slot, so every item is moved at most kLevels times.
+//
+// Not thread-safe: callers shard wheels and lock around them.
+template <typename T> class TimingWheel {
+public:
+  static constexpr size_t kLevels = 4;
+  static constexpr size_t kBits = 6;
+  static constexpr size_t kSlots = size_t{1} << kBits;
+
+  explicit TimingWheel(uint64_t now) : current_(now) {}
+
+  uint64_t current() const { return current_; }
+  size_t size() const { return size_; }
+
+  // Fires at the first advance() to reach `deadline` (or at the next one
+  // if the deadline has already passed).
+  void schedule(uint64_t deadline, T item) {
+    ++size_;
+    place(deadline, std::move(item));
+  }
+
+  // Moves the wheel to `now`, appending every item that came due to `due`.
+  void advance(uint64_t now, std::vector<T> &due) {
+    drain(ready_, due);
+    while (current_ < now) {
+      ++current_;
+      // Cascade the higher levels whose slot just came up, top down, so an
+      // item can fall all the way to level 0 in one tick.
+      for (size_t level = kLevels; level-- > 1;) {
+        if (current_ & ((uint64_t{1} << (kBits * level)) - 1))
+          continue;
+        if (level == kLevels - 1 &&
+            !(current_ & ((uint64_t{1} << (kBits * kLevels)) - 1)))
+          cascade(overflow_);
+        cascade(slots_[level][slotOf(current_, level)]);
+      }
+      drain(slots_[0][slotOf(current_, 0)], due);
+      drain(ready_, due);
+    }
+  }
+
+private:
+  using Bucket = std::vector<std::pair<uint64_t, T>>;
+
+  static size_t slotOf(uint64_t tick, size_t level) {
+    return static_cast<size_t>((tick >> (kBits * level)) & (kSlots - 1));
+  }
+
+  void place(uint64_t deadline, T item) {
+    if (deadline <= current_) {
+      ready_.emplace_back(deadline, std::move(item));
+      return;
+    }
+    uint64_t diff = deadline ^ current_;
+    size_t level = 0;
+    while (level < kLevels && (diff >> (kBits * (level + 1))) != 0)
+      ++level;
+    if (level == kLevels)
+      overflow_.emplace_back(deadline, std::move(item));
+    else
+      slots_[level][slotOf(deadline, level)].emplace_back(deadline,
+                                                          std::move(item));
+  }
+
+  void cascade(Bucket &bucket) {
+    Bucket items;
+    items.swap(bucket);
+    for (auto &[deadline, item] : items)
+      place(deadline, std::move(item));
+  }
+
+  void drain(Bucket &bucket, std::vector<T> &due) {
+    for (auto &entry : bucket)
+      due.push_back(std::move(entry.second));
+    size_ -= bucket.size();
+    bucket.clear();
+  }
+
+  uint64_t current_;
+  size_t size_ = 0;
+  std::array<std::array<Bucket, kSlots>, kLevels> slots_;
+  Bucket overflow_;
+  Bucket ready_; // scheduled at or before current_
+};
+
+} // namespace kvstore
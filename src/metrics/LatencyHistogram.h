@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace kvstore {
+
+// HDR-style log-linear histogram of nanosecond durations. Values below 64
+// get a bucket each; above that every power of two is split into 32
+// buckets, so any recorded value is reported within 1/32 (~3%) of the
+// truth, from 1 ns up to ~18 minutes, in a fixed 1152-bucket array.
+//
+// Each histogram has a single writer (the thread that owns it) and any
+// number of readers merging snapshots. Counts are atomics only so those
+// reads are race-free; the writer updates them with plain relaxed
+// load/store pairs, which compile to ordinary moves, not locked adds.
+class LatencyHistogram {
+public:
+  static constexpr size_t kSubBits = 5;
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBits;
+  static constexpr size_t kMaxBits = 40;
+  static constexpr size_t kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+  static constexpr uint64_t kMaxValue = (uint64_t{1} << kMaxBits) - 1;
+
+  static size_t bucketOf(uint64_t value) {
+    value = std::min(value, kMaxValue);
+    if (value < 2 * kSubBuckets)
+      return static_cast<size_t>(value);
+    size_t shift = 63 - __builtin_clzll(value) - kSubBits;
+    return (shift << kSubBits) + static_cast<size_t>(value >> shift);
+  }
+
+  // Largest value that lands in `bucket`.
+  static uint64_t upperBound(size_t bucket) {
+    if (bucket < 2 * kSubBuckets)
+      return bucket;
+    size_t shift = (bucket >> kSubBits) - 1;
+    uint64_t sub = bucket - (shift << kSubBits);
+    return ((sub + 1) << shift) - 1;
+  }
+
+  // Only the owning thread may call record().
+  void record(uint64_t nanos) {
+    bump(counts_[bucketOf(nanos)], 1);
+    bump(sum_, nanos);
+    if (nanos > max_.load(std::memory_order_relaxed))
+      max_.store(nanos, std::memory_order_relaxed);
+  }
+
+  // Plain-integer copy of one or more merged histograms.
+  struct Snapshot {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(kBuckets);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    double mean() const {
+      return count == 0 ? 0 : static_cast<double>(sum) / count;
+    }
+
+    // Upper bound of the bucket holding the q-quantile, capped at max.
+    uint64_t percentile(double q) const {
+      if (count == 0)
+        return 0;
+      uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+      uint64_t seen = 0;
+      for (size_t i = 0; i < kBuckets; ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+          return std::min(upperBound(i), max);
+      }
+      return max;
+    }
+
+    // Number of values <= limit, counting whole buckets only.
+    uint64_t countAtMost(uint64_t limit) const {
+      uint64_t total = 0;
+      for (size_t i = 0; i < kBuckets && upperBound(i) <= limit; ++i)
+        total += counts[i];
+      return total;
+    }
+  };
+
+  void mergeInto(Snapshot &snapshot) const {
+    for (size_t i = 0; i < kBuckets; ++i) {
+      uint64_t n = counts_[i].load(std::memory_order_relaxed);
+      snapshot.counts[i] += n;
+      snapshot.count += n;
+    }
+    snapshot.sum += sum_.load(std::memory_order_relaxed);
+    snapshot.max = std::max(snapshot.max, max_.load(std::memory_order_relaxed));
+  }
+
+private:
+  static void bump(std::atomic<uint64_t> &counter, uint64_t by) {
+    counter.store(counter.load(std::memory_order_relaxed) + by,
+                  std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+} // namespace kvstore
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace kvstore {
+
+// Minimal HTTP/1.0 endpoint for Prometheus scrapes and trace dumps. A GET
+// of a registered path is answered with what its route renders, anything
+// else with 404, and the connection is closed. Requests are served one at
+// a time on a single background thread, so they never run on the CQ
+// threads.
+class MetricsHttpEndpoint {
+public:
+  struct Route {
+    std::string content_type;
+    std::function<std::string()> render;
+  };
+  using Routes = std::map<std::string, Route>; // by path, e.g. "/metrics"
+
+  MetricsHttpEndpoint(uint16_t port, Routes routes)
+      : routes_(std::move(routes)) {
+    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0)
+      throw std::runtime_error(std::string("metrics socket: ") +
+                               std::strerror(errno));
+    int one = 1;
+    ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (::bind(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd_, 16) != 0) {
+      int err = errno;
+      ::close(fd_);
+      throw std::runtime_error("metrics port " + std::to_string(port) + ": " +
+                               std::strerror(err));
+    }
+    thread_ = std::thread([this]() { serve(); });
+  }
+
+  MetricsHttpEndpoint(const MetricsHttpEndpoint &) = delete;
+  MetricsHttpEndpoint &operator=(const MetricsHttpEndpoint &) = delete;
+
+  ~MetricsHttpEndpoint() {
+    stopping_ = true;
+    thread_.join();
+    ::close(fd_);
+  }
+
+private:
+  void serve() {
+    while (!stopping_) {
+      // Wakes up periodically to notice shutdown.
+      pollfd pfd{fd_, POLLIN, 0};
+      if (::poll(&pfd, 1, 200) <= 0)
+        continue;
+      int client = ::accept(fd_, nullptr, nullptr);
+      if (client < 0)
+        continue;
+      respond(client);
+      ::close(client);
+    }
+  }
+
+  // Path of the request line "GET <path> HTTP/1.x", without any query.
+  static std::string pathOf(const std::string &head) {
+    size_t start = head.find(' ');
+    if (start == std::string::npos)
+      return {};
+    size_t end = head.find_first_of(" ?\r\n", start + 1);
+    return head.substr(start + 1, end == std::string::npos
+                                      ? std::string::npos
+                                      : end - start - 1);
+  }
+
+  void respond(int client) {
+    // Only the request line matters.
+    char buf[1024];
+    ssize_t n = 0;
+    pollfd pfd{client, POLLIN, 0};
+    if (::poll(&pfd, 1, 1000) > 0)
+      n = ::recv(client, buf, sizeof(buf), 0);
+    auto route = routes_.find(pathOf(std::string(buf, n > 0 ? n : 0)));
+    std::string status = "200 OK", type = "text/plain", body;
+    if (route == routes_.end()) {
+      status = "404 Not Found";
+      body = "not found\n";
+    } else {
+      type = route->second.content_type;
+      body = route->second.render();
+    }
+    std::string response = "HTTP/1.0 " + status +
+                           "\r\nContent-Type: " + type +
+                           "\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\n\r\n" + body;
+    const char *data = response.data();
+    size_t left = response.size();
+    while (left > 0) {
+      ssize_t sent = ::send(client, data, left, MSG_NOSIGNAL);
+      if (sent <= 0)
+        return;
+      data += sent;
+      left -= static_cast<size_t>(sent);
+    }
+  }
+
+  Routes routes_;
+  int fd_ = -1;
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+};
+
+} // namespace kvstore
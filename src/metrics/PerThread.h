@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// One T per thread that uses it, all owned by this registry so a reader can
+// visit every thread's copy. Lookup of the calling thread's copy is a
+// thread-local compare, with no lock and no shared writes. The thread-local
+// slot remembers one registry per T, so a thread's first call, and its
+// first call after using another registry of the same T, takes the
+// registry lock to find (or create) its copy.
+//
+// Copies outlive their threads (so counts from exited threads stay
+// visible) and are freed with the registry. A new thread that reuses an
+// exited thread's id continues its copy.
+template <typename T> class PerThread {
+public:
+  PerThread() : id_(nextId()) {}
+
+  PerThread(const PerThread &) = delete;
+  PerThread &operator=(const PerThread &) = delete;
+
+  // The calling thread's copy, default-constructed on first use.
+  T &local() {
+    Cached &cached = cache();
+    if (cached.owner == id_)
+      return *static_cast<T *>(cached.value);
+    T *value;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = by_thread_.find(std::this_thread::get_id());
+      value = it != by_thread_.end() ? it->second : add(std::make_unique<T>());
+    }
+    cached.owner = id_;
+    cached.value = value;
+    return *value;
+  }
+
+  // Gives the calling thread a fresh copy built from `args`, replacing the
+  // one local() returns (the old copy stays registered).
+  template <typename... Args> T &emplace(Args &&...args) {
+    auto owned = std::make_unique<T>(std::forward<Args>(args)...);
+    T *value;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      value = add(std::move(owned));
+    }
+    Cached &cached = cache();
+    cached.owner = id_;
+    cached.value = value;
+    return *value;
+  }
+
+  // Calls visit(const T &) for every registered copy. Owning threads may
+  // be writing to them concurrently.
+  template <typename Visitor> void forEach(Visitor &&visit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &value : values_)
+      visit(static_cast<const T &>(*value));
+  }
+
+private:
+  // Keyed by a process-unique id rather than `this`, so a registry
+  // allocated at the address of a destroyed one is not confused with it.
+  struct Cached {
+    uint64_t owner = 0;
+    void *value = nullptr;
+  };
+
+  // Shared by all PerThread<T> of one T; a miss falls back to by_thread_.
+  static Cached &cache() {
+    thread_local Cached cached;
+    return cached;
+  }
+
+  // Registers `value` as the calling thread's copy. Callers hold mutex_.
+  T *add(std::unique_ptr<T> value) {
+    T *raw = value.get();
+    values_.push_back(std::move(value));
+    by_thread_[std::this_thread::get_id()] = raw;
+    return raw;
+  }
+
+  static uint64_t nextId() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const uint64_t id_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<T>> values_;
+  std::unordered_map<std::thread::id, T *> by_thread_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+#include "PerThread.h"
+#include "compression/CompressionStats.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace kvstore {
+
+// Request metrics for AsyncKVServer. Every thread that serves RPCs records
+// into its own ThreadMetrics (counters plus a LatencyHistogram per RPC
+// type), so the hot path touches only thread-private cache lines and takes
+// no lock. A snapshot merges all threads on demand, for the Stats RPC and
+// the Prometheus text export.
+class ServerMetrics {
+public:
+  enum class Rpc {
+    kPut,
+    kGet,
+    kDelete,
+    kMultiGet,
+    kMultiPut,
+    kMultiDelete,
+    kPipeline, // one sample per op on the stream
+    kScan,
+    kPutStream,
+    kGetStream,
+    kStats,
+    kCount
+  };
+  static constexpr size_t kRpcs = static_cast<size_t>(Rpc::kCount);
+
+  static const char *rpcName(Rpc rpc) {
+    static const char *const kNames[kRpcs] = {
+        "put", "get", "delete", "multi_get", "multi_put", "multi_delete",
+        "pipeline", "scan", "put_stream", "get_stream", "stats"};
+    return kNames[static_cast<size_t>(rpc)];
+  }
+
+  using Clock = std::chrono::steady_clock;
+
+  static uint64_t nanosSince(Clock::time_point start) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             start)
+            .count());
+  }
+
+  // Counters of one thread, written only by that thread.
+  class ThreadMetrics {
+  public:
+    explicit ThreadMetrics(int cq = -1) : cq_(cq) {}
+
+    void record(Rpc rpc, uint64_t nanos, uint64_t bytes_in,
+                uint64_t bytes_out, bool error) {
+      PerRpc &r = rpcs_[static_cast<size_t>(rpc)];
+      bump(r.requests, 1);
+      bump(r.bytes_in, bytes_in);
+      bump(r.bytes_out, bytes_out);
+      if (error)
+        bump(r.errors, 1);
+      r.latency.record(nanos);
+    }
+
+  private:
+    friend class ServerMetrics;
+
+    struct PerRpc {
+      std::atomic<uint64_t> requests{0};
+      std::atomic<uint64_t> errors{0};
+      std::atomic<uint64_t> bytes_in{0};
+      std::atomic<uint64_t> bytes_out{0};
+      LatencyHistogram latency;
+    };
+
+    static void bump(std::atomic<uint64_t> &counter, uint64_t by) {
+      counter.store(counter.load(std::memory_order_relaxed) + by,
+                    std::memory_order_relaxed);
+    }
+
+    int cq_;
+    std::array<PerRpc, kRpcs> rpcs_;
+  };
+
+  struct RpcSnapshot {
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    LatencyHistogram::Snapshot latency;
+  };
+
+  struct Snapshot {
+    std::array<RpcSnapshot, kRpcs> rpcs;
+    std::vector<uint64_t> cq_requests; // indexed by completion queue
+    // Filled in by the server, not by ServerMetrics.
+    uint64_t keys = 0;
+    uint64_t store_bytes = 0;
+    uint64_t store_reserved_bytes = 0;
+    // Replication: role is "primary", "replica" or empty. log_seqno is
+    // a primary's; the rest are a replica's (see Replica::Status).
+    std::string replication_role;
+    uint64_t log_seqno = 0;
+    bool replica_connected = false;
+    uint64_t applied_seqno = 0;
+    uint64_t primary_seqno = 0;
+    uint64_t snapshots = 0;
+    LatencyHistogram::Snapshot replication_delay;
+    // Value compression; codec is empty when values are stored as is.
+    std::string compression_codec;
+    CompressionStats compression;
+  };
+
+  // Registers the calling thread as a poller of completion queue `cq`.
+  // Threads that record without attaching are counted under no queue.
+  void attach(int cq) { threads_.emplace(cq); }
+
+  // The calling thread's metrics, registered on first use.
+  ThreadMetrics &local() { return threads_.local(); }
+
+  Snapshot snapshot() const {
+    Snapshot snapshot;
+    threads_.forEach([&](const ThreadMetrics &thread) {
+      uint64_t requests = 0;
+      for (size_t i = 0; i < kRpcs; ++i) {
+        const auto &from = thread.rpcs_[i];
+        RpcSnapshot &to = snapshot.rpcs[i];
+        uint64_t n = from.requests.load(std::memory_order_relaxed);
+        to.requests += n;
+        to.errors += from.errors.load(std::memory_order_relaxed);
+        to.bytes_in += from.bytes_in.load(std::memory_order_relaxed);
+        to.bytes_out += from.bytes_out.load(std::memory_order_relaxed);
+        from.latency.mergeInto(to.latency);
+        requests += n;
+      }
+      if (thread.cq_ >= 0) {
+        size_t cq = static_cast<size_t>(thread.cq_);
+        if (snapshot.cq_requests.size() <= cq)
+          snapshot.cq_requests.resize(cq + 1);
+        snapshot.cq_requests[cq] += requests;
+      }
+    });
+    return snapshot;
+  }
+
+  // Prometheus text exposition format (version 0.0.4).
+  static std::string prometheusText(const Snapshot &snapshot) {
+    static const double kBucketSeconds[] = {
+        10e-6, 25e-6, 50e-6, 100e-6, 250e-6, 500e-6, 1e-3, 2.5e-3,
+        5e-3,  10e-3, 25e-3, 50e-3,  100e-3, 250e-3, 500e-3, 1.0};
+    std::ostringstream out;
+    auto header = [&](const char *name, const char *type, const char *help) {
+      out << "# HELP " << name << ' ' << help << '\n'
+          << "# TYPE " << name << ' ' << type << '\n';
+    };
+    auto perRpc = [&](const char *name, const char *help,
+                      uint64_t RpcSnapshot::*field) {
+      header(name, "counter", help);
+      for (size_t i = 0; i < kRpcs; ++i)
+        out << name << "{rpc=\"" << rpcName(static_cast<Rpc>(i)) << "\"} "
+            << snapshot.rpcs[i].*field << '\n';
+    };
+    perRpc("kvstore_requests_total", "Requests served.",
+           &RpcSnapshot::requests);
+    perRpc("kvstore_request_errors_total", "Requests that failed.",
+           &RpcSnapshot::errors);
+    perRpc("kvstore_request_bytes_total", "Request payload bytes received.",
+           &RpcSnapshot::bytes_in);
+    perRpc("kvstore_response_bytes_total", "Response payload bytes sent.",
+           &RpcSnapshot::bytes_out);
+
+    header("kvstore_request_duration_seconds", "histogram",
+           "Time from request arrival to response completion.");
+    for (size_t i = 0; i < kRpcs; ++i) {
+      const auto &latency = snapshot.rpcs[i].latency;
+      std::string rpc = rpcName(static_cast<Rpc>(i));
+      for (double le : kBucketSeconds)
+        out << "kvstore_request_duration_seconds_bucket{rpc=\"" << rpc
+            << "\",le=\"" << le << "\"} "
+            << latency.countAtMost(static_cast<uint64_t>(le * 1e9)) << '\n';
+      out << "kvstore_request_duration_seconds_bucket{rpc=\"" << rpc
+          << "\",le=\"+Inf\"} " << latency.count << '\n'
+          << "kvstore_request_duration_seconds_sum{rpc=\"" << rpc << "\"} "
+          << latency.sum / 1e9 << '\n'
+          << "kvstore_request_duration_seconds_count{rpc=\"" << rpc << "\"} "
+          << latency.count << '\n';
+    }
+
+    header("kvstore_request_duration_quantile_seconds", "gauge",
+           "Latency quantiles since start, from the HDR histogram.");
+    for (size_t i = 0; i < kRpcs; ++i) {
+      for (double q : {0.5, 0.9, 0.99, 0.999})
+        out << "kvstore_request_duration_quantile_seconds{rpc=\""
+            << rpcName(static_cast<Rpc>(i)) << "\",quantile=\"" << q << "\"} "
+            << snapshot.rpcs[i].latency.percentile(q) / 1e9 << '\n';
+    }
+
+    header("kvstore_cq_requests_total", "counter",
+           "Requests served by threads of each completion queue.");
+    for (size_t cq = 0; cq < snapshot.cq_requests.size(); ++cq)
+      out << "kvstore_cq_requests_total{cq=\"" << cq << "\"} "
+          << snapshot.cq_requests[cq] << '\n';
+
+    header("kvstore_keys", "gauge", "Keys in the store.");
+    out << "kvstore_keys " << snapshot.keys << '\n';
+    header("kvstore_store_bytes", "gauge",
+           "Bytes of live records in the slab allocator.");
+    out << "kvstore_store_bytes " << snapshot.store_bytes << '\n';
+    header("kvstore_store_reserved_bytes", "gauge",
+           "Bytes the slab allocator holds, including free space.");
+    out << "kvstore_store_reserved_bytes " << snapshot.store_reserved_bytes
+        << '\n';
+
+    if (snapshot.replication_role == "primary") {
+      header("kvstore_changelog_seqno", "gauge",
+             "Newest sequence number in the change log.");
+      out << "kvstore_changelog_seqno " << snapshot.log_seqno << '\n';
+    } else if (snapshot.replication_role == "replica") {
+      header("kvstore_replica_connected", "gauge",
+             "Whether the replication stream is open.");
+      out << "kvstore_replica_connected " << snapshot.replica_connected
+          << '\n';
+      header("kvstore_replica_applied_seqno", "gauge",
+             "Newest change-log entry applied.");
+      out << "kvstore_replica_applied_seqno " << snapshot.applied_seqno
+          << '\n';
+      header("kvstore_replica_lag_entries", "gauge",
+             "Change-log entries the primary has that are not applied yet.");
+      out << "kvstore_replica_lag_entries "
+          << (snapshot.primary_seqno > snapshot.applied_seqno
+                  ? snapshot.primary_seqno - snapshot.applied_seqno
+                  : 0)
+          << '\n';
+      header("kvstore_replica_snapshots_total", "counter",
+             "Full snapshots received from the primary.");
+      out << "kvstore_replica_snapshots_total " << snapshot.snapshots << '\n';
+      header("kvstore_replication_delay_quantile_seconds", "gauge",
+             "Time from the primary logging a write to it being applied.");
+      for (double q : {0.5, 0.9, 0.99, 0.999})
+        out << "kvstore_replication_delay_quantile_seconds{quantile=\"" << q
+            << "\"} " << snapshot.replication_delay.percentile(q) / 1e9
+            << '\n';
+    }
+
+    if (!snapshot.compression_codec.empty()) {
+      const CompressionStats &c = snapshot.compression;
+      header("kvstore_compression_values_total", "counter",
+             "Values written, by whether they were stored compressed.");
+      out << "kvstore_compression_values_total{stored=\"compressed\"} "
+          << c.compressed << '\n'
+          << "kvstore_compression_values_total{stored=\"uncompressed\"} "
+          << c.uncompressed << '\n';
+      header("kvstore_compression_raw_bytes_total", "counter",
+             "Value bytes written, before compression.");
+      out << "kvstore_compression_raw_bytes_total " << c.raw_bytes << '\n';
+      header("kvstore_compression_stored_bytes_total", "counter",
+             "Value bytes written, as stored.");
+      out << "kvstore_compression_stored_bytes_total " << c.stored_bytes
+          << '\n';
+      header("kvstore_compression_seconds_total", "counter",
+             "Time spent compressing and decompressing values.");
+      out << "kvstore_compression_seconds_total{op=\"compress\"} "
+          << c.compress_ns / 1e9 << '\n'
+          << "kvstore_compression_seconds_total{op=\"decompress\"} "
+          << c.decompress_ns / 1e9 << '\n';
+      header("kvstore_decompressions_total", "counter",
+             "Compressed values decompressed on read.");
+      out << "kvstore_decompressions_total " << c.decompressed << '\n';
+      header("kvstore_compression_passthrough_total", "counter",
+             "Values sent to clients still compressed.");
+      out << "kvstore_compression_passthrough_total " << c.passed_through
+          << '\n';
+      header("kvstore_compression_corrupt_total", "counter",
+             "Stored values that failed to decode.");
+      out << "kvstore_compression_corrupt_total " << c.corrupt << '\n';
+    }
+    return out.str();
+  }
+
+private:
+  PerThread<ThreadMetrics> threads_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "PerThread.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+namespace kvstore {
+
+// Sampled per-request stage timestamps for finding where tail latency comes
+// from. One in `sample_every` requests on each thread is traced: the server
+// stamps the stages of its CallData as it goes and hands the finished
+// Trace to record(), which appends it to the calling thread's ring buffer.
+// Rings are single-producer and overwrite their oldest entries, so
+// recording never blocks or allocates; writeChromeJson() copies them out
+// concurrently, skipping any slot that is being overwritten.
+//
+// The output is Chrome trace event JSON, which chrome://tracing and
+// ui.perfetto.dev open directly: one span per request on the thread that
+// dequeued it, split into the stages below.
+class StageTracer {
+public:
+  // Timestamps taken along a unary call:
+  //  kDequeued     the CQ handed the matched request to a thread
+  //  kHandleStart  after arming the replacement handler, before the store op
+  //  kStoreDone    store op finished, response about to be serialized
+  //  kCompleted    the CQ reported the response written (or the call failed)
+  // gRPC's async API doesn't expose when the request arrived, so time
+  // spent queued before kDequeued is not visible here.
+  enum Stage { kDequeued, kHandleStart, kStoreDone, kCompleted, kStages };
+
+  struct Trace {
+    std::array<uint64_t, kStages> at{}; // steady-clock nanoseconds
+    uint32_t thread = 0;                // threadId() at kDequeued
+    uint32_t completion_thread = 0;     // threadId() at kCompleted
+    const char *name = "";              // RPC name; must be a literal
+    bool error = false;
+  };
+
+  StageTracer(uint32_t sample_every, size_t ring_size)
+      : sample_every_(sample_every == 0 ? 1 : sample_every),
+        ring_size_(ring_size == 0 ? 1 : ring_size) {}
+
+  // Decides whether the calling thread's next request is traced.
+  bool sample() {
+    thread_local uint32_t countdown = 0;
+    if (countdown == 0) {
+      countdown = sample_every_ - 1;
+      return true;
+    }
+    --countdown;
+    return false;
+  }
+
+  static uint64_t now() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+  }
+
+  // Small sequential id of the calling thread, for the trace's tid.
+  static uint32_t threadId() {
+    static std::atomic<uint32_t> next{1};
+    thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+  }
+
+  void record(const Trace &trace) { rings_.local().push(trace, ring_size_); }
+
+  // Writes every trace still held in the rings as a Chrome trace JSON
+  // object. Returns how many traces were written.
+  size_t writeChromeJson(std::ostream &out) const {
+    std::vector<Trace> traces;
+    rings_.forEach([&](const Ring &ring) { ring.copyTo(traces); });
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    auto event = [&](const Trace &trace, const char *name, uint64_t begin,
+                     uint64_t end) {
+      out << (first ? "\n" : ",\n") << "{\"name\":\"" << name
+          << "\",\"cat\":\"" << trace.name << "\",\"ph\":\"X\",\"pid\":1"
+          << ",\"tid\":" << trace.thread << ",\"ts\":" << micros(begin)
+          << ",\"dur\":" << micros(end >= begin ? end - begin : 0);
+      first = false;
+    };
+    out << std::fixed << std::setprecision(3);
+    for (const Trace &trace : traces) {
+      event(trace, trace.name, trace.at[kDequeued], trace.at[kCompleted]);
+      out << ",\"args\":{\"completion_tid\":" << trace.completion_thread
+          << ",\"error\":" << (trace.error ? "true" : "false") << "}}";
+      event(trace, "arm_next", trace.at[kDequeued], trace.at[kHandleStart]);
+      out << "}";
+      event(trace, "store", trace.at[kHandleStart], trace.at[kStoreDone]);
+      out << "}";
+      event(trace, "respond", trace.at[kStoreDone], trace.at[kCompleted]);
+      out << "}";
+    }
+    out << "\n]}\n";
+    return traces.size();
+  }
+
+private:
+  static double micros(uint64_t nanos) { return nanos / 1e3; }
+
+  // Single-producer ring with a sequence number per slot (a seqlock): odd
+  // while the owner is writing the slot, even once it is complete. Fields
+  // are relaxed atomics so concurrent copies are race-free.
+  class Ring {
+  public:
+    void push(const Trace &trace, size_t capacity) {
+      if (slots_.empty())
+        slots_ = std::vector<Slot>(capacity);
+      Slot &slot = slots_[next_ % slots_.size()];
+      uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+      slot.seq.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t i = 0; i < kStages; ++i)
+        slot.at[i].store(trace.at[i], std::memory_order_relaxed);
+      slot.threads.store(uint64_t{trace.thread} << 32 |
+                             trace.completion_thread,
+                         std::memory_order_relaxed);
+      slot.name.store(trace.name, std::memory_order_relaxed);
+      slot.error.store(trace.error, std::memory_order_relaxed);
+      slot.seq.store(seq + 2, std::memory_order_release);
+      ++next_;
+      filled_.store(std::min(next_, slots_.size()),
+                    std::memory_order_release);
+    }
+
+    void copyTo(std::vector<Trace> &out) const {
+      size_t filled = filled_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < filled; ++i) {
+        const Slot &slot = slots_[i];
+        uint64_t before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1)
+          continue;
+        Trace trace;
+        for (size_t s = 0; s < kStages; ++s)
+          trace.at[s] = slot.at[s].load(std::memory_order_relaxed);
+        uint64_t threads = slot.threads.load(std::memory_order_relaxed);
+        trace.thread = static_cast<uint32_t>(threads >> 32);
+        trace.completion_thread = static_cast<uint32_t>(threads);
+        trace.name = slot.name.load(std::memory_order_relaxed);
+        trace.error = slot.error.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == before)
+          out.push_back(trace);
+      }
+    }
+
+  private:
+    struct Slot {
+      std::atomic<uint64_t> seq{0};
+      std::array<std::atomic<uint64_t>, kStages> at{};
+      std::atomic<uint64_t> threads{0};
+      std::atomic<const char *> name{""};
+      std::atomic<bool> error{false};
+    };
+
+    // Allocated by the owner on its first push, before filled_ is
+    // published, so readers only index slots that exist.
+    std::vector<Slot> slots_;
+    size_t next_ = 0;
+    std::atomic<size_t> filled_{0};
+  };
+
+  const uint32_t sample_every_;
+  const size_t ring_size_;
+  PerThread<Ring> rings_;
+};
+
+} // namespace kvstore
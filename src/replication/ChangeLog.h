@@ -0,0 +1,206 @@
+#pragma once
+
+#include "map/IConcurrentMap.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Bounded in-memory log of the writes a primary applies, read by its
+// replicas. Every Put and Delete gets the next sequence number, from 1.
+// The newest max_bytes of entries are kept; a replica that falls further
+// behind than that starts over from a snapshot. Each log has a random id,
+// so a replica can tell a restarted primary, whose sequence numbers begin
+// again, from the one it was following.
+class ChangeLog {
+public:
+  enum class Op : uint8_t { kPut, kDelete };
+
+  struct Entry {
+    uint64_t seqno;
+    Op op;
+    std::string key;
+    std::string value;
+    int64_t time_us; // when logged, since the Unix epoch
+  };
+
+  using Visitor = std::function<void(const Entry &)>;
+
+  explicit ChangeLog(size_t max_bytes = size_t{64} << 20)
+      : max_bytes_(max_bytes), id_(randomId()) {}
+
+  uint64_t id() const { return id_; }
+
+  uint64_t lastSeqno() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_ - 1;
+  }
+
+  uint64_t append(Op op, std::string_view key, std::string_view value) {
+    std::vector<std::function<void()>> wake;
+    uint64_t seqno;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      seqno = next_++;
+      entries_.push_back({seqno, op, std::string(key), std::string(value),
+                          nowMicros()});
+      bytes_ += cost(entries_.back());
+      while (bytes_ > max_bytes_ && entries_.size() > 1) {
+        bytes_ -= cost(entries_.front());
+        entries_.pop_front();
+      }
+      wake.swap(waiters_);
+    }
+    for (auto &waiter : wake)
+      waiter();
+    return seqno;
+  }
+
+  // Visits the entries after seqno `after`, oldest first, stopping once
+  // about max_bytes have been visited (always at least one). Returns
+  // false, visiting nothing, if any of them has already been dropped or
+  // `after` is past the end of the log.
+  bool readAfter(uint64_t after, size_t max_bytes,
+                 const Visitor &visit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t first = next_ - entries_.size();
+    if (after + 1 < first || after >= next_)
+      return false;
+    size_t bytes = 0;
+    for (size_t i = after + 1 - first; i < entries_.size(); ++i) {
+      if (bytes > 0 && bytes + cost(entries_[i]) > max_bytes)
+        break;
+      bytes += cost(entries_[i]);
+      visit(entries_[i]);
+    }
+    return true;
+  }
+
+  // Calls wake once there is an entry after `after`: straight away if
+  // there already is, else from the thread that appends the next one, so
+  // wake must be quick and must not append.
+  void waitAfter(uint64_t after, std::function<void()> wake) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (next_ - 1 <= after) {
+        waiters_.push_back(std::move(wake));
+        return;
+      }
+    }
+    wake();
+  }
+
+  static int64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+private:
+  // Never 0, which a new replica sends.
+  static uint64_t randomId() {
+    std::random_device random;
+    return (uint64_t{random()} << 32 | random()) | 1;
+  }
+
+  static size_t cost(const Entry &entry) {
+    return sizeof(Entry) + entry.key.size() + entry.value.size();
+  }
+
+  const size_t max_bytes_;
+  const uint64_t id_;
+  mutable std::mutex mutex_;
+  std::deque<Entry> entries_;
+  uint64_t next_ = 1;
+  size_t bytes_ = 0;
+  std::vector<std::function<void()>> waiters_;
+};
+
+// Feeds a ChangeLog from an engine: every Put and Delete is appended to
+// the log and applied under one lock stripe, so the log and the engine
+// agree on the order of writes to the same key (as in DurableMap). Reads
+// go straight to the engine.
+class ChangeLogMap : public IConcurrentMap {
+public:
+  ChangeLogMap(std::shared_ptr<IConcurrentMap> store,
+               std::shared_ptr<ChangeLog> log)
+      : store_(std::move(store)), log_(std::move(log)) {}
+
+  bool put(std::string_view key, std::string_view value) override {
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    log_->append(ChangeLog::Op::kPut, key, value);
+    return store_->put(key, value);
+  }
+
+  bool get(std::string_view key, std::string &value) const override {
+    return store_->get(key, value);
+  }
+
+  bool sharesRecords() const override { return store_->sharesRecords(); }
+  RecordPtr getRecord(std::string_view key) const override {
+    return store_->getRecord(key);
+  }
+
+  bool remove(std::string_view key) override {
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    log_->append(ChangeLog::Op::kDelete, key, {});
+    return store_->remove(key);
+  }
+
+  size_t size() const override { return store_->size(); }
+
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    store_->multiGet(keys, found);
+  }
+
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    return store_->scan(start, end, prefix, visit);
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    store_->forEach(visit);
+  }
+
+  void reserve(size_t count) override { store_->reserve(count); }
+
+  // The newest seqno whose write, and every earlier one, is in the
+  // engine. A snapshot scanned after this call and followed by the log
+  // from this seqno on yields the primary's state. Every stripe is held
+  // for the read, so no write is logged but not yet applied.
+  uint64_t stableSeqno() {
+    std::array<std::unique_lock<std::mutex>, kStripes> locks;
+    for (size_t i = 0; i < kStripes; ++i)
+      locks[i] = std::unique_lock<std::mutex>(stripes_[i].mutex);
+    return log_->lastSeqno();
+  }
+
+  ChangeLog &log() { return *log_; }
+
+private:
+  static constexpr size_t kStripes = 256;
+
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  std::mutex &stripeFor(std::string_view key) {
+    return stripes_[std::hash<std::string_view>{}(key) % kStripes].mutex;
+  }
+
+  std::shared_ptr<IConcurrentMap> store_;
+  std::shared_ptr<ChangeLog> log_;
+  std::array<Stripe, kStripes> stripes_;
+};
+
+} // namespace kvstore
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "map/IConcurrentMap.h"
+#include "metrics/LatencyHistogram.h"
+#include "replication/ChangeLog.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <grpcpp/grpcpp.h>
+#include <iostream>
+#include <kvstore.grpc.pb.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kvstore {
+
+// Follows a primary's change log into a local store. A background thread
+// holds a Replicate stream open and applies what arrives in order: a
+// snapshot when the primary can't resume from where this replica left
+// off (a new replica, a restarted primary, or one that fell out of the
+// log), then each mutation. A broken stream is reopened after
+// retry_delay, resuming after the last applied seqno.
+//
+// A snapshot first drops every key, so the store is partial until the
+// snapshot completes. ready() is false until the first snapshot is in and
+// while a later one is being applied; the server refuses reads meanwhile.
+//
+// The store should sit below any TTL layer, like the primary's log does,
+// so values are applied exactly as logged.
+class Replica {
+public:
+  struct Options {
+    std::string primary = "localhost:50051";
+    std::chrono::milliseconds retry_delay{500};
+  };
+
+  struct Status {
+    bool connected = false;
+    uint64_t applied_seqno = 0;
+    uint64_t primary_seqno = 0; // as last heard
+    uint64_t snapshots = 0;     // full copies received
+    // Primary logging a write to this replica applying it, in ns.
+    LatencyHistogram::Snapshot delay;
+  };
+
+  Replica(std::shared_ptr<IConcurrentMap> store, Options options)
+      : store_(std::move(store)), options_(std::move(options)) {}
+
+  ~Replica() { stop(); }
+
+  Replica(const Replica &) = delete;
+  Replica &operator=(const Replica &) = delete;
+
+  void start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (thread_.joinable())
+      return;
+    stopping_ = false;
+    thread_ = std::thread([this]() { run(); });
+  }
+
+  // Closes the stream; start() resumes from the last applied seqno.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      if (ctx_)
+        ctx_->TryCancel();
+    }
+    changed_.notify_all();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  // Whether the store holds a complete snapshot (plus what followed it).
+  bool ready() const { return ready_.load(std::memory_order_acquire); }
+
+  Status status() const {
+    Status status;
+    status.connected = connected_.load(std::memory_order_relaxed);
+    status.applied_seqno = applied_.load(std::memory_order_acquire);
+    status.primary_seqno = primary_seqno_.load(std::memory_order_relaxed);
+    status.snapshots = snapshots_.load(std::memory_order_relaxed);
+    delay_.mergeInto(status.delay);
+    return status;
+  }
+
+  // Waits until seqno `seqno` of the current log has been applied.
+  bool waitForSeqno(uint64_t seqno, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, timeout, [&]() {
+      return applied_.load(std::memory_order_acquire) >= seqno;
+    });
+  }
+
+private:
+  void run() {
+    auto stub = KeyValueStore::NewStub(grpc::CreateChannel(
+        options_.primary, grpc::InsecureChannelCredentials()));
+    while (true) {
+      ReplicateRequest request;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_)
+          break;
+        ctx_ = std::make_unique<grpc::ClientContext>();
+        ctx_->set_wait_for_ready(true);
+      }
+      request.set_log_id(log_id_);
+      request.set_after_seqno(applied_.load(std::memory_order_relaxed));
+      auto reader = stub->Replicate(ctx_.get(), request);
+      ReplicateResponse response;
+      while (reader->Read(&response)) {
+        connected_.store(true, std::memory_order_relaxed);
+        apply(response);
+      }
+      grpc::Status status = reader->Finish();
+      connected_.store(false, std::memory_order_relaxed);
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      ctx_.reset();
+      if (stopping_)
+        break;
+      std::cerr << "Replication from " << options_.primary
+                << " interrupted: " << status.error_message() << std::endl;
+      changed_.wait_for(lock, options_.retry_delay,
+                        [this]() { return stopping_; });
+    }
+  }
+
+  void apply(const ReplicateResponse &response) {
+    if (response.reset()) {
+      ready_.store(false, std::memory_order_release);
+      dropAll();
+      applied_.store(0, std::memory_order_release);
+      snapshots_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (response.entries_size() > 0) {
+      entries_.clear();
+      for (const auto &entry : response.entries())
+        entries_.emplace_back(entry.key(), entry.value());
+      store_->multiPut(entries_);
+    }
+    if (response.snapshot_done()) {
+      ready_.store(true, std::memory_order_release);
+      log_id_ = response.log_id();
+      applied_.store(response.snapshot_seqno(), std::memory_order_release);
+    }
+    if (response.mutations_size() > 0) {
+      for (const auto &mutation : response.mutations()) {
+        if (mutation.op() == Mutation::PUT)
+          store_->put(mutation.key(), mutation.value());
+        else
+          store_->remove(mutation.key());
+      }
+      // One clock read per batch; the batch's entries were applied just
+      // now.
+      int64_t now = ChangeLog::nowMicros();
+      for (const auto &mutation : response.mutations())
+        delay_.record(static_cast<uint64_t>(
+                          std::max<int64_t>(0, now - mutation.time_us())) *
+                      1000);
+      applied_.store(response.mutations().rbegin()->seqno(),
+                     std::memory_order_release);
+    }
+    primary_seqno_.store(response.primary_seqno(), std::memory_order_relaxed);
+    {
+      // Orders the update before a waiter's predicate check.
+      std::lock_guard<std::mutex> lock(mutex_);
+    }
+    changed_.notify_all();
+  }
+
+  // Before a snapshot: the keys it doesn't contain must not survive it.
+  void dropAll() {
+    std::vector<std::string> keys;
+    store_->forEach([&](std::string_view key, std::string_view) {
+      keys.emplace_back(key);
+      return true;
+    });
+    for (const auto &key : keys)
+      store_->remove(key);
+  }
+
+  std::shared_ptr<IConcurrentMap> store_;
+  const Options options_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool stopping_ = false;
+  std::unique_ptr<grpc::ClientContext> ctx_;
+  std::thread thread_;
+
+  // Written by the replication thread only.
+  uint64_t log_id_ = 0;
+  IConcurrentMap::EntryList entries_;
+  LatencyHistogram delay_;
+  std::atomic<bool> connected_{false};
+  std::atomic<bool> ready_{false};
+  std::atomic<uint64_t> applied_{0};
+  std::atomic<uint64_t> primary_seqno_{0};
+  std::atomic<uint64_t> snapshots_{0};
+};
+
+} // namespace kvstore
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace kvstore {
+
+// Parses a Linux CPU list such as "0-3,8,10-11" (the format of sysfs
+// cpulist files and taskset -c) into sorted, de-duplicated CPU ids.
+inline std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream in(list);
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace),
+                range.end());
+    if (range.empty())
+      continue;
+    size_t dash = range.find('-');
+    try {
+      size_t used = 0;
+      int first = std::stoi(range.substr(0, dash), &used);
+      int last = first;
+      if (used != (dash == std::string::npos ? range.size() : dash))
+        throw std::invalid_argument(range);
+      if (dash != std::string::npos) {
+        last = std::stoi(range.substr(dash + 1), &used);
+        if (used != range.size() - dash - 1)
+          throw std::invalid_argument(range);
+      }
+      if (first < 0 || last < first)
+        throw std::invalid_argument(range);
+      for (int cpu = first; cpu <= last; ++cpu)
+        cpus.push_back(cpu);
+    } catch (const std::exception &) {
+      throw std::invalid_argument("bad CPU list '" + list + "'");
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+// The CPUs this process may run on, grouped by NUMA node.
+class CpuTopology {
+public:
+  // cpus_by_node[n] lists the usable CPUs of kernel node n; nodes without
+  // any are skipped.
+  explicit CpuTopology(const std::vector<std::vector<int>> &cpus_by_node) {
+    for (size_t n = 0; n < cpus_by_node.size(); ++n) {
+      if (cpus_by_node[n].empty())
+        continue;
+      std::vector<int> cpus = cpus_by_node[n];
+      std::sort(cpus.begin(), cpus.end());
+      nodes_.push_back(std::move(cpus));
+      node_ids_.push_back(static_cast<int>(n));
+    }
+    if (nodes_.empty())
+      throw std::invalid_argument("CPU topology has no CPUs");
+  }
+
+  // Reads the node layout from sysfs, restricted to the process's
+  // affinity mask (so a server started under taskset only plans within
+  // it). Without sysfs node information every allowed CPU is one node.
+  static CpuTopology detect() {
+    std::vector<int> allowed = allowedCpus();
+    std::vector<std::vector<int>> cpus_by_node;
+    for (int node = 0;; ++node) {
+      std::ifstream in("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+      if (!in)
+        break;
+      std::string list;
+      std::getline(in, list);
+      std::vector<int> cpus;
+      for (int cpu : parseCpuList(list))
+        if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+          cpus.push_back(cpu);
+      cpus_by_node.push_back(std::move(cpus));
+    }
+    bool any = false;
+    for (const auto &cpus : cpus_by_node)
+      any = any || !cpus.empty();
+    if (!any)
+      cpus_by_node = {allowed};
+    return CpuTopology(cpus_by_node);
+  }
+
+  static std::vector<int> allowedCpus() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::vector<int> cpus;
+    if (::sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &set))
+          cpus.push_back(cpu);
+    }
+    if (cpus.empty())
+      cpus.push_back(0);
+    return cpus;
+  }
+
+  // Usable CPUs of each node that has any, in node order.
+  const std::vector<std::vector<int>> &nodes() const { return nodes_; }
+
+  // Kernel node id of nodes()[index].
+  int nodeId(size_t index) const { return node_ids_[index]; }
+
+  // Kernel node id of the node holding `cpu`, or -1.
+  int nodeOf(int cpu) const {
+    for (size_t n = 0; n < nodes_.size(); ++n)
+      if (std::binary_search(nodes_[n].begin(), nodes_[n].end(), cpu))
+        return node_ids_[n];
+    return -1;
+  }
+
+  // One CPU for each of num_cqs * threads_per_cq threads, in order CQ 0
+  // thread 0, CQ 0 thread 1, ... CQs are dealt round-robin to nodes and
+  // all threads of a CQ stay on its node, so a request is handled on the
+  // node whose threads allocated its CQ's structures. Within a node the
+  // threads take distinct CPUs until there are more threads than CPUs.
+  std::vector<std::vector<int>> spread(int num_cqs,
+                                       int threads_per_cq) const {
+    std::vector<std::vector<int>> plan;
+    std::vector<size_t> next(nodes_.size(), 0);
+    for (int cq = 0; cq < num_cqs; ++cq) {
+      size_t node = static_cast<size_t>(cq) % nodes_.size();
+      for (int t = 0; t < threads_per_cq; ++t) {
+        const auto &cpus = nodes_[node];
+        plan.push_back({cpus[next[node]++ % cpus.size()]});
+      }
+    }
+    return plan;
+  }
+
+private:
+  std::vector<std::vector<int>> nodes_;
+  std::vector<int> node_ids_;
+};
+
+// Restricts the calling thread to `cpus`. Returns false (errno set) if
+// the kernel refuses, e.g. for a CPU outside the process's cpuset.
+inline bool pinThisThread(const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      errno = EINVAL;
+      return false;
+    }
+    CPU_SET(cpu, &set);
+  }
+  int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+  errno = err;
+  return err == 0;
+}
+
+// Makes the calling thread's future page allocations prefer `node`,
+// overriding a process-wide policy such as numactl --interleave. Returns
+// false (errno set) if the kernel has no NUMA support.
+inline bool preferNode(int node) {
+  if (node < 0 || node >= 64) {
+    errno = EINVAL;
+    return false;
+  }
+  unsigned long mask = 1ul << node;
+  // maxnode counts one past the last bit the kernel should read.
+  return ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                   sizeof(mask) * 8 + 1) == 0;
+}
+
+} // namespace kvstore
@@ -1,12 +1,29 @@
 #ifndef SERVER_IMPL_H
 #define SERVER_IMPL_H
 
+#include "compression/CompressingMap.h"
+#include "map/IConcurrentMap.h"
+#include "map/SkipListMap.h"
+#include "map/SlabAllocator.h"
+#include "metrics/ServerMetrics.h"
+#include "metrics/StageTracer.h"
+#include "replication/ChangeLog.h"
+#include "replication/Replica.h"
+#include "runtime/CpuTopology.h"
+#include "storage/ChunkedValueMap.h"
+#include <algorithm>
 #include <atomic>
-#include <folly/ConcurrentSkipList.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <google/protobuf/arena.h>
+#include <grpcpp/alarm.h>
 #include <grpcpp/grpcpp.h>
 #include <iostream>
 #include <kvstore.grpc.pb.h>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
@@ -22,45 +39,244 @@ using kvstore::DeleteResponse;
 using kvstore::GetRequest;
 using kvstore::GetResponse;
 using kvstore::KeyValueStore;
+using kvstore::MultiDeleteRequest;
+using kvstore::MultiDeleteResponse;
+using kvstore::MultiGetRequest;
+using kvstore::MultiGetResponse;
+using kvstore::MultiPutRequest;
+using kvstore::MultiPutResponse;
 using kvstore::PutRequest;
 using kvstore::PutResponse;
-
-struct KeyValueComparator {
-  bool operator()(const std::pair<std::string, std::string> &a,
-                  const std::pair<std::string, std::string> &b) const {
-    return a.first < b.first;
-  }
-};
+using kvstore::StatsRequest;
+using kvstore::StatsResponse;
 
 class AsyncKVServer {
 public:
-  using KeyValue = std::pair<std::string, std::string>;
-  using SkipList = folly::ConcurrentSkipList<KeyValue, KeyValueComparator>;
-  using SkipListPtr = std::shared_ptr<SkipList>;
-  using Accessor = SkipList::Accessor;
+  using StorePtr = std::shared_ptr<kvstore::IConcurrentMap>;
+
+  // Inline first arena block of each CallData; requests and responses that
+  // fit never touch the heap.
+  static constexpr size_t kArenaBlockSize = 2048;
+
+  // Responses a Pipeline stream may have queued before the server stops
+  // reading from it.
+  static constexpr size_t kPipelineWindow = 128;
+
+  // Target payload per Scan response message; a single entry larger than
+  // this is still sent in a chunk of its own.
+  static constexpr size_t kScanChunkBytes = 64 * 1024;
+
+  // Get sends values at least this long straight from the stored record
+  // (see GetCallData); shorter ones are cheaper to copy than to reference.
+  static constexpr size_t kShareValueBytes = 1024;
+
+  // Largest GetStream message for values not stored in chunks.
+  static constexpr size_t kStreamChunkBytes = 1 << 20;
+
+  // Target payload of change-log entries per Replicate message, and how
+  // long a caught-up Replicate stream waits before sending a heartbeat.
+  static constexpr size_t kReplicateBatchBytes = 256 * 1024;
+  static constexpr std::chrono::milliseconds kReplicateHeartbeat{100};
+
+  // Returned by writes to a replica.
+  static constexpr const char *kReadOnlyError =
+      "read-only replica; write to the primary";
+
+  // Returned by reads from a replica that is loading a snapshot.
+  static constexpr const char *kSyncingError =
+      "replica is loading a snapshot; retry or read from the primary";
 
   AsyncKVServer(const std::string &address)
-      : address_(address), store_(SkipList::createInstance()) {}
+      : AsyncKVServer(address, std::make_shared<kvstore::SkipListMap>()) {}
+
+  // pool_calls recycles CallData objects through per-CQ free lists and
+  // allocates their messages on an arena; turning it off restores a heap
+  // CallData and messages per RPC, which is only useful for comparison.
+  // collect_metrics records per-RPC counters and latency histograms for the
+  // Stats RPC; turning it off leaves them at zero.
+  AsyncKVServer(const std::string &address, StorePtr store,
+                bool pool_calls = true, bool collect_metrics = true)
+      : address_(address), store_(std::move(store)), pool_calls_(pool_calls),
+        collect_metrics_(collect_metrics) {}
+
+  // Thread layout of Run(). Every CQ gets threads_per_cq threads, which
+  // all wait on that CQ.
+  struct Topology {
+    int num_cqs = 4;
+    int threads_per_cq = 2;
+    // CPUs each thread is pinned to, in order CQ 0 thread 0, CQ 0 thread
+    // 1, ..., CQ 1 thread 0, ... (see CpuTopology::spread). Threads past
+    // the end of the list, or with an empty set, are left to the OS.
+    std::vector<std::vector<int>> thread_cpus;
+    // Pinned threads prefer memory on the NUMA node of their first CPU.
+    // What a CQ's threads allocate for themselves (CallData pools, arenas,
+    // metrics, trace rings, slab caches) is first touched on that node
+    // either way, as each CQ's structures are built by its own threads
+    // after pinning; this also overrides a process-wide interleave policy.
+    bool numa_local = false;
+  };
 
   void Run(int num_cqs = 4, int threads_per_cq = 2) {
-    ServerBuilder builder;
-    builder.AddListeningPort(address_, grpc::InsecureServerCredentials());
-    builder.RegisterService(&service_);
-    for (int i = 0; i < num_cqs; ++i)
-      cqs_.emplace_back(builder.AddCompletionQueue());
+    Topology topology;
+    topology.num_cqs = num_cqs;
+    topology.threads_per_cq = threads_per_cq;
+    Run(topology);
+  }
+
+  void Run(const Topology &topology) {
+    {
+      std::lock_guard<std::mutex> lock(start_mu_);
+      if (shutting_down_.load(std::memory_order_acquire))
+        return;
+      ServerBuilder builder;
+      builder.AddListeningPort(address_, grpc::InsecureServerCredentials());
+      builder.RegisterService(&service_);
+      for (int i = 0; i < topology.num_cqs; ++i) {
+        cqs_.emplace_back(builder.AddCompletionQueue());
+        pools_.emplace_back(std::make_unique<LazyPools>());
+      }
 
-    server_ = builder.BuildAndStart();
+      server_ = builder.BuildAndStart();
+    }
     std::cout << "Server listening on " << address_ << std::endl;
 
-    for (size_t i = 0; i < cqs_.size(); ++i)
-      for (int j = 0; j < threads_per_cq; ++j)
-        threads_.emplace_back([this, i]() { HandleRpcs(cqs_[i].get()); });
+    size_t next = 0;
+    for (size_t i = 0; i < cqs_.size(); ++i) {
+      for (int j = 0; j < topology.threads_per_cq; ++j, ++next) {
+        std::vector<int> cpus;
+        if (next < topology.thread_cpus.size())
+          cpus = topology.thread_cpus[next];
+        bool numa_local = topology.numa_local;
+        threads_.emplace_back([this, i, cpus, numa_local]() {
+          Place(cpus, numa_local);
+          HandleRpcs(i, cqs_[i].get(), PoolsFor(i));
+        });
+      }
+    }
 
     for (auto &thread : threads_)
       thread.join();
   }
 
+  // Stops accepting RPCs and drains the completion queues, which makes a
+  // concurrent Run() return. Called before Run(), it makes Run() return
+  // without serving.
+  void Shutdown() {
+    std::lock_guard<std::mutex> lock(start_mu_);
+    shutting_down_.store(true, std::memory_order_release);
+    if (!server_)
+      return;
+    server_->Shutdown();
+    for (auto &cq : cqs_)
+      cq->Shutdown();
+  }
+
+  // Makes this server a primary: Replicate streams the writes `source`
+  // logs, which should be the store or a layer of it. Call before Run().
+  void EnableReplication(std::shared_ptr<kvstore::ChangeLogMap> source) {
+    primary_ = std::move(source);
+  }
+
+  // Makes this server a read-only replica fed by `replica`, whose state
+  // Stats reports. Call before Run().
+  void ServeAsReplica(std::shared_ptr<kvstore::Replica> replica) {
+    replica_ = std::move(replica);
+  }
+
+  // Reports the compression `values` does, which should be the store or a
+  // layer of it, and lets Get pass its values through to clients that
+  // accept them compressed. Call before Run().
+  void EnableCompression(std::shared_ptr<kvstore::CompressingMap> values) {
+    compression_ = std::move(values);
+  }
+
+  // Lets PutStream and GetStream keep large values in `values`' chunks,
+  // which should be the store itself. Without it they still work, but
+  // hold each value whole. Call before Run().
+  void EnableLargeValues(std::shared_ptr<kvstore::ChunkedValueMap> values) {
+    large_values_ = std::move(values);
+  }
+
+  // Merges the metrics of all threads and adds the store's size and the
+  // replication and compression state.
+  kvstore::ServerMetrics::Snapshot MetricsSnapshot() const {
+    kvstore::ServerMetrics::Snapshot snapshot = metrics_.snapshot();
+    snapshot.keys = store_->size();
+    if (kvstore::SlabAllocator::enabled()) {
+      auto slab = kvstore::SlabAllocator::global().stats();
+      snapshot.store_bytes = slab.bytes_used;
+      snapshot.store_reserved_bytes = slab.bytes_reserved;
+    }
+    if (primary_) {
+      snapshot.replication_role = "primary";
+      snapshot.log_seqno = primary_->log().lastSeqno();
+    } else if (replica_) {
+      kvstore::Replica::Status status = replica_->status();
+      snapshot.replication_role = "replica";
+      snapshot.replica_connected = status.connected;
+      snapshot.applied_seqno = status.applied_seqno;
+      snapshot.primary_seqno = status.primary_seqno;
+      snapshot.snapshots = status.snapshots;
+      snapshot.replication_delay = std::move(status.delay);
+    }
+    if (compression_) {
+      snapshot.compression_codec =
+          kvstore::codecName(compression_->codec().codec());
+      snapshot.compression = compression_->stats();
+    }
+    return snapshot;
+  }
+
+  // Metrics in Prometheus text format, for a scrape endpoint.
+  std::string MetricsText() const {
+    return kvstore::ServerMetrics::prometheusText(MetricsSnapshot());
+  }
+
+  // Traces the stages of one in `sample_every` unary calls per thread,
+  // keeping the last `ring_size` traces of each thread. Call before Run().
+  void EnableTracing(uint32_t sample_every, size_t ring_size) {
+    tracer_ = std::make_unique<kvstore::StageTracer>(sample_every, ring_size);
+  }
+
+  // Writes the buffered traces as Chrome trace JSON (see StageTracer).
+  // Returns how many were written; none unless tracing is enabled.
+  size_t DumpTrace(std::ostream &out) const {
+    if (!tracer_) {
+      out << "{\"traceEvents\":[]}\n";
+      return 0;
+    }
+    return tracer_->writeChromeJson(out);
+  }
+
 private:
+  using Rpc = kvstore::ServerMetrics::Rpc;
+  using MetricsClock = kvstore::ServerMetrics::Clock;
+
+  // Get is served raw, as ByteBuffers, so its responses can reference
+  // stored values instead of copying them into a message.
+  using Service = KeyValueStore::WithRawMethod_Get<KeyValueStore::AsyncService>;
+
+  // Called once an RPC (or Pipeline op) is done. Message sizes are only
+  // computed when metrics are on.
+  template <typename RequestT, typename ResponseT>
+  void Record(Rpc rpc, MetricsClock::time_point start,
+              const RequestT &request, const ResponseT &response,
+              bool error) {
+    if (collect_metrics_)
+      Record(rpc, start, request.ByteSizeLong(), response.ByteSizeLong(),
+             error);
+  }
+
+  void Record(Rpc rpc, MetricsClock::time_point start, size_t bytes_in,
+              size_t bytes_out, bool error) {
+    metrics_.local().record(rpc, kvstore::ServerMetrics::nanosSince(start),
+                            bytes_in, bytes_out, error);
+  }
+
+  // A replica's store is partial while it loads a snapshot, so reads are
+  // refused until it has one.
+  bool Syncing() const { return replica_ && !replica_->ready(); }
+
   // Base for all CallData
   class CallDataBase {
   public:
@@ -68,151 +284,1495 @@ private:
     virtual void Proceed(bool ok) = 0;
   };
 
-  // PUT handler
-  class PutCallData : public CallDataBase {
+  // Finished CallData objects of one type, kept per completion queue so the
+  // next request on that queue reuses them instead of allocating. Threads
+  // polling the same queue share the pool.
+  template <typename CallData> class CallDataPool {
+  public:
+    ~CallDataPool() {
+      for (CallData *call : free_)
+        delete call;
+    }
+
+    CallData *Acquire() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_.empty())
+        return nullptr;
+      CallData *call = free_.back();
+      free_.pop_back();
+      return call;
+    }
+
+    void Release(CallData *call) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(call);
+    }
+
+  private:
+    std::mutex mutex_;
+    std::vector<CallData *> free_;
+  };
+
+  // Shared state machine for unary handlers. Request and response messages
+  // live on an arena whose first block is part of the object, so a typical
+  // call allocates neither; Reset() rebuilds the context and clears the
+  // arena before a pooled object serves its next call. Derived classes
+  // provide kRpc, RequestCall() and Handle(), and may hide Failed(),
+  // Respond() and the byte counts.
+  template <typename Derived, typename RequestT, typename ResponseT>
+  class UnaryCallData : public CallDataBase {
   public:
-    PutCallData(KeyValueStore::AsyncService *service, ServerCompletionQueue *cq,
-                SkipListPtr &store)
-        : service_(service), cq_(cq), responder_(&ctx_), store_(store),
-          status_(CREATE) {
-      Proceed(true);
+    using Pool = CallDataPool<Derived>;
+
+    UnaryCallData(AsyncKVServer *server, ServerCompletionQueue *cq,
+                  Pool *pool)
+        : server_(server), service_(&server->service_), cq_(cq),
+          store_(server->store_), pool_(pool),
+          arena_(arena_block_, sizeof(arena_block_)) {}
+
+    ~UnaryCallData() override {
+      if (pool_ == nullptr) {
+        delete request_;
+        delete response_;
+      }
+    }
+
+    // Starts listening for the next call on cq. A null pool allocates a
+    // fresh object and heap messages per call and deletes them when the call
+    // finishes.
+    static void Spawn(AsyncKVServer *server, ServerCompletionQueue *cq,
+                      Pool *pool) {
+      if (server->shutting_down_.load(std::memory_order_acquire))
+        return;
+      Derived *call = pool ? pool->Acquire() : nullptr;
+      if (call == nullptr)
+        call = new Derived(server, cq, pool);
+      call->Reset();
+      call->Proceed(true);
     }
 
     void Proceed(bool ok) override {
-      if (status_ == CREATE) {
+      if (!ok) {
+        // The server is shutting down or the client went away.
+        if (status_ == FINISH) {
+          RecordCall(true);
+          EndTrace(true);
+        }
+        Recycle();
+      } else if (status_ == CREATE) {
         status_ = PROCESS;
-        service_->RequestPut(&ctx_, &request_, &responder_, cq_, cq_, this);
+        static_cast<Derived *>(this)->RequestCall();
       } else if (status_ == PROCESS) {
+        if (server_->collect_metrics_)
+          start_ = MetricsClock::now();
+        tracing_ = server_->tracer_ && server_->tracer_->sample();
+        if (tracing_)
+          trace_.thread = kvstore::StageTracer::threadId();
+        Stamp(kvstore::StageTracer::kDequeued);
         // Spawn next handler
-        new PutCallData(service_, cq_, store_);
-        // Process request
-        {
-          AsyncKVServer::Accessor accessor(store_);
-          auto kv = std::make_pair(request_.key(), request_.value());
-          auto it = accessor.find(kv);
-          if (it != accessor.end())
-            accessor.erase(kv);
-          accessor.insert(kv);
-        }
-        response_.set_success(true);
+        Spawn(server_, cq_, pool_);
+        Stamp(kvstore::StageTracer::kHandleStart);
+        static_cast<Derived *>(this)->Handle();
+        Stamp(kvstore::StageTracer::kStoreDone);
         status_ = FINISH;
-        responder_.Finish(response_, Status::OK, this);
+        // Another thread may pick up the completion before Finish returns,
+        // so nothing is stamped after it.
+        static_cast<Derived *>(this)->Respond();
       } else {
         // FINISH
-        delete this;
+        bool failed = static_cast<Derived *>(this)->Failed();
+        RecordCall(failed);
+        EndTrace(failed);
+        Recycle();
       }
     }
 
-  private:
+    // Whether the handled request counts as an error.
+    bool Failed() const { return false; }
+
+    // Sends the response.
+    void Respond() { responder_->Finish(*response_, Status::OK, this); }
+
+    // Message sizes for the metrics.
+    size_t RequestBytes() const { return request_->ByteSizeLong(); }
+    size_t ResponseBytes() const { return response_->ByteSizeLong(); }
+
+  protected:
+    void Reset() {
+      status_ = CREATE;
+      responder_.reset();
+      ctx_.emplace();
+      responder_.emplace(&*ctx_);
+      arena_.Reset();
+      google::protobuf::Arena *arena = pool_ ? &arena_ : nullptr;
+      request_ = google::protobuf::Arena::CreateMessage<RequestT>(arena);
+      response_ = google::protobuf::Arena::CreateMessage<ResponseT>(arena);
+    }
+
+    // Sizes are only computed when metrics are on.
+    void RecordCall(bool failed) {
+      if (!server_->collect_metrics_)
+        return;
+      const Derived *self = static_cast<const Derived *>(this);
+      server_->Record(Derived::kRpc, start_, self->RequestBytes(),
+                      self->ResponseBytes(), failed);
+    }
+
+    void Stamp(kvstore::StageTracer::Stage stage) {
+      if (tracing_)
+        trace_.at[stage] = kvstore::StageTracer::now();
+    }
+
+    void EndTrace(bool failed) {
+      if (!tracing_)
+        return;
+      Stamp(kvstore::StageTracer::kCompleted);
+      trace_.completion_thread = kvstore::StageTracer::threadId();
+      trace_.name = kvstore::ServerMetrics::rpcName(Derived::kRpc);
+      trace_.error = failed;
+      server_->tracer_->record(trace_);
+      tracing_ = false;
+    }
+
+    void Recycle() {
+      if (pool_)
+        pool_->Release(static_cast<Derived *>(this));
+      else
+        delete this;
+    }
+
     enum CallStatus { CREATE, PROCESS, FINISH };
-    CallStatus status_;
+    CallStatus status_ = CREATE;
+    AsyncKVServer *server_;
     KeyValueStore::AsyncService *service_;
     ServerCompletionQueue *cq_;
+    StorePtr &store_;
+    Pool *pool_;
+    MetricsClock::time_point start_;
+    bool tracing_ = false;
+    kvstore::StageTracer::Trace trace_;
+    std::optional<ServerContext> ctx_;
+    std::optional<ServerAsyncResponseWriter<ResponseT>> responder_;
+    alignas(16) char arena_block_[kArenaBlockSize];
+    google::protobuf::Arena arena_;
+    RequestT *request_ = nullptr;
+    ResponseT *response_ = nullptr;
+  };
+
+  // Runs a store call. An engine that can't take writes (e.g. an LSM
+  // engine stalled behind a failed flush) throws, as does a read of a
+  // chunked value too large to send whole, and the call then fails with
+  // the reason in the response's error rather than on the CQ thread.
+  template <typename Response, typename Call>
+  static void GuardStore(Response *response, Call &&call) {
+    try {
+      call();
+    } catch (const std::exception &e) {
+      response->set_error(e.what());
+    }
+  }
+
+  // Shared by Put and the Pipeline put op.
+  static void ApplyPut(kvstore::IConcurrentMap &store,
+                       const PutRequest &request, PutResponse *response) {
+    if (request.ttl_ms() != 0 && !store.expiresKeys()) {
+      response->set_error("TTL is not enabled on this server");
+      return;
+    }
+    GuardStore(response, [&]() {
+      if (request.ttl_ms() == 0)
+        store.put(request.key(), request.value());
+      else
+        store.putExpiring(request.key(), request.value(),
+                          std::chrono::milliseconds(request.ttl_ms()));
+      response->set_success(true);
+    });
+  }
+
+  // PUT handler
+  class PutCallData
+      : public UnaryCallData<PutCallData, PutRequest, PutResponse> {
+  public:
+    using UnaryCallData::UnaryCallData;
+    static constexpr Rpc kRpc = Rpc::kPut;
+
+    void RequestCall() {
+      service_->RequestPut(&*ctx_, request_, &*responder_, cq_, cq_, this);
+    }
+
+    void Handle() {
+      if (server_->replica_)
+        response_->set_error(kReadOnlyError);
+      else
+        ApplyPut(*store_, *request_, response_);
+    }
+
+    bool Failed() const { return !response_->error().empty(); }
+  };
+
+  // GET handler. Get is a raw method, so the call reads and writes
+  // ByteBuffers: the request is parsed into request_, and most responses
+  // are built in response_ and serialized. On engines that share records
+  // (IConcurrentMap::getRecord), a value of kShareValueBytes or more is
+  // instead sent as a slice over the stored record, behind a few bytes of
+  // message header: the slice holds a reference to the record until gRPC
+  // has written it out, so the value is never copied on its way to the
+  // transport, however many writes replace it meanwhile.
+  class GetCallData
+      : public UnaryCallData<GetCallData, GetRequest, GetResponse> {
+  public:
+    using UnaryCallData::UnaryCallData;
+    static constexpr Rpc kRpc = Rpc::kGet;
+
+    void Reset() {
+      raw_responder_.reset();
+      UnaryCallData::Reset();
+      raw_responder_.emplace(&*ctx_);
+      raw_request_.Clear();
+      raw_response_.Clear();
+      reply_ = Status::OK;
+      shared_ = false;
+      response_bytes_ = 0;
+    }
+
+    void RequestCall() {
+      server_->service_.RequestGet(&*ctx_, &raw_request_, &*raw_responder_,
+                                   cq_, cq_, this);
+    }
+
+    // Stored codecs go out as they are.
+    static_assert(static_cast<int>(kvstore::Codec::kLz4) ==
+                      kvstore::COMPRESSION_LZ4 &&
+                  static_cast<int>(kvstore::Codec::kZstd) ==
+                      kvstore::COMPRESSION_ZSTD &&
+                  static_cast<int>(kvstore::Codec::kSnappy) ==
+                      kvstore::COMPRESSION_SNAPPY &&
+                  static_cast<int>(kvstore::Codec::kZstdDict) ==
+                      kvstore::COMPRESSION_ZSTD_DICT);
+
+    void Handle() {
+      reply_ = grpc::SerializationTraits<GetRequest>::Deserialize(
+          &raw_request_, request_);
+      if (!reply_.ok())
+        return;
+      if (server_->Syncing()) {
+        response_->set_error(kSyncingError);
+        return;
+      }
+      const auto &compression = server_->compression_;
+      // Reserved keys go to the store, which hides them.
+      if (request_->accept_compressed() && compression &&
+          !(server_->large_values_ &&
+            kvstore::ChunkedValueMap::isReserved(request_->key()))) {
+        kvstore::Codec codec;
+        uint64_t raw_size;
+        response_->set_found(compression->getCompressed(
+            request_->key(), *response_->mutable_value(), codec, raw_size));
+        if (response_->found() && codec != kvstore::Codec::kNone) {
+          response_->set_compression(
+              static_cast<kvstore::Compression>(codec));
+          response_->set_raw_size(raw_size);
+        }
+      } else if (store_->sharesRecords()) {
+        kvstore::RecordPtr record;
+        GuardStore(response_, [&]() {
+          record = store_->getRecord(request_->key());
+        });
+        if (record && record->value().size() >= kShareValueBytes) {
+          Share(std::move(record));
+          return;
+        }
+        response_->set_found(record != nullptr);
+        if (record)
+          response_->set_value(record->value().data(),
+                               record->value().size());
+      } else {
+        GuardStore(response_, [&]() {
+          response_->set_found(
+              store_->get(request_->key(), *response_->mutable_value()));
+        });
+      }
+    }
+
+    void Respond() {
+      if (reply_.ok() && !shared_) {
+        bool own_buffer;
+        grpc::SerializationTraits<GetResponse>::Serialize(
+            *response_, &raw_response_, &own_buffer);
+      }
+      response_bytes_ = raw_response_.Length();
+      raw_responder_->Finish(raw_response_, reply_, this);
+    }
+
+    bool Failed() const {
+      return !reply_.ok() || !response_->error().empty();
+    }
+    size_t ResponseBytes() const { return response_bytes_; }
+
+  private:
+    // The encoding below is GetResponse{found: true, value: <record>}.
+    static_assert(GetResponse::kValueFieldNumber == 1 &&
+                  GetResponse::kFoundFieldNumber == 2);
+
+    void Share(kvstore::RecordPtr record) {
+      std::string_view value = record->value();
+      // found = true (tag: field 2, varint), then the tag of value (field
+      // 1, length-delimited) and its length as a varint.
+      uint8_t header[3 + 10] = {0x10, 1, 0x0a};
+      size_t length = 3;
+      uint64_t n = value.size();
+      for (; n >= 0x80; n >>= 7)
+        header[length++] = static_cast<uint8_t>(n | 0x80);
+      header[length++] = static_cast<uint8_t>(n);
+      grpc::Slice slices[] = {
+          grpc::Slice(header, length),
+          grpc::Slice(const_cast<char *>(value.data()), value.size(),
+                      &ReleaseRecord,
+                      const_cast<kvstore::Record *>(record.detach()))};
+      raw_response_ = grpc::ByteBuffer(slices, 2);
+      shared_ = true;
+    }
+
+    static void ReleaseRecord(void *record) {
+      static_cast<const kvstore::Record *>(record)->release();
+    }
+
+    grpc::ByteBuffer raw_request_;
+    grpc::ByteBuffer raw_response_;
+    std::optional<ServerAsyncResponseWriter<grpc::ByteBuffer>> raw_responder_;
+    Status reply_;
+    bool shared_ = false;
+    size_t response_bytes_ = 0;
+  };
+
+  // DELETE handler
+  class DeleteCallData
+      : public UnaryCallData<DeleteCallData, DeleteRequest, DeleteResponse> {
+  public:
+    using UnaryCallData::UnaryCallData;
+    static constexpr Rpc kRpc = Rpc::kDelete;
+
+    void RequestCall() {
+      service_->RequestDelete(&*ctx_, request_, &*responder_, cq_, cq_, this);
+    }
+
+    void Handle() {
+      if (server_->replica_)
+        response_->set_error(kReadOnlyError);
+      else
+        GuardStore(response_, [&]() {
+          response_->set_success(store_->remove(request_->key()));
+        });
+    }
+
+    bool Failed() const { return !response_->error().empty(); }
+  };
+
+  // MULTIGET handler. The key list is kept across pooled reuse so its
+  // capacity is recycled along with the CallData.
+  class MultiGetCallData : public UnaryCallData<MultiGetCallData,
+                                                MultiGetRequest,
+                                                MultiGetResponse> {
+  public:
+    using UnaryCallData::UnaryCallData;
+    static constexpr Rpc kRpc = Rpc::kMultiGet;
+
+    void RequestCall() {
+      service_->RequestMultiGet(&*ctx_, request_, &*responder_, cq_, cq_,
+                                this);
+    }
+
+    void Handle() {
+      if (server_->Syncing()) {
+        response_->set_error(kSyncingError);
+        return;
+      }
+      keys_.assign(request_->keys().begin(), request_->keys().end());
+      auto *values = response_->mutable_values();
+      auto *found = response_->mutable_found();
+      values->Reserve(request_->keys_size());
+      for (int i = 0; i < request_->keys_size(); ++i)
+        values->Add();
+      found->Resize(request_->keys_size(), false);
+      GuardStore(response_, [&]() {
+        store_->multiGet(keys_, [values, found](size_t i,
+                                                std::string_view value) {
+          values->Mutable(i)->assign(value.data(), value.size());
+          found->Set(i, true);
+        });
+      });
+    }
+
+    bool Failed() const { return !response_->error().empty(); }
+
+  private:
+    kvstore::IConcurrentMap::KeyList keys_;
+  };
+
+  // MULTIPUT handler
+  class MultiPutCallData : public UnaryCallData<MultiPutCallData,
+                                                MultiPutRequest,
+                                                MultiPutResponse> {
+  public:
+    using UnaryCallData::UnaryCallData;
+    static constexpr Rpc kRpc = Rpc::kMultiPut;
+
+    void RequestCall() {
+      service_->RequestMultiPut(&*ctx_, request_, &*responder_, cq_, cq_,
+                                this);
+    }
+
+    void Handle() {
+      if (server_->replica_) {
+        response_->set_error(kReadOnlyError);
+        return;
+      }
+      entries_.clear();
+      for (const auto &entry : request_->entries())
+        entries_.emplace_back(entry.key(), entry.value());
+      GuardStore(response_, [&]() {
+        store_->multiPut(entries_);
+        response_->set_success(true);
+      });
+    }
+
+    bool Failed() const { return !response_->error().empty(); }
+
+  private:
+    kvstore::IConcurrentMap::EntryList entries_;
+  };
+
+  // MULTIDELETE handler
+  class MultiDeleteCallData : public UnaryCallData<MultiDeleteCallData,
+                                                   MultiDeleteRequest,
+                                                   MultiDeleteResponse> {
+  public:
+    using UnaryCallData::UnaryCallData;
+    static constexpr Rpc kRpc = Rpc::kMultiDelete;
+
+    void RequestCall() {
+      service_->RequestMultiDelete(&*ctx_, request_, &*responder_, cq_, cq_,
+                                   this);
+    }
+
+    void Handle() {
+      if (server_->replica_) {
+        response_->set_error(kReadOnlyError);
+        return;
+      }
+      keys_.assign(request_->keys().begin(), request_->keys().end());
+      auto *deleted = response_->mutable_deleted();
+      deleted->Resize(request_->keys_size(), false);
+      GuardStore(response_, [&]() {
+        store_->multiRemove(keys_,
+                            [deleted](size_t i) { deleted->Set(i, true); });
+      });
+    }
+
+    bool Failed() const { return !response_->error().empty(); }
+
+  private:
+    kvstore::IConcurrentMap::KeyList keys_;
+  };
+
+  // STATS handler
+  class StatsCallData
+      : public UnaryCallData<StatsCallData, StatsRequest, StatsResponse> {
+  public:
+    using UnaryCallData::UnaryCallData;
+    static constexpr Rpc kRpc = Rpc::kStats;
+
+    void RequestCall() {
+      service_->RequestStats(&*ctx_, request_, &*responder_, cq_, cq_, this);
+    }
+
+    void Handle() {
+      auto snapshot = server_->MetricsSnapshot();
+      for (size_t i = 0; i < kvstore::ServerMetrics::kRpcs; ++i) {
+        const auto &from = snapshot.rpcs[i];
+        kvstore::RpcStats *to = response_->add_rpcs();
+        to->set_rpc(kvstore::ServerMetrics::rpcName(static_cast<Rpc>(i)));
+        to->set_requests(from.requests);
+        to->set_errors(from.errors);
+        to->set_bytes_in(from.bytes_in);
+        to->set_bytes_out(from.bytes_out);
+        to->set_mean_us(from.latency.mean() / 1e3);
+        to->set_p50_us(from.latency.percentile(0.5) / 1e3);
+        to->set_p90_us(from.latency.percentile(0.9) / 1e3);
+        to->set_p99_us(from.latency.percentile(0.99) / 1e3);
+        to->set_p999_us(from.latency.percentile(0.999) / 1e3);
+        to->set_max_us(from.latency.max / 1e3);
+      }
+      for (size_t cq = 0; cq < snapshot.cq_requests.size(); ++cq) {
+        kvstore::CqStats *stats = response_->add_cqs();
+        stats->set_cq(static_cast<uint32_t>(cq));
+        stats->set_requests(snapshot.cq_requests[cq]);
+      }
+      response_->set_keys(snapshot.keys);
+      response_->set_store_bytes(snapshot.store_bytes);
+      if (!snapshot.replication_role.empty()) {
+        kvstore::ReplicationStats *replication =
+            response_->mutable_replication();
+        replication->set_role(snapshot.replication_role);
+        replication->set_log_seqno(snapshot.log_seqno);
+        replication->set_connected(snapshot.replica_connected);
+        replication->set_applied_seqno(snapshot.applied_seqno);
+        replication->set_primary_seqno(snapshot.primary_seqno);
+        replication->set_snapshots(snapshot.snapshots);
+        const auto &delay = snapshot.replication_delay;
+        replication->set_delay_p50_us(delay.percentile(0.5) / 1e3);
+        replication->set_delay_p99_us(delay.percentile(0.99) / 1e3);
+        replication->set_delay_max_us(delay.max / 1e3);
+      }
+      if (!snapshot.compression_codec.empty()) {
+        const auto &from = snapshot.compression;
+        kvstore::CompressionStats *to = response_->mutable_compression();
+        to->set_codec(snapshot.compression_codec);
+        to->set_compressed(from.compressed);
+        to->set_uncompressed(from.uncompressed);
+        to->set_raw_bytes(from.raw_bytes);
+        to->set_stored_bytes(from.stored_bytes);
+        to->set_saved_bytes_per_value(from.savedBytesPerValue());
+        to->set_compress_ns_per_op(
+            from.compressed + from.uncompressed
+                ? static_cast<double>(from.compress_ns) /
+                      (from.compressed + from.uncompressed)
+                : 0);
+        to->set_decompressed(from.decompressed);
+        to->set_decompress_ns_per_op(
+            from.decompressed
+                ? static_cast<double>(from.decompress_ns) / from.decompressed
+                : 0);
+        to->set_passed_through(from.passed_through);
+        to->set_corrupt(from.corrupt);
+      }
+      if (request_->prometheus_text())
+        response_->set_prometheus_text(
+            kvstore::ServerMetrics::prometheusText(snapshot));
+    }
+  };
+
+  // SCAN handler. Each chunk is produced by a fresh scan resuming just past
+  // the last key sent, and the next chunk is built only once the previous
+  // write has completed. A CQ thread therefore does bounded work per event,
+  // at most one chunk is buffered per scan, and no skip-list accessor is
+  // held while the client is slow to read.
+  class ScanCallData : public CallDataBase {
+  public:
+    // Starts listening for the next Scan on cq.
+    static void Spawn(AsyncKVServer *server, ServerCompletionQueue *cq) {
+      if (server->shutting_down_.load(std::memory_order_acquire))
+        return;
+      new ScanCallData(server, cq);
+    }
+
+    void Proceed(bool ok) override {
+      if (status_ == PROCESS) {
+        if (!ok) {
+          delete this;
+          return;
+        }
+        Spawn(server_, cq_);
+        if (server_->collect_metrics_)
+          start_ = MetricsClock::now();
+        if (server_->Syncing()) {
+          status_ = FINISH;
+          failed_ = true;
+          writer_.Finish(Status(grpc::StatusCode::UNAVAILABLE, kSyncingError),
+                         this);
+          return;
+        }
+        cursor_.assign(std::max(request_.start(), request_.prefix()));
+        status_ = STREAMING;
+        NextChunk();
+      } else if (status_ == STREAMING) {
+        if (!ok) {
+          // The client went away mid-scan.
+          status_ = FINISH;
+          failed_ = true;
+          writer_.Finish(Status::CANCELLED, this);
+          return;
+        }
+        NextChunk();
+      } else {
+        // FINISH. Every chunk sent counts as response bytes.
+        if (server_->collect_metrics_)
+          server_->Record(Rpc::kScan, start_, request_.ByteSizeLong(),
+                          bytes_sent_, failed_ || !ok);
+        delete this;
+      }
+    }
+
+  private:
+    ScanCallData(AsyncKVServer *server, ServerCompletionQueue *cq)
+        : server_(server), cq_(cq), writer_(&ctx_) {
+      server->service_.RequestScan(&ctx_, &request_, &writer_, cq, cq, this);
+    }
+
+    void NextChunk() {
+      response_.Clear();
+      size_t bytes = 0;
+      bool done = true;
+      bool ordered = server_->store_->scan(
+          cursor_, request_.end(), request_.prefix(),
+          [&](std::string_view key, std::string_view value) {
+            if (request_.limit() != 0 && sent_ == request_.limit())
+              return false;
+            size_t size = key.size() + value.size();
+            if (bytes > 0 && bytes + size > kScanChunkBytes) {
+              done = false;
+              return false;
+            }
+            kvstore::KeyValue *entry = response_.add_entries();
+            entry->set_key(key.data(), key.size());
+            entry->set_value(value.data(), value.size());
+            bytes += size;
+            ++sent_;
+            return true;
+          });
+
+      status_ = done ? FINISH : STREAMING;
+      if (server_->collect_metrics_)
+        bytes_sent_ += response_.ByteSizeLong();
+      if (!ordered) {
+        failed_ = true;
+        writer_.Finish(Status(grpc::StatusCode::FAILED_PRECONDITION,
+                              "storage engine does not support ordered scans"),
+                       this);
+      } else if (response_.entries_size() == 0) {
+        writer_.Finish(Status::OK, this);
+      } else if (done) {
+        writer_.WriteAndFinish(response_, grpc::WriteOptions(), Status::OK,
+                               this);
+      } else {
+        // Resume at the smallest key after the last one sent.
+        const std::string &last = response_.entries().rbegin()->key();
+        cursor_.assign(last).push_back('\0');
+        writer_.Write(response_, this);
+      }
+    }
+
+    enum CallStatus { PROCESS, STREAMING, FINISH };
+    CallStatus status_ = PROCESS;
+    AsyncKVServer *server_;
+    ServerCompletionQueue *cq_;
     ServerContext ctx_;
-    PutRequest request_;
-    PutResponse response_;
-    ServerAsyncResponseWriter<PutResponse> responder_;
-    SkipListPtr &store_;
+    kvstore::ScanRequest request_;
+    kvstore::ScanResponse response_;
+    grpc::ServerAsyncWriter<kvstore::ScanResponse> writer_;
+    std::string cursor_;
+    uint32_t sent_ = 0;
+    MetricsClock::time_point start_;
+    size_t bytes_sent_ = 0;
+    bool failed_ = false;
   };
 
-  // GET handler
-  class GetCallData : public CallDataBase {
+  // PUTSTREAM handler: reads a value a piece at a time into a
+  // ChunkedValueMap writer, which stores every full chunk as it arrives, so
+  // at most one chunk and one message are held per stream. The value is
+  // committed when the message marked last arrives; a stream that ends or
+  // breaks before then drops what it wrote. Without the chunk layer the
+  // pieces are gathered and stored whole.
+  class PutStreamCallData : public CallDataBase {
   public:
-    GetCallData(KeyValueStore::AsyncService *service, ServerCompletionQueue *cq,
-                SkipListPtr &store)
-        : service_(service), cq_(cq), responder_(&ctx_), store_(store),
-          status_(CREATE) {
-      Proceed(true);
+    // Starts listening for the next PutStream on cq.
+    static void Spawn(AsyncKVServer *server, ServerCompletionQueue *cq) {
+      if (server->shutting_down_.load(std::memory_order_acquire))
+        return;
+      new PutStreamCallData(server, cq);
     }
 
     void Proceed(bool ok) override {
-      if (status_ == CREATE) {
-        status_ = PROCESS;
-        service_->RequestGet(&ctx_, &request_, &responder_, cq_, cq_, this);
-      } else if (status_ == PROCESS) {
-        new GetCallData(service_, cq_, store_);
-        // Process
-        {
-          AsyncKVServer::Accessor accessor(store_);
-          auto search = std::make_pair(request_.key(), "");
-          auto it = accessor.find(search);
-          if (it != accessor.end()) {
-            response_.set_value(it->second);
-            response_.set_found(true);
-          } else {
-            response_.set_found(false);
+      switch (status_) {
+      case PROCESS:
+        if (!ok) {
+          delete this;
+          return;
+        }
+        Spawn(server_, cq_);
+        if (server_->collect_metrics_)
+          start_ = MetricsClock::now();
+        if (server_->replica_) {
+          response_.set_error(kReadOnlyError);
+          Finish(Status::OK);
+          return;
+        }
+        status_ = READING;
+        reader_.Read(&chunk_, this);
+        break;
+      case READING:
+        if (!ok) {
+          // The client stopped sending before the last piece.
+          writer_.reset();
+          Finish(Status(grpc::StatusCode::INVALID_ARGUMENT,
+                        "stream ended before the last chunk"));
+          return;
+        }
+        try {
+          Append();
+          if (!chunk_.last()) {
+            reader_.Read(&chunk_, this);
+            return;
           }
+          if (writer_)
+            writer_->commit();
+          else
+            server_->store_->put(key_, value_);
+          response_.set_success(true);
+        } catch (const std::exception &e) {
+          // As GuardStore; the writer's destructor drops what it stored.
+          response_.set_error(e.what());
         }
-        status_ = FINISH;
-        responder_.Finish(response_, Status::OK, this);
-      } else {
+        writer_.reset();
+        Finish(Status::OK);
+        break;
+      case FINISH:
+        if (server_->collect_metrics_)
+          server_->Record(Rpc::kPutStream, start_, bytes_received_,
+                          response_.ByteSizeLong(),
+                          failed_ || !ok || !response_.error().empty());
         delete this;
+        break;
       }
     }
 
   private:
-    enum CallStatus { CREATE, PROCESS, FINISH };
-    CallStatus status_;
-    KeyValueStore::AsyncService *service_;
+    PutStreamCallData(AsyncKVServer *server, ServerCompletionQueue *cq)
+        : server_(server), cq_(cq), reader_(&ctx_) {
+      server->service_.RequestPutStream(&ctx_, &reader_, cq, cq, this);
+    }
+
+    void Append() {
+      if (server_->collect_metrics_)
+        bytes_received_ += chunk_.ByteSizeLong();
+      if (first_) {
+        first_ = false;
+        key_ = std::move(*chunk_.mutable_key());
+        if (server_->large_values_)
+          writer_ = server_->large_values_->writer(key_);
+      }
+      if (writer_)
+        writer_->append(chunk_.data());
+      else
+        value_.append(chunk_.data());
+    }
+
+    void Finish(const Status &status) {
+      failed_ = !status.ok();
+      // As for Replicate: the CQ may no longer take operations.
+      if (server_->shutting_down_.load(std::memory_order_acquire)) {
+        delete this;
+        return;
+      }
+      status_ = FINISH;
+      reader_.Finish(response_, status, this);
+    }
+
+    enum CallStatus { PROCESS, READING, FINISH };
+    CallStatus status_ = PROCESS;
+    AsyncKVServer *server_;
+    ServerCompletionQueue *cq_;
+    ServerContext ctx_;
+    kvstore::PutChunk chunk_;
+    PutResponse response_;
+    grpc::ServerAsyncReader<PutResponse, kvstore::PutChunk> reader_;
+    bool first_ = true;
+    std::string key_;
+    std::unique_ptr<kvstore::ChunkedValueMap::Writer> writer_;
+    std::string value_; // without the chunk layer
+    MetricsClock::time_point start_;
+    size_t bytes_received_ = 0;
+    bool failed_ = false;
+  };
+
+  // GETSTREAM handler: sends a value a chunk at a time, reading each chunk
+  // from the ChunkedValueMap just before it is written, so one chunk is
+  // held per stream. A value stored whole (or any value, without the chunk
+  // layer) is read once and sent in kStreamChunkBytes slices. If the value
+  // is replaced or deleted mid-stream, the stream fails with ABORTED.
+  class GetStreamCallData : public CallDataBase {
+  public:
+    // Starts listening for the next GetStream on cq.
+    static void Spawn(AsyncKVServer *server, ServerCompletionQueue *cq) {
+      if (server->shutting_down_.load(std::memory_order_acquire))
+        return;
+      new GetStreamCallData(server, cq);
+    }
+
+    void Proceed(bool ok) override {
+      switch (status_) {
+      case PROCESS:
+        if (!ok) {
+          delete this;
+          return;
+        }
+        Spawn(server_, cq_);
+        if (server_->collect_metrics_)
+          start_ = MetricsClock::now();
+        if (server_->Syncing()) {
+          Finish(Status(grpc::StatusCode::UNAVAILABLE, kSyncingError));
+          return;
+        }
+        Open();
+        status_ = STREAMING;
+        Next();
+        break;
+      case STREAMING:
+        if (!ok) {
+          // The client went away.
+          Finish(Status::CANCELLED);
+          return;
+        }
+        Next();
+        break;
+      case FINISH:
+        if (server_->collect_metrics_)
+          server_->Record(Rpc::kGetStream, start_, request_.ByteSizeLong(),
+                          bytes_sent_, failed_ || !ok);
+        delete this;
+        break;
+      }
+    }
+
+  private:
+    GetStreamCallData(AsyncKVServer *server, ServerCompletionQueue *cq)
+        : server_(server), cq_(cq), writer_(&ctx_) {
+      server->service_.RequestGetStream(&ctx_, &request_, &writer_, cq, cq,
+                                        this);
+    }
+
+    void Open() {
+      if (server_->large_values_)
+        found_ = server_->large_values_->open(request_.key(), manifest_,
+                                              whole_);
+      else if ((found_ = server_->store_->get(request_.key(), whole_)))
+        manifest_.size = whole_.size();
+    }
+
+    void Next() {
+      response_.Clear();
+      if (sent_ == 0) {
+        response_.set_found(found_);
+        response_.set_total_size(manifest_.size);
+      }
+      if (manifest_.chunks > 0) {
+        if (!server_->large_values_->readChunk(request_.key(), manifest_,
+                                               next_chunk_++,
+                                               *response_.mutable_data())) {
+          Finish(Status(grpc::StatusCode::ABORTED,
+                        "value changed while streaming"));
+          return;
+        }
+      } else if (found_) {
+        response_.set_data(whole_.data() + sent_,
+                           std::min<size_t>(kStreamChunkBytes,
+                                            whole_.size() - sent_));
+      }
+      sent_ += response_.data().size();
+      if (server_->collect_metrics_)
+        bytes_sent_ += response_.ByteSizeLong();
+      if (sent_ < manifest_.size) {
+        writer_.Write(response_, this);
+        return;
+      }
+      status_ = FINISH;
+      writer_.WriteAndFinish(response_, grpc::WriteOptions(), Status::OK,
+                             this);
+    }
+
+    void Finish(const Status &status) {
+      failed_ = true;
+      // As for Replicate: the CQ may no longer take operations.
+      if (server_->shutting_down_.load(std::memory_order_acquire)) {
+        delete this;
+        return;
+      }
+      status_ = FINISH;
+      writer_.Finish(status, this);
+    }
+
+    enum CallStatus { PROCESS, STREAMING, FINISH };
+    CallStatus status_ = PROCESS;
+    AsyncKVServer *server_;
     ServerCompletionQueue *cq_;
     ServerContext ctx_;
     GetRequest request_;
-    GetResponse response_;
-    ServerAsyncResponseWriter<GetResponse> responder_;
-    SkipListPtr &store_;
+    kvstore::GetChunk response_;
+    grpc::ServerAsyncWriter<kvstore::GetChunk> writer_;
+    bool found_ = false;
+    kvstore::ChunkedValueMap::Manifest manifest_;
+    std::string whole_; // a value not stored in chunks
+    uint32_t next_chunk_ = 0;
+    uint64_t sent_ = 0;
+    MetricsClock::time_point start_;
+    size_t bytes_sent_ = 0;
+    bool failed_ = false;
   };
 
-  // DELETE handler
-  class DeleteCallData : public CallDataBase {
+  // REPLICATE handler: streams a primary's change log to one replica. A
+  // replica that can't resume where it left off first gets a snapshot: the
+  // seqno up to which every logged write is in the store is noted, the
+  // store is sent in chunks (by resuming scans as in Scan, or, on engines
+  // without key order, gathered in one pass on a thread of its own while
+  // the stream polls on its alarm), and the log is then streamed from that
+  // seqno, so writes that raced the scan are applied again in order. One
+  // write or alarm is outstanding at a time. A caught-up stream
+  // arms an alarm that the next append cancels to wake it, or that fires
+  // after kReplicateHeartbeat to send a heartbeat, so an idle stream still
+  // notices a departed replica or a shutdown. Streams live as long as the
+  // replica, so they are left out of the RPC metrics; the replica reports
+  // its lag instead.
+  class ReplicateCallData : public CallDataBase {
   public:
-    DeleteCallData(KeyValueStore::AsyncService *service,
-                   ServerCompletionQueue *cq, SkipListPtr &store)
-        : service_(service), cq_(cq), responder_(&ctx_), store_(store),
-          status_(CREATE) {
-      Proceed(true);
+    // Starts listening for the next Replicate on cq.
+    static void Spawn(AsyncKVServer *server, ServerCompletionQueue *cq) {
+      if (server->shutting_down_.load(std::memory_order_acquire))
+        return;
+      new ReplicateCallData(server, cq);
+    }
+
+    ~ReplicateCallData() override {
+      std::lock_guard<std::mutex> lock(wakeup_->mutex);
+      wakeup_->alarm = nullptr;
     }
 
     void Proceed(bool ok) override {
-      if (status_ == CREATE) {
-        status_ = PROCESS;
-        service_->RequestDelete(&ctx_, &request_, &responder_, cq_, cq_, this);
-      } else if (status_ == PROCESS) {
-        new DeleteCallData(service_, cq_, store_);
+      switch (status_) {
+      case PROCESS:
+        if (!ok) {
+          delete this;
+          return;
+        }
+        Spawn(server_, cq_);
+        if (!server_->primary_) {
+          Finish(Status(grpc::StatusCode::FAILED_PRECONDITION,
+                        "this server is not a primary"));
+          return;
+        }
+        log_ = &server_->primary_->log();
+        cursor_ = request_.after_seqno();
+        if (request_.log_id() != log_->id())
+          BeginSnapshot();
+        Next();
+        break;
+      case WRITING:
+        if (!ok) {
+          // The replica went away.
+          Finish(Status::CANCELLED);
+          return;
+        }
+        Next();
+        break;
+      case WAITING: {
         {
-          AsyncKVServer::Accessor accessor(store_);
-          auto search = std::make_pair(request_.key(), "");
-          auto it = accessor.find(search);
-          if (it != accessor.end()) {
-            accessor.erase(search);
-            response_.set_success(true);
-          } else {
-            response_.set_success(false);
-          }
+          std::lock_guard<std::mutex> lock(wakeup_->mutex);
+          wakeup_->armed = false;
+        }
+        // The alarm fired, rather than an append cancelling it.
+        heartbeat_ = ok;
+        Next();
+        break;
+      }
+      case GATHERING: {
+        {
+          std::lock_guard<std::mutex> lock(wakeup_->mutex);
+          wakeup_->armed = false;
+        }
+        Next();
+        break;
+      }
+      case FINISH:
+        delete this;
+        break;
+      }
+    }
+
+  private:
+    // Shared with the waiter registered on the log, which may run after
+    // the call is gone.
+    struct Wakeup {
+      std::mutex mutex;
+      grpc::Alarm *alarm;
+      bool armed = false;
+      bool subscribed = false;
+    };
+
+    ReplicateCallData(AsyncKVServer *server, ServerCompletionQueue *cq)
+        : server_(server), cq_(cq), writer_(&ctx_),
+          wakeup_(std::make_shared<Wakeup>()) {
+      wakeup_->alarm = &alarm_;
+      server->service_.RequestReplicate(&ctx_, &request_, &writer_, cq, cq,
+                                        this);
+    }
+
+    void Next() {
+      if (server_->shutting_down_.load(std::memory_order_acquire)) {
+        Finish(Status(grpc::StatusCode::UNAVAILABLE,
+                      "server is shutting down"));
+        return;
+      }
+      response_.Clear();
+      if (snapshot_) {
+        if (!NextSnapshotChunk()) {
+          WaitForGather();
+          return;
         }
-        status_ = FINISH;
-        responder_.Finish(response_, Status::OK, this);
       } else {
+        bool kept = log_->readAfter(
+            cursor_, kReplicateBatchBytes,
+            [this](const kvstore::ChangeLog::Entry &entry) {
+              kvstore::Mutation *mutation = response_.add_mutations();
+              mutation->set_seqno(entry.seqno);
+              if (entry.op == kvstore::ChangeLog::Op::kPut) {
+                mutation->set_op(kvstore::Mutation::PUT);
+                mutation->set_value(entry.value);
+              } else {
+                mutation->set_op(kvstore::Mutation::DELETE);
+              }
+              mutation->set_key(entry.key);
+              mutation->set_time_us(entry.time_us);
+              cursor_ = entry.seqno;
+            });
+        if (!kept) {
+          // The replica fell out of the log (or is ahead of it).
+          BeginSnapshot();
+          if (!NextSnapshotChunk()) {
+            WaitForGather();
+            return;
+          }
+        } else if (response_.mutations_size() == 0 && !heartbeat_) {
+          Wait();
+          return;
+        }
+      }
+      heartbeat_ = false;
+      response_.set_primary_seqno(log_->lastSeqno());
+      status_ = WRITING;
+      writer_.Write(response_, this);
+    }
+
+    void BeginSnapshot() {
+      snapshot_ = true;
+      first_chunk_ = true;
+      ordered_ = true;
+      resume_key_.clear();
+      pending_.clear();
+      gathered_.reset();
+      snapshot_seqno_ = server_->primary_->stableSeqno();
+    }
+
+    // Fills response_ with the next chunk. Returns false, with nothing
+    // filled, while an unordered engine is still being gathered.
+    bool NextSnapshotChunk() {
+      bool done = true;
+      if (ordered_) {
+        size_t bytes = 0;
+        ordered_ = server_->primary_->scan(
+            resume_key_, {}, {},
+            [&](std::string_view key, std::string_view value) {
+              size_t size = key.size() + value.size();
+              if (bytes > 0 && bytes + size > kScanChunkBytes) {
+                done = false;
+                return false;
+              }
+              kvstore::KeyValue *entry = response_.add_entries();
+              entry->set_key(key.data(), key.size());
+              entry->set_value(value.data(), value.size());
+              bytes += size;
+              return true;
+            });
+        if (!ordered_) {
+          GatherSnapshot();
+          return false;
+        }
+        if (!done)
+          resume_key_.assign(response_.entries().rbegin()->key())
+              .push_back('\0');
+      }
+      if (!ordered_) {
+        if (gathered_) {
+          std::lock_guard<std::mutex> lock(gathered_->mutex);
+          if (!gathered_->done)
+            return false;
+          pending_ = std::move(gathered_->chunks);
+        }
+        gathered_.reset();
+        if (!pending_.empty()) {
+          response_.Swap(&pending_.back());
+          pending_.pop_back();
+        }
+        done = pending_.empty();
+      }
+      response_.set_reset(first_chunk_);
+      first_chunk_ = false;
+      if (done) {
+        snapshot_ = false;
+        response_.set_snapshot_done(true);
+        response_.set_snapshot_seqno(snapshot_seqno_);
+        response_.set_log_id(log_->id());
+        cursor_ = snapshot_seqno_;
+      }
+      return true;
+    }
+
+    // For engines without key order: copies the whole store into chunks
+    // in one pass, stored last chunk first. It runs on a detached thread,
+    // so a large store doesn't hold up this CQ's other calls; the thread
+    // shares only the store and the result, and cancels the alarm
+    // WaitForGather armed once it is done.
+    void GatherSnapshot() {
+      gathered_ = std::make_shared<Gathered>();
+      std::thread([store = server_->primary_, gathered = gathered_,
+                   wakeup = wakeup_]() {
+        std::vector<kvstore::ReplicateResponse> chunks(1);
+        size_t bytes = 0;
+        store->forEach([&](std::string_view key, std::string_view value) {
+          size_t size = key.size() + value.size();
+          if (bytes > 0 && bytes + size > kScanChunkBytes) {
+            chunks.emplace_back();
+            bytes = 0;
+          }
+          kvstore::KeyValue *entry = chunks.back().add_entries();
+          entry->set_key(key.data(), key.size());
+          entry->set_value(value.data(), value.size());
+          bytes += size;
+          return true;
+        });
+        {
+          std::lock_guard<std::mutex> lock(gathered->mutex);
+          gathered->chunks.assign(std::make_move_iterator(chunks.rbegin()),
+                                  std::make_move_iterator(chunks.rend()));
+          gathered->done = true;
+        }
+        std::lock_guard<std::mutex> lock(wakeup->mutex);
+        if (wakeup->armed && wakeup->alarm) {
+          wakeup->alarm->Cancel();
+          wakeup->armed = false;
+        }
+      }).detach();
+    }
+
+    // Polls the gather every kReplicateHeartbeat, or sooner when it
+    // cancels the alarm.
+    void WaitForGather() {
+      status_ = GATHERING;
+      std::lock_guard<std::mutex> lock(wakeup_->mutex);
+      wakeup_->armed = true;
+      alarm_.Set(cq_, std::chrono::system_clock::now() + kReplicateHeartbeat,
+                 this);
+    }
+
+    // Sleeps until the next append or the heartbeat, whichever is first.
+    void Wait() {
+      status_ = WAITING;
+      bool subscribe;
+      {
+        std::lock_guard<std::mutex> lock(wakeup_->mutex);
+        wakeup_->armed = true;
+        alarm_.Set(cq_, std::chrono::system_clock::now() + kReplicateHeartbeat,
+                   this);
+        subscribe = !wakeup_->subscribed;
+        wakeup_->subscribed = true;
+      }
+      // A waiter still registered from an earlier Wait has not run, so no
+      // entry has been appended since and it covers this wait too.
+      if (subscribe)
+        log_->waitAfter(cursor_, [wakeup = wakeup_]() {
+          std::lock_guard<std::mutex> lock(wakeup->mutex);
+          wakeup->subscribed = false;
+          if (wakeup->armed && wakeup->alarm) {
+            wakeup->alarm->Cancel();
+            wakeup->armed = false;
+          }
+        });
+    }
+
+    void Finish(const Status &status) {
+      // Shutdown doesn't wait for streams, and this one's CQ may already
+      // be closed to new operations; dropping the context cancels the call.
+      if (server_->shutting_down_.load(std::memory_order_acquire)) {
         delete this;
+        return;
       }
+      status_ = FINISH;
+      writer_.Finish(status, this);
+    }
+
+    enum CallStatus { PROCESS, WRITING, WAITING, GATHERING, FINISH };
+    CallStatus status_ = PROCESS;
+    AsyncKVServer *server_;
+    ServerCompletionQueue *cq_;
+    ServerContext ctx_;
+    kvstore::ReplicateRequest request_;
+    kvstore::ReplicateResponse response_;
+    grpc::ServerAsyncWriter<kvstore::ReplicateResponse> writer_;
+    grpc::Alarm alarm_;
+    std::shared_ptr<Wakeup> wakeup_;
+    kvstore::ChangeLog *log_ = nullptr;
+    uint64_t cursor_ = 0; // last seqno sent
+    bool heartbeat_ = false;
+
+    // Snapshot in progress.
+    bool snapshot_ = false;
+    bool first_chunk_ = false;
+    bool ordered_ = true;
+    uint64_t snapshot_seqno_ = 0;
+    std::string resume_key_;
+    std::vector<kvstore::ReplicateResponse> pending_;
+    // An unordered engine's chunks, filled in by GatherSnapshot's thread.
+    struct Gathered {
+      std::mutex mutex;
+      bool done = false;
+      std::vector<kvstore::ReplicateResponse> chunks;
+    };
+    std::shared_ptr<Gathered> gathered_;
+  };
+
+  // PIPELINE handler: a bidirectional stream of tagged ops. One read and
+  // one write can be outstanding at once and their completions may run on
+  // different threads of the CQ, so each event has its own tag and the
+  // stream state is guarded by mutex_. Responses queue in a fixed window;
+  // reading pauses while it is full, so a client that stops reading its
+  // responses cannot grow server memory. Streams are long-lived, so these
+  // objects are allocated per stream rather than pooled.
+  class PipelineCallData {
+  public:
+    static constexpr size_t kWindow = kPipelineWindow;
+
+    // Starts listening for the next Pipeline stream on cq.
+    static void Spawn(AsyncKVServer *server, ServerCompletionQueue *cq) {
+      if (server->shutting_down_.load(std::memory_order_acquire))
+        return;
+      new PipelineCallData(server, cq);
     }
 
   private:
-    enum CallStatus { CREATE, PROCESS, FINISH };
-    CallStatus status_;
-    KeyValueStore::AsyncService *service_;
+    // Completion-queue tag routing one kind of event back to the call.
+    class Tag : public CallDataBase {
+    public:
+      using Handler = void (PipelineCallData::*)(bool);
+      Tag(PipelineCallData *call, Handler handler)
+          : call_(call), handler_(handler) {}
+      void Proceed(bool ok) override { (call_->*handler_)(ok); }
+
+    private:
+      PipelineCallData *call_;
+      Handler handler_;
+    };
+
+    PipelineCallData(AsyncKVServer *server, ServerCompletionQueue *cq)
+        : server_(server), cq_(cq), stream_(&ctx_),
+          connect_tag_(this, &PipelineCallData::OnConnect),
+          read_tag_(this, &PipelineCallData::OnRead),
+          write_tag_(this, &PipelineCallData::OnWrite),
+          finish_tag_(this, &PipelineCallData::OnFinish) {
+      server->service_.RequestPipeline(&ctx_, &stream_, cq, cq,
+                                       &connect_tag_);
+    }
+
+    void OnConnect(bool ok) {
+      if (!ok) {
+        delete this;
+        return;
+      }
+      Spawn(server_, cq_);
+      std::lock_guard<std::mutex> lock(mutex_);
+      StartRead();
+    }
+
+    void OnRead(bool ok) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      reading_ = false;
+      if (!ok) {
+        // The client half-closed (or the call was cancelled).
+        reads_done_ = true;
+      } else if (broken_) {
+        // A write already failed; nobody will read this response.
+        MaybeFinish();
+        return;
+      } else {
+        Execute(request_, window_[(head_ + queued_) % kWindow]);
+        ++queued_;
+        StartRead();
+      }
+      StartWrite();
+      MaybeFinish();
+    }
+
+    void OnWrite(bool ok) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      writing_ = false;
+      if (!ok) {
+        // The client is gone; drop what is queued and unblock the read.
+        broken_ = true;
+        queued_ = 0;
+        ctx_.TryCancel();
+      } else {
+        head_ = (head_ + 1) % kWindow;
+        --queued_;
+        StartRead();
+      }
+      StartWrite();
+      MaybeFinish();
+    }
+
+    void OnFinish(bool) { delete this; }
+
+    void StartRead() {
+      if (reading_ || reads_done_ || broken_ || queued_ == kWindow)
+        return;
+      reading_ = true;
+      stream_.Read(&request_, &read_tag_);
+    }
+
+    void StartWrite() {
+      if (writing_ || broken_ || queued_ == 0)
+        return;
+      writing_ = true;
+      stream_.Write(window_[head_], &write_tag_);
+    }
+
+    // Finishes once reads are over and every response has been written,
+    // or once a write failed and nothing is outstanding.
+    void MaybeFinish() {
+      if (finishing_ || reading_ || writing_ || (queued_ > 0 && !broken_))
+        return;
+      if (!reads_done_ && !broken_)
+        return;
+      finishing_ = true;
+      stream_.Finish(Status::OK, &finish_tag_);
+    }
+
+    void Execute(const kvstore::PipelineRequest &request,
+                 kvstore::PipelineResponse &response) {
+      MetricsClock::time_point start;
+      if (server_->collect_metrics_)
+        start = MetricsClock::now();
+      StorePtr &store = server_->store_;
+      response.Clear();
+      response.set_tag(request.tag());
+      switch (request.op_case()) {
+      case kvstore::PipelineRequest::kGet: {
+        GetResponse *get = response.mutable_get();
+        if (server_->Syncing())
+          get->set_error(kSyncingError);
+        else
+          GuardStore(get, [&]() {
+            get->set_found(
+                store->get(request.get().key(), *get->mutable_value()));
+          });
+        break;
+      }
+      case kvstore::PipelineRequest::kPut:
+        if (server_->replica_)
+          response.mutable_put()->set_error(kReadOnlyError);
+        else
+          ApplyPut(*store, request.put(), response.mutable_put());
+        break;
+      case kvstore::PipelineRequest::kDel:
+        if (server_->replica_)
+          response.mutable_del()->set_error(kReadOnlyError);
+        else
+          GuardStore(response.mutable_del(), [&]() {
+            response.mutable_del()->set_success(
+                store->remove(request.del().key()));
+          });
+        break;
+      default:
+        response.set_error("request has no operation");
+        break;
+      }
+      // Pipeline samples cover executing the op, not writing its response.
+      server_->Record(Rpc::kPipeline, start, request, response,
+                      !response.error().empty() ||
+                          !response.get().error().empty() ||
+                          !response.put().error().empty() ||
+                          !response.del().error().empty());
+    }
+
+    AsyncKVServer *server_;
     ServerCompletionQueue *cq_;
     ServerContext ctx_;
-    DeleteRequest request_;
-    DeleteResponse response_;
-    ServerAsyncResponseWriter<DeleteResponse> responder_;
-    SkipListPtr &store_;
+    grpc::ServerAsyncReaderWriter<kvstore::PipelineResponse,
+                                  kvstore::PipelineRequest>
+        stream_;
+    Tag connect_tag_, read_tag_, write_tag_, finish_tag_;
+
+    std::mutex mutex_;
+    kvstore::PipelineRequest request_;
+    kvstore::PipelineResponse window_[kWindow];
+    size_t head_ = 0;   // next response to write
+    size_t queued_ = 0; // responses waiting to be written, from head_
+    bool reading_ = false;
+    bool writing_ = false;
+    bool reads_done_ = false;
+    bool broken_ = false;
+    bool finishing_ = false;
+  };
+
+  // CallData pools for one completion queue.
+  struct CallDataPools {
+    PutCallData::Pool put;
+    GetCallData::Pool get;
+    DeleteCallData::Pool del;
+    MultiGetCallData::Pool multi_get;
+    MultiPutCallData::Pool multi_put;
+    MultiDeleteCallData::Pool multi_del;
+    StatsCallData::Pool stats;
+  };
+
+  // A CQ's pools, built by whichever of its threads gets there first so
+  // their memory is local to the CQ's threads.
+  struct LazyPools {
+    std::once_flag once;
+    std::unique_ptr<CallDataPools> pools;
   };
 
-  void HandleRpcs(ServerCompletionQueue *cq) {
+  CallDataPools *PoolsFor(size_t index) {
+    LazyPools &lazy = *pools_[index];
+    std::call_once(lazy.once, [&]() {
+      if (pool_calls_)
+        lazy.pools = std::make_unique<CallDataPools>();
+    });
+    return lazy.pools.get();
+  }
+
+  // Pins the calling CQ thread; a failure is reported and the thread runs
+  // unpinned.
+  static void Place(const std::vector<int> &cpus, bool numa_local) {
+    if (cpus.empty())
+      return;
+    if (!kvstore::pinThisThread(cpus)) {
+      std::cerr << "Failed to pin CQ thread to CPU " << cpus[0] << ": "
+                << std::strerror(errno) << std::endl;
+      return;
+    }
+    static const kvstore::CpuTopology machine =
+        kvstore::CpuTopology::detect();
+    int node = machine.nodeOf(cpus[0]);
+    if (numa_local && node >= 0 && !kvstore::preferNode(node))
+      std::cerr << "Failed to prefer NUMA node " << node << ": "
+                << std::strerror(errno) << std::endl;
+  }
+
+  void HandleRpcs(size_t index, ServerCompletionQueue *cq,
+                  CallDataPools *pools) {
+    if (collect_metrics_)
+      metrics_.attach(static_cast<int>(index));
     // One of each to start
-    new PutCallData(&service_, cq, store_);
-    new GetCallData(&service_, cq, store_);
-    new DeleteCallData(&service_, cq, store_);
+    PutCallData::Spawn(this, cq, pools ? &pools->put : nullptr);
+    GetCallData::Spawn(this, cq, pools ? &pools->get : nullptr);
+    DeleteCallData::Spawn(this, cq, pools ? &pools->del : nullptr);
+    MultiGetCallData::Spawn(this, cq, pools ? &pools->multi_get : nullptr);
+    MultiPutCallData::Spawn(this, cq, pools ? &pools->multi_put : nullptr);
+    MultiDeleteCallData::Spawn(this, cq,
+                               pools ? &pools->multi_del : nullptr);
+    StatsCallData::Spawn(this, cq, pools ? &pools->stats : nullptr);
+    PipelineCallData::Spawn(this, cq);
+    ScanCallData::Spawn(this, cq);
+    PutStreamCallData::Spawn(this, cq);
+    GetStreamCallData::Spawn(this, cq);
+    ReplicateCallData::Spawn(this, cq);
     void *tag;
     bool ok;
     while (cq->Next(&tag, &ok)) {
@@ -222,11 +1782,23 @@ private:
 
   // Members
   std::string address_;
-  SkipListPtr store_;
-  KeyValueStore::AsyncService service_;
+  StorePtr store_;
+  Service service_;
   std::vector<std::unique_ptr<ServerCompletionQueue>> cqs_;
+  std::vector<std::unique_ptr<LazyPools>> pools_;
   std::vector<std::thread> threads_;
   std::unique_ptr<Server> server_;
+  bool pool_calls_;
+  bool collect_metrics_;
+  kvstore::ServerMetrics metrics_;
+  std::unique_ptr<kvstore::StageTracer> tracer_;
+  std::shared_ptr<kvstore::ChangeLogMap> primary_;
+  std::shared_ptr<kvstore::Replica> replica_;
+  std::shared_ptr<kvstore::CompressingMap> compression_;
+  std::shared_ptr<kvstore::ChunkedValueMap> large_values_;
+  std::atomic<bool> shutting_down_{false};
+  // Orders Shutdown() against Run() building server_ and cqs_.
+  std::mutex start_mu_;
 };
 
 #endif // SERVER_IMPL_H
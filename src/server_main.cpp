@@ -1,7 +1,312 @@
+#include "compression/CompressingMap.h"
+#include "map/EvictingMap.h"
+#include "map/ExpiringMap.h"
+#include "map/MapFactory.h"
+#include "metrics/MetricsHttpEndpoint.h"
 #include "server_impl.h"
+#include "storage/Checkpointer.h"
+#include "storage/ChunkedValueMap.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <sstream>
 
-int main() {
-  AsyncKVServer server("0.0.0.0:50051");
-  server.Run();
+int main(int argc, char **argv) {
+  // --config=<path> selects the runtime config (default runtime_config.json
+  // in the working directory); --engine=<map_type> overrides its map_type so
+  // engines can be A/B tested without editing the file. --address,
+  // --role and --primary override the listening address and replication
+  // settings, so a primary and a replica can share one config file.
+  std::string config_path = "runtime_config.json";
+  std::string engine, address, role, primary;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--config=", 9) == 0)
+      config_path = argv[i] + 9;
+    else if (std::strncmp(argv[i], "--engine=", 9) == 0)
+      engine = argv[i] + 9;
+    else if (std::strncmp(argv[i], "--address=", 10) == 0)
+      address = argv[i] + 10;
+    else if (std::strncmp(argv[i], "--role=", 7) == 0)
+      role = argv[i] + 7;
+    else if (std::strncmp(argv[i], "--primary=", 10) == 0)
+      primary = argv[i] + 10;
+  }
+
+  std::ifstream config_file(config_path);
+  if (!config_file.is_open()) {
+    std::cerr << "Failed to open " << config_path << std::endl;
+    return 1;
+  }
+  nlohmann::json config = nlohmann::json::parse(config_file);
+  if (!engine.empty())
+    config["map_type"] = engine;
+  if (!address.empty())
+    config["address"] = address;
+  if (!role.empty())
+    config["replication"]["role"] = role;
+  if (!primary.empty())
+    config["replication"]["primary"] = primary;
+
+  // "slab" (default) packs records into size-class arena pages; "malloc"
+  // gives every record its own heap allocation.
+  kvstore::SlabAllocator::setEnabled(
+      config.value("record_allocator", "slab") == "slab");
+
+  AsyncKVServer::StorePtr store;
+  try {
+    store = kvstore::MapFactory<std::string, std::string>::createConcurrentMap(
+        config);
+  } catch (const std::exception &e) {
+    std::cerr << "Failed to create store: " << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << "Using " << config["map_type"].get<std::string>() << " engine"
+            << std::endl;
+
+  // Optional cache mode: bound the engine's memory by evicting keys. This
+  // sits below the write-ahead log, so evictions are not logged; recovery
+  // replays every write and evicts again as the store fills up.
+  nlohmann::json cache_config = config.value("cache", nlohmann::json::object());
+  size_t maxmemory_mb = cache_config.value("maxmemory_mb", 0);
+  if (maxmemory_mb > 0) {
+    kvstore::EvictingMap::Options options;
+    options.max_bytes = maxmemory_mb << 20;
+    options.shards = cache_config.value("shards", options.shards);
+    try {
+      options.policy = kvstore::EvictingMap::parsePolicy(
+          cache_config.value("eviction_policy", "s3fifo"));
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    store = std::make_shared<kvstore::EvictingMap>(store, options);
+    std::cout << "Cache mode: evicting above " << maxmemory_mb << " MB"
+              << std::endl;
+  }
+
+  // Optional write-ahead log and snapshots: load the latest snapshot and
+  // replay the log written since into the fresh store, then log every write
+  // from here on. The lsm engine logs each memtable itself and keeps its
+  // data in tables on disk, so it needs neither.
+  nlohmann::json wal_config = config.value("wal", nlohmann::json::object());
+  nlohmann::json snapshot_config =
+      config.value("snapshot", nlohmann::json::object());
+  std::unique_ptr<kvstore::Checkpointer> checkpointer;
+  if (config["map_type"] != "lsm") {
+    try {
+      kvstore::Checkpointer::Options options;
+      options.wal.durability = kvstore::WriteAheadLog::parseDurability(
+          wal_config.value("durability", "none"));
+      options.wal.batch_window =
+          std::chrono::microseconds(wal_config.value("batch_window_us", 0));
+      options.wal.max_batch_bytes =
+          wal_config.value("max_batch_bytes", options.wal.max_batch_bytes);
+      options.wal_path = wal_config.value("path", options.wal_path);
+      options.snapshot_path =
+          snapshot_config.value("path", options.snapshot_path);
+      options.interval =
+          std::chrono::seconds(snapshot_config.value("interval_s", 0));
+      options.load_threads =
+          snapshot_config.value("load_threads", options.load_threads);
+      checkpointer = std::make_unique<kvstore::Checkpointer>(store, options);
+      const auto &stats = checkpointer->recoveryStats();
+      std::cout << "Loaded " << stats.snapshot_entries << " entries from "
+                << options.snapshot_path << " in "
+                << stats.snapshot_load_secs << "s, replayed "
+                << stats.wal_records << " log records in "
+                << stats.wal_replay_secs << "s" << std::endl;
+      store = checkpointer->store();
+    } catch (const std::exception &e) {
+      std::cerr << "Failed to recover store: " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // Optional replication, below the TTL layer like the write-ahead log. A
+  // primary logs every write for its replicas to stream; a replica follows
+  // its primary into this store and refuses writes from clients.
+  nlohmann::json replication_config =
+      config.value("replication", nlohmann::json::object());
+  std::string replication_role = replication_config.value("role", "none");
+  std::shared_ptr<kvstore::ChangeLogMap> change_log;
+  std::shared_ptr<kvstore::Replica> replica;
+  if (replication_role == "primary") {
+    size_t log_mb = replication_config.value("log_mb", 64);
+    change_log = std::make_shared<kvstore::ChangeLogMap>(
+        store, std::make_shared<kvstore::ChangeLog>(log_mb << 20));
+    store = change_log;
+    std::cout << "Primary: keeping " << log_mb << " MB of change log"
+              << std::endl;
+  } else if (replication_role == "replica") {
+    kvstore::Replica::Options options;
+    options.primary = replication_config.value("primary", options.primary);
+    options.retry_delay = std::chrono::milliseconds(replication_config.value(
+        "retry_ms", options.retry_delay.count()));
+    replica = std::make_shared<kvstore::Replica>(store, options);
+    std::cout << "Replica of " << options.primary << std::endl;
+  } else if (replication_role != "none") {
+    std::cerr << "Unknown replication role '" << replication_role << "'"
+              << std::endl;
+    return 1;
+  }
+
+  // Optional per-key TTLs, layered over the (durable) store so deadlines
+  // are logged with the values.
+  nlohmann::json ttl_config = config.value("ttl", nlohmann::json::object());
+  if (ttl_config.value("enabled", false)) {
+    kvstore::ExpiringMap::Options options;
+    options.tick = std::chrono::milliseconds(
+        ttl_config.value("tick_ms", options.tick.count()));
+    options.wheel_shards =
+        ttl_config.value("wheel_shards", options.wheel_shards);
+    options.max_expired_per_slice = ttl_config.value(
+        "max_expired_per_slice", options.max_expired_per_slice);
+    options.slice_pause = std::chrono::microseconds(
+        ttl_config.value("slice_pause_us", options.slice_pause.count()));
+    // Eviction may drop the format marker along with any other key.
+    options.verify_format = maxmemory_mb == 0;
+    store = std::make_shared<kvstore::ExpiringMap>(store, options);
+  }
+
+  // Optional value compression, outermost so every layer below (TTL
+  // headers aside) holds compressed values, and Get can hand them out
+  // without decompressing.
+  nlohmann::json compression_config =
+      config.value("compression", nlohmann::json::object());
+  std::shared_ptr<kvstore::CompressingMap> compression;
+  try {
+    kvstore::ValueCodec::Options options;
+    options.codec = kvstore::ValueCodec::parseCodec(
+        compression_config.value("codec", "none"));
+    options.min_bytes =
+        compression_config.value("min_bytes", options.min_bytes);
+    options.zstd_level =
+        compression_config.value("zstd_level", options.zstd_level);
+    std::string dictionary_path =
+        compression_config.value("zstd_dictionary", "");
+    if (!dictionary_path.empty()) {
+      std::ifstream dictionary(dictionary_path, std::ios::binary);
+      if (!dictionary.is_open())
+        throw std::runtime_error("can't open " + dictionary_path);
+      options.dictionary.assign(std::istreambuf_iterator<char>(dictionary),
+                                std::istreambuf_iterator<char>());
+    }
+    if (options.codec != kvstore::Codec::kNone) {
+      compression = std::make_shared<kvstore::CompressingMap>(store, options);
+      store = compression;
+      std::cout << "Compressing values of " << options.min_bytes
+                << " bytes and up with "
+                << kvstore::codecName(compression->codec().codec())
+                << std::endl;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Bad compression config: " << e.what() << std::endl;
+    return 1;
+  }
+
+  // Chunked storage for PutStream and GetStream, outermost so chunks are
+  // compressed, logged and replicated like any other value.
+  nlohmann::json large_values_config =
+      config.value("large_values", nlohmann::json::object());
+  std::shared_ptr<kvstore::ChunkedValueMap> large_values;
+  if (large_values_config.value("enabled", false)) {
+    kvstore::ChunkedValueMap::Options options;
+    options.external_writes = replica != nullptr;
+    options.chunk_bytes =
+        large_values_config.value("chunk_kb", options.chunk_bytes >> 10)
+        << 10;
+    if (options.chunk_bytes == 0) {
+      std::cerr << "large_values.chunk_kb must be positive" << std::endl;
+      return 1;
+    }
+    options.max_assembled_bytes =
+        large_values_config.value("max_get_kb",
+                                  options.max_assembled_bytes >> 10)
+        << 10;
+    large_values = std::make_shared<kvstore::ChunkedValueMap>(store, options);
+    store = large_values;
+  }
+
+  nlohmann::json metrics_config =
+      config.value("metrics", nlohmann::json::object());
+  AsyncKVServer server(config.value("address", "0.0.0.0:50051"), store,
+                       config.value("pool_call_data", true),
+                       metrics_config.value("enabled", true));
+  if (change_log)
+    server.EnableReplication(change_log);
+  if (compression)
+    server.EnableCompression(compression);
+  if (large_values)
+    server.EnableLargeValues(large_values);
+  if (replica) {
+    server.ServeAsReplica(replica);
+    replica->start();
+  }
+  nlohmann::json tracing_config =
+      config.value("tracing", nlohmann::json::object());
+  uint32_t sample_every = tracing_config.value("sample_every", 0);
+  if (sample_every > 0)
+    server.EnableTracing(sample_every,
+                         tracing_config.value("ring_size", 4096));
+
+  // Optional HTTP endpoint: /metrics for Prometheus scrapes (the same
+  // metrics as the Stats RPC) and /trace for the sampled stage traces.
+  std::unique_ptr<kvstore::MetricsHttpEndpoint> metrics_endpoint;
+  int metrics_port = metrics_config.value("http_port", 0);
+  if (metrics_port > 0) {
+    kvstore::MetricsHttpEndpoint::Routes routes;
+    routes["/metrics"] = {"text/plain; version=0.0.4",
+                          [&server]() { return server.MetricsText(); }};
+    routes["/trace"] = {"application/json", [&server]() {
+                          std::ostringstream out;
+                          server.DumpTrace(out);
+                          return out.str();
+                        }};
+    try {
+      metrics_endpoint = std::make_unique<kvstore::MetricsHttpEndpoint>(
+          static_cast<uint16_t>(metrics_port), std::move(routes));
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    std::cout << "Metrics on http://0.0.0.0:" << metrics_port << "/metrics"
+              << std::endl;
+  }
+  // CQ thread layout. "pin" is "none" (the OS schedules the threads),
+  // "auto" (one CPU per thread, each CQ's threads on one NUMA node) or
+  // "explicit" (a CPU list such as "0-3" per thread in "cpus").
+  nlohmann::json topology_config =
+      config.value("topology", nlohmann::json::object());
+  AsyncKVServer::Topology topology;
+  topology.num_cqs = topology_config.value("num_cqs", topology.num_cqs);
+  topology.threads_per_cq =
+      topology_config.value("threads_per_cq", topology.threads_per_cq);
+  topology.numa_local =
+      topology_config.value("numa_local", topology.numa_local);
+  std::string pin = topology_config.value("pin", "none");
+  try {
+    if (topology.num_cqs < 1 || topology.threads_per_cq < 1)
+      throw std::invalid_argument("need at least one CQ and one thread");
+    if (pin == "auto") {
+      topology.thread_cpus = kvstore::CpuTopology::detect().spread(
+          topology.num_cqs, topology.threads_per_cq);
+    } else if (pin == "explicit") {
+      for (const auto &cpus : topology_config.value(
+               "cpus", std::vector<std::string>{}))
+        topology.thread_cpus.push_back(kvstore::parseCpuList(cpus));
+    } else if (pin != "none") {
+      throw std::invalid_argument("unknown pin mode '" + pin + "'");
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Bad topology: " << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << topology.num_cqs << " CQs x " << topology.threads_per_cq
+            << " threads, pinning " << pin
+            << (topology.numa_local ? ", NUMA-local" : "") << std::endl;
+  server.Run(topology);
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "DurableMap.h"
+#include "SnapshotFile.h"
+#include "WriteAheadLog.h"
+#include "map/IConcurrentMap.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Owns a store's persistence: recovers it at startup from the latest
+// snapshot plus the log written since, and takes background snapshots so
+// the log never has to be replayed from the beginning of time.
+//
+// The log is split into numbered segments `<wal path>.<generation>`. A
+// snapshot of generation G rotates the log to segment G + 1 while every
+// DurableMap stripe is held, so each record in segments <= G is already
+// applied to the engine when the scan starts. The scan itself runs without
+// blocking writers and may also see later writes; replaying segment G + 1
+// onwards on top of it converges to the same state, because replay applies
+// the last write of every key it touches. Once the snapshot is published,
+// segments <= G are deleted.
+class Checkpointer {
+public:
+  struct Options {
+    std::string snapshot_path = "kvstore.snap";
+    std::string wal_path = "kvstore.wal";
+    // Durability::kNone runs without a log; snapshots then capture the
+    // store as of the last snapshot only.
+    WriteAheadLog::Options wal;
+    // Zero disables background snapshots (snapshotNow() still works).
+    std::chrono::seconds interval{0};
+    size_t load_threads = 4;
+  };
+
+  struct RecoveryStats {
+    uint64_t snapshot_entries = 0;
+    size_t wal_records = 0;
+    double snapshot_load_secs = 0;
+    double wal_replay_secs = 0;
+  };
+
+  Checkpointer(std::shared_ptr<IConcurrentMap> engine, Options options)
+      : engine_(std::move(engine)), options_(std::move(options)) {
+    recover();
+    store_ = engine_;
+    if (options_.wal.durability != WriteAheadLog::Durability::kNone) {
+      durable_ = std::make_shared<DurableMap>(
+          engine_, std::make_shared<WriteAheadLog>(segmentPath(generation_),
+                                                   options_.wal));
+      store_ = durable_;
+    }
+    if (options_.interval.count() > 0)
+      thread_ = std::thread([this]() { snapshotLoop(); });
+  }
+
+  Checkpointer(const Checkpointer &) = delete;
+  Checkpointer &operator=(const Checkpointer &) = delete;
+
+  ~Checkpointer() {
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex_);
+      stopping_ = true;
+    }
+    stop_cv_.notify_one();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  // The store to serve from: the engine, wrapped in a DurableMap when the
+  // log is enabled.
+  std::shared_ptr<IConcurrentMap> store() const { return store_; }
+
+  const RecoveryStats &recoveryStats() const { return recovery_; }
+
+  // Writes a snapshot now and drops the log segments it covers. Returns the
+  // number of entries written.
+  uint64_t snapshotNow() {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    uint64_t covered = generation_;
+    if (durable_)
+      durable_->rotateLog(segmentPath(covered + 1));
+    generation_ = covered + 1;
+    uint64_t entries =
+        SnapshotWriter::writeFrom(*engine_, options_.snapshot_path, covered);
+    removeSegments(covered);
+    return entries;
+  }
+
+  std::string segmentPath(uint64_t generation) const {
+    return options_.wal_path + "." + std::to_string(generation);
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  void recover() {
+    uint64_t covered = 0;
+    auto start = Clock::now();
+    if (std::filesystem::exists(options_.snapshot_path)) {
+      SnapshotReader snapshot(options_.snapshot_path);
+      snapshot.loadInto(*engine_, options_.load_threads);
+      covered = snapshot.generation();
+      recovery_.snapshot_entries = snapshot.entries();
+    }
+    recovery_.snapshot_load_secs = secondsSince(start);
+
+    start = Clock::now();
+    generation_ = covered + 1;
+    for (uint64_t segment : listSegments()) {
+      if (segment <= covered)
+        continue;
+      recovery_.wal_records += DurableMap::recover(segmentPath(segment),
+                                                   *engine_);
+      generation_ = std::max(generation_, segment + 1);
+    }
+    recovery_.wal_replay_secs = secondsSince(start);
+    removeSegments(covered);
+  }
+
+  // Generations of the log segments on disk, in ascending order.
+  std::vector<uint64_t> listSegments() const {
+    std::filesystem::path wal(options_.wal_path);
+    std::filesystem::path dir =
+        wal.has_parent_path() ? wal.parent_path() : ".";
+    std::string prefix = wal.filename().string() + ".";
+    std::vector<uint64_t> segments;
+    if (!std::filesystem::is_directory(dir))
+      return segments;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+      std::string name = entry.path().filename().string();
+      if (name.size() <= prefix.size() || name.compare(0, prefix.size(),
+                                                       prefix) != 0)
+        continue;
+      std::string suffix = name.substr(prefix.size());
+      if (suffix.find_first_not_of("0123456789") != std::string::npos)
+        continue;
+      segments.push_back(std::stoull(suffix));
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+  }
+
+  void removeSegments(uint64_t up_to) const {
+    for (uint64_t segment : listSegments())
+      if (segment <= up_to)
+        std::filesystem::remove(segmentPath(segment));
+  }
+
+  void snapshotLoop() {
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    while (!stop_cv_.wait_for(lock, options_.interval,
+                              [&]() { return stopping_; })) {
+      lock.unlock();
+      try {
+        snapshotNow();
+      } catch (const std::exception &e) {
+        // The log still holds everything; try again next interval.
+        std::cerr << "Snapshot failed: " << e.what() << std::endl;
+      }
+      lock.lock();
+    }
+  }
+
+  std::shared_ptr<IConcurrentMap> engine_;
+  Options options_;
+  std::shared_ptr<DurableMap> durable_;
+  std::shared_ptr<IConcurrentMap> store_;
+  RecoveryStats recovery_;
+  std::mutex snapshot_mutex_;
+  uint64_t generation_ = 1; // segment currently being written
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+} // namespace kvstore
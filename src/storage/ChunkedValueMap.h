@@ -0,0 +1,439 @@
+#pragma once
+
+#include "map/IConcurrentMap.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Stores values too large for one message as a series of chunks, so they
+// can be written and read a piece at a time (PutStream and GetStream)
+// without the server ever holding one contiguous copy.
+//
+// A chunked value is kept in the engine as ordinary entries under a
+// reserved key prefix: a manifest naming the value's generation, size and
+// chunk count, and the chunks after it, so the layers below (log,
+// snapshots, change log) carry it like any other write. Nothing is stored
+// under the key itself. Once a chunked value may exist, get() on a missing
+// key therefore costs a second lookup for the manifest, and on a hit
+// assembles the value; until then a miss is a single lookup. A value that
+// fits in one chunk is stored under its key as usual.
+//
+// Each streamed write uses a fresh generation and only becomes visible
+// when its manifest is written, which also retires the generation it
+// replaces; a stream cut off earlier removes its chunks (a crash leaves
+// them behind). A write, a delete and a commit of the same key serialize
+// on a lock stripe. Until the first chunked value exists, writes skip the
+// manifest checks altogether.
+//
+// Chunked values are left out of scan() and forEach(), and size() counts
+// each manifest and chunk as a key. Keys starting with kReservedPrefix are
+// reserved: reads don't find them and writes throw std::invalid_argument.
+// get() and getRecord() throw std::length_error for a chunked value
+// larger than max_assembled_bytes.
+class ChunkedValueMap : public IConcurrentMap {
+public:
+  static constexpr std::string_view kReservedPrefix{"\xff\xff" "chunked\0",
+                                                    10};
+
+  struct Options {
+    size_t chunk_bytes = size_t{1} << 20;
+    // Largest chunked value get() and getRecord() assemble whole; past it
+    // they throw std::length_error and the value can only be read a chunk
+    // at a time. gRPC clients accept 4 MB messages by default.
+    size_t max_assembled_bytes = size_t{4} << 20;
+    // Set when chunked values can reach the store without passing through
+    // this layer (e.g. a replica's stream), so reads always look for a
+    // manifest.
+    bool external_writes = false;
+  };
+
+  // Where a value is and how to read it.
+  struct Manifest {
+    uint64_t generation = 0;
+    uint64_t size = 0;
+    uint32_t chunks = 0; // 0: stored whole under its key
+  };
+
+  // Writes one value a piece at a time. Nothing is visible until commit();
+  // a writer destroyed without committing removes what it wrote.
+  class Writer {
+  public:
+    Writer(ChunkedValueMap &map, std::string_view key)
+        : map_(map), key_(key), generation_(map.nextGeneration()) {}
+
+    ~Writer() {
+      if (!committed_)
+        for (uint32_t i = 0; i < chunks_; ++i)
+          map_.store_->remove(map_.chunkKey(key_, generation_, i));
+    }
+
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+
+    // Every chunk but the last is exactly chunk_bytes, whatever the
+    // pieces.
+    void append(std::string_view data) {
+      size_ += data.size();
+      const size_t chunk_bytes = map_.options_.chunk_bytes;
+      while (!data.empty()) {
+        // Whole chunks go straight to the engine, without buffering.
+        if (pending_.empty() && data.size() >= chunk_bytes) {
+          writeChunk(data.substr(0, chunk_bytes));
+          data.remove_prefix(chunk_bytes);
+          continue;
+        }
+        size_t take = std::min(chunk_bytes - pending_.size(), data.size());
+        pending_.append(data.data(), take);
+        data.remove_prefix(take);
+        if (pending_.size() == chunk_bytes) {
+          writeChunk(pending_);
+          pending_.clear();
+        }
+      }
+    }
+
+    uint64_t size() const { return size_; }
+
+    // Makes the value visible under the key, replacing any earlier one.
+    // Returns true if the key was new.
+    bool commit() {
+      committed_ = true;
+      if (chunks_ == 0)
+        return map_.put(key_, pending_);
+      if (!pending_.empty())
+        writeChunk(pending_);
+      return map_.commit(key_, {generation_, size_, chunks_});
+    }
+
+  private:
+    void writeChunk(std::string_view data) {
+      map_.store_->put(map_.chunkKey(key_, generation_, chunks_++), data);
+    }
+
+    ChunkedValueMap &map_;
+    std::string key_;
+    uint64_t generation_;
+    std::string pending_;
+    uint64_t size_ = 0;
+    uint32_t chunks_ = 0;
+    bool committed_ = false;
+  };
+
+  ChunkedValueMap(std::shared_ptr<IConcurrentMap> store, Options options)
+      : store_(std::move(store)), options_(options),
+        generation_(uint64_t{std::random_device{}()} << 32) {
+    // Chunked values written before a restart need the write-side checks.
+    auto found = [this](std::string_view key, std::string_view) {
+      if (!isReserved(key))
+        return true;
+      maybe_chunked_.store(true, std::memory_order_relaxed);
+      return false;
+    };
+    if (options_.external_writes)
+      maybe_chunked_.store(true, std::memory_order_relaxed);
+    else if (!store_->scan(kReservedPrefix, {}, kReservedPrefix, found))
+      store_->forEach(found);
+  }
+
+  static bool isReserved(std::string_view key) {
+    return key.substr(0, kReservedPrefix.size()) == kReservedPrefix;
+  }
+
+  std::unique_ptr<Writer> writer(std::string_view key) {
+    checkKey(key);
+    return std::make_unique<Writer>(*this, key);
+  }
+
+  size_t chunkBytes() const { return options_.chunk_bytes; }
+
+  // Looks key up without reading a chunked value. A value stored whole is
+  // copied to `whole`.
+  bool open(std::string_view key, Manifest &manifest,
+            std::string &whole) const {
+    if (isReserved(key))
+      return false;
+    if (store_->get(key, whole)) {
+      manifest = {0, whole.size(), 0};
+      return true;
+    }
+    return mayBeChunked() && readManifest(key, manifest);
+  }
+
+  // Replaces `chunk` with chunk `index` of an opened value. Returns false
+  // if that generation has since been replaced or deleted.
+  bool readChunk(std::string_view key, const Manifest &manifest,
+                 uint32_t index, std::string &chunk) const {
+    return store_->get(chunkKey(key, manifest.generation, index), chunk);
+  }
+
+  bool put(std::string_view key, std::string_view value) override {
+    checkKey(key);
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    return store_->put(key, value) && !dropChunked(key);
+  }
+
+  bool putExpiring(std::string_view key, std::string_view value,
+                   std::chrono::milliseconds ttl) override {
+    checkKey(key);
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    return store_->putExpiring(key, value, ttl) && !dropChunked(key);
+  }
+
+  bool expiresKeys() const override { return store_->expiresKeys(); }
+
+  bool get(std::string_view key, std::string &value) const override {
+    if (isReserved(key))
+      return false;
+    if (store_->get(key, value))
+      return true;
+    Manifest manifest;
+    if (!mayBeChunked() || !readManifest(key, manifest))
+      return false;
+    checkAssembledSize(manifest);
+    return assemble(key, manifest, value);
+  }
+
+  // A chunked value is assembled straight into a record of its own.
+  bool sharesRecords() const override { return store_->sharesRecords(); }
+  RecordPtr getRecord(std::string_view key) const override {
+    if (isReserved(key))
+      return nullptr;
+    if (RecordPtr record = store_->getRecord(key))
+      return record;
+    Manifest manifest;
+    if (!store_->sharesRecords() || !mayBeChunked() ||
+        !readManifest(key, manifest))
+      return nullptr;
+    checkAssembledSize(manifest);
+    const Record *record = Record::create(key, manifest.size, [&](char *out) {
+      thread_local std::string chunk;
+      uint64_t left = manifest.size;
+      for (uint32_t i = 0; i < manifest.chunks; ++i) {
+        if (!readChunk(key, manifest, i, chunk) || chunk.size() > left)
+          return false;
+        std::memcpy(out, chunk.data(), chunk.size());
+        out += chunk.size();
+        left -= chunk.size();
+      }
+      return left == 0;
+    });
+    return RecordPtr(record, false);
+  }
+
+  bool remove(std::string_view key) override {
+    checkKey(key);
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    bool removed = store_->remove(key);
+    return dropChunked(key) || removed;
+  }
+
+  size_t size() const override { return store_->size(); }
+
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    thread_local std::vector<bool> hit;
+    hit.assign(keys.size(), false);
+    store_->multiGet(keys, [&](size_t i, std::string_view value) {
+      hit[i] = true;
+      if (!isReserved(keys[i]))
+        found(i, value);
+    });
+    if (!mayBeChunked())
+      return;
+    std::string value;
+    for (size_t i = 0; i < keys.size(); ++i)
+      if (!hit[i] && get(keys[i], value))
+        found(i, value);
+  }
+
+  // Batches go to the engine whole until there are chunked values to
+  // replace.
+  size_t multiPut(const EntryList &entries) override {
+    for (const auto &entry : entries)
+      checkKey(entry.first);
+    if (!maybe_chunked_.load(std::memory_order_relaxed))
+      return store_->multiPut(entries);
+    return IConcurrentMap::multiPut(entries);
+  }
+
+  void multiRemove(const KeyList &keys, const IndexVisitor &removed) override {
+    for (std::string_view key : keys)
+      checkKey(key);
+    if (!maybe_chunked_.load(std::memory_order_relaxed))
+      store_->multiRemove(keys, removed);
+    else
+      IConcurrentMap::multiRemove(keys, removed);
+  }
+
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    return store_->scan(start, end, prefix, visible(visit));
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    store_->forEach(visible(visit));
+  }
+
+  void reserve(size_t count) override { store_->reserve(count); }
+
+private:
+  static constexpr size_t kStripes = 256;
+
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  // Checked before anything is written, so a batch is all or nothing.
+  static void checkKey(std::string_view key) {
+    if (isReserved(key))
+      throw std::invalid_argument(
+          "key uses the prefix reserved for chunked values");
+  }
+
+  void checkAssembledSize(const Manifest &manifest) const {
+    if (manifest.size > options_.max_assembled_bytes)
+      throw std::length_error(
+          "value is " + std::to_string(manifest.size) +
+          " bytes, over the " + std::to_string(options_.max_assembled_bytes) +
+          " byte limit for reading it whole; use GetStream");
+  }
+
+  // Pairs with the release store in commit(): a reader that missed a key
+  // being committed for the first time sees the flag set.
+  bool mayBeChunked() const {
+    return maybe_chunked_.load(std::memory_order_acquire);
+  }
+
+  static ScanVisitor visible(const ScanVisitor &visit) {
+    return [&visit](std::string_view key, std::string_view value) {
+      return isReserved(key) || visit(key, value);
+    };
+  }
+
+  static void appendVarint(std::string &out, uint64_t value) {
+    for (; value >= 0x80; value >>= 7)
+      out.push_back(static_cast<char>(value | 0x80));
+    out.push_back(static_cast<char>(value));
+  }
+
+  static bool readVarint(std::string_view &in, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift <= 63 && !in.empty(); shift += 7) {
+      uint8_t byte = static_cast<uint8_t>(in[0]);
+      in.remove_prefix(1);
+      value |= uint64_t{byte & 0x7fu} << shift;
+      if (byte < 0x80)
+        return true;
+    }
+    return false;
+  }
+
+  // Big-endian, so a value's chunks sort in order right after its
+  // manifest.
+  static void appendFixed(std::string &out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i)
+      out.push_back(static_cast<char>(value >> (8 * i)));
+  }
+
+  // The key's length comes first, so no key's entries can be mistaken for
+  // another's.
+  static std::string manifestKey(std::string_view key) {
+    std::string out(kReservedPrefix);
+    appendVarint(out, key.size());
+    out.append(key.data(), key.size());
+    return out;
+  }
+
+  static std::string chunkKey(std::string_view key, uint64_t generation,
+                              uint32_t index) {
+    std::string out = manifestKey(key);
+    appendFixed(out, generation, 8);
+    appendFixed(out, index, 4);
+    return out;
+  }
+
+  uint64_t nextGeneration() {
+    return generation_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  bool readManifest(std::string_view key, Manifest &manifest) const {
+    std::string stored;
+    if (!store_->get(manifestKey(key), stored))
+      return false;
+    std::string_view in = stored;
+    uint64_t chunks;
+    return readVarint(in, manifest.generation) &&
+           readVarint(in, manifest.size) && readVarint(in, chunks) &&
+           (manifest.chunks = static_cast<uint32_t>(chunks), true);
+  }
+
+  bool assemble(std::string_view key, const Manifest &manifest,
+                std::string &value) const {
+    thread_local std::string chunk;
+    value.clear();
+    value.reserve(manifest.size);
+    for (uint32_t i = 0; i < manifest.chunks; ++i) {
+      if (!readChunk(key, manifest, i, chunk))
+        return false;
+      value.append(chunk);
+    }
+    return true;
+  }
+
+  bool commit(std::string_view key, const Manifest &manifest) {
+    std::string stored;
+    appendVarint(stored, manifest.generation);
+    appendVarint(stored, manifest.size);
+    appendVarint(stored, manifest.chunks);
+    std::lock_guard<std::mutex> lock(stripeFor(key));
+    maybe_chunked_.store(true, std::memory_order_release);
+    Manifest old;
+    bool replaced = readManifest(key, old);
+    store_->put(manifestKey(key), stored);
+    replaced = store_->remove(key) || replaced;
+    if (replaced && old.chunks > 0)
+      removeChunks(key, old);
+    return !replaced;
+  }
+
+  // Removes the chunked value at key, if any. Call under its stripe.
+  bool dropChunked(std::string_view key) {
+    Manifest manifest;
+    if (!maybe_chunked_.load(std::memory_order_relaxed) ||
+        !readManifest(key, manifest))
+      return false;
+    store_->remove(manifestKey(key));
+    removeChunks(key, manifest);
+    return true;
+  }
+
+  void removeChunks(std::string_view key, const Manifest &manifest) {
+    for (uint32_t i = 0; i < manifest.chunks; ++i)
+      store_->remove(chunkKey(key, manifest.generation, i));
+  }
+
+  std::mutex &stripeFor(std::string_view key) {
+    return stripes_[std::hash<std::string_view>{}(key) % kStripes].mutex;
+  }
+
+  std::shared_ptr<IConcurrentMap> store_;
+  const Options options_;
+  std::atomic<uint64_t> generation_;
+  std::atomic<bool> maybe_chunked_{false};
+  std::array<Stripe, kStripes> stripes_;
+};
+
+} // namespace kvstore
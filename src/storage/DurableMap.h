@@ -0,0 +1,150 @@
+#pragma once
+
+#include "WriteAheadLog.h"
+#include "map/IConcurrentMap.h"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Makes an in-memory engine durable by logging every Put and Delete to a
+// WriteAheadLog before acknowledging it. A key's log append and its apply
+// to the engine happen under one lock stripe, so the log and the engine
+// agree on the order of writes to the same key; writes to different keys
+// proceed in parallel. The wait for durability happens outside the stripe,
+// which is what lets concurrent writers share a group commit. Reads go
+// straight to the engine.
+class DurableMap : public IConcurrentMap {
+public:
+  DurableMap(std::shared_ptr<IConcurrentMap> store,
+             std::shared_ptr<WriteAheadLog> wal)
+      : store_(std::move(store)), wal_(std::move(wal)) {}
+
+  // Replays the log at `path` into `store`. Call before opening a
+  // WriteAheadLog on the same path.
+  static size_t recover(const std::string &path, IConcurrentMap &store) {
+    return WriteAheadLog::replay(
+        path, [&](WriteAheadLog::Op op, std::string_view key,
+                  std::string_view value) {
+          if (op == WriteAheadLog::Op::kPut)
+            store.put(key, value);
+          else
+            store.remove(key);
+        });
+  }
+
+  bool put(std::string_view key, std::string_view value) override {
+    uint64_t seq;
+    bool inserted;
+    {
+      std::lock_guard<std::mutex> lock(stripeFor(key));
+      seq = wal_->appendPut(key, value);
+      inserted = store_->put(key, value);
+    }
+    wal_->waitDurable(seq);
+    return inserted;
+  }
+
+  bool get(std::string_view key, std::string &value) const override {
+    return store_->get(key, value);
+  }
+
+  bool sharesRecords() const override { return store_->sharesRecords(); }
+  RecordPtr getRecord(std::string_view key) const override {
+    return store_->getRecord(key);
+  }
+
+  bool remove(std::string_view key) override {
+    uint64_t seq;
+    bool removed;
+    {
+      std::lock_guard<std::mutex> lock(stripeFor(key));
+      seq = wal_->appendDelete(key);
+      removed = store_->remove(key);
+    }
+    wal_->waitDurable(seq);
+    return removed;
+  }
+
+  size_t size() const override { return store_->size(); }
+
+  void multiGet(const KeyList &keys, const ValueVisitor &found) const override {
+    store_->multiGet(keys, found);
+  }
+
+  // Batches log and apply key by key, then wait once for the whole batch.
+  size_t multiPut(const EntryList &entries) override {
+    uint64_t last = 0;
+    size_t inserted = 0;
+    for (const auto &[key, value] : entries) {
+      std::lock_guard<std::mutex> lock(stripeFor(key));
+      last = wal_->appendPut(key, value);
+      inserted += store_->put(key, value);
+    }
+    wal_->waitDurable(last);
+    return inserted;
+  }
+
+  void multiRemove(const KeyList &keys, const IndexVisitor &removed) override {
+    uint64_t last = 0;
+    std::vector<size_t> hits;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      std::lock_guard<std::mutex> lock(stripeFor(keys[i]));
+      last = wal_->appendDelete(keys[i]);
+      if (store_->remove(keys[i]))
+        hits.push_back(i);
+    }
+    wal_->waitDurable(last);
+    // Reported only once the deletes are durable.
+    for (size_t i : hits)
+      removed(i);
+  }
+
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    return store_->scan(start, end, prefix, visit);
+  }
+
+  void forEach(const ScanVisitor &visit) const override {
+    store_->forEach(visit);
+  }
+
+  void reserve(size_t count) override { store_->reserve(count); }
+
+  // Switches the log to a new file at `path`. Every stripe is held while
+  // switching, so each write is either logged to the old file and already
+  // applied to the engine, or logged to the new file.
+  void rotateLog(const std::string &path) {
+    std::array<std::unique_lock<std::mutex>, kStripes> locks;
+    for (size_t i = 0; i < kStripes; ++i)
+      locks[i] = std::unique_lock<std::mutex>(stripes_[i].mutex);
+    wal_->rotate(path);
+  }
+
+  const WriteAheadLog &wal() const { return *wal_; }
+
+private:
+  static constexpr size_t kStripes = 256;
+
+  // Padded to a cache line so neighbouring stripes don't false-share.
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  std::mutex &stripeFor(std::string_view key) {
+    return stripes_[std::hash<std::string_view>{}(key) % kStripes].mutex;
+  }
+
+  std::shared_ptr<IConcurrentMap> store_;
+  std::shared_ptr<WriteAheadLog> wal_;
+  std::array<Stripe, kStripes> stripes_;
+};
+
+} // namespace kvstore
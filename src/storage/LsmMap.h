@@ -0,0 +1,914 @@
+#pragma once
+
+#include "SSTable.h"
+#include "ThreadPool.h"
+#include "WriteAheadLog.h"
+#include "map/IConcurrentMap.h"
+#include "map/SkipListMap.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// Log-structured engine for datasets larger than memory. Writes go to a
+// SkipListMap memtable; once it holds memtable_bytes it is frozen and a
+// background job flushes it to an immutable SSTable in level 0. Level 0
+// tables may overlap and are searched newest first; levels 1 and up each
+// hold non-overlapping tables, with every level size_multiplier times
+// larger than the one above. Leveled compaction on its own thread pool
+// merges level 0 into level 1 once level 0 holds l0_compaction_trigger
+// tables, and a table of level N into N + 1 once level N outgrows its
+// budget.
+//
+// A Get checks the memtable, the frozen memtables waiting for flush and
+// the level 0 tables, then at most one table per deeper level, and each
+// table only if its key range and bloom filter allow. Writers are stalled
+// (rather than letting reads degrade) while too many memtables wait for
+// flush or level 0 reaches l0_stop_writes_trigger tables. If a flush or
+// compaction fails, writes that would stall behind it throw instead.
+//
+// Table files and a MANIFEST listing the live ones are kept in `dir`.
+// Unless wal.durability is kNone, every memtable also has its own
+// write-ahead log `<number>.log` there, deleted once the memtable's table
+// is in the MANIFEST; at startup the logs still present are replayed into
+// a level 0 table. Destroying the engine flushes it.
+//
+// put() and remove() never read before writing, so their return values
+// are not the IConcurrentMap answer: both always return true, whether or
+// not the key was in the store.
+class LsmMap : public IConcurrentMap {
+public:
+  struct Options {
+    std::string dir = "kvstore.lsm";
+    size_t memtable_bytes = 64 << 20;
+    size_t max_immutable_memtables = 2;
+    size_t l0_compaction_trigger = 4;
+    size_t l0_stop_writes_trigger = 12;
+    uint64_t base_level_bytes = 256ull << 20;
+    uint64_t size_multiplier = 10;
+    uint64_t target_table_bytes = 64ull << 20;
+    size_t block_size = 4096;
+    size_t bloom_bits_per_key = 10;
+    WriteAheadLog::Options wal{WriteAheadLog::Durability::kNone};
+  };
+
+  static constexpr size_t kLevels = 7;
+
+  // Filled by the instrumented get() overload.
+  struct ReadStats {
+    size_t tables_searched = 0; // passed key range and bloom filter
+    size_t bloom_skips = 0;     // in key range, rejected by the filter
+  };
+
+  struct Stats {
+    uint64_t flushes = 0;
+    uint64_t compactions = 0;
+    uint64_t compaction_bytes_written = 0;
+    std::array<size_t, kLevels> tables{};
+    std::array<uint64_t, kLevels> bytes{};
+  };
+
+  // Flushes and compactions run one at a time each, on their own worker.
+  explicit LsmMap(Options options) : options_(std::move(options)), pool_(2) {
+    std::filesystem::create_directories(options_.dir);
+    auto version = std::make_shared<Version>();
+    loadManifest(*version);
+    recoverLogs(*version);
+    std::lock_guard<std::mutex> lock(mutex_);
+    mem_ = newMemtable();
+    version->mem = mem_;
+    saveManifest(*version);
+    removeLogsBefore(mem_->log_number);
+    version_ = version;
+    scheduleWork();
+  }
+
+  LsmMap(const LsmMap &) = delete;
+  LsmMap &operator=(const LsmMap &) = delete;
+
+  // After a failed flush the unflushed memtables stay in their logs.
+  ~LsmMap() override {
+    try {
+      rotateMemtable(true);
+    } catch (const std::exception &e) {
+      std::cerr << "LSM final flush failed: " << e.what() << std::endl;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [&]() {
+      return !flush_running_ && (version_->immutable.empty() ||
+                                 !background_error_.empty());
+    });
+    closing_ = true; // no new compactions
+    idle_cv_.wait(lock, [&]() { return !compaction_running_; });
+  }
+
+  // Writes are blind: answering whether the key was new would cost a read
+  // per write, so put() always returns true.
+  bool put(std::string_view key, std::string_view value) override {
+    write(key, EntryType::kValue, value);
+    return true;
+  }
+
+  bool get(std::string_view key, std::string &value) const override {
+    return get(key, value, nullptr);
+  }
+
+  bool get(std::string_view key, std::string &value,
+           ReadStats *stats) const {
+    auto version = current();
+    EntryType type;
+    if (version->mem->get(key, value, type))
+      return type == EntryType::kValue;
+    for (const auto &mem : version->immutable)
+      if (mem->get(key, value, type))
+        return type == EntryType::kValue;
+
+    uint64_t hash = BloomFilter::hash(key);
+    auto search = [&](const SSTable &table, SSTable::Lookup &result) {
+      if (key < table.smallest() || key > table.largest())
+        return false;
+      if (!table.mayContain(key, hash)) {
+        if (stats)
+          ++stats->bloom_skips;
+        return false;
+      }
+      if (stats)
+        ++stats->tables_searched;
+      result = table.get(key, value);
+      return result != SSTable::Lookup::kNotFound;
+    };
+    SSTable::Lookup result;
+    for (const auto &table : version->levels[0])
+      if (search(*table, result))
+        return result == SSTable::Lookup::kFound;
+    for (size_t level = 1; level < kLevels; ++level) {
+      const auto &tables = version->levels[level];
+      auto it = std::lower_bound(
+          tables.begin(), tables.end(), key,
+          [](const TablePtr &t, std::string_view k) {
+            return t->largest() < k;
+          });
+      if (it != tables.end() && search(**it, result))
+        return result == SSTable::Lookup::kFound;
+    }
+    return false;
+  }
+
+  // Blind, like put(): writes a tombstone and always returns true.
+  bool remove(std::string_view key) override {
+    write(key, EntryType::kTombstone, {});
+    return true;
+  }
+
+  // Approximate: counts every version of a key and every tombstone that
+  // compaction has not yet merged away.
+  size_t size() const override {
+    auto version = current();
+    size_t total = version->mem->map.size();
+    for (const auto &mem : version->immutable)
+      total += mem->map.size();
+    for (const auto &level : version->levels)
+      for (const auto &table : level)
+        total += table->entries();
+    return total;
+  }
+
+  bool scan(std::string_view start, std::string_view end,
+            std::string_view prefix, const ScanVisitor &visit) const override {
+    auto version = current();
+    std::string_view from = std::max(start, prefix);
+    std::vector<std::unique_ptr<EntryIterator>> sources;
+    sources.push_back(std::make_unique<MemtableIterator>(version->mem, from));
+    for (const auto &mem : version->immutable)
+      sources.push_back(std::make_unique<MemtableIterator>(mem, from));
+    for (const auto &table : version->levels[0])
+      sources.push_back(std::make_unique<SSTable::Iterator>(table, from));
+    for (size_t level = 1; level < kLevels; ++level)
+      if (!version->levels[level].empty())
+        sources.push_back(std::make_unique<LevelIterator>(
+            version->levels[level], from));
+
+    for (MergingIterator it(std::move(sources)); it.valid(); it.next()) {
+      std::string_view key = it.key();
+      if ((!end.empty() && key >= end) ||
+          key.substr(0, prefix.size()) != prefix)
+        break;
+      if (it.type() == EntryType::kValue && !visit(key, it.value()))
+        break;
+    }
+    return true;
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    for (size_t level = 0; level < kLevels; ++level) {
+      stats.tables[level] = version_->levels[level].size();
+      stats.bytes[level] = levelBytes(*version_, level);
+    }
+    return stats;
+  }
+
+  // Freezes the memtable and blocks until every frozen memtable is in a
+  // table and no compaction is pending. Throws if a flush failed.
+  void flush() {
+    rotateMemtable(true);
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [&]() {
+      return !flush_running_ && !compaction_running_ &&
+             (version_->immutable.empty() || !background_error_.empty());
+    });
+    if (!version_->immutable.empty())
+      throw std::runtime_error("LSM flush failed: " + background_error_);
+  }
+
+private:
+  using TablePtr = std::shared_ptr<SSTable>;
+
+  // Values are stored in the skip list behind a one-byte EntryType tag so
+  // tombstones can shadow keys in the tables below. log_number names the
+  // memtable's log, which is only open when logging is on.
+  struct Memtable {
+    SkipListMap map;
+    std::atomic<size_t> bytes{0};
+    uint64_t log_number = 0;
+    std::unique_ptr<WriteAheadLog> log;
+
+    bool get(std::string_view key, std::string &value,
+             EntryType &type) const {
+      if (!map.get(key, value))
+        return false;
+      type = static_cast<EntryType>(value[0]);
+      value.erase(0, 1);
+      return true;
+    }
+  };
+  using MemtablePtr = std::shared_ptr<Memtable>;
+
+  // An immutable view of the engine. Readers grab the current one and
+  // search it without locks; every change installs a new Version.
+  struct Version {
+    MemtablePtr mem;
+    std::vector<MemtablePtr> immutable; // newest first
+    // Level 0 newest first; deeper levels sorted by key range.
+    std::array<std::vector<TablePtr>, kLevels> levels;
+  };
+  using VersionPtr = std::shared_ptr<const Version>;
+
+  struct Compaction {
+    size_t level = 0;
+    std::vector<TablePtr> inputs; // newest first
+    std::vector<TablePtr> next;   // overlapping tables of level + 1
+    bool drop_tombstones = false;
+  };
+
+  // Reads a memtable in batches, re-seeking past the last key for each
+  // batch, so scans don't hold a skip-list accessor across visits.
+  class MemtableIterator : public EntryIterator {
+  public:
+    MemtableIterator(MemtablePtr mem, std::string_view from)
+        : mem_(std::move(mem)) {
+      fill(from, false);
+    }
+
+    bool valid() const override { return pos_ < batch_.size(); }
+    std::string_view key() const override { return batch_[pos_].first; }
+    std::string_view value() const override {
+      return std::string_view(batch_[pos_].second).substr(1);
+    }
+    EntryType type() const override {
+      return static_cast<EntryType>(batch_[pos_].second[0]);
+    }
+
+    void next() override {
+      if (++pos_ < batch_.size() || exhausted_)
+        return;
+      std::string last = std::move(batch_.back().first);
+      fill(last, true);
+    }
+
+  private:
+    static constexpr size_t kBatch = 256;
+
+    void fill(std::string_view from, bool after) {
+      batch_.clear();
+      pos_ = 0;
+      mem_->map.scan(from, {}, {},
+                     [&](std::string_view key, std::string_view value) {
+                       if (after && key == from)
+                         return true;
+                       batch_.emplace_back(key, value);
+                       return batch_.size() < kBatch;
+                     });
+      exhausted_ = batch_.size() < kBatch;
+    }
+
+    MemtablePtr mem_;
+    std::vector<std::pair<std::string, std::string>> batch_;
+    size_t pos_ = 0;
+    bool exhausted_ = false;
+  };
+
+  // Walks the non-overlapping tables of one level as a single sequence.
+  class LevelIterator : public EntryIterator {
+  public:
+    LevelIterator(std::vector<TablePtr> tables, std::string_view from)
+        : tables_(std::move(tables)) {
+      auto it = std::lower_bound(tables_.begin(), tables_.end(), from,
+                                 [](const TablePtr &t, std::string_view k) {
+                                   return t->largest() < k;
+                                 });
+      index_ = static_cast<size_t>(it - tables_.begin());
+      if (index_ < tables_.size())
+        current_ = std::make_unique<SSTable::Iterator>(tables_[index_], from);
+      skipExhausted();
+    }
+
+    bool valid() const override { return current_ && current_->valid(); }
+    std::string_view key() const override { return current_->key(); }
+    std::string_view value() const override { return current_->value(); }
+    EntryType type() const override { return current_->type(); }
+
+    void next() override {
+      current_->next();
+      skipExhausted();
+    }
+
+  private:
+    void skipExhausted() {
+      while (current_ && !current_->valid()) {
+        if (++index_ >= tables_.size()) {
+          current_.reset();
+          return;
+        }
+        current_ = std::make_unique<SSTable::Iterator>(tables_[index_], "");
+      }
+    }
+
+    std::vector<TablePtr> tables_;
+    size_t index_ = 0;
+    std::unique_ptr<SSTable::Iterator> current_;
+  };
+
+  // Merges sources given newest first into one sorted stream holding only
+  // the newest version of each key (tombstones included).
+  class MergingIterator {
+  public:
+    explicit MergingIterator(std::vector<std::unique_ptr<EntryIterator>> s)
+        : sources_(std::move(s)) {
+      for (size_t i = 0; i < sources_.size(); ++i)
+        if (sources_[i]->valid())
+          heap_.push_back(i);
+      std::make_heap(heap_.begin(), heap_.end(), Greater{this});
+    }
+
+    bool valid() const { return !heap_.empty(); }
+    std::string_view key() const { return top().key(); }
+    std::string_view value() const { return top().value(); }
+    EntryType type() const { return top().type(); }
+
+    // Advances every source positioned at the current key.
+    void next() {
+      std::string key(top().key());
+      while (!heap_.empty() && top().key() == key) {
+        std::pop_heap(heap_.begin(), heap_.end(), Greater{this});
+        size_t source = heap_.back();
+        sources_[source]->next();
+        if (sources_[source]->valid())
+          std::push_heap(heap_.begin(), heap_.end(), Greater{this});
+        else
+          heap_.pop_back();
+      }
+    }
+
+  private:
+    // Min-heap on (key, source), so the newest source of a key is on top.
+    struct Greater {
+      const MergingIterator *self;
+      bool operator()(size_t a, size_t b) const {
+        std::string_view ka = self->sources_[a]->key();
+        std::string_view kb = self->sources_[b]->key();
+        return ka != kb ? ka > kb : a > b;
+      }
+    };
+
+    const EntryIterator &top() const { return *sources_[heap_.front()]; }
+
+    std::vector<std::unique_ptr<EntryIterator>> sources_;
+    std::vector<size_t> heap_;
+  };
+
+  VersionPtr current() const { return std::atomic_load(&version_); }
+
+  // Callers hold mutex_.
+  void install(std::shared_ptr<Version> version) {
+    std::atomic_store(&version_, VersionPtr(std::move(version)));
+  }
+
+  // A full memtable is frozen before the write rather than after it, so a
+  // write that fails (stalled behind a failed flush) has not been applied.
+  // The log append and the memtable insert happen under one stripe, so the
+  // log replays writes to a key in the order the memtable took them. The
+  // wait for durability happens outside both locks, which lets concurrent
+  // writers share a group commit.
+  void write(std::string_view key, EntryType type, std::string_view value) {
+    thread_local std::string encoded;
+    encoded.assign(1, static_cast<char>(type));
+    encoded.append(value);
+    MemtablePtr logged;
+    uint64_t seq = 0;
+    std::shared_lock<std::shared_mutex> lock(write_mutex_);
+    while (mem_->bytes.load(std::memory_order_relaxed) >=
+           options_.memtable_bytes) {
+      lock.unlock();
+      rotateMemtable(false);
+      lock.lock();
+    }
+    if (mem_->log) {
+      std::lock_guard<std::mutex> stripe(stripeFor(key));
+      seq = type == EntryType::kValue ? mem_->log->appendPut(key, value)
+                                      : mem_->log->appendDelete(key);
+      mem_->map.put(key, encoded);
+      logged = mem_;
+    } else {
+      mem_->map.put(key, encoded);
+    }
+    mem_->bytes.fetch_add(key.size() + encoded.size() + kEntryOverhead,
+                          std::memory_order_relaxed);
+    lock.unlock();
+    if (logged)
+      logged->log->waitDurable(seq);
+  }
+
+  // Callers hold mutex_.
+  bool writesStalled() const {
+    return version_->immutable.size() >= options_.max_immutable_memtables ||
+           version_->levels[0].size() >= options_.l0_stop_writes_trigger;
+  }
+
+  // Freezes the memtable and schedules its flush. Unless forced, only does
+  // so if the memtable is (still) full; waits while writes are stalled, and
+  // throws if they stay stalled behind a failed flush or compaction.
+  void rotateMemtable(bool force) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stall_cv_.wait(lock, [&]() {
+      return !writesStalled() || !background_error_.empty();
+    });
+    if (writesStalled())
+      throw std::runtime_error("LSM writes stalled: " + background_error_);
+    std::unique_lock<std::shared_mutex> write_lock(write_mutex_);
+    if (mem_->map.size() == 0 ||
+        (!force && mem_->bytes.load() < options_.memtable_bytes))
+      return;
+    MemtablePtr fresh = newMemtable();
+    auto next = std::make_shared<Version>(*version_);
+    next->immutable.insert(next->immutable.begin(), mem_);
+    mem_ = std::move(fresh);
+    next->mem = mem_;
+    install(std::move(next));
+    write_lock.unlock();
+    scheduleWork();
+  }
+
+  // Callers hold mutex_ (or are the constructor).
+  MemtablePtr newMemtable() {
+    auto mem = std::make_shared<Memtable>();
+    mem->log_number = next_file_++;
+    if (options_.wal.durability != WriteAheadLog::Durability::kNone)
+      mem->log = std::make_unique<WriteAheadLog>(logPath(mem->log_number),
+                                                 options_.wal);
+    return mem;
+  }
+
+  // Callers hold mutex_ and record the failure the writers will report.
+  void backgroundFailed(const char *what, const std::exception &e) {
+    std::cerr << "LSM " << what << " failed: " << e.what() << std::endl;
+    background_error_ = std::string(what) + " failed: " + e.what();
+    stall_cv_.notify_all();
+    idle_cv_.notify_all();
+  }
+
+  // Callers hold mutex_.
+  void scheduleWork() {
+    if (!flush_running_ && !version_->immutable.empty()) {
+      flush_running_ = true;
+      pool_.submit([this]() { flushLoop(); });
+    }
+    if (!compaction_running_ && !closing_ && needsCompaction()) {
+      compaction_running_ = true;
+      pool_.submit([this]() { compactLoop(); });
+    }
+  }
+
+  // Flushes frozen memtables oldest first, one at a time, so level 0 stays
+  // ordered by age.
+  void flushLoop() {
+    while (true) {
+      MemtablePtr mem;
+      uint64_t number;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (version_->immutable.empty()) {
+          flush_running_ = false;
+          idle_cv_.notify_all();
+          return;
+        }
+        mem = version_->immutable.back();
+        number = next_file_++;
+      }
+      std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+      try {
+        TablePtr table = writeTable(*mem, number);
+        lock.lock();
+        auto next = std::make_shared<Version>(*version_);
+        next->immutable.pop_back();
+        next->levels[0].insert(next->levels[0].begin(), table);
+        saveManifest(*next);
+        install(std::move(next));
+      } catch (const std::exception &e) {
+        // The memtable stays frozen (and readable, and in its log); writes
+        // fail once they would stall behind it.
+        if (!lock.owns_lock())
+          lock.lock();
+        flush_running_ = false;
+        backgroundFailed("flush", e);
+        return;
+      }
+      // The MANIFEST no longer needs the log to recover this memtable.
+      std::error_code ignored;
+      std::filesystem::remove(logPath(mem->log_number), ignored);
+      background_error_.clear();
+      ++stats_.flushes;
+      stall_cv_.notify_all();
+      scheduleWork();
+    }
+  }
+
+  TablePtr writeTable(const Memtable &mem, uint64_t number) const {
+    SSTableWriter writer(tablePath(number), writerOptions());
+    mem.map.scan({}, {}, {}, [&](std::string_view key, std::string_view value) {
+      writer.add(key, static_cast<EntryType>(value[0]), value.substr(1));
+      return true;
+    });
+    writer.finish();
+    return std::make_shared<SSTable>(tablePath(number), number);
+  }
+
+  void compactLoop() {
+    while (true) {
+      Compaction c;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closing_ || !pickCompaction(c)) {
+          compaction_running_ = false;
+          idle_cv_.notify_all();
+          return;
+        }
+      }
+      std::vector<TablePtr> outputs;
+      try {
+        outputs = runCompaction(c);
+      } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        compaction_running_ = false;
+        backgroundFailed("compaction", e);
+        return;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto next = std::make_shared<Version>(*version_);
+      auto drop = [](std::vector<TablePtr> &level,
+                     const std::vector<TablePtr> &gone) {
+        level.erase(std::remove_if(level.begin(), level.end(),
+                                   [&](const TablePtr &t) {
+                                     return std::find(gone.begin(), gone.end(),
+                                                      t) != gone.end();
+                                   }),
+                    level.end());
+      };
+      drop(next->levels[c.level], c.inputs);
+      auto &out = next->levels[c.level + 1];
+      drop(out, c.next);
+      out.insert(out.end(), outputs.begin(), outputs.end());
+      std::sort(out.begin(), out.end(), [](const TablePtr &a,
+                                           const TablePtr &b) {
+        return a->smallest() < b->smallest();
+      });
+      saveManifest(*next);
+      install(std::move(next));
+      for (const auto &t : c.inputs)
+        t->markObsolete();
+      for (const auto &t : c.next)
+        t->markObsolete();
+      background_error_.clear();
+      ++stats_.compactions;
+      for (const auto &t : outputs)
+        stats_.compaction_bytes_written += t->fileSize();
+      stall_cv_.notify_all();
+    }
+  }
+
+  // Callers hold mutex_.
+  bool needsCompaction() const {
+    if (version_->levels[0].size() >= options_.l0_compaction_trigger)
+      return true;
+    for (size_t level = 1; level + 1 < kLevels; ++level)
+      if (levelBytes(*version_, level) > maxBytes(level))
+        return true;
+    return false;
+  }
+
+  // Callers hold mutex_.
+  bool pickCompaction(Compaction &c) {
+    const Version &v = *version_;
+    if (v.levels[0].size() >= options_.l0_compaction_trigger) {
+      c.level = 0;
+      c.inputs = v.levels[0];
+    } else {
+      for (size_t level = 1; level + 1 < kLevels && c.inputs.empty();
+           ++level) {
+        if (levelBytes(v, level) <= maxBytes(level))
+          continue;
+        // Round-robin over the key space so every table gets its turn.
+        const auto &tables = v.levels[level];
+        auto it = std::find_if(tables.begin(), tables.end(),
+                               [&](const TablePtr &t) {
+                                 return t->smallest() > compact_pointer_[level];
+                               });
+        TablePtr pick = it != tables.end() ? *it : tables.front();
+        compact_pointer_[level] = pick->largest();
+        c.level = level;
+        c.inputs = {pick};
+      }
+      if (c.inputs.empty())
+        return false;
+    }
+    std::string smallest = c.inputs.front()->smallest();
+    std::string largest = c.inputs.front()->largest();
+    for (const auto &t : c.inputs) {
+      smallest = std::min(smallest, t->smallest());
+      largest = std::max(largest, t->largest());
+    }
+    c.next.clear();
+    for (const auto &t : v.levels[c.level + 1])
+      if (t->overlaps(smallest, largest))
+        c.next.push_back(t);
+    c.drop_tombstones = true;
+    for (size_t level = c.level + 2; level < kLevels; ++level)
+      if (!v.levels[level].empty())
+        c.drop_tombstones = false;
+    return true;
+  }
+
+  std::vector<TablePtr> runCompaction(const Compaction &c) {
+    std::vector<std::unique_ptr<EntryIterator>> sources;
+    for (const auto &t : c.inputs)
+      sources.push_back(std::make_unique<SSTable::Iterator>(t, ""));
+    for (const auto &t : c.next)
+      sources.push_back(std::make_unique<SSTable::Iterator>(t, ""));
+
+    std::vector<TablePtr> outputs;
+    std::unique_ptr<SSTableWriter> writer;
+    uint64_t number = 0;
+    auto finishTable = [&]() {
+      writer->finish();
+      writer.reset();
+      outputs.push_back(std::make_shared<SSTable>(tablePath(number), number));
+    };
+    try {
+      for (MergingIterator it(std::move(sources)); it.valid(); it.next()) {
+        if (c.drop_tombstones && it.type() == EntryType::kTombstone)
+          continue;
+        if (!writer) {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            number = next_file_++;
+          }
+          writer = std::make_unique<SSTableWriter>(tablePath(number),
+                                                   writerOptions());
+        }
+        writer->add(it.key(), it.type(), it.value());
+        if (writer->fileSize() >= options_.target_table_bytes)
+          finishTable();
+      }
+      if (writer)
+        finishTable();
+    } catch (...) {
+      for (const auto &t : outputs)
+        t->markObsolete();
+      throw;
+    }
+    return outputs;
+  }
+
+  uint64_t maxBytes(size_t level) const {
+    uint64_t bytes = options_.base_level_bytes;
+    for (size_t i = 1; i < level; ++i)
+      bytes *= options_.size_multiplier;
+    return bytes;
+  }
+
+  static uint64_t levelBytes(const Version &v, size_t level) {
+    uint64_t bytes = 0;
+    for (const auto &t : v.levels[level])
+      bytes += t->fileSize();
+    return bytes;
+  }
+
+  SSTableWriter::Options writerOptions() const {
+    SSTableWriter::Options options;
+    options.block_size = options_.block_size;
+    options.bloom_bits_per_key = options_.bloom_bits_per_key;
+    return options;
+  }
+
+  std::string tablePath(uint64_t number) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%08llu.sst",
+                  static_cast<unsigned long long>(number));
+    return options_.dir + name;
+  }
+
+  std::string logPath(uint64_t number) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%08llu.log",
+                  static_cast<unsigned long long>(number));
+    return options_.dir + name;
+  }
+
+  std::string manifestPath() const { return options_.dir + "/MANIFEST"; }
+
+  // MANIFEST is a text file: "next_file <n>", "log_number <n>" then one
+  // "<level> <number>" line per live table. Logs numbered below log_number
+  // belong to memtables already in a table. It is replaced atomically on
+  // every change, and table files it doesn't list are leftovers of an
+  // interrupted flush or compaction. Callers hold mutex_ (or are the
+  // constructor).
+  void saveManifest(const Version &v) {
+    uint64_t log_number = v.immutable.empty() ? v.mem->log_number
+                                              : v.immutable.back()->log_number;
+    std::string tmp = manifestPath() + ".tmp";
+    {
+      std::ofstream out(tmp, std::ios::trunc);
+      out << "next_file " << next_file_ << "\n";
+      out << "log_number " << log_number << "\n";
+      for (size_t level = 0; level < kLevels; ++level)
+        for (const auto &t : v.levels[level])
+          out << level << " " << t->number() << "\n";
+      out.flush();
+      if (!out)
+        throw std::runtime_error("Failed to write " + tmp);
+    }
+    int fd = ::open(tmp.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      ::fdatasync(fd);
+      ::close(fd);
+    }
+    if (::rename(tmp.c_str(), manifestPath().c_str()) != 0)
+      throw std::runtime_error("Failed to install " + manifestPath());
+    // Logs are deleted on the strength of this MANIFEST.
+    WriteAheadLog::syncDirectoryOf(manifestPath());
+  }
+
+  void loadManifest(Version &v) {
+    std::set<uint64_t> live;
+    std::ifstream in(manifestPath());
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string first;
+      uint64_t number;
+      if (!(fields >> first >> number))
+        continue;
+      if (first == "next_file") {
+        next_file_ = number;
+        continue;
+      }
+      if (first == "log_number") {
+        log_number_ = number;
+        continue;
+      }
+      size_t level = std::stoul(first);
+      if (level >= kLevels)
+        throw std::runtime_error("Bad level in " + manifestPath());
+      v.levels[level].push_back(
+          std::make_shared<SSTable>(tablePath(number), number));
+      live.insert(number);
+    }
+    std::sort(v.levels[0].begin(), v.levels[0].end(),
+              [](const TablePtr &a, const TablePtr &b) {
+                return a->number() > b->number();
+              });
+    for (size_t level = 1; level < kLevels; ++level)
+      std::sort(v.levels[level].begin(), v.levels[level].end(),
+                [](const TablePtr &a, const TablePtr &b) {
+                  return a->smallest() < b->smallest();
+                });
+    namespace fs = std::filesystem;
+    for (const auto &entry : fs::directory_iterator(options_.dir)) {
+      const auto &path = entry.path();
+      if (path.extension() == ".sst" &&
+          !live.count(std::strtoull(path.stem().c_str(), nullptr, 10)))
+        std::filesystem::remove(path);
+    }
+  }
+
+  // Numbers of the memtable logs in `dir` not yet covered by a table, in
+  // ascending order.
+  std::vector<uint64_t> listLogs() const {
+    std::vector<uint64_t> logs;
+    for (const auto &entry : std::filesystem::directory_iterator(options_.dir))
+      if (entry.path().extension() == ".log")
+        logs.push_back(std::strtoull(entry.path().stem().c_str(), nullptr, 10));
+    std::sort(logs.begin(), logs.end());
+    logs.erase(logs.begin(),
+               std::lower_bound(logs.begin(), logs.end(), log_number_));
+    return logs;
+  }
+
+  // Replays the logs of memtables that never made it into a table, oldest
+  // first, and writes what they hold to a new level 0 table.
+  void recoverLogs(Version &v) {
+    Memtable recovered;
+    std::string encoded;
+    for (uint64_t number : listLogs()) {
+      next_file_ = std::max(next_file_, number + 1);
+      WriteAheadLog::replay(
+          logPath(number), [&](WriteAheadLog::Op op, std::string_view key,
+                               std::string_view value) {
+            EntryType type = op == WriteAheadLog::Op::kPut
+                                 ? EntryType::kValue
+                                 : EntryType::kTombstone;
+            encoded.assign(1, static_cast<char>(type));
+            encoded.append(value);
+            recovered.map.put(key, encoded);
+          });
+    }
+    if (recovered.map.size() == 0)
+      return;
+    uint64_t number = next_file_++;
+    v.levels[0].insert(v.levels[0].begin(), writeTable(recovered, number));
+  }
+
+  // Callers have saved a MANIFEST whose log_number is `number`.
+  void removeLogsBefore(uint64_t number) const {
+    for (const auto &entry : std::filesystem::directory_iterator(options_.dir))
+      if (entry.path().extension() == ".log" &&
+          std::strtoull(entry.path().stem().c_str(), nullptr, 10) < number)
+        std::filesystem::remove(entry.path());
+  }
+
+  static constexpr size_t kStripes = 256;
+
+  // Padded to a cache line so neighbouring stripes don't false-share.
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  std::mutex &stripeFor(std::string_view key) {
+    return stripes_[std::hash<std::string_view>{}(key) % kStripes].mutex;
+  }
+
+  // Skip-list node and record headers, roughly.
+  static constexpr size_t kEntryOverhead = 64;
+
+  Options options_;
+  mutable std::mutex mutex_; // guards version changes and the fields below
+  std::condition_variable stall_cv_;
+  std::condition_variable idle_cv_;
+  VersionPtr version_;
+  uint64_t next_file_ = 1;
+  uint64_t log_number_ = 0; // from the MANIFEST; older logs are obsolete
+  bool flush_running_ = false;
+  bool compaction_running_ = false;
+  bool closing_ = false;
+  std::string background_error_; // last failed flush or compaction
+  std::array<std::string, kLevels> compact_pointer_;
+  Stats stats_;
+  // Writers hold it shared; freezing the memtable holds it exclusively.
+  std::shared_mutex write_mutex_;
+  MemtablePtr mem_;
+  std::array<Stripe, kStripes> stripes_;
+  // Last, so it is destroyed (and joined) first.
+  ThreadPool pool_;
+};
+
+} // namespace kvstore
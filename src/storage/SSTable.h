@@ -0,0 +1,443 @@
+#pragma once
+
+#include "SnapshotFile.h"
+#include "WriteAheadLog.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// A deleted key is written as a tombstone so it hides older versions of the
+// key in older tables until compaction drops both.
+enum class EntryType : uint8_t { kValue = 1, kTombstone = 2 };
+
+// Forward cursor over entries in ascending key order. key() and value()
+// stay valid until the next call to next().
+class EntryIterator {
+public:
+  virtual ~EntryIterator() = default;
+  virtual bool valid() const = 0;
+  virtual std::string_view key() const = 0;
+  virtual std::string_view value() const = 0;
+  virtual EntryType type() const = 0;
+  virtual void next() = 0;
+};
+
+// Bloom filter over a table's keys: k probes derived from one 64-bit hash
+// by double hashing. The hash is fixed here (not std::hash) because the
+// bits are stored in the table file.
+struct BloomFilter {
+  static uint64_t hash(std::string_view key) {
+    uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+    for (unsigned char c : key)
+      h = (h ^ c) * 0x100000001b3ull;
+    h ^= h >> 33; // fmix64 finalizer spreads the low bits
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  static uint32_t probesFor(size_t bits_per_key) {
+    // k = ln(2) * bits/key minimises the false-positive rate.
+    return std::clamp<uint32_t>(
+        static_cast<uint32_t>(bits_per_key * 69 / 100), 1, 30);
+  }
+
+  static std::string build(const std::vector<uint64_t> &hashes,
+                           size_t bits_per_key, uint32_t probes) {
+    size_t bits = std::max<size_t>(64, hashes.size() * bits_per_key);
+    std::string filter((bits + 7) / 8, '\0');
+    bits = filter.size() * 8;
+    for (uint64_t h : hashes) {
+      uint64_t delta = (h >> 17) | (h << 47);
+      for (uint32_t i = 0; i < probes; ++i, h += delta)
+        filter[(h % bits) / 8] |= static_cast<char>(1 << ((h % bits) % 8));
+    }
+    return filter;
+  }
+
+  static bool mayContain(std::string_view filter, uint32_t probes,
+                         uint64_t h) {
+    if (filter.empty())
+      return true;
+    size_t bits = filter.size() * 8;
+    uint64_t delta = (h >> 17) | (h << 47);
+    for (uint32_t i = 0; i < probes; ++i, h += delta)
+      if (!(filter[(h % bits) / 8] & (1 << ((h % bits) % 8))))
+        return false;
+    return true;
+  }
+};
+
+// Immutable sorted table of the LSM engine.
+//
+//   data block:  repeated [u8 type][u32 key size][u32 value size][key][value]
+//   index entry: [u64 offset][u32 size][u32 crc32(block)]
+//                [u32 last key size][last key]
+//   bloom:       filter bits
+//   footer:      [u64 index offset][u64 index size][u64 bloom offset]
+//                [u64 bloom size][u64 entries][u32 probes][u32 0][u64 magic]
+//
+// The index is sparse (one entry per block, keyed by the block's last key),
+// so a lookup costs a bloom probe, a binary search in memory and one block.
+struct SSTableFormat {
+  static constexpr uint64_t kMagic = 0x31545353534d534bull; // "KSMSSST1"
+  static constexpr size_t kFooterSize = 7 * 8;
+  static constexpr size_t kEntryHeaderSize = 9;
+};
+
+class SSTableWriter {
+public:
+  struct Options {
+    size_t block_size = 4096;
+    size_t bloom_bits_per_key = 10;
+  };
+
+  SSTableWriter(std::string path, Options options)
+      : path_(std::move(path)), options_(options) {
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644);
+    if (fd_ < 0)
+      throw std::runtime_error("Failed to create table " + path_ + ": " +
+                               std::strerror(errno));
+    block_.reserve(options_.block_size * 2);
+  }
+
+  SSTableWriter(const SSTableWriter &) = delete;
+  SSTableWriter &operator=(const SSTableWriter &) = delete;
+
+  // An unfinished table is deleted.
+  ~SSTableWriter() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      ::unlink(path_.c_str());
+    }
+  }
+
+  // Keys must be strictly increasing.
+  void add(std::string_view key, EntryType type, std::string_view value) {
+    block_.push_back(static_cast<char>(type));
+    SnapshotFormat::put32(block_, static_cast<uint32_t>(key.size()));
+    SnapshotFormat::put32(block_, static_cast<uint32_t>(value.size()));
+    block_.append(key);
+    block_.append(value);
+    last_key_.assign(key);
+    hashes_.push_back(BloomFilter::hash(key));
+    if (block_.size() >= options_.block_size)
+      flushBlock();
+  }
+
+  // Bytes written so far plus the pending block; used to split outputs.
+  uint64_t fileSize() const { return offset_ + block_.size(); }
+  uint64_t entries() const { return hashes_.size(); }
+
+  // Writes the index, filter and footer and syncs the file.
+  void finish() {
+    flushBlock();
+    uint32_t probes = BloomFilter::probesFor(options_.bloom_bits_per_key);
+    std::string bloom =
+        BloomFilter::build(hashes_, options_.bloom_bits_per_key, probes);
+    uint64_t index_offset = offset_;
+    write(index_);
+    uint64_t bloom_offset = offset_;
+    write(bloom);
+    std::string footer;
+    SnapshotFormat::put64(footer, index_offset);
+    SnapshotFormat::put64(footer, index_.size());
+    SnapshotFormat::put64(footer, bloom_offset);
+    SnapshotFormat::put64(footer, bloom.size());
+    SnapshotFormat::put64(footer, hashes_.size());
+    SnapshotFormat::put32(footer, probes);
+    SnapshotFormat::put32(footer, 0);
+    SnapshotFormat::put64(footer, SSTableFormat::kMagic);
+    write(footer);
+    if (::fdatasync(fd_) != 0)
+      throw std::runtime_error("Failed to sync table " + path_ + ": " +
+                               std::strerror(errno));
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+private:
+  void flushBlock() {
+    if (block_.empty())
+      return;
+    SnapshotFormat::put64(index_, offset_);
+    SnapshotFormat::put32(index_, static_cast<uint32_t>(block_.size()));
+    SnapshotFormat::put32(index_,
+                          WriteAheadLog::crc32(block_.data(), block_.size()));
+    SnapshotFormat::put32(index_, static_cast<uint32_t>(last_key_.size()));
+    index_.append(last_key_);
+    write(block_);
+    block_.clear();
+  }
+
+  void write(const std::string &data) {
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+      ssize_t n = ::write(fd_, p, left);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error("Failed to write table " + path_ + ": " +
+                                 std::strerror(errno));
+      }
+      p += n;
+      left -= static_cast<size_t>(n);
+    }
+    offset_ += data.size();
+  }
+
+  std::string path_;
+  Options options_;
+  int fd_ = -1;
+  uint64_t offset_ = 0;
+  std::string block_;
+  std::string last_key_;
+  std::string index_;
+  std::vector<uint64_t> hashes_;
+};
+
+// Read-only, memory-mapped SSTable. Each block's checksum is verified the
+// first time the block is read. Tables are shared between engine versions
+// through shared_ptr; one marked obsolete by compaction deletes its file
+// when the last reader lets go of it.
+class SSTable {
+public:
+  enum class Lookup { kNotFound, kFound, kDeleted };
+
+  SSTable(const std::string &path, uint64_t number)
+      : path_(path), number_(number) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("Failed to open table " + path + ": " +
+                               std::strerror(errno));
+    struct stat st;
+    if (::fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < SSTableFormat::kFooterSize) {
+      ::close(fd);
+      throw std::runtime_error("Table " + path + " is truncated");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      throw std::runtime_error("Failed to map table " + path + ": " +
+                               std::strerror(errno));
+    data_ = static_cast<const char *>(data);
+    // Point reads touch one block; don't read ahead around it.
+    ::madvise(data, size_, MADV_RANDOM);
+    try {
+      parse();
+    } catch (...) {
+      ::munmap(const_cast<char *>(data_), size_);
+      throw;
+    }
+  }
+
+  SSTable(const SSTable &) = delete;
+  SSTable &operator=(const SSTable &) = delete;
+
+  ~SSTable() {
+    ::munmap(const_cast<char *>(data_), size_);
+    if (obsolete_.load(std::memory_order_relaxed))
+      ::unlink(path_.c_str());
+  }
+
+  uint64_t number() const { return number_; }
+  uint64_t fileSize() const { return size_; }
+  uint64_t entries() const { return entries_; }
+  const std::string &smallest() const { return smallest_; }
+  const std::string &largest() const { return largest_; }
+
+  bool overlaps(std::string_view smallest, std::string_view largest) const {
+    return !(largest_ < smallest || largest < smallest_);
+  }
+
+  void markObsolete() { obsolete_.store(true, std::memory_order_relaxed); }
+
+  bool mayContain(std::string_view key, uint64_t hash) const {
+    return key >= smallest_ && key <= largest_ &&
+           BloomFilter::mayContain(bloom_, probes_, hash);
+  }
+
+  // Looks `key` up, assuming mayContain() already passed.
+  Lookup get(std::string_view key, std::string &value) const {
+    size_t b = blockFor(key);
+    if (b == index_.size())
+      return Lookup::kNotFound;
+    const char *p = block(b);
+    const char *end = p + index_[b].size;
+    while (p < end) {
+      Entry e = decode(p);
+      if (e.key >= key) {
+        if (e.key != key)
+          return Lookup::kNotFound;
+        if (e.type == EntryType::kTombstone)
+          return Lookup::kDeleted;
+        value.assign(e.value);
+        return Lookup::kFound;
+      }
+      p = e.next;
+    }
+    return Lookup::kNotFound;
+  }
+
+private:
+  struct Entry {
+    EntryType type = EntryType::kValue;
+    std::string_view key;
+    std::string_view value;
+    const char *next = nullptr;
+  };
+
+public:
+  class Iterator : public EntryIterator {
+  public:
+    // Positioned at the first entry >= target.
+    Iterator(std::shared_ptr<const SSTable> table, std::string_view target)
+        : table_(std::move(table)) {
+      block_ = table_->blockFor(target);
+      enterBlock();
+      while (valid() && entry_.key < target)
+        next();
+    }
+
+    bool valid() const override { return block_ < table_->index_.size(); }
+    std::string_view key() const override { return entry_.key; }
+    std::string_view value() const override { return entry_.value; }
+    EntryType type() const override { return entry_.type; }
+
+    void next() override {
+      if (entry_.next < end_) {
+        entry_ = table_->decode(entry_.next);
+        return;
+      }
+      ++block_;
+      enterBlock();
+    }
+
+  private:
+    void enterBlock() {
+      if (!valid())
+        return;
+      const char *p = table_->block(block_);
+      end_ = p + table_->index_[block_].size;
+      entry_ = table_->decode(p);
+    }
+
+    std::shared_ptr<const SSTable> table_;
+    size_t block_ = 0;
+    const char *end_ = nullptr;
+    SSTable::Entry entry_;
+  };
+
+private:
+  struct Block {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t crc;
+    std::string_view last_key; // points into the mapping
+  };
+
+  // The first block whose last key is >= key, or index_.size().
+  size_t blockFor(std::string_view key) const {
+    auto it = std::lower_bound(
+        index_.begin(), index_.end(), key,
+        [](const Block &b, std::string_view k) { return b.last_key < k; });
+    return static_cast<size_t>(it - index_.begin());
+  }
+
+  const char *block(size_t b) const {
+    const char *p = data_ + index_[b].offset;
+    if (!verified_[b].load(std::memory_order_acquire)) {
+      if (WriteAheadLog::crc32(p, index_[b].size) != index_[b].crc)
+        throw std::runtime_error("Table " + path_ + ": block " +
+                                 std::to_string(b) + " is corrupt");
+      verified_[b].store(true, std::memory_order_release);
+    }
+    return p;
+  }
+
+  Entry decode(const char *p) const {
+    Entry e;
+    e.type = static_cast<EntryType>(p[0]);
+    uint32_t key_size = SnapshotFormat::get32(p + 1);
+    uint32_t value_size = SnapshotFormat::get32(p + 5);
+    p += SSTableFormat::kEntryHeaderSize;
+    e.key = std::string_view(p, key_size);
+    e.value = std::string_view(p + key_size, value_size);
+    e.next = p + key_size + value_size;
+    return e;
+  }
+
+  void parse() {
+    const char *footer = data_ + size_ - SSTableFormat::kFooterSize;
+    if (SnapshotFormat::get64(footer + 48) != SSTableFormat::kMagic)
+      throw std::runtime_error("Table " + path_ + " has a bad footer");
+    uint64_t index_offset = SnapshotFormat::get64(footer);
+    uint64_t index_size = SnapshotFormat::get64(footer + 8);
+    uint64_t bloom_offset = SnapshotFormat::get64(footer + 16);
+    uint64_t bloom_size = SnapshotFormat::get64(footer + 24);
+    entries_ = SnapshotFormat::get64(footer + 32);
+    probes_ = SnapshotFormat::get32(footer + 40);
+    uint64_t data_end = size_ - SSTableFormat::kFooterSize;
+    if (index_offset + index_size != bloom_offset ||
+        bloom_offset + bloom_size != data_end)
+      throw std::runtime_error("Table " + path_ + " has a bad footer");
+    bloom_ = std::string_view(data_ + bloom_offset, bloom_size);
+
+    const char *p = data_ + index_offset;
+    const char *end = p + index_size;
+    while (p < end) {
+      if (end - p < 20)
+        throw std::runtime_error("Table " + path_ + " has a bad index");
+      Block b;
+      b.offset = SnapshotFormat::get64(p);
+      b.size = SnapshotFormat::get32(p + 8);
+      b.crc = SnapshotFormat::get32(p + 12);
+      uint32_t key_size = SnapshotFormat::get32(p + 16);
+      p += 20;
+      if (static_cast<uint64_t>(end - p) < key_size ||
+          b.offset + b.size > index_offset || b.size == 0)
+        throw std::runtime_error("Table " + path_ + " has a bad index");
+      b.last_key = std::string_view(p, key_size);
+      p += key_size;
+      index_.push_back(b);
+    }
+    verified_ = std::make_unique<std::atomic<bool>[]>(index_.size());
+    if (!index_.empty()) {
+      smallest_.assign(decode(block(0)).key);
+      largest_.assign(index_.back().last_key);
+    }
+  }
+
+  std::string path_;
+  uint64_t number_;
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t entries_ = 0;
+  uint32_t probes_ = 0;
+  std::string_view bloom_;
+  std::vector<Block> index_;
+  std::unique_ptr<std::atomic<bool>[]> verified_;
+  std::string smallest_;
+  std::string largest_;
+  std::atomic<bool> obsolete_{false};
+};
+
+} // namespace kvstore
@@ -0,0 +1,403 @@
+#pragma once
+
+#include "WriteAheadLog.h"
+#include "map/IConcurrentMap.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+
+// On-disk snapshot: every entry of the store, sorted by key and packed into
+// ~64 KiB data blocks, followed by a block index and a fixed-size footer.
+//
+//   data block:  repeated [u32 key size][u32 value size][key][value]
+//   index entry: [u64 offset][u32 size][u32 entries][u32 crc32(block)]
+//                [u32 first key size][first key]
+//   footer:      [u64 index offset][u64 index size][u64 blocks]
+//                [u64 entries][u64 generation][u64 magic]
+//
+// The generation is the last write-ahead log segment whose records the
+// snapshot is guaranteed to contain (see Checkpointer).
+struct SnapshotFormat {
+  static constexpr uint64_t kMagic = 0x31504e534b56534bull; // "KSVKSNP1"
+  static constexpr size_t kBlockSize = 64 << 10;
+  static constexpr size_t kFooterSize = 6 * 8;
+  static constexpr size_t kEntryHeaderSize = 8;
+
+  static void put32(std::string &out, uint32_t v) {
+    out.append(reinterpret_cast<const char *>(&v), 4);
+  }
+  static void put64(std::string &out, uint64_t v) {
+    out.append(reinterpret_cast<const char *>(&v), 8);
+  }
+  static uint32_t get32(const char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+  }
+  static uint64_t get64(const char *p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+  }
+};
+
+// Writes a snapshot to `path.tmp` and renames it over `path` in finish(),
+// so a crash mid-write leaves the previous snapshot intact. Keys must be
+// added in strictly increasing order.
+class SnapshotWriter {
+public:
+  SnapshotWriter(std::string path, uint64_t generation)
+      : path_(std::move(path)), tmp_path_(path_ + ".tmp"),
+        generation_(generation) {
+    fd_ = ::open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644);
+    if (fd_ < 0)
+      throw std::runtime_error("Failed to create snapshot " + tmp_path_ +
+                               ": " + std::strerror(errno));
+    block_.reserve(SnapshotFormat::kBlockSize * 2);
+  }
+
+  SnapshotWriter(const SnapshotWriter &) = delete;
+  SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+  // An unfinished snapshot is discarded.
+  ~SnapshotWriter() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      ::unlink(tmp_path_.c_str());
+    }
+  }
+
+  void add(std::string_view key, std::string_view value) {
+    if (entries_ > 0 && key <= last_key_)
+      throw std::invalid_argument("Snapshot keys must be strictly increasing");
+    if (block_.empty())
+      block_first_key_.assign(key);
+    SnapshotFormat::put32(block_, static_cast<uint32_t>(key.size()));
+    SnapshotFormat::put32(block_, static_cast<uint32_t>(value.size()));
+    block_.append(key);
+    block_.append(value);
+    last_key_.assign(key);
+    ++entries_;
+    ++block_entries_;
+    if (block_.size() >= SnapshotFormat::kBlockSize)
+      flushBlock();
+  }
+
+  // Writes the index and footer, syncs and atomically publishes the file.
+  void finish() {
+    flushBlock();
+    uint64_t index_offset = offset_;
+    write(index_);
+    std::string footer;
+    SnapshotFormat::put64(footer, index_offset);
+    SnapshotFormat::put64(footer, index_.size());
+    SnapshotFormat::put64(footer, blocks_);
+    SnapshotFormat::put64(footer, entries_);
+    SnapshotFormat::put64(footer, generation_);
+    SnapshotFormat::put64(footer, SnapshotFormat::kMagic);
+    write(footer);
+    if (::fdatasync(fd_) != 0)
+      throw std::runtime_error("Failed to sync snapshot " + tmp_path_ + ": " +
+                               std::strerror(errno));
+    ::close(fd_);
+    fd_ = -1;
+    if (::rename(tmp_path_.c_str(), path_.c_str()) != 0)
+      throw std::runtime_error("Failed to publish snapshot " + path_ + ": " +
+                               std::strerror(errno));
+    // The rename is only durable once the directory is; callers delete the
+    // log segments the snapshot covers right after this returns.
+    WriteAheadLog::syncDirectoryOf(path_);
+  }
+
+  uint64_t entries() const { return entries_; }
+
+  // Snapshots `store` to `path`. Ordered engines are scanned in batches of
+  // about kScanBatchBytes, each a fresh scan from where the last stopped,
+  // so no single scan pins the engine (e.g. skip-list node reclamation)
+  // for the whole snapshot. Unordered ones are collected and sorted first.
+  // Concurrent writes may or may not be included (the snapshot is fuzzy),
+  // which is why the log segments after `generation` are replayed on top
+  // of it.
+  static uint64_t writeFrom(const IConcurrentMap &store,
+                            const std::string &path, uint64_t generation) {
+    SnapshotWriter writer(path, generation);
+    std::vector<std::pair<std::string, std::string>> batch;
+    std::string resume;
+    bool resuming = false;
+    bool ordered = true;
+    while (true) {
+      batch.clear();
+      size_t bytes = 0;
+      bool full = false;
+      ordered = store.scan(resume, {}, {}, [&](std::string_view key,
+                                               std::string_view value) {
+        if (resuming && key == resume)
+          return true; // written by the previous batch
+        batch.emplace_back(key, value);
+        bytes += key.size() + value.size();
+        full = bytes >= kScanBatchBytes;
+        return !full;
+      });
+      if (!ordered)
+        break;
+      for (const auto &[key, value] : batch)
+        writer.add(key, value);
+      if (!full)
+        break;
+      resume = std::move(batch.back().first);
+      resuming = true;
+    }
+    if (!ordered) {
+      std::vector<std::pair<std::string, std::string>> entries;
+      entries.reserve(store.size());
+      store.forEach([&](std::string_view key, std::string_view value) {
+        entries.emplace_back(key, value);
+        return true;
+      });
+      std::sort(entries.begin(), entries.end());
+      for (const auto &[key, value] : entries)
+        writer.add(key, value);
+    }
+    writer.finish();
+    return writer.entries();
+  }
+
+private:
+  static constexpr size_t kScanBatchBytes = 1 << 20;
+
+  void flushBlock() {
+    if (block_.empty())
+      return;
+    SnapshotFormat::put64(index_, offset_);
+    SnapshotFormat::put32(index_, static_cast<uint32_t>(block_.size()));
+    SnapshotFormat::put32(index_, block_entries_);
+    SnapshotFormat::put32(index_,
+                          WriteAheadLog::crc32(block_.data(), block_.size()));
+    SnapshotFormat::put32(index_,
+                          static_cast<uint32_t>(block_first_key_.size()));
+    index_.append(block_first_key_);
+    write(block_);
+    ++blocks_;
+    block_.clear();
+    block_entries_ = 0;
+  }
+
+  void write(const std::string &data) {
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+      ssize_t n = ::write(fd_, p, left);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error("Failed to write snapshot " + tmp_path_ +
+                                 ": " + std::strerror(errno));
+      }
+      p += n;
+      left -= static_cast<size_t>(n);
+    }
+    offset_ += data.size();
+  }
+
+  std::string path_;
+  std::string tmp_path_;
+  uint64_t generation_;
+  int fd_ = -1;
+  uint64_t offset_ = 0;
+  uint64_t blocks_ = 0;
+  uint64_t entries_ = 0;
+  std::string block_;
+  std::string block_first_key_;
+  uint32_t block_entries_ = 0;
+  std::string last_key_;
+  std::string index_;
+};
+
+// Read-only view of a snapshot file through mmap(). Opening only parses
+// the footer and block index; blocks are checksummed as they are read.
+class SnapshotReader {
+public:
+  using EntryVisitor =
+      std::function<void(std::string_view key, std::string_view value)>;
+
+  explicit SnapshotReader(const std::string &path) : path_(path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("Failed to open snapshot " + path + ": " +
+                               std::strerror(errno));
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Failed to stat snapshot " + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ < SnapshotFormat::kFooterSize) {
+      ::close(fd);
+      throw std::runtime_error("Snapshot " + path + " is truncated");
+    }
+    void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      throw std::runtime_error("Failed to map snapshot " + path + ": " +
+                               std::strerror(errno));
+    data_ = static_cast<const char *>(data);
+    // Loading touches every page once; start reading ahead now.
+    ::madvise(data, size_, MADV_WILLNEED);
+    try {
+      parseIndex();
+    } catch (...) {
+      ::munmap(const_cast<char *>(data_), size_);
+      throw;
+    }
+  }
+
+  SnapshotReader(const SnapshotReader &) = delete;
+  SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+  ~SnapshotReader() { ::munmap(const_cast<char *>(data_), size_); }
+
+  uint64_t generation() const { return generation_; }
+  uint64_t entries() const { return entries_; }
+  size_t blocks() const { return index_.size(); }
+
+  // Visits the entries of block `b` in key order.
+  void forEachInBlock(size_t b, const EntryVisitor &visit) const {
+    const Block &block = index_[b];
+    const char *p = data_ + block.offset;
+    if (WriteAheadLog::crc32(p, block.size) != block.crc)
+      throw std::runtime_error("Snapshot " + path_ + ": block " +
+                               std::to_string(b) + " is corrupt");
+    const char *end = p + block.size;
+    for (uint32_t i = 0; i < block.entries; ++i) {
+      if (end - p < static_cast<ptrdiff_t>(SnapshotFormat::kEntryHeaderSize))
+        throw std::runtime_error("Snapshot " + path_ + ": bad block");
+      uint32_t key_size = SnapshotFormat::get32(p);
+      uint32_t value_size = SnapshotFormat::get32(p + 4);
+      p += SnapshotFormat::kEntryHeaderSize;
+      if (static_cast<size_t>(end - p) < size_t{key_size} + value_size)
+        throw std::runtime_error("Snapshot " + path_ + ": bad block");
+      visit({p, key_size}, {p + key_size, value_size});
+      p += key_size + value_size;
+    }
+  }
+
+  // Point lookup: binary search over the index, then a scan of one block.
+  bool get(std::string_view key, std::string &value) const {
+    auto it = std::upper_bound(
+        index_.begin(), index_.end(), key,
+        [](std::string_view k, const Block &b) { return k < b.first_key; });
+    if (it == index_.begin())
+      return false;
+    bool found = false;
+    forEachInBlock(static_cast<size_t>(it - index_.begin()) - 1,
+                   [&](std::string_view k, std::string_view v) {
+                     if (k == key) {
+                       value.assign(v);
+                       found = true;
+                     }
+                   });
+    return found;
+  }
+
+  // Bulk-loads every entry into `store`. The engine is sized up front, and
+  // each thread inserts a contiguous run of blocks, so the threads build
+  // disjoint, already-sorted key ranges of the index in parallel.
+  void loadInto(IConcurrentMap &store, size_t threads) const {
+    store.reserve(entries_);
+    threads = std::max<size_t>(1, std::min(threads, index_.size()));
+    std::vector<std::thread> workers;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    size_t per_thread = (index_.size() + threads - 1) / threads;
+    for (size_t t = 0; t < threads; ++t) {
+      size_t first = t * per_thread;
+      size_t last = std::min(index_.size(), first + per_thread);
+      workers.emplace_back([&, first, last]() {
+        try {
+          for (size_t b = first; b < last; ++b)
+            forEachInBlock(b, [&](std::string_view key,
+                                  std::string_view value) {
+              store.put(key, value);
+            });
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          error = std::current_exception();
+        }
+      });
+    }
+    for (auto &w : workers)
+      w.join();
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+private:
+  struct Block {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t entries;
+    uint32_t crc;
+    std::string_view first_key; // points into the mapping
+  };
+
+  void parseIndex() {
+    const char *footer = data_ + size_ - SnapshotFormat::kFooterSize;
+    if (SnapshotFormat::get64(footer + 40) != SnapshotFormat::kMagic)
+      throw std::runtime_error("Snapshot " + path_ + " has a bad footer");
+    uint64_t index_offset = SnapshotFormat::get64(footer);
+    uint64_t index_size = SnapshotFormat::get64(footer + 8);
+    uint64_t blocks = SnapshotFormat::get64(footer + 16);
+    entries_ = SnapshotFormat::get64(footer + 24);
+    generation_ = SnapshotFormat::get64(footer + 32);
+    uint64_t data_end = size_ - SnapshotFormat::kFooterSize;
+    if (index_offset > data_end || index_size != data_end - index_offset)
+      throw std::runtime_error("Snapshot " + path_ + " has a bad index");
+
+    const char *p = data_ + index_offset;
+    const char *end = p + index_size;
+    index_.reserve(blocks);
+    for (uint64_t i = 0; i < blocks; ++i) {
+      if (end - p < 24)
+        throw std::runtime_error("Snapshot " + path_ + " has a bad index");
+      Block block;
+      block.offset = SnapshotFormat::get64(p);
+      block.size = SnapshotFormat::get32(p + 8);
+      block.entries = SnapshotFormat::get32(p + 12);
+      block.crc = SnapshotFormat::get32(p + 16);
+      uint32_t key_size = SnapshotFormat::get32(p + 20);
+      p += 24;
+      if (static_cast<uint64_t>(end - p) < key_size ||
+          block.offset + block.size > index_offset)
+        throw std::runtime_error("Snapshot " + path_ + " has a bad index");
+      block.first_key = std::string_view(p, key_size);
+      p += key_size;
+      index_.push_back(block);
+    }
+  }
+
+  std::string path_;
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t entries_ = 0;
+  uint64_t generation_ = 0;
+  std::vector<Block> index_;
+};
+
+} // namespace kvstore
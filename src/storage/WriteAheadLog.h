@@ -0,0 +1,318 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+namespace kvstore {
+
+// Append-only log of Puts and Deletes with group commit. Writers append
+// framed records to a shared buffer and get back a sequence number; one
+// flusher thread drains the buffer with a single write() per batch (plus
+// fdatasync() in kSync mode), so concurrent writers from every CQ thread
+// share the cost of each system call. The flusher waits up to
+// batch_window after the first record of a batch to let more writers join.
+//
+// Each record is framed as [u32 payload size][u32 crc32(payload)] followed
+// by the payload [u8 op][u32 key size][key][value]. replay() stops at the
+// first short or corrupt record and truncates the torn tail.
+class WriteAheadLog {
+public:
+  // kNone: no log at all (the store is memory-only).
+  // kAsync: acknowledged once buffered, before the batch is write()n, so a
+  //         process crash loses up to batch_window of acknowledged writes
+  //         (plus the batch in flight). Written batches are not synced and
+  //         are lost on a power loss.
+  // kSync: acknowledged only after the batch holding the record has been
+  //        written and fdatasync()ed.
+  enum class Durability { kNone, kAsync, kSync };
+
+  enum class Op : uint8_t { kPut = 1, kDelete = 2 };
+
+  struct Options {
+    Durability durability = Durability::kSync;
+    std::chrono::microseconds batch_window{0};
+    // A batch is flushed early once it grows past this many bytes.
+    size_t max_batch_bytes = 1 << 20;
+  };
+
+  struct Stats {
+    uint64_t records = 0;
+    uint64_t batches = 0;
+    uint64_t bytes = 0;
+  };
+
+  using ReplayVisitor =
+      std::function<void(Op op, std::string_view key, std::string_view value)>;
+
+  static Durability parseDurability(const std::string &name) {
+    if (name == "none")
+      return Durability::kNone;
+    if (name == "async")
+      return Durability::kAsync;
+    if (name == "sync")
+      return Durability::kSync;
+    throw std::invalid_argument("Unknown WAL durability: " + name);
+  }
+
+  WriteAheadLog(const std::string &path, Options options)
+      : options_(options), fd_(openFile(path)) {
+    flusher_ = std::thread([this]() { flushLoop(); });
+  }
+
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // Flushes (and syncs) everything appended so far.
+  ~WriteAheadLog() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    work_cv_.notify_one();
+    flusher_.join();
+    if (options_.durability != Durability::kNone)
+      ::fdatasync(fd_);
+    ::close(fd_);
+  }
+
+  uint64_t appendPut(std::string_view key, std::string_view value) {
+    return append(Op::kPut, key, value);
+  }
+
+  uint64_t appendDelete(std::string_view key) {
+    return append(Op::kDelete, key, {});
+  }
+
+  // Blocks until record `seq` is durable. Returns at once unless kSync.
+  void waitDurable(uint64_t seq) {
+    if (options_.durability != Durability::kSync)
+      return;
+    std::unique_lock<std::mutex> lock(mutex_);
+    durable_cv_.wait(lock, [&]() { return durable_seq_ >= seq; });
+  }
+
+  // Makes everything appended so far durable in the current file, then
+  // directs later records to a new file at `path`. Callers must keep
+  // appends out while rotating (DurableMap::rotateLog does).
+  void rotate(const std::string &path) {
+    int next = openFile(path);
+    int previous;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      durable_cv_.wait(lock, [&]() { return durable_seq_ == appended_seq_; });
+      previous = fd_;
+      fd_ = next;
+    }
+    if (::fdatasync(previous) != 0)
+      fail("fdatasync");
+    ::close(previous);
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  // Feeds every intact record of the log at `path` to visit, in order, and
+  // truncates anything after the last intact record. A missing file is an
+  // empty log. Returns the number of records replayed.
+  static size_t replay(const std::string &path, const ReplayVisitor &visit) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+      return 0;
+    size_t records = 0;
+    uint64_t good_offset = 0;
+    std::string payload;
+    while (true) {
+      char header[kHeaderSize];
+      if (!in.read(header, kHeaderSize))
+        break;
+      uint32_t size, crc;
+      std::memcpy(&size, header, 4);
+      std::memcpy(&crc, header + 4, 4);
+      if (size < kPayloadHeaderSize)
+        break;
+      payload.resize(size);
+      if (!in.read(payload.data(), size) ||
+          crc32(payload.data(), size) != crc)
+        break;
+      uint32_t key_size;
+      std::memcpy(&key_size, payload.data() + 1, 4);
+      if (key_size > size - kPayloadHeaderSize)
+        break;
+      std::string_view body(payload.data() + kPayloadHeaderSize,
+                            size - kPayloadHeaderSize);
+      visit(static_cast<Op>(payload[0]), body.substr(0, key_size),
+            body.substr(key_size));
+      ++records;
+      good_offset += kHeaderSize + size;
+    }
+    in.close();
+    if (::truncate(path.c_str(), static_cast<off_t>(good_offset)) != 0)
+      throw std::runtime_error("Failed to truncate WAL " + path + ": " +
+                               std::strerror(errno));
+    return records;
+  }
+
+  // fsync()s the directory holding `path`, making renames and unlinks in
+  // it durable.
+  static void syncDirectoryOf(const std::string &path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "."
+                      : slash == 0               ? "/"
+                                                 : path.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("Failed to open directory " + dir + ": " +
+                               std::strerror(errno));
+    int rc = ::fsync(fd);
+    ::close(fd);
+    if (rc != 0)
+      throw std::runtime_error("Failed to sync directory " + dir + ": " +
+                               std::strerror(errno));
+  }
+
+  static uint32_t crc32(const char *data, size_t size) {
+    static const std::array<uint32_t, 256> table = []() {
+      std::array<uint32_t, 256> t{};
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+          c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        t[i] = c;
+      }
+      return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i)
+      crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+  }
+
+private:
+  static constexpr size_t kHeaderSize = 8;        // size + crc
+  static constexpr size_t kPayloadHeaderSize = 5; // op + key size
+
+  static int openFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644);
+    if (fd < 0)
+      throw std::runtime_error("Failed to open WAL " + path + ": " +
+                               std::strerror(errno));
+    return fd;
+  }
+
+  uint64_t append(Op op, std::string_view key, std::string_view value) {
+    uint32_t size =
+        static_cast<uint32_t>(kPayloadHeaderSize + key.size() + value.size());
+    uint32_t key_size = static_cast<uint32_t>(key.size());
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool was_empty = buffer_.empty();
+    size_t start = buffer_.size();
+    buffer_.resize(start + kHeaderSize + size);
+    char *p = buffer_.data() + start;
+    char *payload = p + kHeaderSize;
+    payload[0] = static_cast<char>(op);
+    std::memcpy(payload + 1, &key_size, 4);
+    std::memcpy(payload + kPayloadHeaderSize, key.data(), key.size());
+    std::memcpy(payload + kPayloadHeaderSize + key.size(), value.data(),
+                value.size());
+    uint32_t crc = crc32(payload, size);
+    std::memcpy(p, &size, 4);
+    std::memcpy(p + 4, &crc, 4);
+    uint64_t seq = ++appended_seq_;
+    bool full = buffer_.size() >= options_.max_batch_bytes;
+    lock.unlock();
+    // The flusher only needs waking for the first record of a batch, or to
+    // cut its window short once the batch is full.
+    if (was_empty || full)
+      work_cv_.notify_one();
+    return seq;
+  }
+
+  void flushLoop() {
+    std::string batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      work_cv_.wait(lock, [&]() { return stopping_ || !buffer_.empty(); });
+      if (buffer_.empty())
+        break; // stopping with nothing left
+      if (options_.batch_window.count() > 0 && !stopping_)
+        work_cv_.wait_for(lock, options_.batch_window, [&]() {
+          return stopping_ || buffer_.size() >= options_.max_batch_bytes;
+        });
+      batch.swap(buffer_);
+      uint64_t batch_seq = appended_seq_;
+      uint64_t batch_records = batch_seq - durable_seq_;
+      // rotate() only switches files once this batch is durable.
+      int fd = fd_;
+      lock.unlock();
+
+      writeAll(fd, batch);
+      if (options_.durability == Durability::kSync && ::fdatasync(fd) != 0)
+        fail("fdatasync");
+
+      lock.lock();
+      durable_seq_ = batch_seq;
+      stats_.records += batch_records;
+      stats_.batches += 1;
+      stats_.bytes += batch.size();
+      batch.clear(); // keeps capacity for the next batch
+      durable_cv_.notify_all();
+    }
+  }
+
+  static void writeAll(int fd, const std::string &batch) {
+    const char *p = batch.data();
+    size_t left = batch.size();
+    while (left > 0) {
+      ssize_t n = ::write(fd, p, left);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        fail("write");
+      }
+      p += n;
+      left -= static_cast<size_t>(n);
+    }
+  }
+
+  // Acknowledged writes can no longer be made durable; keep serving would
+  // silently lose data, so stop the process instead.
+  [[noreturn]] static void fail(const char *what) {
+    std::cerr << "WAL " << what << " failed: " << std::strerror(errno)
+              << std::endl;
+    std::abort();
+  }
+
+  Options options_;
+  int fd_; // guarded by mutex_
+  mutable std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable durable_cv_;
+  std::string buffer_;
+  uint64_t appended_seq_ = 0;
+  uint64_t durable_seq_ = 0;
+  bool stopping_ = false;
+  Stats stats_;
+  std::thread flusher_;
+};
+
+} // namespace kvstore
@@ -18,6 +18,7 @@ const (
 	serverAddress = "localhost:50051"
 	concurrency   = 50
 	totalRequests = 1000
+	batchSize     = 100
 )
 
 // Config holds the benchmark configuration
@@ -27,6 +28,7 @@ type Config struct {
 	TotalRequests int
 	ProtoFile     string
 	Tag           string
+	BatchSize     int // keys per MultiGet/MultiPut/MultiDelete request
 }
 
 // BenchmarkResult represents the structure of ghz JSON output
@@ -42,7 +44,10 @@ type BenchmarkResult struct {
 	RPS        float64 `json:"rps"`
 	ErrorCount int     `json:"errorCount"`
 	ErrorRate  float64 `json:"errorRate"`
-	Details    []struct {
+	// KeysPerRequest is set by the harness, not ghz: 1 for the unary RPCs,
+	// the batch size for the Multi* ones.
+	KeysPerRequest int `json:"-"`
+	Details        []struct {
 		Timestamp string  `json:"timestamp"`
 		Latency   float64 `json:"latency"`
 		Error     string  `json:"error"`
@@ -57,6 +62,7 @@ func DefaultConfig() Config {
 		Concurrency:   concurrency,
 		TotalRequests: totalRequests,
 		ProtoFile:     "../../proto/kvstore.proto", // Relative path from tests/benchmark
+		BatchSize:     batchSize,
 	}
 }
 
@@ -115,6 +121,7 @@ func saveResultsToCSV(results []BenchmarkResult, config Config) error {
 		"Total Time (s)", "Average Latency (ms)", "Fastest (ms)", "Slowest (ms)",
 		"RPS", "Error Count", "Error Rate",
 		"P10 (ms)", "P25 (ms)", "P50 (ms)", "P75 (ms)", "P90 (ms)", "P95 (ms)", "P99 (ms)",
+		"Keys Per Request", "Per-Key Average Latency (ms)", "Keys/s",
 	}
 	if err := writer.Write(header); err != nil {
 		return fmt.Errorf("failed to write CSV header: %v", err)
@@ -139,6 +146,13 @@ func saveResultsToCSV(results []BenchmarkResult, config Config) error {
 		p95 := calculatePercentile(latencies, 95)
 		p99 := calculatePercentile(latencies, 99)
 
+		// Amortise over the keys in each request so batch and unary rows
+		// compare directly.
+		keysPerRequest := result.KeysPerRequest
+		if keysPerRequest < 1 {
+			keysPerRequest = 1
+		}
+
 		row := []string{
 			now,
 			result.Name,
@@ -158,6 +172,9 @@ func saveResultsToCSV(results []BenchmarkResult, config Config) error {
 			fmt.Sprintf("%.2f", p90/1000),
 			fmt.Sprintf("%.2f", p95/1000),
 			fmt.Sprintf("%.2f", p99/1000),
+			fmt.Sprintf("%d", keysPerRequest),
+			fmt.Sprintf("%.4f", result.Average/1000/float64(keysPerRequest)),
+			fmt.Sprintf("%.2f", result.RPS*float64(keysPerRequest)),
 		}
 		fmt.Printf("row: %v\n", row)
 		if err := writer.Write(row); err != nil {
@@ -248,6 +265,52 @@ func runBenchmark(config Config, name, method string, data interface{}) (*Benchm
 	return &result, nil
 }
 
+type keyValue struct {
+	Key   string `json:"key"`
+	Value string `json:"value"`
+}
+
+// runBatchBenchmarks runs MultiPut, MultiGet and MultiDelete with
+// config.BatchSize keys per request.
+func runBatchBenchmarks(config Config, keys, values []string) ([]BenchmarkResult, error) {
+	n := config.BatchSize
+	if n < 1 || n > len(keys) {
+		n = len(keys)
+	}
+	batchKeys := make([]string, n)
+	entries := make([]keyValue, n)
+	for i := 0; i < n; i++ {
+		batchKeys[i] = encodeBase64(keys[i])
+		entries[i] = keyValue{Key: batchKeys[i], Value: encodeBase64(values[i])}
+	}
+
+	runs := []struct {
+		name, method string
+		data         interface{}
+	}{
+		{"multi_put", "MultiPut", struct {
+			Entries []keyValue `json:"entries"`
+		}{entries}},
+		{"multi_get", "MultiGet", struct {
+			Keys []string `json:"keys"`
+		}{batchKeys}},
+		{"multi_delete", "MultiDelete", struct {
+			Keys []string `json:"keys"`
+		}{batchKeys}},
+	}
+
+	var results []BenchmarkResult
+	for _, run := range runs {
+		result, err := runBenchmark(config, run.name, run.method, run.data)
+		if err != nil {
+			return nil, fmt.Errorf("failed to run %s benchmark: %v", run.method, err)
+		}
+		result.KeysPerRequest = n
+		results = append(results, *result)
+	}
+	return results, nil
+}
+
 // RunBenchmarks executes all benchmarks with the given configuration
 func RunBenchmarks(config Config) error {
 	// Generate test data
@@ -267,6 +330,7 @@ func RunBenchmarks(config Config) error {
 	if err != nil {
 		return fmt.Errorf("failed to run Put benchmark: %v", err)
 	}
+	putResult.KeysPerRequest = 1
 	results = append(results, *putResult)
 
 	// Benchmark Get operations
@@ -279,6 +343,7 @@ func RunBenchmarks(config Config) error {
 	if err != nil {
 		return fmt.Errorf("failed to run Get benchmark: %v", err)
 	}
+	getResult.KeysPerRequest = 1
 	results = append(results, *getResult)
 
 	// Benchmark Delete operations
@@ -291,8 +356,16 @@ func RunBenchmarks(config Config) error {
 	if err != nil {
 		return fmt.Errorf("failed to run Delete benchmark: %v", err)
 	}
+	deleteResult.KeysPerRequest = 1
 	results = append(results, *deleteResult)
 
+	// Benchmark the batch RPCs over the first BatchSize keys
+	batchResults, err := runBatchBenchmarks(config, keys, values)
+	if err != nil {
+		return err
+	}
+	results = append(results, batchResults...)
+
 	// Save all results to CSV
 	if err := saveResultsToCSV(results, config); err != nil {
 		return fmt.Errorf("failed to save results to CSV: %v", err)
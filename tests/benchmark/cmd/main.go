@@ -15,6 +15,7 @@ func main() {
 	totalRequests := flag.Int("requests", 1000, "Total number of requests")
 	protoFile := flag.String("proto", "../../proto/kvstore.proto", "Path to proto file")
 	tag := flag.String("tag", "", "Tag to identify this benchmark run")
+	batchSize := flag.Int("batch", 100, "Keys per MultiGet/MultiPut/MultiDelete request")
 	flag.Parse()
 
 	// Create benchmark configuration
@@ -24,6 +25,7 @@ func main() {
 		TotalRequests: *totalRequests,
 		ProtoFile:     *protoFile,
 		Tag:           *tag,
+		BatchSize:     *batchSize,
 	}
 
 	// Run benchmarks
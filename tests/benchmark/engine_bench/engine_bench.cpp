@@ -0,0 +1,226 @@
+// Storage-engine microbenchmarks on Google Benchmark.
+//
+// Every engine the server can run on (built through MapFactory from the
+// same JSON as runtime_config.json) is driven with string keys and values,
+// from 1 up to the machine's thread count, over a preloaded key space:
+//
+//   Mixed/<engine>/read_pct:<%>/value:<bytes>/threads:<n>
+//       Gets and Puts (overwrites of existing keys) in the given ratio on
+//       uniformly random keys. Google Benchmark times whole batches, so
+//       there is no clock call per operation; items_per_second is the
+//       aggregate across threads.
+//   MemoryPerKey/<engine>/value:<bytes>
+//       Heap growth from loading the key space into a fresh engine,
+//       reported per key and as overhead beyond the key and value bytes.
+//
+// Run from the build directory:
+//   ./engine_bench --keys=1000000 --benchmark_filter='Mixed/sharded_hash'
+//   ./engine_bench --benchmark_format=csv > engines.csv
+// --keys sets the key-space size (default 200000) and --max_threads the
+// largest thread count (default: hardware threads); every other flag goes
+// to Google Benchmark.
+#include <benchmark/benchmark.h>
+#include <malloc.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/MapFactory.h"
+#include "map/SlabAllocator.h"
+
+using namespace kvstore;
+
+namespace {
+
+size_t g_num_keys = 200000;
+int g_max_threads =
+    static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+const char *const kEngines[] = {"skiplist", "sharded_hash", "lsm", "std_map",
+                                "boost_map"};
+
+nlohmann::json engineConfig(const std::string &engine,
+                            const std::string &lsm_dir) {
+  // Mirrors the map_options defaults in runtime_config.json.
+  return {{"map_type", engine},
+          {"map_options",
+           {{"sharded_hash",
+             {{"num_shards", 64},
+              {"initial_capacity", 1024},
+              {"load_factor", 0.75}}},
+            {"lsm", {{"dir", lsm_dir}}},
+            {"striped", {{"num_stripes", 64}}},
+            {"boost_map", {{"initial_size", 1000}, {"load_factor", 0.75}}},
+            {"std_map", {{"initial_size", 1000}}}}}};
+}
+
+// An engine instance; an LSM gets a directory of its own, removed with it.
+struct Engine {
+  explicit Engine(const std::string &engine) {
+    static int next = 0;
+    if (engine == "lsm") {
+      dir = "engine_bench.lsm." + std::to_string(next++);
+      std::filesystem::remove_all(dir);
+    }
+    map = MapFactory<std::string, std::string>::createConcurrentMap(
+        engineConfig(engine, dir));
+  }
+  ~Engine() {
+    map.reset();
+    if (!dir.empty())
+      std::filesystem::remove_all(dir);
+  }
+
+  std::unique_ptr<IConcurrentMap> map;
+  std::string dir;
+};
+
+// Fixed-width keys in shuffled order, so neighbouring ids don't share a
+// shard or land next to each other in an ordered index.
+const std::vector<std::string> &keys() {
+  static const std::vector<std::string> keys = [] {
+    std::vector<std::string> keys(g_num_keys);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      char buf[24];
+      std::snprintf(buf, sizeof(buf), "user%012zu", i);
+      keys[i] = buf;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+    return keys;
+  }();
+  return keys;
+}
+
+void load(IConcurrentMap &map, size_t value_size) {
+  const std::string value(value_size, 'v');
+  map.reserve(keys().size());
+  for (const auto &key : keys())
+    map.put(key, value);
+}
+
+// The engine the Mixed benchmarks share: preloaded once per engine and
+// value size, then reused across read ratios and thread counts (writes
+// only overwrite, so the key space stays the same). Only one is alive at a
+// time to bound memory.
+IConcurrentMap &sharedEngine(const std::string &engine, size_t value_size) {
+  static std::mutex mutex;
+  static std::string current;
+  static std::unique_ptr<Engine> instance;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string id = engine + "/" + std::to_string(value_size);
+  if (id != current) {
+    instance.reset();
+    instance = std::make_unique<Engine>(engine);
+    load(*instance->map, value_size);
+    current = id;
+  }
+  return *instance->map;
+}
+
+void mixed(benchmark::State &state, const std::string &engine) {
+  const size_t value_size = static_cast<size_t>(state.range(0));
+  const int read_pct = static_cast<int>(state.range(1));
+  IConcurrentMap &map = sharedEngine(engine, value_size);
+  const auto &key_space = keys();
+  const std::string value(value_size, 'w');
+  std::string out;
+  out.reserve(value_size);
+  // xorshift keeps the per-op cost of choosing a key and op negligible.
+  uint64_t x = 0x9E3779B97F4A7C15ull * (state.thread_index() + 1);
+  for (auto _ : state) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    const std::string &key = key_space[x % key_space.size()];
+    if (static_cast<int>((x >> 40) % 100) < read_pct)
+      benchmark::DoNotOptimize(map.get(key, out));
+    else
+      benchmark::DoNotOptimize(map.put(key, value));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Bytes held for live allocations. Record payloads come from the global
+// SlabAllocator, whose pages outlive the engines that used them (a later
+// engine reuses them without growing the heap), so those are counted as
+// the slab's live size-class bytes instead of the pages it reserved.
+size_t liveBytes() {
+  struct mallinfo2 info = ::mallinfo2();
+  SlabAllocator::Stats slab = SlabAllocator::global().stats();
+  return info.uordblks + info.hblkhd - slab.pages * SlabAllocator::kPageSize +
+         slab.bytes_allocated;
+}
+
+void memoryPerKey(benchmark::State &state, const std::string &engine) {
+  const size_t value_size = static_cast<size_t>(state.range(0));
+  keys(); // build the key list outside the measurement
+  double per_key = 0;
+  for (auto _ : state) {
+    size_t before = liveBytes();
+    auto instance = std::make_unique<Engine>(engine);
+    load(*instance->map, value_size);
+    per_key = (static_cast<double>(liveBytes()) - before) / keys().size();
+    state.PauseTiming();
+    instance.reset();
+    state.ResumeTiming();
+  }
+  double payload = keys()[0].size() + value_size;
+  state.counters["bytes_per_key"] = per_key;
+  state.counters["overhead_per_key"] = per_key - payload;
+  state.SetItemsProcessed(state.iterations() * keys().size());
+}
+
+void registerBenchmarks() {
+  for (const char *engine : kEngines) {
+    benchmark::RegisterBenchmark(
+        (std::string("Mixed/") + engine).c_str(),
+        [engine](benchmark::State &state) { mixed(state, engine); })
+        // The first argument varies fastest: keeping the value size
+        // outermost loads each engine once per size.
+        ->ArgsProduct({{100, 95, 50}, {100, 1024}})
+        ->ArgNames({"read_pct", "value"})
+        ->ThreadRange(1, g_max_threads)
+        ->UseRealTime();
+    benchmark::RegisterBenchmark(
+        (std::string("MemoryPerKey/") + engine).c_str(),
+        [engine](benchmark::State &state) { memoryPerKey(state, engine); })
+        ->Arg(100)
+        ->Arg(1024)
+        ->ArgName("value")
+        ->Iterations(1)
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // Pull out our own flags; Google Benchmark rejects ones it doesn't know.
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--keys=", 7) == 0)
+      g_num_keys =
+          std::max<size_t>(1, std::strtoull(argv[i] + 7, nullptr, 10));
+    else if (std::strncmp(argv[i], "--max_threads=", 14) == 0)
+      g_max_threads = std::max(1, std::atoi(argv[i] + 14));
+    else
+      argv[kept++] = argv[i];
+  }
+  argc = kept;
+  registerBenchmarks();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kvstore {
+namespace loadgen {
+
+// Splits "name:a:b" into {"name", "a", "b"}.
+inline std::vector<std::string> splitSpec(const std::string &spec) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (true) {
+    size_t colon = spec.find(':', start);
+    parts.push_back(spec.substr(start, colon - start));
+    if (colon == std::string::npos)
+      return parts;
+    start = colon + 1;
+  }
+}
+
+inline double specNumber(const std::vector<std::string> &parts, size_t i,
+                         const std::string &spec) {
+  if (i >= parts.size())
+    throw std::invalid_argument("missing parameter in '" + spec + "'");
+  size_t used = 0;
+  double value = 0;
+  try {
+    value = std::stod(parts[i], &used);
+  } catch (const std::exception &) {
+  }
+  if (used == 0 || used != parts[i].size())
+    throw std::invalid_argument("bad number '" + parts[i] + "' in '" + spec +
+                                "'");
+  return value;
+}
+
+// Picks which of `num_keys` keys an operation touches.
+//   uniform             every key equally likely
+//   zipf:<s>            rank r (from 0) has weight 1/(r+1)^s; s may be >= 1
+//   hotspot:<keys>:<ops> the first <keys> fraction of the key space gets
+//                       the <ops> fraction of operations, uniformly within
+//                       each part (e.g. hotspot:0.01:0.9)
+// Ranks are scattered over the key space by a fixed permutation, so the
+// popular keys aren't neighbours in key order or in one server shard.
+class KeyChooser {
+public:
+  KeyChooser(const std::string &spec, uint64_t num_keys)
+      : num_keys_(num_keys) {
+    if (num_keys == 0)
+      throw std::invalid_argument("key space is empty");
+    auto parts = splitSpec(spec);
+    if (parts[0] == "uniform" && parts.size() == 1) {
+      kind_ = Kind::kUniform;
+    } else if (parts[0] == "zipf" && parts.size() == 2) {
+      kind_ = Kind::kZipf;
+      double s = specNumber(parts, 1, spec);
+      if (s <= 0)
+        throw std::invalid_argument("zipf exponent must be positive");
+      // Inverse-CDF table: one double per key, O(log n) per draw.
+      cdf_.resize(num_keys);
+      double sum = 0;
+      for (uint64_t r = 0; r < num_keys; ++r)
+        cdf_[r] = sum += std::pow(static_cast<double>(r + 1), -s);
+      for (double &c : cdf_)
+        c /= sum;
+    } else if (parts[0] == "hotspot" && parts.size() == 3) {
+      kind_ = Kind::kHotspot;
+      double keys = specNumber(parts, 1, spec);
+      hot_ops_ = specNumber(parts, 2, spec);
+      if (keys <= 0 || keys > 1 || hot_ops_ < 0 || hot_ops_ > 1)
+        throw std::invalid_argument("hotspot fractions must be in (0, 1]");
+      hot_keys_ = std::max<uint64_t>(
+          1, static_cast<uint64_t>(keys * static_cast<double>(num_keys)));
+    } else {
+      throw std::invalid_argument("unknown key distribution '" + spec + "'");
+    }
+    // An odd multiplier near 2^64/phi, bumped until it is coprime with
+    // num_keys, makes rank -> rank * multiplier mod num_keys a bijection.
+    multiplier_ = 0x9E3779B97F4A7C15ull % num_keys_ | 1;
+    while (gcd(multiplier_, num_keys_) != 1)
+      multiplier_ += 2;
+  }
+
+  // Popularity rank of the next key: 0 is the hottest.
+  template <typename Rng> uint64_t nextRank(Rng &rng) const {
+    switch (kind_) {
+    case Kind::kUniform:
+      return below(rng, num_keys_);
+    case Kind::kZipf: {
+      double u = std::uniform_real_distribution<double>(0, 1)(rng);
+      auto it = std::lower_bound(cdf_.begin(), cdf_.end(), u);
+      return std::min<uint64_t>(it - cdf_.begin(), num_keys_ - 1);
+    }
+    case Kind::kHotspot:
+      if (hot_keys_ == num_keys_ ||
+          std::uniform_real_distribution<double>(0, 1)(rng) < hot_ops_)
+        return below(rng, hot_keys_);
+      return hot_keys_ + below(rng, num_keys_ - hot_keys_);
+    }
+    return 0;
+  }
+
+  // Index in [0, num_keys) of the key with popularity `rank`.
+  uint64_t keyIndex(uint64_t rank) const {
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(rank) *
+                                 multiplier_ % num_keys_);
+  }
+
+  template <typename Rng> uint64_t next(Rng &rng) const {
+    return keyIndex(nextRank(rng));
+  }
+
+  uint64_t numKeys() const { return num_keys_; }
+
+private:
+  enum class Kind { kUniform, kZipf, kHotspot };
+
+  template <typename Rng> static uint64_t below(Rng &rng, uint64_t n) {
+    return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng);
+  }
+
+  static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b != 0)
+      a = std::exchange(b, a % b);
+    return a;
+  }
+
+  const uint64_t num_keys_;
+  Kind kind_ = Kind::kUniform;
+  std::vector<double> cdf_;
+  uint64_t hot_keys_ = 0;
+  double hot_ops_ = 0;
+  uint64_t multiplier_ = 1;
+};
+
+// Value sizes for writes, in bytes.
+//   fixed:<n>
+//   uniform:<min>:<max>  inclusive
+//   exp:<mean>:<max>     exponential with the given mean, capped at max;
+//                        mostly small values with a long tail
+class ValueSizer {
+public:
+  explicit ValueSizer(const std::string &spec) {
+    auto parts = splitSpec(spec);
+    if (parts[0] == "fixed" && parts.size() == 2) {
+      kind_ = Kind::kFixed;
+      min_ = max_ = size(parts, 1, spec);
+    } else if (parts[0] == "uniform" && parts.size() == 3) {
+      kind_ = Kind::kUniform;
+      min_ = size(parts, 1, spec);
+      max_ = size(parts, 2, spec);
+    } else if (parts[0] == "exp" && parts.size() == 3) {
+      kind_ = Kind::kExponential;
+      mean_ = specNumber(parts, 1, spec);
+      max_ = size(parts, 2, spec);
+      if (mean_ <= 0)
+        throw std::invalid_argument("exp mean must be positive");
+    } else {
+      throw std::invalid_argument("unknown value size distribution '" + spec +
+                                  "'");
+    }
+    if (min_ > max_)
+      throw std::invalid_argument("value size min exceeds max in '" + spec +
+                                  "'");
+  }
+
+  template <typename Rng> size_t next(Rng &rng) const {
+    switch (kind_) {
+    case Kind::kFixed:
+      return max_;
+    case Kind::kUniform:
+      return std::uniform_int_distribution<size_t>(min_, max_)(rng);
+    case Kind::kExponential: {
+      double n = std::exponential_distribution<double>(1 / mean_)(rng);
+      return std::min(max_, static_cast<size_t>(n));
+    }
+    }
+    return max_;
+  }
+
+  // Upper bound of next(), for sizing the shared value buffer.
+  size_t max() const { return max_; }
+
+private:
+  enum class Kind { kFixed, kUniform, kExponential };
+
+  static size_t size(const std::vector<std::string> &parts, size_t i,
+                     const std::string &spec) {
+    double n = specNumber(parts, i, spec);
+    if (n < 0)
+      throw std::invalid_argument("negative size in '" + spec + "'");
+    return static_cast<size_t>(n);
+  }
+
+  Kind kind_ = Kind::kFixed;
+  size_t min_ = 0;
+  size_t max_ = 0;
+  double mean_ = 0;
+};
+
+// Intended send times of an open-loop sender, as nanosecond offsets from
+// the start of the run. They depend only on the rate, never on how fast
+// responses come back, which is what keeps a slow server from throttling
+// the load it is measured under. `poisson` spaces requests by exponential
+// gaps (independent arrivals); `uniform` spaces them evenly.
+class ArrivalSchedule {
+public:
+  ArrivalSchedule(double ops_per_sec, bool poisson)
+      : gap_ns_(1e9 / ops_per_sec), poisson_(poisson) {
+    if (!(ops_per_sec > 0))
+      throw std::invalid_argument("rate must be positive");
+  }
+
+  // Intended time of the next request; advances the schedule.
+  template <typename Rng> uint64_t next(Rng &rng) {
+    uint64_t at = static_cast<uint64_t>(next_ns_);
+    next_ns_ += poisson_ ? std::exponential_distribution<double>(1)(rng) *
+                               gap_ns_
+                         : gap_ns_;
+    return at;
+  }
+
+  // Intended time of the request next() will return, without advancing.
+  uint64_t peek() const { return static_cast<uint64_t>(next_ns_); }
+
+private:
+  const double gap_ns_;
+  const bool poisson_;
+  double next_ns_ = 0;
+};
+
+} // namespace loadgen
+} // namespace kvstore
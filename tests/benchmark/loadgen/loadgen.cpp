@@ -0,0 +1,498 @@
+// Open-loop load generator for the KeyValueStore service.
+//
+// Unlike the ghz harness in benchmark.go, which runs a fixed number of
+// requests from a fixed number of workers, requests here are sent on a
+// schedule set only by --rate, whether or not earlier ones have returned.
+// Each latency is measured from the request's *intended* send time, so a
+// server that stalls is charged for every request queued behind the stall
+// rather than just the one that hit it (coordinated-omission correction).
+// The uncorrected service time, from the actual send, is printed alongside
+// for comparison.
+//
+// Each connection has its own channel, completion queue and thread, which
+// both sends on schedule and reaps completions. Gets and Puts are mixed by
+// --read_ratio; keys and value sizes follow the distributions in
+// Workload.h. Latencies go into HDR histograms and are written as one row
+// per operation to results/benchmark_results_<time>[_<tag>].csv, in the
+// same columns as benchmark.go plus the target rate and deeper tails.
+//
+//   ./loadgen --rate=50000 --duration_s=30 --key_dist=zipf:0.99 \
+//       --value_size=exp:256:65536 --read_ratio=0.95 --tag=zipf
+#include <grpcpp/grpcpp.h>
+#include <kvstore.grpc.pb.h>
+#include <kvstore.pb.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "metrics/LatencyHistogram.h"
+#include "tests/benchmark/loadgen/Workload.h"
+
+using Clock = std::chrono::steady_clock;
+using kvstore::LatencyHistogram;
+using kvstore::loadgen::ArrivalSchedule;
+using kvstore::loadgen::KeyChooser;
+using kvstore::loadgen::ValueSizer;
+
+namespace {
+
+struct Options {
+  std::string server = "localhost:50051";
+  double rate = 10000;  // requests/s, across all connections
+  double duration_s = 10;
+  double warmup_s = 2;  // sent on schedule but not recorded
+  int connections = 4;
+  int max_inflight = 4096; // per connection
+  double read_ratio = 0.9;
+  uint64_t keys = 100000;
+  std::string key_dist = "zipf:0.99";
+  std::string value_size = "fixed:100";
+  std::string arrivals = "poisson";
+  int deadline_ms = 1000;
+  bool preload = true;
+  uint64_t seed = 1;
+  std::string tag;
+  std::string results_dir = "results";
+};
+
+void usage(const Options &d) {
+  std::cerr
+      << "usage: loadgen [--flag=value ...]\n"
+      << "  --server=" << d.server << "\n"
+      << "  --rate=" << d.rate << "            requests/s in total\n"
+      << "  --duration_s=" << d.duration_s << "        measured seconds\n"
+      << "  --warmup_s=" << d.warmup_s << "  unrecorded seconds first\n"
+      << "  --connections=" << d.connections << "\n"
+      << "  --max_inflight=" << d.max_inflight << "     per connection\n"
+      << "  --read_ratio=" << d.read_ratio << "       fraction of Gets\n"
+      << "  --keys=" << d.keys << "\n"
+      << "  --key_dist=" << d.key_dist
+      << "   uniform | zipf:<s> | hotspot:<keys>:<ops>\n"
+      << "  --value_size=" << d.value_size
+      << "  fixed:<n> | uniform:<min>:<max> | exp:<mean>:<max>\n"
+      << "  --arrivals=" << d.arrivals << "     poisson | uniform\n"
+      << "  --deadline_ms=" << d.deadline_ms << "\n"
+      << "  --preload=" << d.preload << "          Put every key first\n"
+      << "  --seed=" << d.seed << "\n"
+      << "  --tag=                 suffix for the results file\n"
+      << "  --results_dir=" << d.results_dir << "\n";
+}
+
+bool parseOptions(int argc, char **argv, Options &o) {
+  std::map<std::string, std::string> flags;
+  for (int i = 1; i < argc; ++i) {
+    const char *eq = std::strchr(argv[i], '=');
+    if (std::strncmp(argv[i], "--", 2) != 0 || eq == nullptr)
+      return false;
+    flags[std::string(argv[i] + 2, eq - argv[i] - 2)] = eq + 1;
+  }
+  auto take = [&](const char *name, auto &field) {
+    auto it = flags.find(name);
+    if (it == flags.end())
+      return;
+    using T = std::decay_t<decltype(field)>;
+    if constexpr (std::is_same_v<T, std::string>)
+      field = it->second;
+    else if constexpr (std::is_same_v<T, bool>)
+      field = it->second == "1" || it->second == "true";
+    else if constexpr (std::is_floating_point_v<T>)
+      field = std::stod(it->second);
+    else
+      field = static_cast<T>(std::stoull(it->second));
+    flags.erase(it);
+  };
+  try {
+    take("server", o.server);
+    take("rate", o.rate);
+    take("duration_s", o.duration_s);
+    take("warmup_s", o.warmup_s);
+    take("connections", o.connections);
+    take("max_inflight", o.max_inflight);
+    take("read_ratio", o.read_ratio);
+    take("keys", o.keys);
+    take("key_dist", o.key_dist);
+    take("value_size", o.value_size);
+    take("arrivals", o.arrivals);
+    take("deadline_ms", o.deadline_ms);
+    take("preload", o.preload);
+    take("seed", o.seed);
+    take("tag", o.tag);
+    take("results_dir", o.results_dir);
+  } catch (const std::exception &) {
+    return false;
+  }
+  for (const auto &flag : flags)
+    std::cerr << "unknown flag --" << flag.first << "\n";
+  return flags.empty() && o.connections > 0 && o.max_inflight > 0 &&
+         o.duration_s > 0 && o.warmup_s >= 0 && o.read_ratio >= 0 &&
+         o.read_ratio <= 1 && (o.arrivals == "poisson" ||
+                               o.arrivals == "uniform");
+}
+
+std::string keyName(uint64_t index) { return "key-" + std::to_string(index); }
+
+std::shared_ptr<grpc::Channel> makeChannel(const std::string &address,
+                                           int id) {
+  // A distinct channel arg keeps gRPC from sharing one connection.
+  grpc::ChannelArguments args;
+  args.SetInt("kvstore.connection_id", id);
+  return grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(),
+                                   args);
+}
+
+enum Op { kGet, kPut, kOps };
+const char *const kOpNames[kOps] = {"get", "put"};
+
+// Results of one connection; merged once its thread has finished.
+struct OpStats {
+  LatencyHistogram corrected;   // from intended send time
+  LatencyHistogram uncorrected; // from actual send time
+  uint64_t errors = 0;
+  uint64_t misses = 0; // Gets of absent keys; not errors
+};
+
+struct Call {
+  Op op;
+  uint64_t intended_ns; // offsets from the run's start
+  uint64_t sent_ns;
+  grpc::ClientContext ctx;
+  grpc::Status status;
+  kvstore::GetRequest get_request;
+  kvstore::GetResponse get_response;
+  kvstore::PutRequest put_request;
+  kvstore::PutResponse put_response;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<kvstore::GetResponse>> get;
+  std::unique_ptr<grpc::ClientAsyncResponseReader<kvstore::PutResponse>> put;
+};
+
+class Connection {
+public:
+  Connection(const Options &options, int id, const KeyChooser &keys,
+             const ValueSizer &sizes, const std::string &value_bytes)
+      : options_(options), keys_(keys), sizes_(sizes),
+        value_bytes_(value_bytes),
+        stub_(kvstore::KeyValueStore::NewStub(
+            makeChannel(options.server, id))),
+        rng_(options.seed * 1000003 + id),
+        schedule_(options.rate / options.connections,
+                  options.arrivals == "poisson") {}
+
+  // Writes keys [begin, end), closed-loop with a small window so the
+  // server isn't swamped into missing deadlines. Returns how many failed.
+  uint64_t preload(uint64_t begin, uint64_t end) {
+    const int window = std::min(options_.max_inflight, 64);
+    uint64_t failed = 0, next = begin;
+    int inflight = 0;
+    while (next < end || inflight > 0) {
+      while (next < end && inflight < window) {
+        start(kPut, next++, 0, 0);
+        ++inflight;
+      }
+      void *tag;
+      bool ok;
+      if (!cq_.Next(&tag, &ok))
+        break;
+      std::unique_ptr<Call> call(static_cast<Call *>(tag));
+      failed += !ok || !call->status.ok() || !call->put_response.success();
+      --inflight;
+    }
+    return failed;
+  }
+
+  // Sends on schedule from `start` until `end_ns` has passed, then waits
+  // for the stragglers.
+  void run(Clock::time_point start, uint64_t warmup_ns, uint64_t end_ns) {
+    start_ = start;
+    warmup_ns_ = warmup_ns;
+    std::uniform_real_distribution<double> coin(0, 1);
+    int inflight = 0;
+    while (true) {
+      uint64_t now = sinceStart();
+      // Everything that is due goes out now, late or not; a late send
+      // still counts its latency from when it was due.
+      while (schedule_.peek() <= now && schedule_.peek() < end_ns &&
+             inflight < options_.max_inflight) {
+        Op op = coin(rng_) < options_.read_ratio ? kGet : kPut;
+        uint64_t intended = schedule_.next(rng_);
+        this->start(op, keys_.next(rng_), intended, sinceStart());
+        ++inflight;
+      }
+      bool sending = schedule_.peek() < end_ns;
+      if (!sending && inflight == 0)
+        return;
+      // Sleep in the CQ until a completion or the next send is due. With
+      // max_inflight reached, or nothing left to send, only a completion
+      // can make progress (and the RPC deadline bounds the wait).
+      void *tag;
+      bool ok;
+      if (sending && inflight < options_.max_inflight) {
+        // gRPC takes system_clock deadlines; the schedule is steady_clock.
+        auto wait = std::chrono::nanoseconds(schedule_.peek() - now);
+        auto status = cq_.AsyncNext(
+            &tag, &ok, std::chrono::system_clock::now() + wait);
+        if (status == grpc::CompletionQueue::SHUTDOWN)
+          return;
+        if (status == grpc::CompletionQueue::TIMEOUT)
+          continue;
+      } else if (!cq_.Next(&tag, &ok)) {
+        return;
+      }
+      complete(std::unique_ptr<Call>(static_cast<Call *>(tag)), ok);
+      --inflight;
+    }
+  }
+
+  void shutdown() {
+    cq_.Shutdown();
+    void *tag;
+    bool ok;
+    while (cq_.Next(&tag, &ok))
+      delete static_cast<Call *>(tag);
+  }
+
+  const OpStats &stats(Op op) const { return stats_[op]; }
+
+  // How late requests went out; large values mean the generator, not the
+  // server, is the bottleneck.
+  const LatencyHistogram &sendLag() const { return send_lag_; }
+
+private:
+  uint64_t sinceStart() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start_)
+        .count();
+  }
+
+  void start(Op op, uint64_t key, uint64_t intended, uint64_t sent) {
+    auto *call = new Call;
+    call->op = op;
+    call->intended_ns = intended;
+    call->sent_ns = sent;
+    call->ctx.set_deadline(std::chrono::system_clock::now() +
+                           std::chrono::milliseconds(options_.deadline_ms));
+    if (op == kGet) {
+      call->get_request.set_key(keyName(key));
+      call->get = stub_->PrepareAsyncGet(&call->ctx, call->get_request, &cq_);
+      call->get->StartCall();
+      call->get->Finish(&call->get_response, &call->status, call);
+    } else {
+      call->put_request.set_key(keyName(key));
+      // Any window of the random buffer will do as a value.
+      size_t size = sizes_.next(rng_);
+      size_t offset = std::uniform_int_distribution<size_t>(
+          0, value_bytes_.size() - size)(rng_);
+      call->put_request.set_value(value_bytes_.data() + offset, size);
+      call->put = stub_->PrepareAsyncPut(&call->ctx, call->put_request, &cq_);
+      call->put->StartCall();
+      call->put->Finish(&call->put_response, &call->status, call);
+    }
+  }
+
+  void complete(std::unique_ptr<Call> call, bool ok) {
+    uint64_t now = sinceStart();
+    if (call->intended_ns < warmup_ns_)
+      return;
+    OpStats &stats = stats_[call->op];
+    stats.corrected.record(now - call->intended_ns);
+    stats.uncorrected.record(now - call->sent_ns);
+    send_lag_.record(call->sent_ns - call->intended_ns);
+    if (!ok || !call->status.ok() ||
+        (call->op == kPut && !call->put_response.success()))
+      ++stats.errors;
+    else if (call->op == kGet && !call->get_response.found())
+      ++stats.misses;
+  }
+
+  const Options &options_;
+  const KeyChooser &keys_;
+  const ValueSizer &sizes_;
+  const std::string &value_bytes_;
+  std::unique_ptr<kvstore::KeyValueStore::Stub> stub_;
+  grpc::CompletionQueue cq_;
+  std::mt19937_64 rng_;
+  ArrivalSchedule schedule_;
+  Clock::time_point start_;
+  uint64_t warmup_ns_ = 0;
+  OpStats stats_[kOps];
+  LatencyHistogram send_lag_;
+};
+
+struct Merged {
+  LatencyHistogram::Snapshot corrected, uncorrected;
+  uint64_t errors = 0, misses = 0;
+};
+
+std::string fileTimestamp(std::time_t t) {
+  char buf[32];
+  std::strftime(buf, sizeof(buf), "%Y-%m-%d_%H-%M-%S", std::localtime(&t));
+  return buf;
+}
+
+// RFC 3339 with the local offset, as benchmark.go writes it.
+std::string rfc3339(std::time_t t) {
+  char buf[40], zone[8];
+  std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", std::localtime(&t));
+  std::strftime(zone, sizeof(zone), "%z", std::localtime(&t));
+  return std::string(buf) + std::string(zone, 3) + ":" + (zone + 3);
+}
+
+std::string ms(double nanos) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.2f", nanos / 1e6);
+  return buf;
+}
+
+std::string fixed(double value, int digits) {
+  char buf[48];
+  std::snprintf(buf, sizeof(buf), "%.*f", digits, value);
+  return buf;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage(Options{});
+    return 2;
+  }
+
+  std::unique_ptr<KeyChooser> keys;
+  std::unique_ptr<ValueSizer> sizes;
+  try {
+    keys = std::make_unique<KeyChooser>(options.key_dist, options.keys);
+    sizes = std::make_unique<ValueSizer>(options.value_size);
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+  std::string value_bytes(std::max<size_t>(sizes->max(), 1) * 2, '\0');
+  std::mt19937_64 fill(options.seed);
+  for (char &c : value_bytes)
+    c = static_cast<char>('a' + fill() % 26);
+
+  std::vector<std::unique_ptr<Connection>> connections;
+  for (int c = 0; c < options.connections; ++c)
+    connections.push_back(std::make_unique<Connection>(options, c, *keys,
+                                                       *sizes, value_bytes));
+
+  auto parallel = [&](auto body) {
+    std::vector<std::thread> threads;
+    for (int c = 0; c < options.connections; ++c)
+      threads.emplace_back(body, c);
+    for (auto &t : threads)
+      t.join();
+  };
+
+  if (options.preload) {
+    std::cout << "Preloading " << options.keys << " keys...\n";
+    std::atomic<uint64_t> failed{0};
+    uint64_t per = (options.keys + options.connections - 1) /
+                   options.connections;
+    parallel([&](int c) {
+      uint64_t begin = std::min(options.keys, c * per);
+      failed += connections[c]->preload(
+          begin, std::min(options.keys, begin + per));
+    });
+    if (failed > 0) {
+      std::cerr << failed << " preload Puts failed; is the server at "
+                << options.server << "?\n";
+      return 1;
+    }
+  }
+
+  std::cout << "Benchmarking with " << options.rate << " req/s ("
+            << options.arrivals << "), " << options.connections
+            << " connections, " << options.read_ratio * 100 << "% Gets, keys "
+            << options.key_dist << " over " << options.keys << ", values "
+            << options.value_size << "...\n";
+  uint64_t warmup_ns = static_cast<uint64_t>(options.warmup_s * 1e9);
+  uint64_t end_ns = warmup_ns + static_cast<uint64_t>(options.duration_s * 1e9);
+  auto start = Clock::now();
+  parallel([&](int c) { connections[c]->run(start, warmup_ns, end_ns); });
+  // From the end of warmup until the last straggler came back.
+  double total_s =
+      std::chrono::duration<double>(Clock::now() - start).count() -
+      options.warmup_s;
+  for (auto &connection : connections)
+    connection->shutdown();
+
+  Merged merged[kOps + 1]; // the last is all operations together
+  LatencyHistogram::Snapshot send_lag;
+  for (auto &connection : connections) {
+    connection->sendLag().mergeInto(send_lag);
+    for (int op = 0; op < kOps; ++op) {
+      const OpStats &stats = connection->stats(static_cast<Op>(op));
+      for (Merged *m : {&merged[op], &merged[kOps]}) {
+        stats.corrected.mergeInto(m->corrected);
+        stats.uncorrected.mergeInto(m->uncorrected);
+        m->errors += stats.errors;
+        m->misses += stats.misses;
+      }
+    }
+  }
+
+  ::mkdir(options.results_dir.c_str(), 0755);
+  std::time_t now = std::time(nullptr);
+  std::string path = options.results_dir + "/benchmark_results_" +
+                     fileTimestamp(now) +
+                     (options.tag.empty() ? "" : "_" + options.tag) + ".csv";
+  std::ofstream out(path);
+  out << "Timestamp,Operation,Total Requests,Concurrency,Total Time (s),"
+         "Average Latency (ms),Fastest (ms),Slowest (ms),RPS,Error Count,"
+         "Error Rate,P10 (ms),P25 (ms),P50 (ms),P75 (ms),P90 (ms),P95 (ms),"
+         "P99 (ms),Keys Per Request,Per-Key Average Latency (ms),Keys/s,"
+         "Target RPS,P99.9 (ms),P99.99 (ms)\n";
+  for (int op = 0; op <= kOps; ++op) {
+    const Merged &m = merged[op];
+    const auto &h = m.corrected;
+    const char *name = op == kOps ? "all" : kOpNames[op];
+    double rps = h.count / total_s;
+    double target = options.rate *
+                    (op == kOps  ? 1
+                     : op == kGet ? options.read_ratio
+                                  : 1 - options.read_ratio);
+    out << rfc3339(now) << "," << name << "," << h.count << ","
+        << options.connections << "," << fixed(total_s, 2) << ","
+        << ms(h.mean()) << "," << ms(h.percentile(0)) << "," << ms(h.max)
+        << "," << fixed(rps, 2) << "," << m.errors << ","
+        << fixed(h.count ? static_cast<double>(m.errors) / h.count : 0, 2);
+    for (double q : {0.10, 0.25, 0.50, 0.75, 0.90, 0.95, 0.99})
+      out << "," << ms(h.percentile(q));
+    out << ",1," << fixed(h.mean() / 1e6, 4) << "," << fixed(rps, 2) << ","
+        << fixed(target, 2) << "," << ms(h.percentile(0.999)) << ","
+        << ms(h.percentile(0.9999)) << "\n";
+
+    std::cout << name << ": " << h.count << " requests, " << m.errors
+              << " errors";
+    if (op == kGet)
+      std::cout << ", " << m.misses << " misses";
+    std::cout << "\n  corrected   p50 " << ms(h.percentile(0.5)) << " p99 "
+              << ms(h.percentile(0.99)) << " p99.9 "
+              << ms(h.percentile(0.999)) << " max " << ms(h.max) << " ms\n"
+              << "  uncorrected p50 " << ms(m.uncorrected.percentile(0.5))
+              << " p99 " << ms(m.uncorrected.percentile(0.99)) << " p99.9 "
+              << ms(m.uncorrected.percentile(0.999)) << " max "
+              << ms(m.uncorrected.max) << " ms\n";
+  }
+  std::cout << "send lag p50 " << ms(send_lag.percentile(0.5)) << " p99 "
+            << ms(send_lag.percentile(0.99)) << " max " << ms(send_lag.max)
+            << " ms\n";
+  out.close();
+  std::cout << "Done! See " << path << "\n";
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Counts heap allocations per unary RPC against an in-process AsyncKVServer,
+// with CallData pooling off (heap CallData and messages per RPC, as before)
+// and on (pooled CallData, arena messages). The count covers the whole
+// process, so it includes the synchronous client; that part is identical in
+// both modes and the difference is the server.
+//
+// Build from a configured build directory (for the generated protos):
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated allocs_per_rpc.cpp \
+//     <build>/generated/kvstore*.pb.cc $(pkg-config --libs grpc++ protobuf) \
+//     -pthread -o allocs_per_rpc
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "map/ShardedHashMap.h"
+#include "server_impl.h"
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+struct Result {
+  double put, get, del;
+};
+
+double measure(int num_rpcs, const std::function<void(int)> &rpc) {
+  for (int i = 0; i < 1000; ++i) // warm up pools, channel and caches
+    rpc(i);
+  size_t before = allocations.load();
+  for (int i = 0; i < num_rpcs; ++i)
+    rpc(i);
+  return static_cast<double>(allocations.load() - before) / num_rpcs;
+}
+
+Result run(bool pool_calls, int num_rpcs, const std::string &address) {
+  AsyncKVServer server(address, std::make_shared<kvstore::ShardedHashMap>(),
+                       pool_calls);
+  std::thread server_thread([&]() { server.Run(1, 1); });
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  auto stub = KeyValueStore::NewStub(
+      grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+  std::string value(100, 'v');
+
+  Result r;
+  r.put = measure(num_rpcs, [&](int i) {
+    PutRequest req;
+    req.set_key("key" + std::to_string(i % 1000));
+    req.set_value(value);
+    PutResponse resp;
+    grpc::ClientContext ctx;
+    stub->Put(&ctx, req, &resp);
+  });
+  r.get = measure(num_rpcs, [&](int i) {
+    GetRequest req;
+    req.set_key("key" + std::to_string(i % 1000));
+    GetResponse resp;
+    grpc::ClientContext ctx;
+    stub->Get(&ctx, req, &resp);
+  });
+  r.del = measure(num_rpcs, [&](int i) {
+    DeleteRequest req;
+    req.set_key("key" + std::to_string(i % 1000));
+    DeleteResponse resp;
+    grpc::ClientContext ctx;
+    stub->Delete(&ctx, req, &resp);
+  });
+
+  server.Shutdown();
+  server_thread.join();
+  return r;
+}
+
+int main(int argc, char **argv) {
+  int num_rpcs = argc > 1 ? std::atoi(argv[1]) : 20000;
+  std::ofstream out("allocs_per_rpc.csv");
+  out << "Mode,RPCs,Put allocs/RPC,Get allocs/RPC,Delete allocs/RPC\n";
+
+  std::cout << "Benchmarking with " << num_rpcs << " RPCs per operation...\n";
+  Result before = run(false, num_rpcs, "127.0.0.1:50061");
+  Result after = run(true, num_rpcs, "127.0.0.1:50062");
+  for (auto [mode, r] : {std::pair{"unpooled", before}, {"pooled", after}}) {
+    out << mode << "," << num_rpcs << "," << r.put << "," << r.get << ","
+        << r.del << "\n";
+    std::cout << mode << ": put " << r.put << ", get " << r.get
+              << ", delete " << r.del << " allocations/RPC\n";
+  }
+
+  out.close();
+  std::cout << "Done! See allocs_per_rpc.csv\n";
+  return 0;
+}
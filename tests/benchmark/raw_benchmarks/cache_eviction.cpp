@@ -0,0 +1,136 @@
+// Hit ratio and throughput of the cache mode (EvictingMap) with S3-FIFO
+// versus plain LRU. Each thread replays a Zipfian key trace cache-aside
+// style: Get, and Put on a miss. Traces vary the skew and one mixes in
+// sequential scans over cold keys; the cache holds 1%, 5% or 20% of the
+// key space.
+//
+// g++ -O2 -std=c++17 -I../../../src cache_eviction.cpp -pthread \
+//     -o cache_eviction
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/EvictingMap.h"
+#include "map/ShardedHashMap.h"
+
+using namespace kvstore;
+using Clock = std::chrono::steady_clock;
+
+// Inverse-CDF sampling over a precomputed table of ranks 0..n-1.
+class Zipf {
+public:
+  Zipf(size_t n, double alpha) : cdf_(n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i)
+      cdf_[i] = sum += 1.0 / std::pow(static_cast<double>(i + 1), alpha);
+    for (double &c : cdf_)
+      c /= sum;
+  }
+
+  template <typename Rng> size_t operator()(Rng &rng) const {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    return std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+  }
+
+private:
+  std::vector<double> cdf_;
+};
+
+std::string key_for(size_t rank, size_t num_keys) {
+  // Scatter the popular ranks so they don't all land in one shard.
+  size_t id = (rank * 2654435761u) % num_keys;
+  char key[32];
+  std::snprintf(key, sizeof(key), "key%010zu", id);
+  return key;
+}
+
+struct Trace {
+  const char *name;
+  double alpha;
+  bool scans; // every 200 operations end with a 64-key sequential scan
+};
+
+int main(int argc, char **argv) {
+  size_t num_keys = argc > 1 ? std::atoll(argv[1]) : 1'000'000;
+  size_t ops_per_thread = argc > 2 ? std::atoll(argv[2]) : 2'000'000;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  const std::string value(100, 'v');
+  size_t entry_bytes = EvictingMap::cost(key_for(0, num_keys), value);
+
+  std::ofstream out("cache_eviction.csv");
+  out << "Trace,Cache %,Policy,Threads,Ops,Hit ratio,Mops/s,Evictions\n";
+
+  for (Trace trace : {Trace{"zipf0.8", 0.8, false},
+                      Trace{"zipf0.99", 0.99, false},
+                      Trace{"zipf1.2", 1.2, false},
+                      Trace{"zipf0.99+scan", 0.99, true}}) {
+    Zipf zipf(num_keys, trace.alpha);
+    for (double fraction : {0.01, 0.05, 0.20}) {
+      for (const char *policy : {"s3fifo", "lru"}) {
+        for (size_t threads : {size_t{1}, max_threads}) {
+          std::cout << "Benchmarking with " << trace.name << ", "
+                    << fraction * 100 << "% cache, " << policy << ", "
+                    << threads << " threads...\n";
+          EvictingMap::Options options;
+          options.max_bytes =
+              static_cast<size_t>(fraction * num_keys) * entry_bytes;
+          options.policy = EvictingMap::parsePolicy(policy);
+          EvictingMap cache(std::make_shared<ShardedHashMap>(), options);
+
+          std::atomic<size_t> hits{0}, lookups{0};
+          std::vector<std::thread> workers;
+          auto start = Clock::now();
+          for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+              std::mt19937_64 rng(t + 1);
+              std::string got;
+              size_t local_hits = 0, local_lookups = 0;
+              size_t scan_pos = num_keys / 2 + t * (num_keys / 64);
+              for (size_t i = 0; i < ops_per_thread; ++i) {
+                std::string key;
+                bool scan_step = trace.scans && i % 200 >= 136;
+                if (scan_step) {
+                  key = key_for(scan_pos++ % num_keys, num_keys);
+                } else {
+                  key = key_for(zipf(rng), num_keys);
+                  ++local_lookups;
+                }
+                if (cache.get(key, got))
+                  local_hits += !scan_step;
+                else
+                  cache.put(key, value);
+              }
+              hits += local_hits;
+              lookups += local_lookups;
+            });
+          }
+          for (auto &worker : workers)
+            worker.join();
+          double secs =
+              std::chrono::duration<double>(Clock::now() - start).count();
+          // Scan steps count towards throughput but not the hit ratio.
+          size_t total = threads * ops_per_thread;
+          out << trace.name << "," << fraction * 100 << "," << policy << ","
+              << threads << "," << total << ","
+              << static_cast<double>(hits) / lookups << ","
+              << total / secs / 1e6 << "," << cache.stats().evictions
+              << "\n";
+        }
+      }
+    }
+  }
+
+  out.close();
+  std::cout << "Done! See cache_eviction.csv\n";
+  return 0;
+}
@@ -0,0 +1,193 @@
+// Tail latency under different CQ thread layouts. An in-process
+// AsyncKVServer is started with each topology in turn and driven at a
+// fixed Get/Put rate (15 in 16 Gets, 100k keys) by paced client threads;
+// each latency is measured from the request's scheduled send time, so
+// queueing behind a descheduled or migrating CQ thread shows up in the
+// tail. Rounds alternate between topologies so drift affects all of them.
+//
+//   os            4 CQs x 2 threads, scheduled by the OS (the old default)
+//   pinned        4 CQs x 2 threads, one CPU each, CQs spread over nodes
+//   pinned_numa   as pinned, plus node-preferred allocation
+//   pinned_1x     one CQ with a single pinned thread per server CPU
+//
+// The server's CPUs and the clients' can be split so they don't compete:
+//   ./cq_topology [server_cpus] [client_cpus] [ops_per_sec] [seconds]
+//   ./cq_topology 0-7,16-23 8-15,24-31 50000 10
+//
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated cq_topology.cpp \
+//     <build>/generated/kvstore*.pb.cc $(pkg-config --libs grpc++ protobuf) \
+//     -pthread -o cq_topology
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/ShardedHashMap.h"
+#include "metrics/LatencyHistogram.h"
+#include "runtime/CpuTopology.h"
+#include "server_impl.h"
+
+using Clock = std::chrono::steady_clock;
+using kvstore::CpuTopology;
+using kvstore::LatencyHistogram;
+
+const int kKeys = 100000;
+const int kClientThreads = 16;
+
+struct Layout {
+  const char *name;
+  AsyncKVServer::Topology topology;
+};
+
+// The process's CPUs restricted to `list` (all of them if empty), by node.
+CpuTopology restrict(const std::string &list) {
+  CpuTopology machine = CpuTopology::detect();
+  if (list.empty())
+    return machine;
+  std::vector<int> wanted = kvstore::parseCpuList(list);
+  std::vector<std::vector<int>> by_node;
+  for (size_t n = 0; n < machine.nodes().size(); ++n) {
+    size_t id = static_cast<size_t>(machine.nodeId(n));
+    by_node.resize(std::max(by_node.size(), id + 1));
+    for (int cpu : machine.nodes()[n])
+      if (std::binary_search(wanted.begin(), wanted.end(), cpu))
+        by_node[id].push_back(cpu);
+  }
+  return CpuTopology(by_node);
+}
+
+std::vector<Layout> layouts(const CpuTopology &cpus) {
+  std::vector<Layout> out;
+  AsyncKVServer::Topology os;
+  out.push_back({"os", os});
+  AsyncKVServer::Topology pinned = os;
+  pinned.thread_cpus = cpus.spread(pinned.num_cqs, pinned.threads_per_cq);
+  out.push_back({"pinned", pinned});
+  AsyncKVServer::Topology numa = pinned;
+  numa.numa_local = true;
+  out.push_back({"pinned_numa", numa});
+  AsyncKVServer::Topology one;
+  one.num_cqs = 0;
+  for (const auto &node : cpus.nodes())
+    one.num_cqs += static_cast<int>(node.size());
+  one.threads_per_cq = 1;
+  one.thread_cpus = cpus.spread(one.num_cqs, 1);
+  out.push_back({"pinned_1x", one});
+  return out;
+}
+
+// Paced clients: each thread sends at ops_per_sec / kClientThreads with
+// one request outstanding, and a late send is charged from its slot.
+void drive(const std::string &address, const std::vector<int> &client_cpus,
+           double ops_per_sec, double seconds, LatencyHistogram::Snapshot &out,
+           double &achieved) {
+  std::vector<std::unique_ptr<LatencyHistogram>> histograms;
+  for (int t = 0; t < kClientThreads; ++t)
+    histograms.push_back(std::make_unique<LatencyHistogram>());
+  std::atomic<uint64_t> done{0};
+  auto start = Clock::now() + std::chrono::milliseconds(100);
+  auto gap = std::chrono::nanoseconds(
+      static_cast<int64_t>(1e9 * kClientThreads / ops_per_sec));
+  auto end = start + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double>(seconds));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kClientThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      if (!client_cpus.empty())
+        kvstore::pinThisThread(client_cpus);
+      grpc::ChannelArguments args;
+      args.SetInt("kvstore.connection_id", t);
+      auto stub = KeyValueStore::NewStub(grpc::CreateCustomChannel(
+          address, grpc::InsecureChannelCredentials(), args));
+      uint64_t x = 0x9E3779B97F4A7C15ull * (t + 1);
+      GetRequest get;
+      GetResponse get_response;
+      PutRequest put;
+      PutResponse put_response;
+      put.set_value(std::string(100, 'w'));
+      // Stagger the threads' slots across one gap.
+      auto intended = start + gap * t / kClientThreads;
+      for (; intended < end; intended += gap) {
+        std::this_thread::sleep_until(intended);
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        std::string key = "key" + std::to_string(x % kKeys);
+        grpc::ClientContext ctx;
+        if (x >> 60 != 0) {
+          get.set_key(key);
+          stub->Get(&ctx, get, &get_response);
+        } else {
+          put.set_key(key);
+          stub->Put(&ctx, put, &put_response);
+        }
+        histograms[t]->record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - intended)
+                .count());
+        done.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  for (const auto &h : histograms)
+    h->mergeInto(out);
+  achieved = done.load() / seconds;
+}
+
+int main(int argc, char **argv) {
+  std::string server_cpus = argc > 1 ? argv[1] : "";
+  std::string client_cpus = argc > 2 ? argv[2] : "";
+  double ops_per_sec = argc > 3 ? std::atof(argv[3]) : 20000;
+  double seconds = argc > 4 ? std::atof(argv[4]) : 5;
+  const int rounds = 3;
+
+  auto store = std::make_shared<kvstore::ShardedHashMap>();
+  for (int i = 0; i < kKeys; ++i)
+    store->put("key" + std::to_string(i), std::string(100, 'v'));
+  std::vector<int> clients =
+      client_cpus.empty() ? std::vector<int>{}
+                          : kvstore::parseCpuList(client_cpus);
+  std::vector<Layout> all = layouts(restrict(server_cpus));
+  std::vector<LatencyHistogram::Snapshot> latency(all.size());
+  std::vector<double> rate(all.size());
+
+  int port = 50080;
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t l = 0; l < all.size(); ++l) {
+      std::cout << "Benchmarking with " << all[l].name << " (round "
+                << r + 1 << ")...\n";
+      std::string address = "127.0.0.1:" + std::to_string(port++);
+      AsyncKVServer server(address, store);
+      std::thread runner([&]() { server.Run(all[l].topology); });
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      double achieved = 0;
+      drive(address, clients, ops_per_sec, seconds, latency[l], achieved);
+      rate[l] += achieved / rounds;
+      server.Shutdown();
+      runner.join();
+    }
+  }
+
+  std::ofstream out("cq_topology.csv");
+  out << "Topology,Threads,Target ops/s,Achieved ops/s,P50 (us),P99 (us),"
+         "P99.9 (us),Max (us)\n";
+  for (size_t l = 0; l < all.size(); ++l) {
+    const auto &t = all[l].topology;
+    const auto &h = latency[l];
+    out << all[l].name << "," << t.num_cqs * t.threads_per_cq << ","
+        << ops_per_sec << "," << rate[l] << "," << h.percentile(0.5) / 1e3
+        << "," << h.percentile(0.99) / 1e3 << ","
+        << h.percentile(0.999) / 1e3 << "," << h.max / 1e3 << "\n";
+  }
+  out.close();
+  std::cout << "Done! See cq_topology.csv\n";
+  return 0;
+}
@@ -0,0 +1,102 @@
+// Multi-threaded Put/Get throughput: folly skip list vs sharded hash index.
+//
+// g++ -O2 -std=c++17 -I../../../src hash_vs_skiplist.cpp -lfolly -lglog \
+//     -lgflags -ldl -ldouble-conversion -lfmt -pthread -o hash_vs_skiplist
+// ./hash_vs_skiplist [threads] [max_keys]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/IConcurrentMap.h"
+#include "map/ShardedHashMap.h"
+#include "map/SkipListMap.h"
+
+using namespace kvstore;
+
+// Runs fn(thread_id, begin, end) over [0, n) split across threads and returns
+// the wall time in seconds.
+template <typename Func>
+double run_parallel(int threads, size_t n, Func &&fn) {
+  std::vector<std::thread> workers;
+  auto t1 = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; ++t) {
+    size_t begin = n * t / threads;
+    size_t end = n * (t + 1) / threads;
+    workers.emplace_back([&, t, begin, end]() { fn(t, begin, end); });
+  }
+  for (auto &w : workers)
+    w.join();
+  auto t2 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(t2 - t1).count();
+}
+
+std::string make_key(size_t i) { return "key-" + std::to_string(i); }
+
+void benchmark_engine(const std::string &name, IConcurrentMap &map,
+                      size_t num_keys, int threads, std::ofstream &out) {
+  // Pre-build keys so string formatting stays out of the timed region.
+  std::vector<std::string> keys(num_keys);
+  for (size_t i = 0; i < num_keys; ++i)
+    keys[i] = make_key(i);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937{42});
+  const std::string value(32, 'v');
+
+  double put_s = run_parallel(threads, num_keys, [&](int, size_t b, size_t e) {
+    for (size_t i = b; i < e; ++i)
+      map.put(keys[i], value);
+  });
+
+  std::atomic<size_t> hits{0};
+  auto get_op = [&](int t, size_t b, size_t e) {
+    std::mt19937_64 rng(t);
+    std::uniform_int_distribution<size_t> dist(0, num_keys - 1);
+    std::string v;
+    size_t local_hits = 0;
+    for (size_t i = b; i < e; ++i)
+      local_hits += map.get(keys[dist(rng)], v);
+    hits += local_hits;
+  };
+  double get_s = run_parallel(threads, num_keys, get_op);
+
+  double put_mops = num_keys / put_s / 1e6;
+  double get_mops = num_keys / get_s / 1e6;
+  std::cout << name << " keys=" << num_keys << " threads=" << threads
+            << " put=" << put_mops << " Mops/s get=" << get_mops
+            << " Mops/s hits=" << hits << "\n";
+  out << name << "," << num_keys << "," << threads << "," << put_s << ","
+      << put_mops << "," << get_s << "," << get_mops << "\n";
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? std::atoi(argv[1])
+                         : std::max(1u, std::thread::hardware_concurrency());
+  size_t max_keys = argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                             : 100'000'000;
+
+  std::ofstream out("hash_vs_skiplist.csv");
+  out << "MapType,Keys,Threads,put_s,put_mops,get_s,get_mops\n";
+
+  for (size_t num_keys = 1'000'000; num_keys <= max_keys; num_keys *= 10) {
+    std::cout << "Benchmarking with " << num_keys << " keys...\n";
+    {
+      SkipListMap skiplist;
+      benchmark_engine("folly_skiplist", skiplist, num_keys, threads, out);
+    }
+    {
+      ShardedHashMap hash(256, num_keys * 2);
+      benchmark_engine("sharded_hash", hash, num_keys, threads, out);
+    }
+  }
+
+  out.close();
+  std::cout << "Done! See hash_vs_skiplist.csv\n";
+  return 0;
+}
@@ -0,0 +1,195 @@
+// Latency and server memory of multi-megabyte values, unary Put/Get
+// against PutStream/GetStream. A server (skip list under 1 MB chunked
+// storage) is forked on port 50097. For each value size this process
+// writes and reads one key a few times each way, sending streams in 1 MB
+// pieces, and reports the mean latency and the server's transient peak:
+// its high-water RSS (VmHWM, reset through /proc/<pid>/clear_refs before
+// each run) above its RSS once the run is over, i.e. memory the calls
+// used and gave back rather than the value kept in the store. Unary Puts
+// over gRPC's 4 MB receive limit fail; for those sizes unary Get reads a
+// value stored by PutStream.
+//
+//   ./large_values [reps] [MB,MB,...]
+//   ./large_values 5 1,2,4,16,64
+//
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated large_values.cpp \
+//     <build>/generated/kvstore*.pb.cc $(pkg-config --libs grpc++ protobuf) \
+//     -pthread -o large_values
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "map/SkipListMap.h"
+#include "server_impl.h"
+#include "storage/ChunkedValueMap.h"
+
+using Clock = std::chrono::steady_clock;
+
+const char *kAddress = "127.0.0.1:50097";
+const size_t kPiece = 1 << 20;
+
+// Runs the server in a child process until killed.
+pid_t spawnServer() {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  auto store = std::make_shared<kvstore::ChunkedValueMap>(
+      std::make_shared<kvstore::SkipListMap>(),
+      kvstore::ChunkedValueMap::Options{});
+  AsyncKVServer server(kAddress, store);
+  server.EnableLargeValues(store);
+  server.Run(2, 1);
+  _exit(0);
+}
+
+// A field of /proc/<pid>/status, in MB.
+double statusMB(pid_t pid, const std::string &field) {
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  for (std::string line; std::getline(status, line);)
+    if (line.compare(0, field.size() + 1, field + ":") == 0)
+      return std::atof(line.c_str() + field.size() + 1) / 1024;
+  return 0;
+}
+
+void resetPeak(pid_t pid) {
+  std::ofstream("/proc/" + std::to_string(pid) + "/clear_refs") << "5";
+}
+
+bool unaryPut(KeyValueStore::Stub &stub, const std::string &key,
+              const std::string &value) {
+  grpc::ClientContext ctx;
+  PutRequest request;
+  request.set_key(key);
+  request.set_value(value);
+  PutResponse response;
+  return stub.Put(&ctx, request, &response).ok() && response.success();
+}
+
+bool unaryGet(KeyValueStore::Stub &stub, const std::string &key,
+              size_t size) {
+  grpc::ClientContext ctx;
+  GetRequest request;
+  request.set_key(key);
+  GetResponse response;
+  return stub.Get(&ctx, request, &response).ok() &&
+         response.value().size() == size;
+}
+
+bool streamPut(KeyValueStore::Stub &stub, const std::string &key,
+               const std::string &value) {
+  grpc::ClientContext ctx;
+  PutResponse response;
+  auto writer = stub.PutStream(&ctx, &response);
+  kvstore::PutChunk chunk;
+  chunk.set_key(key);
+  for (size_t pos = 0; pos < value.size(); pos += kPiece) {
+    chunk.set_data(value.data() + pos, std::min(kPiece, value.size() - pos));
+    chunk.set_last(pos + kPiece >= value.size());
+    if (!writer->Write(chunk))
+      break;
+    chunk.clear_key();
+  }
+  writer->WritesDone();
+  return writer->Finish().ok() && response.success();
+}
+
+bool streamGet(KeyValueStore::Stub &stub, const std::string &key,
+               size_t size) {
+  grpc::ClientContext ctx;
+  GetRequest request;
+  request.set_key(key);
+  auto reader = stub.GetStream(&ctx, request);
+  kvstore::GetChunk chunk;
+  size_t received = 0;
+  while (reader->Read(&chunk))
+    received += chunk.data().size();
+  return reader->Finish().ok() && received == size;
+}
+
+struct Result {
+  double ms = 0;
+  double peak_mb = 0;
+  bool ok = true;
+};
+
+// Runs op `reps` times and measures it.
+template <typename Op> Result measure(pid_t server, int reps, Op op) {
+  Result result;
+  resetPeak(server);
+  auto start = Clock::now();
+  for (int i = 0; i < reps && result.ok; ++i)
+    result.ok = op();
+  result.ms =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count() /
+      reps;
+  result.peak_mb = statusMB(server, "VmHWM") - statusMB(server, "VmRSS");
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int reps = argc > 1 ? std::atoi(argv[1]) : 5;
+  std::vector<size_t> sizes;
+  std::stringstream list(argc > 2 ? argv[2] : "1,2,4,16,64");
+  for (std::string mb; std::getline(list, mb, ',');)
+    sizes.push_back(std::strtoull(mb.c_str(), nullptr, 10));
+
+  pid_t server = spawnServer();
+  grpc::ChannelArguments args;
+  args.SetMaxReceiveMessageSize(-1);
+  args.SetMaxSendMessageSize(-1);
+  auto stub = KeyValueStore::NewStub(grpc::CreateCustomChannel(
+      kAddress, grpc::InsecureChannelCredentials(), args));
+  {
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    StatsResponse response;
+    stub->Stats(&ctx, StatsRequest(), &response);
+  }
+
+  std::ofstream out("large_values.csv");
+  out << "Value MB,Mode,Put ms,Get ms,Put server peak MB,"
+         "Get server peak MB\n";
+  auto cell = [](const Result &result, double value) {
+    std::ostringstream text;
+    if (result.ok)
+      text << value;
+    else
+      text << "failed";
+    return text.str();
+  };
+  for (size_t mb : sizes) {
+    std::cout << "Benchmarking with " << mb << " MB values..." << std::endl;
+    size_t size = mb << 20;
+    std::string value(size, 'v');
+    for (const char *mode : {"unary", "stream"}) {
+      std::string key = std::string(mode) + std::to_string(mb);
+      bool unary = mode[0] == 'u';
+      Result put = measure(server, reps, [&]() {
+        return unary ? unaryPut(*stub, key, value)
+                     : streamPut(*stub, key, value);
+      });
+      if (!put.ok && unary)
+        streamPut(*stub, key, value);
+      Result get = measure(server, reps, [&]() {
+        return unary ? unaryGet(*stub, key, size)
+                     : streamGet(*stub, key, size);
+      });
+      out << mb << "," << mode << "," << cell(put, put.ms) << ","
+          << cell(get, get.ms) << "," << cell(put, put.peak_mb) << ","
+          << cell(get, get.peak_mb) << "\n";
+    }
+  }
+  out.close();
+  kill(server, SIGKILL);
+  waitpid(server, nullptr, 0);
+  std::cout << "Done! See large_values.csv" << std::endl;
+  return 0;
+}
@@ -0,0 +1,98 @@
+// LsmMap with a dataset many times larger than its memtable budget: load
+// throughput, then point-get throughput and read amplification (tables
+// actually searched per get, after key-range and bloom filter checks) for
+// present and absent keys, per dataset size. Also reports the level shape.
+//
+// g++ -O2 -std=c++17 -I../../../src lsm_read_amplification.cpp -pthread \
+//     -o lsm_read_amplification
+// Tables go to ./lsm_bench in the cwd. For a dataset that really exceeds
+// RAM, cap the page cache (e.g. run under a memory-limited cgroup).
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "storage/LsmMap.h"
+
+using namespace kvstore;
+using Clock = std::chrono::steady_clock;
+
+std::string key_for(uint64_t i) {
+  char key[32];
+  std::snprintf(key, sizeof(key), "user%012llu",
+                static_cast<unsigned long long>(i));
+  return key;
+}
+
+int main(int argc, char **argv) {
+  uint64_t max_keys = argc > 1 ? std::atoll(argv[1]) : 16'000'000;
+  size_t memtable_mb = argc > 2 ? std::atoi(argv[2]) : 16;
+  const int num_gets = 200'000;
+  const std::string dir = "lsm_bench";
+  const std::string value(100, 'v');
+
+  std::ofstream out("lsm_read_amplification.csv");
+  out << "Keys,Memtable MB,Dataset MB,Load Ops/s,Lookup,Gets/s,"
+         "Tables/Get,Bloom Skips/Get,Levels\n";
+
+  for (uint64_t num_keys = 1'000'000; num_keys <= max_keys; num_keys *= 4) {
+    std::cout << "Benchmarking with " << num_keys << " keys...\n";
+    std::filesystem::remove_all(dir);
+    LsmMap::Options options;
+    options.dir = dir;
+    options.memtable_bytes = memtable_mb << 20;
+    options.target_table_bytes = options.memtable_bytes;
+    options.base_level_bytes = options.memtable_bytes * 4;
+    LsmMap map(options);
+
+    // Random insertion order so every flush overlaps the whole key space.
+    std::mt19937_64 rng(42);
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < num_keys; ++i)
+      map.put(key_for(rng() % num_keys), value);
+    map.flush();
+    double load_secs =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto stats = map.stats();
+    uint64_t dataset_bytes = 0;
+    std::string levels;
+    for (size_t level = 0; level < LsmMap::kLevels; ++level) {
+      dataset_bytes += stats.bytes[level];
+      if (stats.tables[level])
+        levels += "L" + std::to_string(level) + ":" +
+                  std::to_string(stats.tables[level]) + " ";
+    }
+
+    for (const char *lookup : {"present", "absent"}) {
+      bool absent = lookup[0] == 'a';
+      LsmMap::ReadStats reads;
+      std::string got;
+      start = Clock::now();
+      for (int i = 0; i < num_gets; ++i) {
+        // Absent keys fall between stored ones, inside every table's range.
+        std::string key = key_for(rng() % num_keys);
+        if (absent)
+          key += "x";
+        map.get(key, got, &reads);
+      }
+      double secs =
+          std::chrono::duration<double>(Clock::now() - start).count();
+      out << num_keys << "," << memtable_mb << ","
+          << dataset_bytes / (1024 * 1024) << "," << num_keys / load_secs
+          << "," << lookup << "," << num_gets / secs << ","
+          << static_cast<double>(reads.tables_searched) / num_gets << ","
+          << static_cast<double>(reads.bloom_skips) / num_gets << ","
+          << levels << "\n";
+    }
+  }
+
+  std::filesystem::remove_all(dir);
+  out.close();
+  std::cout << "Done! See lsm_read_amplification.csv\n";
+  return 0;
+}
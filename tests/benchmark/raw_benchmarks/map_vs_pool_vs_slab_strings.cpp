@@ -0,0 +1,170 @@
+// map_vs_pool_vs_intrusive extended to string payloads: std::map with the
+// default and pool node allocators against ShardedHashMap records allocated
+// with malloc or the slab allocator. Besides per-op latency percentiles it
+// reports RSS per key and malloc calls per Put after a churn phase that
+// rewrites every value with a different random size.
+//
+// g++ -O2 -std=c++17 -I../../../src map_vs_pool_vs_slab_strings.cpp \
+//     -pthread -o map_vs_pool_vs_slab_strings
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <boost/pool/pool_alloc.hpp>
+
+#include "map/ShardedHashMap.h"
+#include "map/SlabAllocator.h"
+
+using namespace kvstore;
+
+static size_t malloc_calls = 0;
+
+void *operator new(size_t size) {
+  ++malloc_calls;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+size_t rss_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  statm >> pages >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Helper: Time and percentiles
+template <typename Func> std::vector<double> benchmark_op(Func &&f, int ops) {
+  std::vector<double> timings(ops);
+  for (int i = 0; i < ops; ++i) {
+    auto t1 = std::chrono::high_resolution_clock::now();
+    f(i);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    timings[i] = std::chrono::duration<double, std::micro>(t2 - t1).count();
+  }
+  return timings;
+}
+
+void write_percentiles(std::ofstream &out, const std::vector<double> &data) {
+  std::vector<double> sorted = data;
+  std::sort(sorted.begin(), sorted.end());
+  auto get_pct = [&](double pct) {
+    size_t idx = static_cast<size_t>(pct * sorted.size());
+    if (idx >= sorted.size())
+      idx = sorted.size() - 1;
+    return sorted[idx];
+  };
+  double avg =
+      std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+  out << "," << avg << "," << sorted.front() << "," << sorted.back() << ","
+      << get_pct(0.50) << "," << get_pct(0.75) << "," << get_pct(0.90) << ","
+      << get_pct(0.95) << "," << get_pct(0.99);
+}
+
+struct Workload {
+  std::vector<std::string> keys;
+  std::vector<std::string> values;       // initial values
+  std::vector<std::string> churn_values; // different sizes, same keys
+};
+
+Workload make_workload(int num_ops) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> small(8, 200);
+  Workload w;
+  for (int i = 0; i < num_ops; ++i) {
+    w.keys.push_back("user:" + std::to_string(rng()) + ":" +
+                     std::to_string(i));
+    w.values.emplace_back(small(rng), 'v');
+    w.churn_values.emplace_back(small(rng), 'c');
+  }
+  return w;
+}
+
+// Adapts std::map variants to the put/get/remove interface.
+template <typename Map> struct StdMapAdapter {
+  Map m;
+  void put(const std::string &k, const std::string &v) { m[k] = v; }
+  bool get(const std::string &k) { return m.find(k) != m.end(); }
+  void remove(const std::string &k) { m.erase(k); }
+};
+
+struct HashAdapter {
+  ShardedHashMap m{64, 1024};
+  std::string scratch;
+  void put(const std::string &k, const std::string &v) { m.put(k, v); }
+  bool get(const std::string &k) { return m.get(k, scratch); }
+  void remove(const std::string &k) { m.remove(k); }
+};
+
+template <typename Adapter>
+void benchmark_map(const std::string &name, const Workload &w,
+                   std::ofstream &out) {
+  int num_ops = static_cast<int>(w.keys.size());
+  size_t rss_before = rss_bytes();
+  auto *map = new Adapter();
+
+  size_t mallocs_before = malloc_calls;
+  auto insert_t =
+      benchmark_op([&](int i) { map->put(w.keys[i], w.values[i]); }, num_ops);
+  // Churn: overwrite every value with one of a different size.
+  auto churn_t = benchmark_op(
+      [&](int i) { map->put(w.keys[i], w.churn_values[i]); }, num_ops);
+  double mallocs_per_put =
+      static_cast<double>(malloc_calls - mallocs_before) / (2.0 * num_ops);
+
+  double rss_per_key =
+      static_cast<double>(rss_bytes() - rss_before) / num_ops;
+  auto slab = SlabAllocator::global().stats();
+  auto find_t = benchmark_op([&](int i) { map->get(w.keys[i]); }, num_ops);
+  auto erase_t = benchmark_op([&](int i) { map->remove(w.keys[i]); }, num_ops);
+
+  out << name << "," << num_ops;
+  write_percentiles(out, insert_t);
+  write_percentiles(out, churn_t);
+  write_percentiles(out, find_t);
+  write_percentiles(out, erase_t);
+  out << "," << rss_per_key << "," << mallocs_per_put << ","
+      << slab.fragmentationRatio() << "\n";
+  delete map;
+}
+
+int main() {
+  // Tree nodes come from the pool; the strings inside them still malloc.
+  using PoolMap = std::map<
+      std::string, std::string, std::less<std::string>,
+      boost::fast_pool_allocator<std::pair<const std::string, std::string>>>;
+
+  std::ofstream out("map_vs_pool_vs_slab_strings.csv");
+  out << "MapType,OpsCount";
+  for (const char *op : {"insert", "churn", "find", "erase"})
+    for (const char *stat :
+         {"avg", "min", "max", "p50", "p75", "p90", "p95", "p99"})
+      out << "," << op << "_us_" << stat;
+  out << ",rss_bytes_per_key,mallocs_per_put,slab_fragmentation\n";
+
+  for (int num_ops = 10'000; num_ops <= 1'000'000; num_ops *= 10) {
+    std::cout << "Benchmarking with " << num_ops << " operations...\n";
+    Workload w = make_workload(num_ops);
+    benchmark_map<StdMapAdapter<std::map<std::string, std::string>>>(
+        "std::map", w, out);
+    benchmark_map<StdMapAdapter<PoolMap>>("std::map_pool", w, out);
+    SlabAllocator::setEnabled(false);
+    benchmark_map<HashAdapter>("sharded_hash_malloc", w, out);
+    SlabAllocator::setEnabled(true);
+    benchmark_map<HashAdapter>("sharded_hash_slab", w, out);
+  }
+
+  out.close();
+  std::cout << "Done! See map_vs_pool_vs_slab_strings.csv\n";
+  return 0;
+}
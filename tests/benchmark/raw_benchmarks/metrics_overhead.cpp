@@ -0,0 +1,142 @@
+// Throughput cost of request metrics. Two in-process AsyncKVServers share
+// one store, one recording metrics and one not, and the same Get workload
+// (unary calls and a Pipeline stream, 8 connections) is run against each
+// in alternating rounds so drift affects both equally. Reports the median
+// ops/s of each and the relative overhead, plus the cost of a single
+// record() call in isolation.
+//
+// Build from a configured build directory (for the generated protos):
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated \
+//     metrics_overhead.cpp <build>/generated/kvstore*.pb.cc \
+//     $(pkg-config --libs grpc++ protobuf) -pthread -o metrics_overhead
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/ShardedHashMap.h"
+#include "metrics/ServerMetrics.h"
+#include "server_impl.h"
+
+using Clock = std::chrono::steady_clock;
+
+const int kKeys = 10000;
+
+std::shared_ptr<grpc::Channel> make_channel(const std::string &address,
+                                            int id) {
+  // A distinct channel arg keeps gRPC from sharing one connection.
+  grpc::ChannelArguments args;
+  args.SetInt("kvstore.connection_id", id);
+  return grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(),
+                                   args);
+}
+
+void unary_client(const std::string &address, int id, int ops) {
+  auto stub = KeyValueStore::NewStub(make_channel(address, id));
+  GetRequest request;
+  GetResponse response;
+  for (int i = 0; i < ops; ++i) {
+    request.set_key("key" + std::to_string((i * 31 + id) % kKeys));
+    grpc::ClientContext ctx;
+    stub->Get(&ctx, request, &response);
+  }
+}
+
+void pipeline_client(const std::string &address, int id, int ops) {
+  auto stub = KeyValueStore::NewStub(make_channel(address, id));
+  grpc::ClientContext ctx;
+  auto stream = stub->Pipeline(&ctx);
+  std::thread reader([&]() {
+    kvstore::PipelineResponse response;
+    while (stream->Read(&response)) {
+    }
+  });
+  kvstore::PipelineRequest request;
+  for (int i = 0; i < ops; ++i) {
+    request.set_tag(i);
+    request.mutable_get()->set_key("key" +
+                                   std::to_string((i * 31 + id) % kKeys));
+    stream->Write(request);
+  }
+  stream->WritesDone();
+  reader.join();
+  stream->Finish();
+}
+
+template <typename Client>
+double run_clients(Client client, const std::string &address, int conns,
+                   int ops_per_conn) {
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  for (int c = 0; c < conns; ++c)
+    threads.emplace_back(client, address, c, ops_per_conn);
+  for (auto &t : threads)
+    t.join();
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  return conns * ops_per_conn / secs;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+double record_nanos() {
+  kvstore::ServerMetrics metrics;
+  const int calls = 10'000'000;
+  auto &local = metrics.local();
+  auto start = Clock::now();
+  for (int i = 0; i < calls; ++i)
+    local.record(kvstore::ServerMetrics::Rpc::kGet, 20000 + (i & 4095), 32,
+                 128, false);
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() /
+         calls;
+}
+
+int main(int argc, char **argv) {
+  int ops = argc > 1 ? std::atoi(argv[1]) : 100000;
+  int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+  const int conns = 8;
+  const std::string with = "127.0.0.1:50064";
+  const std::string without = "127.0.0.1:50065";
+
+  auto store = std::make_shared<kvstore::ShardedHashMap>();
+  for (int i = 0; i < kKeys; ++i)
+    store->put("key" + std::to_string(i), std::string(100, 'v'));
+  AsyncKVServer on(with, store, true, true);
+  AsyncKVServer off(without, store, true, false);
+  std::thread on_thread([&]() { on.Run(4, 2); });
+  std::thread off_thread([&]() { off.Run(4, 2); });
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  std::ofstream out("metrics_overhead.csv");
+  out << "Workload,Ops,Metrics off ops/s,Metrics on ops/s,Overhead %\n";
+  auto compare = [&](const char *name, auto client, int total) {
+    std::cout << "Benchmarking with " << name << " Gets...\n";
+    std::vector<double> on_rates, off_rates;
+    for (int r = 0; r < rounds; ++r) {
+      off_rates.push_back(run_clients(client, without, conns, total / conns));
+      on_rates.push_back(run_clients(client, with, conns, total / conns));
+    }
+    double off_rate = median(off_rates), on_rate = median(on_rates);
+    out << name << "," << total << "," << off_rate << "," << on_rate << ","
+        << (off_rate - on_rate) / off_rate * 100 << "\n";
+  };
+  // Unary is far slower; a tenth of the ops keeps the run short.
+  compare("unary", unary_client, ops / 10);
+  compare("pipeline", pipeline_client, ops);
+  out << "record() ns/call,,,," << record_nanos() << "\n";
+
+  on.Shutdown();
+  off.Shutdown();
+  on_thread.join();
+  off_thread.join();
+  out.close();
+  std::cout << "Done! See metrics_overhead.csv\n";
+  return 0;
+}
@@ -0,0 +1,107 @@
+// Ops/sec of Put over the Pipeline stream versus unary Put against an
+// in-process AsyncKVServer, with 1..8 client connections. Each pipeline
+// connection writes from one thread and reads responses on another; each
+// unary connection issues blocking calls.
+//
+// Build from a configured build directory (for the generated protos):
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated \
+//     pipeline_throughput.cpp <build>/generated/kvstore*.pb.cc \
+//     $(pkg-config --libs grpc++ protobuf) -pthread -o pipeline_throughput
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/ShardedHashMap.h"
+#include "server_impl.h"
+
+using Clock = std::chrono::steady_clock;
+
+std::shared_ptr<grpc::Channel> make_channel(const std::string &address,
+                                            int id) {
+  // A distinct channel arg keeps gRPC from sharing one connection.
+  grpc::ChannelArguments args;
+  args.SetInt("kvstore.connection_id", id);
+  return grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(),
+                                   args);
+}
+
+void pipeline_client(const std::string &address, int id, int ops,
+                     const std::string &value) {
+  auto stub = KeyValueStore::NewStub(make_channel(address, id));
+  grpc::ClientContext ctx;
+  auto stream = stub->Pipeline(&ctx);
+  std::thread reader([&]() {
+    kvstore::PipelineResponse response;
+    while (stream->Read(&response)) {
+    }
+  });
+  kvstore::PipelineRequest request;
+  request.mutable_put()->set_value(value);
+  for (int i = 0; i < ops; ++i) {
+    request.set_tag(i);
+    request.mutable_put()->set_key("key" + std::to_string(id) + "_" +
+                                   std::to_string(i));
+    stream->Write(request);
+  }
+  stream->WritesDone();
+  reader.join();
+  stream->Finish();
+}
+
+void unary_client(const std::string &address, int id, int ops,
+                  const std::string &value) {
+  auto stub = KeyValueStore::NewStub(make_channel(address, id));
+  PutRequest request;
+  request.set_value(value);
+  PutResponse response;
+  for (int i = 0; i < ops; ++i) {
+    request.set_key("key" + std::to_string(id) + "_" + std::to_string(i));
+    grpc::ClientContext ctx;
+    stub->Put(&ctx, request, &response);
+  }
+}
+
+template <typename Client>
+double run_clients(Client client, const std::string &address, int conns,
+                   int ops_per_conn, const std::string &value) {
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  for (int c = 0; c < conns; ++c)
+    threads.emplace_back(client, address, c, ops_per_conn, value);
+  for (auto &t : threads)
+    t.join();
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  return conns * ops_per_conn / secs;
+}
+
+int main(int argc, char **argv) {
+  int ops = argc > 1 ? std::atoi(argv[1]) : 200000;
+  const std::string address = "127.0.0.1:50063";
+  const std::string value(100, 'v');
+
+  AsyncKVServer server(address, std::make_shared<kvstore::ShardedHashMap>());
+  std::thread server_thread([&]() { server.Run(4, 2); });
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  std::ofstream out("pipeline_throughput.csv");
+  out << "Connections,Ops,Pipeline ops/s,Unary ops/s\n";
+  for (int conns = 1; conns <= 8; conns *= 2) {
+    std::cout << "Benchmarking with " << conns << " connections...\n";
+    double pipelined =
+        run_clients(pipeline_client, address, conns, ops / conns, value);
+    // Unary is far slower; a tenth of the ops keeps the run short.
+    double unary =
+        run_clients(unary_client, address, conns, ops / conns / 10, value);
+    out << conns << "," << ops << "," << pipelined << "," << unary << "\n";
+  }
+
+  server.Shutdown();
+  server_thread.join();
+  out.close();
+  std::cout << "Done! See pipeline_throughput.csv\n";
+  return 0;
+}
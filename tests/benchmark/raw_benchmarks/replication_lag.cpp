@@ -0,0 +1,190 @@
+// Replication lag under write load, with the primary and the replica in
+// separate processes. A primary (skip list plus change log) is forked on
+// port 50095; for each target rate a fresh replica is forked on 50096,
+// catches up from a snapshot, and then follows while this process sends
+// paced 100-byte Puts over 100k keys to the primary. Every 20 ms the gap
+// between the primary's newest seqno and the replica's applied seqno is
+// sampled; once the load stops and the replica has caught up, its Stats
+// give the delay from a write being logged to it being applied.
+//
+//   ./replication_lag [seconds] [rate,rate,...]
+//   ./replication_lag 10 10000,50000,100000
+//
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated replication_lag.cpp \
+//     ../../../src/client/AsyncKVClient.cpp \
+//     <build>/generated/kvstore*.pb.cc $(pkg-config --libs grpc++ protobuf) \
+//     -pthread -o replication_lag
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "client/AsyncKVClient.h"
+#include "map/SkipListMap.h"
+#include "replication/ChangeLog.h"
+#include "replication/Replica.h"
+#include "server_impl.h"
+
+using Clock = std::chrono::steady_clock;
+
+const char *kPrimary = "127.0.0.1:50095";
+const char *kReplica = "127.0.0.1:50096";
+const int kKeys = 100000;
+
+// Runs the primary in a child process until killed.
+pid_t spawnPrimary() {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  auto store = std::make_shared<kvstore::ChangeLogMap>(
+      std::make_shared<kvstore::SkipListMap>(),
+      std::make_shared<kvstore::ChangeLog>());
+  for (int i = 0; i < kKeys; ++i)
+    store->put("key" + std::to_string(i), std::string(100, 'v'));
+  AsyncKVServer server(kPrimary, store);
+  server.EnableReplication(store);
+  server.Run(2, 2);
+  _exit(0);
+}
+
+// Forks a replica that waits for a byte on the returned pipe before it
+// starts following the primary, so every child can be forked before the
+// parent touches gRPC and yet each rate gets a replica started fresh.
+std::pair<pid_t, int> spawnReplica() {
+  int fds[2];
+  if (pipe(fds) != 0)
+    std::abort();
+  pid_t pid = fork();
+  if (pid != 0) {
+    close(fds[0]);
+    return {pid, fds[1]};
+  }
+  close(fds[1]);
+  char go;
+  if (read(fds[0], &go, 1) != 1)
+    _exit(0);
+  auto store = std::make_shared<kvstore::SkipListMap>();
+  kvstore::Replica::Options options;
+  options.primary = kPrimary;
+  auto replica = std::make_shared<kvstore::Replica>(store, options);
+  AsyncKVServer server(kReplica, store);
+  server.ServeAsReplica(replica);
+  replica->start();
+  server.Run(1, 1);
+  _exit(0);
+}
+
+void stopChild(pid_t pid) {
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+}
+
+StatsResponse stats(const char *address) {
+  auto stub = KeyValueStore::NewStub(
+      grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+  grpc::ClientContext ctx;
+  ctx.set_wait_for_ready(true);
+  ctx.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(30));
+  StatsResponse response;
+  stub->Stats(&ctx, StatsRequest(), &response);
+  return response;
+}
+
+// Waits until the replica has applied everything the primary has logged.
+void catchUp() {
+  while (true) {
+    uint64_t logged = stats(kPrimary).replication().log_seqno();
+    if (stats(kReplica).replication().applied_seqno() >= logged)
+      return;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? std::atof(argv[1]) : 5;
+  std::vector<double> rates;
+  std::stringstream list(argc > 2 ? argv[2] : "10000,50000,100000");
+  for (std::string rate; std::getline(list, rate, ',');)
+    rates.push_back(std::atof(rate.c_str()));
+
+  pid_t primary = spawnPrimary();
+  std::vector<std::pair<pid_t, int>> replicas;
+  for (size_t r = 0; r < rates.size(); ++r)
+    replicas.push_back(spawnReplica());
+
+  std::ofstream out("replication_lag.csv");
+  out << "Target writes/s,Achieved writes/s,Delay P50 (us),Delay P99 (us),"
+         "Delay max (us),Mean lag (entries),Max lag (entries)\n";
+  for (size_t r = 0; r < rates.size(); ++r) {
+    std::cout << "Benchmarking with " << rates[r] << " writes/s...\n";
+    // A fresh replica per rate, so its delay histogram covers only this
+    // rate.
+    if (write(replicas[r].second, "g", 1) != 1)
+      std::abort();
+    catchUp();
+
+    kvstore::AsyncKVClient::Options options;
+    options.target = kPrimary;
+    options.max_in_flight = 1 << 16;
+    kvstore::AsyncKVClient client(options);
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> failed{0};
+    uint64_t lag_sum = 0, lag_max = 0, samples = 0;
+    std::thread sampler([&]() {
+      while (running) {
+        uint64_t logged = stats(kPrimary).replication().log_seqno();
+        uint64_t applied = stats(kReplica).replication().applied_seqno();
+        uint64_t lag = logged > applied ? logged - applied : 0;
+        lag_sum += lag;
+        lag_max = std::max(lag_max, lag);
+        ++samples;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+    });
+
+    auto gap = std::chrono::nanoseconds(static_cast<int64_t>(1e9 / rates[r]));
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(seconds));
+    uint64_t sent = 0;
+    kvstore::PutRequest put;
+    put.set_value(std::string(100, 'w'));
+    for (auto at = start; at < end; at += gap, ++sent) {
+      std::this_thread::sleep_until(at);
+      put.set_key("key" + std::to_string((sent * 7919) % kKeys));
+      client.Put(put, [&](const grpc::Status &status,
+                          kvstore::PutResponse &) { failed += !status.ok(); });
+    }
+    while (client.InFlight() > 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double achieved =
+        sent / std::chrono::duration<double>(Clock::now() - start).count();
+    running = false;
+    sampler.join();
+    catchUp();
+
+    const auto &replication = stats(kReplica).replication();
+    out << rates[r] << "," << achieved << "," << replication.delay_p50_us()
+        << "," << replication.delay_p99_us() << ","
+        << replication.delay_max_us() << ","
+        << (samples ? lag_sum / samples : 0) << "," << lag_max << "\n";
+    if (failed > 0)
+      std::cerr << failed << " Puts failed\n";
+    stopChild(replicas[r].first);
+    close(replicas[r].second);
+  }
+  out.close();
+  stopChild(primary);
+  std::cout << "Done! See replication_lag.csv\n";
+  return 0;
+}
@@ -0,0 +1,109 @@
+// Scan throughput in keys/sec and MB/sec, both directly on SkipListMap and
+// through the streaming Scan RPC of an in-process AsyncKVServer, for full
+// scans and 1% prefix scans over several value sizes.
+//
+// Build from a configured build directory (for the generated protos):
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated scan_throughput.cpp \
+//     <build>/generated/kvstore*.pb.cc $(pkg-config --libs grpc++ protobuf) \
+//     -pthread -o scan_throughput
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "map/SkipListMap.h"
+#include "server_impl.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Throughput {
+  size_t keys = 0;
+  size_t bytes = 0;
+  double secs = 0;
+};
+
+std::string key_for(int i) {
+  // 100 prefixes ("p00/".."p99/") so a prefix scan covers 1% of the keys.
+  char key[32];
+  std::snprintf(key, sizeof(key), "p%02d/%08d", i % 100, i);
+  return key;
+}
+
+Throughput scan_engine(const kvstore::SkipListMap &map,
+                       const std::string &prefix) {
+  Throughput t;
+  auto start = Clock::now();
+  map.scan("", "", prefix, [&](std::string_view key, std::string_view value) {
+    ++t.keys;
+    t.bytes += key.size() + value.size();
+    return true;
+  });
+  t.secs = std::chrono::duration<double>(Clock::now() - start).count();
+  return t;
+}
+
+Throughput scan_rpc(KeyValueStore::Stub &stub, const std::string &prefix) {
+  Throughput t;
+  auto start = Clock::now();
+  kvstore::ScanRequest request;
+  request.set_prefix(prefix);
+  grpc::ClientContext ctx;
+  auto reader = stub.Scan(&ctx, request);
+  kvstore::ScanResponse response;
+  while (reader->Read(&response)) {
+    for (const auto &entry : response.entries()) {
+      ++t.keys;
+      t.bytes += entry.key().size() + entry.value().size();
+    }
+  }
+  reader->Finish();
+  t.secs = std::chrono::duration<double>(Clock::now() - start).count();
+  return t;
+}
+
+void write_row(std::ofstream &out, const char *path, const char *kind,
+               int num_keys, size_t value_size, const Throughput &t) {
+  out << path << "," << kind << "," << num_keys << "," << value_size << ","
+      << t.keys << "," << t.keys / t.secs << ","
+      << t.bytes / t.secs / (1024 * 1024) << "\n";
+}
+
+int main(int argc, char **argv) {
+  int num_keys = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+  const std::string address = "127.0.0.1:50064";
+
+  std::ofstream out("scan_throughput.csv");
+  out << "Path,Scan,Keys Stored,Value Size,Keys Returned,Keys/s,MB/s\n";
+
+  for (size_t value_size : {16, 128, 1024}) {
+    std::cout << "Benchmarking with " << num_keys << " keys of "
+              << value_size << "-byte values...\n";
+    auto store = std::make_shared<kvstore::SkipListMap>();
+    std::string value(value_size, 'v');
+    for (int i = 0; i < num_keys; ++i)
+      store->put(key_for(i), value);
+
+    write_row(out, "engine", "full", num_keys, value_size,
+              scan_engine(*store, ""));
+    write_row(out, "engine", "prefix", num_keys, value_size,
+              scan_engine(*store, "p42/"));
+
+    AsyncKVServer server(address, store);
+    std::thread server_thread([&]() { server.Run(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto stub = KeyValueStore::NewStub(
+        grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+    write_row(out, "rpc", "full", num_keys, value_size, scan_rpc(*stub, ""));
+    write_row(out, "rpc", "prefix", num_keys, value_size,
+              scan_rpc(*stub, "p42/"));
+    server.Shutdown();
+    server_thread.join();
+  }
+
+  out.close();
+  std::cout << "Done! See scan_throughput.csv\n";
+  return 0;
+}
@@ -0,0 +1,191 @@
+// Throughput as server processes are added behind a ShardedKVClient.
+// Up to max_servers AsyncKVServer processes are forked on ports from
+// 50090, each optionally pinned to its own CPU. For 1..max_servers of
+// them, one client keeps a fixed window of calls in flight for `seconds`
+// (9 in 10 Gets over 100k preloaded keys, 100-byte values), first with
+// single-key calls and then with 16-key MultiGets that the client splits
+// across the servers. With the servers on separate CPUs and a client
+// that isn't the bottleneck, ops/s should grow close to linearly.
+//
+//   ./sharded_scaling [max_servers] [seconds] [server_cpus] [client_cpus]
+//   ./sharded_scaling 8 10 0-7 8-15
+//
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated sharded_scaling.cpp \
+//     ../../../src/client/*.cpp \
+//     <build>/generated/kvstore*.pb.cc $(pkg-config --libs grpc++ protobuf) \
+//     -pthread -o sharded_scaling
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "client/ShardedKVClient.h"
+#include "map/ShardedHashMap.h"
+#include "runtime/CpuTopology.h"
+#include "server_impl.h"
+
+using kvstore::ShardedKVClient;
+
+const int kKeys = 100000;
+const int kWindow = 512;
+const int kBatch = 16;
+
+std::string address(int i) { return "127.0.0.1:" + std::to_string(50090 + i); }
+
+// Runs one server in a child process until killed. Must be called before
+// the parent touches gRPC.
+pid_t spawnServer(int i, const std::vector<int> &cpus) {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  if (!cpus.empty())
+    kvstore::pinThisThread({cpus[i % cpus.size()]});
+  AsyncKVServer server(address(i), std::make_shared<kvstore::ShardedHashMap>());
+  server.Run(1, 1);
+  _exit(0);
+}
+
+// A closed loop of kWindow call chains: each completion sends the next
+// call until `until`. Returns keys read or written per second.
+double drive(ShardedKVClient &client, bool batched, double seconds) {
+  std::atomic<uint64_t> keys{0};
+  std::atomic<int> chains{kWindow};
+  auto until = std::chrono::steady_clock::now() +
+               std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                   std::chrono::duration<double>(seconds));
+  struct Chain {
+    ShardedKVClient *client;
+    bool batched;
+    uint64_t x;
+    std::atomic<uint64_t> *keys;
+    std::atomic<int> *chains;
+    std::chrono::steady_clock::time_point until;
+
+    std::string nextKey() {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      return "key" + std::to_string(x % kKeys);
+    }
+
+    void send() {
+      if (std::chrono::steady_clock::now() >= until) {
+        --*chains;
+        delete this;
+        return;
+      }
+      if (batched) {
+        kvstore::MultiGetRequest get;
+        for (int i = 0; i < kBatch; ++i)
+          get.add_keys(nextKey());
+        client->MultiGet(get, [this](const grpc::Status &status,
+                                     kvstore::MultiGetResponse &) {
+          done(status, kBatch);
+        });
+      } else if (x % 10 != 0) {
+        kvstore::GetRequest get;
+        get.set_key(nextKey());
+        client->Get(get, [this](const grpc::Status &status,
+                                kvstore::GetResponse &) { done(status, 1); });
+      } else {
+        kvstore::PutRequest put;
+        put.set_key(nextKey());
+        put.set_value(std::string(100, 'w'));
+        client->Put(put, [this](const grpc::Status &status,
+                                kvstore::PutResponse &) { done(status, 1); });
+      }
+    }
+
+    void done(const grpc::Status &status, int count) {
+      if (!status.ok()) {
+        std::cerr << "call failed: " << status.error_message() << "\n";
+        until = std::chrono::steady_clock::now();
+      } else {
+        *keys += count;
+      }
+      send();
+    }
+  };
+  for (int c = 0; c < kWindow; ++c)
+    (new Chain{&client, batched, 0x9E3779B97F4A7C15ull * (c + 1), &keys,
+               &chains, until})
+        ->send();
+  while (chains > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  return keys / seconds;
+}
+
+int main(int argc, char **argv) {
+  int max_servers = argc > 1 ? std::atoi(argv[1]) : 4;
+  double seconds = argc > 2 ? std::atof(argv[2]) : 5;
+  std::vector<int> server_cpus =
+      argc > 3 ? kvstore::parseCpuList(argv[3]) : std::vector<int>{};
+  std::vector<int> client_cpus =
+      argc > 4 ? kvstore::parseCpuList(argv[4]) : std::vector<int>{};
+
+  std::vector<pid_t> children;
+  for (int i = 0; i < max_servers; ++i)
+    children.push_back(spawnServer(i, server_cpus));
+  if (!client_cpus.empty())
+    kvstore::pinThisThread(client_cpus);
+
+  ShardedKVClient::Options options;
+  options.client.channels = 2;
+  options.client.cq_threads = 2;
+  options.client.max_in_flight = kWindow;
+  options.client.default_timeout = std::chrono::seconds(10);
+  for (int i = 0; i < max_servers; ++i)
+    options.endpoints.push_back(address(i));
+  ShardedKVClient client(options);
+
+  // Preload every server through the full ring; smaller rings then miss
+  // on some keys, which costs the same as a hit.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  for (int start = 0; start < kKeys; start += 500) {
+    kvstore::MultiPutRequest put;
+    for (int i = start; i < start + 500 && i < kKeys; ++i) {
+      auto *entry = put.add_entries();
+      entry->set_key("key" + std::to_string(i));
+      entry->set_value(std::string(100, 'v'));
+    }
+    auto reply = client.MultiPut(put).get();
+    if (!reply.ok()) {
+      std::cerr << "preload failed: " << reply.status.error_message() << "\n";
+      break;
+    }
+  }
+
+  std::ofstream out("sharded_scaling.csv");
+  out << "Servers,Mode,Keys/s,Speedup,Efficiency\n";
+  for (bool batched : {false, true}) {
+    double base = 0;
+    for (int n = 1; n <= max_servers; ++n) {
+      const char *mode = batched ? "multiget16" : "single";
+      std::cout << "Benchmarking with " << n << " server(s), " << mode
+                << "...\n";
+      client.SetEndpoints(std::vector<std::string>(
+          options.endpoints.begin(), options.endpoints.begin() + n));
+      double rate = drive(client, batched, seconds);
+      if (n == 1)
+        base = rate;
+      double speedup = base > 0 ? rate / base : 0;
+      out << n << "," << mode << "," << rate << "," << speedup << ","
+          << speedup / n << "\n";
+    }
+  }
+  out.close();
+
+  for (pid_t pid : children) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  std::cout << "Done! See sharded_scaling.csv\n";
+  return 0;
+}
@@ -0,0 +1,142 @@
+// Hot-key overwrite contention: the old find+erase+insert Put against the
+// single-traversal in-place upsert in SkipListMap. Readers run alongside the
+// writers and count how often a key that always exists is reported missing.
+//
+// g++ -O2 -std=c++17 -I../../../src skiplist_upsert_contention.cpp -lfolly \
+//     -lglog -lgflags -ldl -ldouble-conversion -lfmt -pthread \
+//     -o skiplist_upsert_contention
+// ./skiplist_upsert_contention [writers] [readers] [seconds]
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <folly/ConcurrentSkipList.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "map/SkipListMap.h"
+
+using namespace kvstore;
+
+// The Put/Get path as it was before the upsert: three traversals per
+// overwrite and a window where the key is absent.
+class EraseInsertSkipList {
+public:
+  using KeyValue = std::pair<std::string, std::string>;
+  struct Comparator {
+    bool operator()(const KeyValue &a, const KeyValue &b) const {
+      return a.first < b.first;
+    }
+  };
+  using SkipList = folly::ConcurrentSkipList<KeyValue, Comparator>;
+
+  EraseInsertSkipList() : list_(SkipList::createInstance()) {}
+
+  void put(const std::string &key, const std::string &value) {
+    SkipList::Accessor accessor(list_);
+    auto kv = std::make_pair(key, value);
+    auto it = accessor.find(kv);
+    if (it != accessor.end())
+      accessor.erase(kv);
+    accessor.insert(kv);
+  }
+
+  bool get(const std::string &key, std::string &value) {
+    SkipList::Accessor accessor(list_);
+    auto it = accessor.find(std::make_pair(key, ""));
+    if (it == accessor.end())
+      return false;
+    value = it->second;
+    return true;
+  }
+
+private:
+  std::shared_ptr<SkipList> list_;
+};
+
+struct Result {
+  double write_mops;
+  double read_mops;
+  size_t misses;
+};
+
+template <typename Map>
+Result run(Map &map, int hot_keys, int writers, int readers, double seconds) {
+  std::vector<std::string> keys;
+  for (int i = 0; i < hot_keys; ++i) {
+    keys.push_back("hot-" + std::to_string(i));
+    map.put(keys.back(), "init");
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> writes{0}, reads{0}, misses{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < writers; ++t) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      std::string value(64, 'v');
+      size_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        map.put(keys[rng() % keys.size()], value);
+        ++n;
+      }
+      writes += n;
+    });
+  }
+  for (int t = 0; t < readers; ++t) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(1000 + t);
+      std::string value;
+      size_t n = 0, m = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (!map.get(keys[rng() % keys.size()], value))
+          ++m;
+        ++n;
+      }
+      reads += n;
+      misses += m;
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto &t : threads)
+    t.join();
+  return {writes / seconds / 1e6, reads / seconds / 1e6, misses.load()};
+}
+
+int main(int argc, char **argv) {
+  int writers = argc > 1 ? std::atoi(argv[1]) : 4;
+  int readers = argc > 2 ? std::atoi(argv[2]) : 4;
+  double seconds = argc > 3 ? std::atof(argv[3]) : 3.0;
+
+  std::ofstream out("skiplist_upsert_contention.csv");
+  out << "Impl,HotKeys,Writers,Readers,write_mops,read_mops,read_misses\n";
+
+  for (int hot_keys : {1, 16, 256, 4096}) {
+    std::cout << "Benchmarking with " << hot_keys << " hot keys...\n";
+    {
+      EraseInsertSkipList map;
+      auto r = run(map, hot_keys, writers, readers, seconds);
+      out << "erase_insert," << hot_keys << "," << writers << "," << readers
+          << "," << r.write_mops << "," << r.read_mops << "," << r.misses
+          << "\n";
+    }
+    {
+      SkipListMap map;
+      auto r = run(map, hot_keys, writers, readers, seconds);
+      out << "atomic_upsert," << hot_keys << "," << writers << "," << readers
+          << "," << r.write_mops << "," << r.read_mops << "," << r.misses
+          << "\n";
+    }
+  }
+
+  out.close();
+  std::cout << "Done! See skiplist_upsert_contention.csv\n";
+  return 0;
+}
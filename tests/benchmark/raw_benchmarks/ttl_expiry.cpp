@@ -0,0 +1,109 @@
+// Cost of a mass expiry. Loads N keys that all expire at the same moment
+// plus the same number that never expire, then measures how long the
+// expiry thread takes to delete the expired half and the Get latency seen
+// by reader threads while it does, for several slice sizes. Slice size 0
+// is the baseline with nothing expiring.
+//
+// g++ -O2 -std=c++17 -I../../../src ttl_expiry.cpp -pthread -o ttl_expiry
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/ExpiringMap.h"
+#include "map/SkipListMap.h"
+
+using namespace kvstore;
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+std::string key_for(const char *prefix, int i) {
+  char key[32];
+  std::snprintf(key, sizeof(key), "%s%010d", prefix, i);
+  return key;
+}
+
+double percentile(std::vector<double> &samples, double p) {
+  if (samples.empty())
+    return 0;
+  size_t index = static_cast<size_t>(p * (samples.size() - 1));
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+int main(int argc, char **argv) {
+  int num_keys = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+  int readers = 4;
+  const std::string value(100, 'v');
+
+  std::ofstream out("ttl_expiry.csv");
+  out << "Keys,Slice,Expiry seconds,Keys/s,Reads,p50 us,p99 us,p999 us\n";
+
+  for (size_t slice : {size_t{0}, size_t{64}, size_t{256}, size_t{4096}}) {
+    std::cout << "Benchmarking with slice size " << slice << "...\n";
+    ExpiringMap::Options options;
+    options.max_expired_per_slice = std::max<size_t>(slice, 1);
+    auto engine = std::make_shared<SkipListMap>();
+    ExpiringMap map(engine, options);
+    auto ttl = 1500ms;
+    auto due = Clock::now() + ttl; // when the first key comes due
+    for (int i = 0; i < num_keys; ++i) {
+      if (slice != 0)
+        map.putExpiring(key_for("ttl", i), value, ttl);
+      map.put(key_for("live", i), value);
+    }
+    // Readers only touch keys that survive, so misses don't skew latency.
+    std::atomic<bool> done{false};
+    std::vector<std::vector<double>> latencies(readers);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; ++t) {
+      threads.emplace_back([&, t]() {
+        std::mt19937 rng(t);
+        std::uniform_int_distribution<int> pick(0, num_keys - 1);
+        std::string got;
+        while (!done.load(std::memory_order_relaxed)) {
+          std::string key = key_for("live", pick(rng));
+          auto start = Clock::now();
+          map.get(key, got);
+          latencies[t].push_back(
+              std::chrono::duration<double, std::micro>(Clock::now() - start)
+                  .count());
+        }
+      });
+    }
+
+    size_t target = static_cast<size_t>(num_keys) + 1; // + format marker
+    if (slice == 0) {
+      std::this_thread::sleep_for(2s);
+    } else {
+      while (engine->size() > target)
+        std::this_thread::sleep_for(1ms);
+    }
+    double secs = std::max(
+        0.0, std::chrono::duration<double>(Clock::now() - due).count());
+    done = true;
+    for (auto &thread : threads)
+      thread.join();
+
+    std::vector<double> all;
+    for (auto &samples : latencies)
+      all.insert(all.end(), samples.begin(), samples.end());
+    size_t reads = all.size();
+    out << num_keys << "," << slice << "," << secs << ","
+        << (slice != 0 && secs > 0 ? num_keys / secs : 0) << "," << reads
+        << "," << percentile(all, 0.5) << "," << percentile(all, 0.99) << ","
+        << percentile(all, 0.999) << "\n";
+  }
+
+  out.close();
+  std::cout << "Done! See ttl_expiry.csv\n";
+  return 0;
+}
@@ -0,0 +1,91 @@
+// Put throughput of SkipListMap behind DurableMap for each WAL durability
+// mode and several group-commit windows, against the in-memory baseline,
+// with 1..16 writer threads. Also reports records per batch, i.e. how many
+// acknowledged writes shared each write()/fdatasync().
+//
+// g++ -O2 -std=c++17 -I../../../src wal_durability.cpp -pthread \
+//     -o wal_durability
+// Run it on the filesystem you care about; the log goes to the cwd.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "map/SkipListMap.h"
+#include "storage/DurableMap.h"
+
+using namespace kvstore;
+using Clock = std::chrono::steady_clock;
+
+struct Mode {
+  const char *name;
+  WriteAheadLog::Durability durability;
+  int window_us;
+};
+
+int main(int argc, char **argv) {
+  int ops_per_thread = argc > 1 ? std::atoi(argv[1]) : 20000;
+  const std::string path = "wal_durability.wal";
+  const std::string value(100, 'v');
+  const Mode modes[] = {
+      {"memory", WriteAheadLog::Durability::kNone, 0},
+      {"async", WriteAheadLog::Durability::kAsync, 0},
+      {"async", WriteAheadLog::Durability::kAsync, 200},
+      {"sync", WriteAheadLog::Durability::kSync, 0},
+      {"sync", WriteAheadLog::Durability::kSync, 200},
+      {"sync", WriteAheadLog::Durability::kSync, 1000},
+  };
+
+  std::ofstream out("wal_durability.csv");
+  out << "Durability,Batch Window (us),Threads,Ops,Ops/s,Records/Batch\n";
+
+  for (int threads = 1; threads <= 16; threads *= 4) {
+    std::cout << "Benchmarking with " << threads << " writer threads...\n";
+    for (const Mode &mode : modes) {
+      std::remove(path.c_str());
+      std::shared_ptr<IConcurrentMap> map = std::make_shared<SkipListMap>();
+      std::shared_ptr<WriteAheadLog> wal;
+      if (mode.durability != WriteAheadLog::Durability::kNone) {
+        WriteAheadLog::Options options;
+        options.durability = mode.durability;
+        options.batch_window = std::chrono::microseconds(mode.window_us);
+        wal = std::make_shared<WriteAheadLog>(path, options);
+        map = std::make_shared<DurableMap>(map, wal);
+      }
+
+      auto start = Clock::now();
+      std::vector<std::thread> workers;
+      for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]() {
+          for (int i = 0; i < ops_per_thread; ++i)
+            map->put("key" + std::to_string(t) + "_" + std::to_string(i),
+                     value);
+        });
+      for (auto &w : workers)
+        w.join();
+      double secs =
+          std::chrono::duration<double>(Clock::now() - start).count();
+
+      double per_batch = 0;
+      if (wal) {
+        auto stats = wal->stats();
+        per_batch = stats.batches
+                        ? static_cast<double>(stats.records) / stats.batches
+                        : 0;
+      }
+      size_t ops = static_cast<size_t>(threads) * ops_per_thread;
+      out << mode.name << "," << mode.window_us << "," << threads << ","
+          << ops << "," << ops / secs << "," << per_batch << "\n";
+    }
+  }
+
+  std::remove(path.c_str());
+  out.close();
+  std::cout << "Done! See wal_durability.csv\n";
+  return 0;
+}
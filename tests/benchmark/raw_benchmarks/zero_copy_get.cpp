@@ -0,0 +1,167 @@
+// Unary Get throughput for large values, sent straight from the stored
+// record versus copied into the response message. Two servers are forked
+// over a ShardedHashMap: one on port 50098 as is, which shares records,
+// and one on 50099 behind a pass-through layer that doesn't, so its Gets
+// take the copying path. For each value size, `threads` clients read one
+// key from each server for a few seconds; the report gives MB/s and the
+// server's CPU time (utime + stime from /proc/<pid>/stat) per GB sent.
+//
+//   ./zero_copy_get [seconds] [threads] [KB,KB,...]
+//   ./zero_copy_get 3 4 4,64,1024,3072
+//
+// g++ -O2 -std=c++17 -I../../../src -I<build>/generated zero_copy_get.cpp \
+//     <build>/generated/kvstore*.pb.cc $(pkg-config --libs grpc++ protobuf) \
+//     -pthread -o zero_copy_get
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "map/ShardedHashMap.h"
+#include "server_impl.h"
+
+using Clock = std::chrono::steady_clock;
+
+const char *kShared = "127.0.0.1:50098";
+const char *kCopied = "127.0.0.1:50099";
+
+// Hides the engine's records, so Get copies values as before.
+class CopyingMap : public kvstore::IConcurrentMap {
+public:
+  explicit CopyingMap(std::shared_ptr<kvstore::IConcurrentMap> store)
+      : store_(std::move(store)) {}
+  bool put(std::string_view key, std::string_view value) override {
+    return store_->put(key, value);
+  }
+  bool get(std::string_view key, std::string &value) const override {
+    return store_->get(key, value);
+  }
+  bool remove(std::string_view key) override { return store_->remove(key); }
+  size_t size() const override { return store_->size(); }
+
+private:
+  std::shared_ptr<kvstore::IConcurrentMap> store_;
+};
+
+// Runs a server in a child process until killed.
+pid_t spawnServer(const char *address, bool share) {
+  pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  std::shared_ptr<kvstore::IConcurrentMap> store =
+      std::make_shared<kvstore::ShardedHashMap>();
+  if (!share)
+    store = std::make_shared<CopyingMap>(store);
+  AsyncKVServer server(address, store);
+  server.Run(1, 2);
+  _exit(0);
+}
+
+// utime + stime of a process, in seconds.
+double cpuSeconds(pid_t pid) {
+  std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+  std::string line;
+  std::getline(stat, line);
+  // Fields after the command name, which is in parentheses.
+  std::istringstream fields(line.substr(line.rfind(')') + 2));
+  std::string field;
+  double ticks = 0;
+  for (int i = 3; i <= 15 && fields >> field; ++i)
+    if (i >= 14)
+      ticks += std::atof(field.c_str());
+  return ticks / sysconf(_SC_CLK_TCK);
+}
+
+std::unique_ptr<KeyValueStore::Stub> connect(const char *address) {
+  grpc::ChannelArguments args;
+  args.SetMaxReceiveMessageSize(-1);
+  // One connection per client thread.
+  args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+  return KeyValueStore::NewStub(grpc::CreateCustomChannel(
+      address, grpc::InsecureChannelCredentials(), args));
+}
+
+struct Result {
+  double mb_per_s = 0;
+  double cpu_ms_per_gb = 0;
+};
+
+Result run(const char *address, pid_t server, size_t size, double seconds,
+           int threads) {
+  {
+    auto stub = connect(address);
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    PutRequest request;
+    request.set_key("value");
+    request.set_value(std::string(size, 'v'));
+    PutResponse response;
+    stub->Put(&ctx, request, &response);
+  }
+  std::atomic<bool> running{true};
+  std::atomic<uint64_t> bytes{0};
+  std::vector<std::thread> clients;
+  double cpu_before = cpuSeconds(server);
+  auto start = Clock::now();
+  for (int t = 0; t < threads; ++t)
+    clients.emplace_back([&]() {
+      auto stub = connect(address);
+      GetRequest request;
+      request.set_key("value");
+      GetResponse response;
+      while (running.load(std::memory_order_relaxed)) {
+        grpc::ClientContext ctx;
+        if (stub->Get(&ctx, request, &response).ok())
+          bytes += response.value().size();
+      }
+    });
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  running = false;
+  for (auto &client : clients)
+    client.join();
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  double gb = bytes.load() / 1e9;
+  Result result;
+  result.mb_per_s = bytes.load() / 1e6 / elapsed;
+  result.cpu_ms_per_gb = (cpuSeconds(server) - cpu_before) * 1e3 / gb;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? std::atof(argv[1]) : 3;
+  int threads = argc > 2 ? std::atoi(argv[2]) : 4;
+  std::vector<size_t> sizes;
+  std::stringstream list(argc > 3 ? argv[3] : "4,64,1024,3072");
+  for (std::string kb; std::getline(list, kb, ',');)
+    sizes.push_back(std::strtoull(kb.c_str(), nullptr, 10));
+
+  pid_t shared = spawnServer(kShared, true);
+  pid_t copied = spawnServer(kCopied, false);
+
+  std::ofstream out("zero_copy_get.csv");
+  out << "Value KB,Path,MB/s,Server CPU ms/GB\n";
+  for (size_t kb : sizes) {
+    std::cout << "Benchmarking with " << kb << " KB values..." << std::endl;
+    for (bool share : {false, true}) {
+      Result result = run(share ? kShared : kCopied, share ? shared : copied,
+                          kb << 10, seconds, threads);
+      out << kb << "," << (share ? "shared" : "copied") << ","
+          << result.mb_per_s << "," << result.cpu_ms_per_gb << "\n";
+    }
+  }
+  out.close();
+  for (pid_t pid : {shared, copied}) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  std::cout << "Done! See zero_copy_get.csv" << std::endl;
+  return 0;
+}
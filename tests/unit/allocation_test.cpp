@@ -0,0 +1,102 @@
+#include "map/IConcurrentMap.h"
+#include "map/ShardedHashMap.h"
+#include "map/SkipListMap.h"
+#include "map/SlabAllocator.h"
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// Counts heap allocations made by the current thread while enabled. This
+// replaces the global operator new for the whole test binary; it is a plain
+// malloc passthrough when counting is off.
+namespace {
+thread_local bool counting_allocations = false;
+thread_local size_t allocation_count = 0;
+
+class AllocationCounter {
+public:
+  AllocationCounter() {
+    allocation_count = 0;
+    counting_allocations = true;
+  }
+  ~AllocationCounter() { counting_allocations = false; }
+  size_t count() const { return allocation_count; }
+};
+} // namespace
+
+void *operator new(size_t size) {
+  if (counting_allocations)
+    ++allocation_count;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+using namespace kvstore;
+
+class AllocationTest : public ::testing::TestWithParam<std::string> {
+protected:
+  void SetUp() override {
+    if (GetParam() == "skiplist")
+      map = std::make_unique<SkipListMap>();
+    else
+      map = std::make_unique<ShardedHashMap>();
+    // Keys and values well past the SSO limit so any copy would allocate.
+    for (int i = 0; i < 1000; ++i) {
+      keys.push_back("a-key-long-enough-to-defeat-sso-" + std::to_string(i));
+      map->put(keys.back(), std::string(100, 'v'));
+    }
+  }
+
+  std::unique_ptr<IConcurrentMap> map;
+  std::vector<std::string> keys;
+};
+
+TEST_P(AllocationTest, GetDoesNotAllocate) {
+  std::string value;
+  value.reserve(128);
+  size_t hits = 0;
+  {
+    AllocationCounter counter;
+    for (const auto &key : keys)
+      hits += map->get(key, value);
+    // Misses must not allocate either.
+    hits += map->get("a-key-long-enough-to-defeat-sso-missing", value);
+    EXPECT_EQ(counter.count(), 0u);
+  }
+  EXPECT_EQ(hits, keys.size());
+  EXPECT_EQ(value, std::string(100, 'v'));
+}
+
+TEST_P(AllocationTest, SlabOverwritesDoNotMalloc) {
+  // Two rounds warm this thread's slab cache and the skip list's retire
+  // lists: the skip list frees a replaced record a couple of epochs late,
+  // so only the second round fills the cache with blocks of this size.
+  // After that a Put reuses freed record blocks.
+  for (int round = 0; round < 2; ++round)
+    for (const auto &key : keys)
+      map->put(key, std::string_view("warm-up"));
+  AllocationCounter counter;
+  for (const auto &key : keys)
+    EXPECT_FALSE(map->put(key, std::string_view("new-value")));
+  EXPECT_EQ(counter.count(), 0u);
+}
+
+TEST_P(AllocationTest, MallocRecordsAllocateOncePerPut) {
+  SlabAllocator::ScopedEnabled disabled(false);
+  for (const auto &key : keys)
+    map->put(key, std::string_view("warm-up"));
+  AllocationCounter counter;
+  for (const auto &key : keys)
+    EXPECT_FALSE(map->put(key, std::string_view("new-value")));
+  EXPECT_EQ(counter.count(), keys.size());
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, AllocationTest,
+                         ::testing::Values("skiplist", "sharded_hash"));
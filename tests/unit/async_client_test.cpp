@@ -0,0 +1,153 @@
+#include "client/AsyncKVClient.h"
+#include "map/ShardedHashMap.h"
+#include "server_impl.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace kvstore;
+
+namespace {
+
+// Store whose reads take `delay` ms, for deadline and backpressure tests.
+class SlowMap : public ShardedHashMap {
+public:
+  bool get(std::string_view key, std::string &value) const override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay.load()));
+    return ShardedHashMap::get(key, value);
+  }
+  RecordPtr getRecord(std::string_view key) const override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay.load()));
+    return ShardedHashMap::getRecord(key);
+  }
+  std::atomic<int> delay{0};
+};
+
+} // namespace
+
+class AsyncKVClientTest : public ::testing::Test {
+protected:
+  static void SetUpTestSuite() {
+    store_ = std::make_shared<SlowMap>();
+    server_ = std::make_unique<AsyncKVServer>(kAddress, store_);
+    runner_ = std::thread([]() { server_->Run(2, 2); });
+    // Wait for the server to come up.
+    auto stub = KeyValueStore::NewStub(
+        grpc::CreateChannel(kAddress, grpc::InsecureChannelCredentials()));
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    StatsResponse response;
+    stub->Stats(&ctx, StatsRequest(), &response);
+  }
+
+  static void TearDownTestSuite() {
+    server_->Shutdown();
+    runner_.join();
+    server_.reset();
+  }
+
+  void TearDown() override { store_->delay = 0; }
+
+  static AsyncKVClient::Options options() {
+    AsyncKVClient::Options options;
+    options.target = kAddress;
+    options.default_timeout = std::chrono::seconds(5);
+    return options;
+  }
+
+  static GetRequest getRequest(const std::string &key) {
+    GetRequest request;
+    request.set_key(key);
+    return request;
+  }
+
+  static constexpr const char *kAddress = "127.0.0.1:50072";
+  static std::shared_ptr<SlowMap> store_;
+  static std::unique_ptr<AsyncKVServer> server_;
+  static std::thread runner_;
+};
+
+std::shared_ptr<SlowMap> AsyncKVClientTest::store_;
+std::unique_ptr<AsyncKVServer> AsyncKVClientTest::server_;
+std::thread AsyncKVClientTest::runner_;
+
+TEST_F(AsyncKVClientTest, FuturesRoundTrip) {
+  AsyncKVClient client(options());
+  PutRequest put;
+  put.set_key("future");
+  put.set_value("value");
+  auto put_reply = client.Put(put).get();
+  ASSERT_TRUE(put_reply.ok());
+  EXPECT_TRUE(put_reply.response.success());
+  auto get_reply = client.Get(getRequest("future")).get();
+  ASSERT_TRUE(get_reply.ok());
+  EXPECT_TRUE(get_reply.response.found());
+  EXPECT_EQ(get_reply.response.value(), "value");
+  EXPECT_EQ(client.InFlight(), 0u);
+}
+
+TEST_F(AsyncKVClientTest, OneThreadKeepsThousandsInFlight) {
+  AsyncKVClient::Options opts = options();
+  opts.max_in_flight = 1000;
+  AsyncKVClient client(opts);
+  const int calls = 5000;
+  std::atomic<int> succeeded{0}, completed{0};
+  size_t peak = 0;
+  PutRequest put;
+  put.set_value("v");
+  for (int i = 0; i < calls; ++i) {
+    put.set_key("burst-" + std::to_string(i));
+    client.Put(put, [&](const grpc::Status &status, PutResponse &response) {
+      succeeded += status.ok() && response.success();
+      ++completed;
+    });
+    peak = std::max(peak, client.InFlight());
+  }
+  while (completed < calls)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_EQ(succeeded, calls);
+  EXPECT_LE(peak, 1000u);
+  EXPECT_GT(peak, 1u); // calls really were outstanding together
+  std::string value;
+  EXPECT_TRUE(store_->get("burst-4999", value));
+}
+
+TEST_F(AsyncKVClientTest, PerCallDeadline) {
+  store_->delay = 300;
+  AsyncKVClient client(options());
+  AsyncKVClient::CallOptions call;
+  call.timeout = std::chrono::milliseconds(20);
+  auto reply = client.Get(getRequest("slow"), call).get();
+  EXPECT_EQ(reply.status.error_code(), grpc::StatusCode::DEADLINE_EXCEEDED);
+}
+
+TEST_F(AsyncKVClientTest, FailsFastWhenFull) {
+  store_->delay = 200;
+  AsyncKVClient::Options opts = options();
+  opts.max_in_flight = 1;
+  opts.block_when_full = false;
+  AsyncKVClient client(opts);
+  auto first = client.Get(getRequest("a"));
+  auto second = client.Get(getRequest("b")).get();
+  EXPECT_EQ(second.status.error_code(),
+            grpc::StatusCode::RESOURCE_EXHAUSTED);
+  EXPECT_TRUE(first.get().ok());
+}
+
+TEST_F(AsyncKVClientTest, DestructionCancelsOutstandingCalls) {
+  store_->delay = 500;
+  std::future<AsyncKVClient::Reply<GetResponse>> reply;
+  auto start = std::chrono::steady_clock::now();
+  {
+    AsyncKVClient::Options opts = options();
+    opts.default_timeout = std::chrono::milliseconds(0);
+    AsyncKVClient client(opts);
+    reply = client.Get(getRequest("cancelled"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  EXPECT_EQ(reply.get().status.error_code(), grpc::StatusCode::CANCELLED);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(400));
+  // Let the server finish the abandoned Get before the suite shuts it down.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+}
@@ -0,0 +1,303 @@
+#include "compression/CompressingMap.h"
+#include "compression/ValueCodec.h"
+#include "map/ExpiringMap.h"
+#include "map/SkipListMap.h"
+#include "server_impl.h"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+
+namespace {
+
+// A JSON-ish record like the ones the store mostly holds.
+std::string record(int i, int items = 8) {
+  std::string value = "{\"id\":" + std::to_string(i) +
+                      ",\"name\":\"user" + std::to_string(i) +
+                      "\",\"active\":true,\"items\":[";
+  for (int j = 0; j < items; ++j)
+    value += std::string(j ? "," : "") + "{\"sku\":\"SKU-" +
+             std::to_string(1000 + (i + j) % 50) +
+             "\",\"qty\":" + std::to_string(j % 4 + 1) +
+             ",\"currency\":\"EUR\",\"status\":\"shipped\"}";
+  return value + "]}";
+}
+
+ValueCodec::Options codecOptions(Codec codec) {
+  ValueCodec::Options options;
+  options.codec = codec;
+  options.min_bytes = 64;
+  return options;
+}
+
+} // namespace
+
+TEST(ValueCodecTest, RoundTripsEveryCodec) {
+  std::string value = record(1);
+  for (Codec codec : {Codec::kLz4, Codec::kZstd, Codec::kSnappy}) {
+    SCOPED_TRACE(codecName(codec));
+    ValueCodec codecs(codecOptions(codec));
+    std::string stored, decoded;
+    Codec used = codecs.encode(value, stored);
+    ASSERT_TRUE(codecs.decode(stored, decoded));
+    EXPECT_EQ(decoded, value);
+    if (codec != Codec::kSnappy) { // whose stand-in may not shrink
+      EXPECT_EQ(used, codec);
+      EXPECT_LT(stored.size(), value.size() / 2);
+    }
+  }
+}
+
+TEST(ValueCodecTest, StoresShortAndIncompressibleValuesAsIs) {
+  ValueCodec codec(codecOptions(Codec::kZstd));
+  std::string stored, decoded;
+  EXPECT_EQ(codec.encode("short", stored), Codec::kNone);
+  EXPECT_EQ(stored.size(), 1 + 5u);
+  ASSERT_TRUE(codec.decode(stored, decoded));
+  EXPECT_EQ(decoded, "short");
+
+  std::mt19937 rng(3);
+  std::string noise(4096, '\0');
+  for (char &c : noise)
+    c = static_cast<char>(rng());
+  EXPECT_EQ(codec.encode(noise, stored), Codec::kNone);
+  EXPECT_EQ(stored.size(), 1 + noise.size());
+  ASSERT_TRUE(codec.decode(stored, decoded));
+  EXPECT_EQ(decoded, noise);
+}
+
+TEST(ValueCodecTest, DictionaryShrinksSmallValues) {
+  ValueCodec::Options options = codecOptions(Codec::kZstd);
+  // Raw-content dictionaries work too; a trained one does better.
+  for (int i = 0; i < 20; ++i)
+    options.dictionary += record(100 + i, 2);
+  ValueCodec with_dictionary(options);
+  ValueCodec without(codecOptions(Codec::kZstd));
+  EXPECT_EQ(with_dictionary.codec(), Codec::kZstdDict);
+
+  std::string value = record(7, 2), small, plain, decoded;
+  EXPECT_EQ(with_dictionary.encode(value, small), Codec::kZstdDict);
+  without.encode(value, plain);
+  EXPECT_LT(small.size(), plain.size());
+  ASSERT_TRUE(with_dictionary.decode(small, decoded));
+  EXPECT_EQ(decoded, value);
+  // Frames that need the dictionary can't be read without it.
+  EXPECT_FALSE(without.decode(small, decoded));
+  // Plain frames can be read with it.
+  ASSERT_TRUE(with_dictionary.decode(plain, decoded));
+  EXPECT_EQ(decoded, value);
+}
+
+TEST(ValueCodecTest, RejectsMalformedValues) {
+  ValueCodec codec(codecOptions(Codec::kLz4));
+  std::string stored, decoded;
+  EXPECT_FALSE(codec.decode("", decoded));
+  EXPECT_FALSE(codec.decode(std::string(1, '\x09') + "x", decoded));
+  EXPECT_FALSE(codec.decode(std::string(1, '\x01') + "\xff", decoded));
+
+  ASSERT_EQ(codec.encode(record(2), stored), Codec::kLz4);
+  stored.resize(stored.size() / 2);
+  EXPECT_FALSE(codec.decode(stored, decoded));
+
+  // Sizes the payload can't hold are refused before allocating them.
+  std::string huge = std::string(1, '\x01') + "\xff\xff\xff\xff\xff\x01" +
+                     std::string(16, 'x');
+  EXPECT_FALSE(codec.decode(huge, decoded));
+  for (Codec c : {Codec::kNone, Codec::kLz4, Codec::kZstd, Codec::kSnappy})
+    EXPECT_FALSE(codec.decompress(c, "xx", uint64_t{1} << 40, decoded));
+}
+
+TEST(CompressingMapTest, EveryReadPathDecompresses) {
+  auto engine = std::make_shared<SkipListMap>();
+  CompressingMap map(engine, codecOptions(Codec::kLz4));
+  EXPECT_TRUE(map.put("a", record(1)));
+  EXPECT_TRUE(map.put("b", "tiny"));
+  std::string c = record(3);
+  EXPECT_EQ(map.multiPut({{"c", c}, {"d", record(4)}}), 2u);
+
+  std::string value, stored;
+  ASSERT_TRUE(map.get("a", value));
+  EXPECT_EQ(value, record(1));
+  ASSERT_TRUE(engine->get("a", stored));
+  EXPECT_LT(stored.size(), value.size() / 2);
+
+  std::vector<std::string> found(3);
+  map.multiGet({"b", "c", "zz"}, [&](size_t i, std::string_view v) {
+    found[i] = std::string(v);
+  });
+  EXPECT_EQ(found, (std::vector<std::string>{"tiny", c, ""}));
+
+  std::vector<std::string> scanned;
+  ASSERT_TRUE(map.scan("b", "", "", [&](std::string_view,
+                                         std::string_view v) {
+    scanned.emplace_back(v);
+    return true;
+  }));
+  EXPECT_EQ(scanned, (std::vector<std::string>{"tiny", c, record(4)}));
+
+  size_t visited = 0;
+  map.forEach([&](std::string_view key, std::string_view v) {
+    ++visited;
+    return key != "a" || v == record(1);
+  });
+  EXPECT_EQ(visited, 4u);
+
+  CompressingMap::Stats stats = map.stats();
+  EXPECT_EQ(stats.compressed, 3u);
+  EXPECT_EQ(stats.uncompressed, 1u);
+  EXPECT_GT(stats.savedBytesPerValue(), 0);
+  EXPECT_GE(stats.decompressed, 3u);
+  EXPECT_EQ(stats.corrupt, 0u);
+}
+
+TEST(CompressingMapTest, GetCompressedHandsOutThePayload) {
+  CompressingMap map(std::make_shared<SkipListMap>(),
+                     codecOptions(Codec::kZstd));
+  map.put("big", record(5));
+  map.put("small", "tiny");
+
+  std::string payload, value;
+  Codec codec;
+  uint64_t raw_size;
+  ASSERT_TRUE(map.getCompressed("big", payload, codec, raw_size));
+  EXPECT_EQ(codec, Codec::kZstd);
+  EXPECT_EQ(raw_size, record(5).size());
+  ASSERT_TRUE(map.codec().decompress(codec, payload, raw_size, value));
+  EXPECT_EQ(value, record(5));
+
+  ASSERT_TRUE(map.getCompressed("small", payload, codec, raw_size));
+  EXPECT_EQ(codec, Codec::kNone);
+  EXPECT_EQ(payload, "tiny");
+  EXPECT_FALSE(map.getCompressed("missing", payload, codec, raw_size));
+  EXPECT_EQ(map.stats().passed_through, 2u);
+}
+
+TEST(CompressingMapTest, LayersOverTtls) {
+  ExpiringMap::Options options;
+  options.tick = std::chrono::milliseconds(1);
+  auto expiring =
+      std::make_shared<ExpiringMap>(std::make_shared<SkipListMap>(), options);
+  CompressingMap map(expiring, codecOptions(Codec::kLz4));
+  EXPECT_TRUE(map.expiresKeys());
+  map.putExpiring("short-lived", record(6), std::chrono::milliseconds(20));
+  map.put("kept", record(7));
+
+  std::string value;
+  ASSERT_TRUE(map.get("short-lived", value));
+  EXPECT_EQ(value, record(6));
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  expiring->expireNow();
+  EXPECT_FALSE(map.get("short-lived", value));
+  ASSERT_TRUE(map.get("kept", value));
+  EXPECT_EQ(value, record(7));
+}
+
+// A server with compression on, reached over gRPC.
+class CompressionServerTest : public ::testing::Test {
+protected:
+  static constexpr const char *kAddress = "127.0.0.1:50079";
+
+  static void SetUpTestSuite() {
+    store_ = std::make_shared<CompressingMap>(std::make_shared<SkipListMap>(),
+                                              codecOptions(Codec::kLz4));
+    server_ = new AsyncKVServer(kAddress, store_);
+    server_->EnableCompression(store_);
+    runner_ = new std::thread([]() { server_->Run(1, 1); });
+    stub_ = KeyValueStore::NewStub(
+        grpc::CreateChannel(kAddress, grpc::InsecureChannelCredentials()))
+                .release();
+  }
+
+  static void TearDownTestSuite() {
+    server_->Shutdown();
+    runner_->join();
+    delete runner_;
+    delete server_;
+    delete stub_;
+    store_.reset();
+  }
+
+  static GetResponse Get(const std::string &key, bool accept_compressed) {
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    GetRequest request;
+    request.set_key(key);
+    request.set_accept_compressed(accept_compressed);
+    GetResponse response;
+    EXPECT_TRUE(stub_->Get(&ctx, request, &response).ok());
+    return response;
+  }
+
+  static void Put(const std::string &key, const std::string &value) {
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    PutRequest request;
+    request.set_key(key);
+    request.set_value(value);
+    PutResponse response;
+    ASSERT_TRUE(stub_->Put(&ctx, request, &response).ok());
+  }
+
+  static std::shared_ptr<CompressingMap> store_;
+  static AsyncKVServer *server_;
+  static std::thread *runner_;
+  static KeyValueStore::Stub *stub_;
+};
+
+std::shared_ptr<CompressingMap> CompressionServerTest::store_;
+AsyncKVServer *CompressionServerTest::server_;
+std::thread *CompressionServerTest::runner_;
+KeyValueStore::Stub *CompressionServerTest::stub_;
+
+TEST_F(CompressionServerTest, GetDecompressesUnlessTheClientAccepts) {
+  Put("doc", record(8));
+  GetResponse plain = Get("doc", false);
+  ASSERT_TRUE(plain.found());
+  EXPECT_EQ(plain.value(), record(8));
+  EXPECT_EQ(plain.compression(), COMPRESSION_NONE);
+
+  GetResponse passed = Get("doc", true);
+  ASSERT_TRUE(passed.found());
+  EXPECT_EQ(passed.compression(), COMPRESSION_LZ4);
+  EXPECT_EQ(passed.raw_size(), record(8).size());
+  EXPECT_LT(passed.value().size(), record(8).size() / 2);
+  // What a client does with it.
+  ValueCodec client(ValueCodec::Options{});
+  std::string value;
+  ASSERT_TRUE(client.decompress(static_cast<Codec>(passed.compression()),
+                                passed.value(), passed.raw_size(), value));
+  EXPECT_EQ(value, record(8));
+
+  Put("note", "tiny");
+  GetResponse small = Get("note", true);
+  EXPECT_EQ(small.compression(), COMPRESSION_NONE);
+  EXPECT_EQ(small.value(), "tiny");
+  EXPECT_FALSE(Get("missing", true).found());
+}
+
+TEST_F(CompressionServerTest, StatsReportSavingsAndCost) {
+  for (int i = 0; i < 50; ++i)
+    Put("s" + std::to_string(i), record(i));
+  Get("s1", false);
+
+  grpc::ClientContext ctx;
+  StatsRequest request;
+  request.set_prometheus_text(true);
+  StatsResponse stats;
+  ASSERT_TRUE(stub_->Stats(&ctx, request, &stats).ok());
+  const CompressionStats &compression = stats.compression();
+  EXPECT_EQ(compression.codec(), "lz4");
+  EXPECT_GE(compression.compressed(), 50u);
+  EXPECT_LT(compression.stored_bytes(), compression.raw_bytes() / 2);
+  EXPECT_GT(compression.saved_bytes_per_value(), 0);
+  EXPECT_GT(compression.compress_ns_per_op(), 0);
+  EXPECT_GE(compression.decompressed(), 1u);
+  EXPECT_NE(stats.prometheus_text().find(
+                "kvstore_compression_values_total{stored=\"compressed\"}"),
+            std::string::npos);
+}
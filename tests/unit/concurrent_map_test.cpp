@@ -0,0 +1,276 @@
+#include "map/IConcurrentMap.h"
+#include "map/ShardedHashMap.h"
+#include "map/SkipListMap.h"
+#include "map/SlabAllocator.h"
+#include "map/StdMap.h"
+#include "map/StripedMap.h"
+#include <algorithm>
+#include <atomic>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+
+template <typename T> class ConcurrentMapTest : public ::testing::Test {
+protected:
+  T map;
+};
+
+// StripedMap over std::map, default-constructible for the typed tests.
+struct StripedStdMap : StripedMap {
+  StripedStdMap()
+      : StripedMap(16, []() {
+          return std::make_unique<StdMap<std::string, std::string>>();
+        }) {}
+};
+
+using ConcurrentMapTypes =
+    ::testing::Types<SkipListMap, ShardedHashMap, StripedStdMap>;
+TYPED_TEST_SUITE(ConcurrentMapTest, ConcurrentMapTypes);
+
+TYPED_TEST(ConcurrentMapTest, PutGetRemove) {
+  std::string value;
+  EXPECT_FALSE(this->map.get("key1", value));
+
+  EXPECT_TRUE(this->map.put("key1", "value1"));
+  EXPECT_TRUE(this->map.get("key1", value));
+  EXPECT_EQ(value, "value1");
+  EXPECT_EQ(this->map.size(), 1u);
+
+  EXPECT_TRUE(this->map.remove("key1"));
+  EXPECT_FALSE(this->map.get("key1", value));
+  EXPECT_FALSE(this->map.remove("key1"));
+  EXPECT_EQ(this->map.size(), 0u);
+}
+
+TYPED_TEST(ConcurrentMapTest, PutOverwrites) {
+  EXPECT_TRUE(this->map.put("key1", "value1"));
+  EXPECT_FALSE(this->map.put("key1", "value2"));
+
+  std::string value;
+  EXPECT_TRUE(this->map.get("key1", value));
+  EXPECT_EQ(value, "value2");
+  EXPECT_EQ(this->map.size(), 1u);
+}
+
+TYPED_TEST(ConcurrentMapTest, ConcurrentDisjointWriters) {
+  const int kThreads = 8;
+  const int kKeysPerThread = 2000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([this, t]() {
+      for (int i = 0; i < kKeysPerThread; ++i) {
+        std::string key =
+            "key-" + std::to_string(t) + "-" + std::to_string(i);
+        this->map.put(key, key);
+        // Delete every other key to leave tombstones behind.
+        if (i % 2 == 0)
+          this->map.remove(key);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  EXPECT_EQ(this->map.size(),
+            static_cast<size_t>(kThreads * kKeysPerThread / 2));
+  std::string value;
+  for (int t = 0; t < kThreads; ++t) {
+    for (int i = 0; i < kKeysPerThread; ++i) {
+      std::string key = "key-" + std::to_string(t) + "-" + std::to_string(i);
+      EXPECT_EQ(this->map.get(key, value), i % 2 == 1);
+    }
+  }
+}
+
+TYPED_TEST(ConcurrentMapTest, OverwriteNeverHidesKey) {
+  this->map.put("hot", "0");
+  std::atomic<bool> done{false};
+  std::atomic<int> misses{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([this, &done, &misses]() {
+      std::string value;
+      while (!done.load()) {
+        if (!this->map.get("hot", value))
+          ++misses;
+      }
+    });
+  }
+  std::thread writer([this]() {
+    for (int i = 1; i <= 20000; ++i)
+      EXPECT_FALSE(this->map.put("hot", std::to_string(i)));
+  });
+  writer.join();
+  done = true;
+  for (auto &reader : readers)
+    reader.join();
+
+  EXPECT_EQ(misses.load(), 0);
+  std::string value;
+  EXPECT_TRUE(this->map.get("hot", value));
+  EXPECT_EQ(value, "20000");
+  EXPECT_EQ(this->map.size(), 1u);
+}
+
+TYPED_TEST(ConcurrentMapTest, BatchResultsArePositional) {
+  // Unsorted keys with a duplicate, so engines that reorder internally must
+  // still report by request position and let the later duplicate win.
+  IConcurrentMap::EntryList entries = {
+      {"m", "1"}, {"c", "2"}, {"x", "3"}, {"c", "4"}, {"a", "5"}};
+  EXPECT_EQ(this->map.multiPut(entries), 4u);
+  EXPECT_EQ(this->map.size(), 4u);
+
+  IConcurrentMap::KeyList keys = {"x", "missing", "c", "a", "m", "c"};
+  std::vector<std::string> values(keys.size(), "<none>");
+  this->map.multiGet(keys, [&](size_t i, std::string_view value) {
+    values[i] = std::string(value);
+  });
+  EXPECT_EQ(values, (std::vector<std::string>{"3", "<none>", "4", "5", "1",
+                                              "4"}));
+
+  std::vector<size_t> removed;
+  this->map.multiRemove({"c", "zz", "a", "c"},
+                        [&](size_t i) { removed.push_back(i); });
+  std::sort(removed.begin(), removed.end());
+  EXPECT_EQ(removed, (std::vector<size_t>{0, 2}));
+  EXPECT_EQ(this->map.size(), 2u);
+}
+
+TYPED_TEST(ConcurrentMapTest, SharedRecordsOutliveOverwrites) {
+  this->map.put("key", "first");
+  RecordPtr record = this->map.getRecord("key");
+  if (!this->map.sharesRecords()) {
+    EXPECT_EQ(record, nullptr);
+    return;
+  }
+  ASSERT_NE(record, nullptr);
+  EXPECT_EQ(record->key(), "key");
+  EXPECT_EQ(record->value(), "first");
+  EXPECT_EQ(this->map.getRecord("missing"), nullptr);
+
+  // The reader keeps the value it was handed.
+  this->map.put("key", "second");
+  this->map.remove("key");
+  this->map.put("other", "x"); // lets the skip list free retired records
+  EXPECT_EQ(record->value(), "first");
+}
+
+TEST(ShardedHashMapTest, GrowsPastInitialCapacity) {
+  ShardedHashMap map(4, 16);
+  EXPECT_EQ(map.shardCount(), 4u);
+  for (int i = 0; i < 10000; ++i)
+    map.put(std::to_string(i), std::to_string(i * 2));
+  EXPECT_EQ(map.size(), 10000u);
+  std::string value;
+  for (int i = 0; i < 10000; ++i) {
+    ASSERT_TRUE(map.get(std::to_string(i), value));
+    EXPECT_EQ(value, std::to_string(i * 2));
+  }
+}
+
+TEST(ShardedHashMapTest, ChurnReusesTombstones) {
+  ShardedHashMap map(1, 64);
+  for (int round = 0; round < 100; ++round) {
+    for (int i = 0; i < 32; ++i)
+      map.put("k" + std::to_string(round * 32 + i), "v");
+    for (int i = 0; i < 32; ++i)
+      EXPECT_TRUE(map.remove("k" + std::to_string(round * 32 + i)));
+  }
+  EXPECT_EQ(map.size(), 0u);
+  EXPECT_TRUE(map.put("final", "v"));
+  std::string value;
+  EXPECT_TRUE(map.get("final", value));
+}
+
+TEST(ShardedHashMapTest, ScanIsUnsupported) {
+  ShardedHashMap map;
+  map.put("a", "1");
+  bool visited = false;
+  EXPECT_FALSE(map.scan("", "", "", [&](std::string_view, std::string_view) {
+    visited = true;
+    return true;
+  }));
+  EXPECT_FALSE(visited);
+}
+
+TEST(SkipListMapTest, ScanRangeAndPrefix) {
+  SkipListMap map;
+  for (const char *key : {"a", "b/1", "b/2", "b/3", "ba", "c", "d"})
+    map.put(key, std::string("v") + key);
+
+  auto collect = [&](std::string_view start, std::string_view end,
+                     std::string_view prefix, size_t limit = 0) {
+    std::vector<std::string> keys;
+    EXPECT_TRUE(map.scan(start, end, prefix,
+                         [&](std::string_view key, std::string_view value) {
+                           EXPECT_EQ(value, "v" + std::string(key));
+                           keys.emplace_back(key);
+                           return limit == 0 || keys.size() < limit;
+                         }));
+    return keys;
+  };
+  using Keys = std::vector<std::string>;
+  EXPECT_EQ(collect("", "", ""),
+            (Keys{"a", "b/1", "b/2", "b/3", "ba", "c", "d"}));
+  EXPECT_EQ(collect("b/2", "c", ""), (Keys{"b/2", "b/3", "ba"}));
+  EXPECT_EQ(collect("", "", "b/"), (Keys{"b/1", "b/2", "b/3"}));
+  EXPECT_EQ(collect("b/2", "", "b/"), (Keys{"b/2", "b/3"}));
+  EXPECT_EQ(collect("", "", "", 2), (Keys{"a", "b/1"}));
+  EXPECT_TRUE(collect("e", "", "").empty());
+}
+
+TEST(SkipListMapTest, SustainedOverwritesStayBounded) {
+  // Readers keep accessors open the whole time, so replaced records can
+  // only be freed as epochs move on under them; slab usage has to track
+  // the live data rather than the number of writes.
+  SlabAllocator::ScopedEnabled enabled(true);
+  const int kKeys = 256;
+  const int kWritesPerThread = 200000;
+  const std::string value(200, 'v');
+  auto keyFor = [](int i) { return "key_" + std::to_string(i); };
+
+  size_t before = SlabAllocator::global().stats().bytes_used;
+  {
+    SkipListMap map;
+    for (int i = 0; i < kKeys; ++i)
+      map.put(keyFor(i), value);
+
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; ++t)
+      readers.emplace_back([&, t]() {
+        std::string out;
+        for (int i = t; !done.load(); ++i)
+          map.get(keyFor(i % kKeys), out);
+      });
+
+    std::atomic<size_t> peak{0};
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t)
+      writers.emplace_back([&, t]() {
+        for (int i = 0; i < kWritesPerThread; ++i) {
+          map.put(keyFor((i * 7 + t) % kKeys), value);
+          if (i % 1000 == 0) {
+            size_t used = SlabAllocator::global().stats().bytes_used;
+            size_t seen = peak.load();
+            while (used > seen && !peak.compare_exchange_weak(seen, used)) {
+            }
+          }
+        }
+      });
+    for (auto &writer : writers)
+      writer.join();
+    done = true;
+    for (auto &reader : readers)
+      reader.join();
+
+    // 800k overwrites of ~250 byte records churn ~200 MB. What is retired
+    // but not yet freed depends on how long an accessor can be preempted,
+    // not on how many writes there were.
+    EXPECT_LT(peak.load() - before, size_t{64} << 20);
+  }
+  EXPECT_EQ(SlabAllocator::global().stats().bytes_used, before);
+}
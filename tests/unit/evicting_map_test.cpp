@@ -0,0 +1,164 @@
+#include "map/EvictingMap.h"
+#include "map/ShardedHashMap.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+
+namespace {
+
+const std::string kValue(100, 'v');
+
+std::string keyFor(const char *prefix, int i) {
+  return prefix + std::to_string(i);
+}
+
+size_t entryCost(const std::string &key) {
+  return EvictingMap::cost(key, kValue);
+}
+
+EvictingMap::Options singleShard(size_t max_bytes,
+                                 EvictingMap::Policy policy) {
+  EvictingMap::Options options;
+  options.max_bytes = max_bytes;
+  options.policy = policy;
+  options.shards = 1;
+  return options;
+}
+
+// Reads the hot keys a few times, then streams 2000 cold keys through
+// the cache once (read miss, then fill) and reports how many hot keys are
+// still resident.
+int hotKeysAfterScan(EvictingMap::Policy policy) {
+  const int hot = 100;
+  auto engine = std::make_shared<ShardedHashMap>();
+  EvictingMap cache(engine, singleShard(400 * entryCost("hot000"), policy));
+  std::string value;
+  for (int i = 0; i < hot; ++i)
+    cache.put(keyFor("hot", i), kValue);
+  for (int round = 0; round < 3; ++round)
+    for (int i = 0; i < hot; ++i)
+      cache.get(keyFor("hot", i), value);
+  for (int i = 0; i < 2000; ++i) {
+    std::string key = keyFor("scan", i);
+    if (!cache.get(key, value))
+      cache.put(key, kValue);
+  }
+  int resident = 0;
+  for (int i = 0; i < hot; ++i)
+    resident += cache.get(keyFor("hot", i), value);
+  return resident;
+}
+
+} // namespace
+
+TEST(EvictingMapTest, StaysWithinMaxBytes) {
+  for (auto policy :
+       {EvictingMap::Policy::kS3Fifo, EvictingMap::Policy::kLru}) {
+    auto engine = std::make_shared<ShardedHashMap>();
+    EvictingMap::Options options;
+    options.max_bytes = 64 * 1024;
+    options.policy = policy;
+    options.shards = 4;
+    EvictingMap cache(engine, options);
+    for (int i = 0; i < 10000; ++i)
+      cache.put(keyFor("key", i), kValue);
+    auto stats = cache.stats();
+    EXPECT_LE(stats.used_bytes, options.max_bytes);
+    EXPECT_GT(stats.evictions, 0u);
+    // Metadata and engine agree on what is resident.
+    EXPECT_EQ(engine->size(), 10000 - stats.evictions);
+    size_t expected = 0;
+    engine->forEach([&](std::string_view key, std::string_view value) {
+      expected += EvictingMap::cost(key, value);
+      return true;
+    });
+    EXPECT_EQ(stats.used_bytes, expected);
+  }
+}
+
+TEST(EvictingMapTest, S3FifoKeepsHotKeysThroughAScan) {
+  EXPECT_EQ(hotKeysAfterScan(EvictingMap::Policy::kS3Fifo), 100);
+  // LRU is what this protects against: the scan flushes the hot set.
+  EXPECT_EQ(hotKeysAfterScan(EvictingMap::Policy::kLru), 0);
+}
+
+TEST(EvictingMapTest, GhostHitGoesStraightToMain) {
+  auto engine = std::make_shared<ShardedHashMap>();
+  // Small holds a single entry, so every new key evicts the previous one.
+  EvictingMap cache(engine, singleShard(10 * entryCost("k0"),
+                                        EvictingMap::Policy::kS3Fifo));
+  cache.put("k0", kValue);
+  for (int i = 1; i < 20; ++i)
+    cache.put(keyFor("k", i), kValue);
+  std::string value;
+  ASSERT_FALSE(cache.get("k0", value));
+  cache.put("k0", kValue); // remembered by the ghost: admitted to main
+  for (int i = 20; i < 25; ++i)
+    cache.put(keyFor("k", i), kValue);
+  EXPECT_TRUE(cache.get("k0", value));
+}
+
+TEST(EvictingMapTest, OverwriteAndRemoveAdjustAccounting) {
+  auto engine = std::make_shared<ShardedHashMap>();
+  EvictingMap cache(engine, singleShard(1 << 20, EvictingMap::Policy::kS3Fifo));
+  cache.put("a", kValue);
+  cache.put("a", "short");
+  EXPECT_EQ(cache.stats().used_bytes, EvictingMap::cost("a", "short"));
+  EXPECT_TRUE(cache.remove("a"));
+  EXPECT_FALSE(cache.remove("a"));
+  EXPECT_EQ(cache.stats().used_bytes, 0u);
+  EXPECT_EQ(engine->size(), 0u);
+}
+
+TEST(EvictingMapTest, RejectsValuesLargerThanAShard) {
+  auto engine = std::make_shared<ShardedHashMap>();
+  EvictingMap cache(
+      engine, singleShard(4 * entryCost("k0"), EvictingMap::Policy::kLru));
+  for (int i = 0; i < 3; ++i)
+    cache.put(keyFor("k", i), kValue);
+  cache.put("k0", std::string(8 * kValue.size(), 'x'));
+
+  std::string value;
+  EXPECT_FALSE(cache.get("k0", value)); // the old value went with it
+  EXPECT_TRUE(cache.get("k1", value));  // the rest of the shard stays
+  EXPECT_TRUE(cache.get("k2", value));
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.rejected, 1u);
+  EXPECT_EQ(stats.evictions, 0u);
+  EXPECT_EQ(stats.used_bytes, 2 * entryCost("k0"));
+}
+
+TEST(EvictingMapTest, ConcurrentReadersAndWriters) {
+  auto engine = std::make_shared<ShardedHashMap>();
+  EvictingMap::Options options;
+  options.max_bytes = 256 * 1024;
+  options.shards = 8;
+  EvictingMap cache(engine, options);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      std::string value;
+      for (int i = 0; i < 20000; ++i) {
+        std::string key = keyFor("key", (i * 7 + t) % 5000);
+        if (!cache.get(key, value))
+          cache.put(key, kValue);
+        if (i % 97 == 0)
+          cache.remove(key);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  auto stats = cache.stats();
+  EXPECT_LE(stats.used_bytes, options.max_bytes);
+  size_t expected = 0;
+  engine->forEach([&](std::string_view key, std::string_view value) {
+    expected += EvictingMap::cost(key, value);
+    return true;
+  });
+  EXPECT_EQ(stats.used_bytes, expected);
+}
@@ -0,0 +1,185 @@
+#include "map/ExpiringMap.h"
+#include "map/SkipListMap.h"
+#include "map/TimingWheel.h"
+#include <algorithm>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+using namespace std::chrono_literals;
+
+TEST(TimingWheelTest, FiresEachItemAtItsDeadline) {
+  const uint64_t start = 1'000'000;
+  TimingWheel<uint64_t> wheel(start);
+  // Deadlines on every level, including ones that need several cascades.
+  std::mt19937_64 rng(7);
+  std::vector<uint64_t> deadlines;
+  for (int i = 0; i < 2000; ++i) {
+    uint64_t delta = rng() % (uint64_t{1} << (6 * (1 + i % 4)));
+    deadlines.push_back(start + delta);
+    wheel.schedule(start + delta, start + delta);
+  }
+  ASSERT_EQ(wheel.size(), deadlines.size());
+
+  std::vector<uint64_t> due;
+  uint64_t now = start;
+  size_t fired = 0;
+  // Uneven steps, so advance() often crosses several slots at once.
+  while (fired < deadlines.size()) {
+    now += 1 + rng() % 97;
+    due.clear();
+    wheel.advance(now, due);
+    for (uint64_t deadline : due) {
+      EXPECT_LE(deadline, now);
+      EXPECT_GT(deadline, now - 97 - 1); // not late by more than one step
+    }
+    fired += due.size();
+  }
+  EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST(TimingWheelTest, PastDeadlinesFireOnNextAdvance) {
+  TimingWheel<int> wheel(100);
+  wheel.schedule(50, 1);
+  wheel.schedule(100, 2);
+  std::vector<int> due;
+  wheel.advance(100, due);
+  EXPECT_EQ(due, (std::vector<int>{1, 2}));
+}
+
+TEST(TimingWheelTest, OverflowBeyondTopLevel) {
+  TimingWheel<int> wheel(0);
+  uint64_t far = (uint64_t{1} << 24) + 5;
+  wheel.schedule(far, 1);
+  std::vector<int> due;
+  wheel.advance(far - 1, due);
+  EXPECT_TRUE(due.empty());
+  wheel.advance(far, due);
+  EXPECT_EQ(due, (std::vector<int>{1}));
+}
+
+class ExpiringMapTest : public ::testing::Test {
+protected:
+  static ExpiringMap::Options fastOptions() {
+    ExpiringMap::Options options;
+    options.tick = 5ms;
+    options.max_expired_per_slice = 16;
+    options.slice_pause = 10us;
+    return options;
+  }
+};
+
+TEST_F(ExpiringMapTest, ExpiredKeysAreHiddenThenReclaimed) {
+  auto engine = std::make_shared<SkipListMap>();
+  ExpiringMap map(engine, fastOptions());
+  for (int i = 0; i < 100; ++i)
+    map.putExpiring("short" + std::to_string(i), "v", 20ms);
+  map.putExpiring("long", "v", 1h);
+  map.put("forever", "v");
+
+  std::string value;
+  ASSERT_TRUE(map.get("short0", value));
+  EXPECT_EQ(value, "v");
+
+  std::this_thread::sleep_for(30ms);
+  EXPECT_FALSE(map.get("short0", value)); // hidden even if not yet reclaimed
+  ASSERT_TRUE(map.get("long", value));
+  ASSERT_TRUE(map.get("forever", value));
+
+  // The expiry thread deletes them from the engine, in slices; the format
+  // marker stays.
+  for (int i = 0; i < 200 && engine->size() > 3; ++i)
+    std::this_thread::sleep_for(5ms);
+  EXPECT_EQ(engine->size(), 3u);
+  EXPECT_EQ(map.stats().expired, 100u);
+}
+
+TEST_F(ExpiringMapTest, RewriteCancelsExpiry) {
+  auto engine = std::make_shared<SkipListMap>();
+  ExpiringMap map(engine, fastOptions());
+  map.putExpiring("k", "old", 10ms);
+  map.put("k", "new"); // no TTL any more
+  std::this_thread::sleep_for(30ms);
+  map.expireNow();
+  std::string value;
+  ASSERT_TRUE(map.get("k", value));
+  EXPECT_EQ(value, "new");
+  EXPECT_EQ(map.stats().expired, 0u);
+}
+
+TEST_F(ExpiringMapTest, ScansAndBatchesSkipExpiredKeys) {
+  auto engine = std::make_shared<SkipListMap>();
+  ExpiringMap map(engine, fastOptions());
+  map.put("a", "1");
+  map.putExpiring("b", "2", 1ms);
+  map.put("c", "3");
+  std::this_thread::sleep_for(5ms);
+
+  std::vector<std::string> seen;
+  map.scan("", "", "", [&](std::string_view key, std::string_view value) {
+    seen.push_back(std::string(key) + "=" + std::string(value));
+    return true;
+  });
+  EXPECT_EQ(seen, (std::vector<std::string>{"a=1", "c=3"}));
+
+  std::vector<size_t> found;
+  map.multiGet({"a", "b", "c"}, [&](size_t i, std::string_view value) {
+    found.push_back(i);
+  });
+  EXPECT_EQ(found, (std::vector<size_t>{0, 2}));
+  EXPECT_FALSE(map.remove("b")); // expired counts as absent
+}
+
+TEST_F(ExpiringMapTest, ReschedulesDeadlinesFoundInTheStore) {
+  auto engine = std::make_shared<SkipListMap>();
+  {
+    ExpiringMap map(engine, fastOptions());
+    map.putExpiring("k", "v", 20ms);
+  } // the wheel is gone, the deadline stays with the value
+  ExpiringMap map(engine, fastOptions());
+  EXPECT_EQ(map.stats().scheduled, 1u);
+  for (int i = 0; i < 100 && engine->size() > 1; ++i)
+    std::this_thread::sleep_for(5ms);
+  EXPECT_EQ(engine->size(), 1u); // the format marker
+}
+
+TEST_F(ExpiringMapTest, RefusesStoresWrittenWithoutHeaders) {
+  auto engine = std::make_shared<SkipListMap>();
+  engine->put("k", "written before TTLs");
+  EXPECT_THROW(ExpiringMap(engine, fastOptions()), std::runtime_error);
+}
+
+TEST_F(ExpiringMapTest, HidesTheFormatMarker) {
+  auto engine = std::make_shared<SkipListMap>();
+  ExpiringMap map(engine, fastOptions());
+  std::string key(ExpiringMap::kFormatKey), value;
+  EXPECT_FALSE(map.get(key, value));
+  EXPECT_FALSE(map.remove(key));
+  size_t visited = 0;
+  map.forEach([&](std::string_view, std::string_view) {
+    ++visited;
+    return true;
+  });
+  EXPECT_EQ(visited, 0u);
+  ExpiringMap reopened(engine, fastOptions()); // the marker is accepted
+}
+
+TEST_F(ExpiringMapTest, SkipsValuesTooShortForAHeader) {
+  auto engine = std::make_shared<SkipListMap>();
+  engine->put("short", "abc");
+  auto options = fastOptions();
+  options.verify_format = false;
+  ExpiringMap map(engine, options);
+  std::string value;
+  EXPECT_FALSE(map.get("short", value));
+  map.multiGet({"short"}, [](size_t, std::string_view) { FAIL(); });
+  map.forEach([](std::string_view, std::string_view) {
+    ADD_FAILURE();
+    return true;
+  });
+}
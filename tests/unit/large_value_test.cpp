@@ -0,0 +1,392 @@
+#include "map/ShardedHashMap.h"
+#include "map/SkipListMap.h"
+#include "server_impl.h"
+#include "storage/ChunkedValueMap.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+
+namespace {
+
+// A value whose bytes depend on their position, so misplaced chunks show.
+std::string pattern(size_t size, int seed = 0) {
+  std::string value(size, '\0');
+  for (size_t i = 0; i < size; ++i)
+    value[i] = static_cast<char>((i * 131 + seed) >> 3);
+  return value;
+}
+
+ChunkedValueMap::Options smallChunks() {
+  ChunkedValueMap::Options options;
+  options.chunk_bytes = 1000;
+  return options;
+}
+
+// Writes value through a writer in pieces of `piece` bytes.
+bool writeInPieces(ChunkedValueMap &map, const std::string &key,
+                   const std::string &value, size_t piece) {
+  auto writer = map.writer(key);
+  for (size_t pos = 0; pos < value.size(); pos += piece)
+    writer->append(std::string_view(value).substr(pos, piece));
+  return writer->commit();
+}
+
+} // namespace
+
+TEST(ChunkedValueMapTest, StreamedValuesReadBackWhole) {
+  auto engine = std::make_shared<SkipListMap>();
+  ChunkedValueMap map(engine, smallChunks());
+  std::string big = pattern(4500), value;
+  // Pieces smaller than, equal to and larger than a chunk.
+  for (size_t piece : {300, 1000, 2500}) {
+    SCOPED_TRACE(piece);
+    std::string key = "big" + std::to_string(piece);
+    EXPECT_TRUE(writeInPieces(map, key, big, piece));
+    ASSERT_TRUE(map.get(key, value));
+    EXPECT_EQ(value, big);
+    std::string stored;
+    EXPECT_FALSE(engine->get(key, stored)); // kept in chunks only
+  }
+
+  // Values that fit in a chunk are stored as they are.
+  EXPECT_TRUE(writeInPieces(map, "small", "tiny", 2));
+  ASSERT_TRUE(engine->get("small", value));
+  EXPECT_EQ(value, "tiny");
+
+  ChunkedValueMap::Manifest manifest;
+  std::string whole, chunk;
+  ASSERT_TRUE(map.open("big300", manifest, whole));
+  EXPECT_EQ(manifest.size, big.size());
+  EXPECT_EQ(manifest.chunks, 5u);
+  std::string assembled;
+  for (uint32_t i = 0; i < manifest.chunks; ++i) {
+    ASSERT_TRUE(map.readChunk("big300", manifest, i, chunk));
+    assembled += chunk;
+  }
+  EXPECT_EQ(assembled, big);
+}
+
+TEST(ChunkedValueMapTest, UncommittedWritesLeaveNothing) {
+  auto engine = std::make_shared<SkipListMap>();
+  ChunkedValueMap map(engine, smallChunks());
+  map.put("kept", "old");
+  {
+    auto writer = map.writer("kept");
+    writer->append(pattern(3000));
+  }
+  std::string value;
+  ASSERT_TRUE(map.get("kept", value));
+  EXPECT_EQ(value, "old");
+  EXPECT_EQ(engine->size(), 1u);
+}
+
+TEST(ChunkedValueMapTest, WritesReplaceChunkedValues) {
+  auto engine = std::make_shared<SkipListMap>();
+  ChunkedValueMap map(engine, smallChunks());
+  std::string value;
+
+  EXPECT_TRUE(writeInPieces(map, "k", pattern(2500, 1), 500));
+  EXPECT_FALSE(writeInPieces(map, "k", pattern(3500, 2), 500));
+  ASSERT_TRUE(map.get("k", value));
+  EXPECT_EQ(value, pattern(3500, 2));
+  EXPECT_EQ(engine->size(), 1u + 4); // manifest and chunks, old ones gone
+
+  EXPECT_FALSE(map.put("k", "plain"));
+  ASSERT_TRUE(map.get("k", value));
+  EXPECT_EQ(value, "plain");
+  EXPECT_EQ(engine->size(), 1u);
+
+  EXPECT_FALSE(writeInPieces(map, "k", pattern(2500, 3), 2500));
+  EXPECT_EQ(engine->size(), 1u + 3);
+  EXPECT_TRUE(map.remove("k"));
+  EXPECT_FALSE(map.get("k", value));
+  EXPECT_FALSE(map.remove("k"));
+  EXPECT_EQ(engine->size(), 0u);
+
+  writeInPieces(map, "a", pattern(1500), 1500);
+  writeInPieces(map, "b", pattern(1500), 1500);
+  std::vector<bool> removed(3);
+  map.multiRemove({"a", "b", "c"}, [&](size_t i) { removed[i] = true; });
+  EXPECT_EQ(removed, (std::vector<bool>{true, true, false}));
+  EXPECT_EQ(engine->size(), 0u);
+}
+
+TEST(ChunkedValueMapTest, ScansSkipChunksAndBatchReadsAssemble) {
+  auto engine = std::make_shared<SkipListMap>();
+  ChunkedValueMap map(engine, smallChunks());
+  map.put("a", "1");
+  writeInPieces(map, "b", pattern(2000), 700);
+  map.put("c", "3");
+
+  std::vector<std::string> keys;
+  ASSERT_TRUE(map.scan("", "", "", [&](std::string_view key,
+                                       std::string_view) {
+    keys.emplace_back(key);
+    return true;
+  }));
+  EXPECT_EQ(keys, (std::vector<std::string>{"a", "c"}));
+  keys.clear();
+  map.forEach([&](std::string_view key, std::string_view) {
+    keys.emplace_back(key);
+    return true;
+  });
+  EXPECT_EQ(keys, (std::vector<std::string>{"a", "c"}));
+
+  std::vector<std::string> found(4);
+  map.multiGet({"a", "b", "c", "d"}, [&](size_t i, std::string_view v) {
+    found[i] = std::string(v);
+  });
+  EXPECT_EQ(found,
+            (std::vector<std::string>{"1", pattern(2000), "3", ""}));
+}
+
+TEST(ChunkedValueMapTest, FindsChunkedValuesAfterRestart) {
+  auto engine = std::make_shared<SkipListMap>();
+  writeInPieces(*std::make_unique<ChunkedValueMap>(engine, smallChunks()),
+                "k", pattern(2500), 2500);
+  // A new layer over the same engine, as after recovery.
+  ChunkedValueMap map(engine, smallChunks());
+  EXPECT_EQ(map.multiPut({{"k", "plain"}, {"j", "x"}}), 1u);
+  std::string value;
+  ASSERT_TRUE(map.get("k", value));
+  EXPECT_EQ(value, "plain");
+  EXPECT_EQ(engine->size(), 2u);
+}
+
+TEST(ChunkedValueMapTest, MissesLookForManifestsOnlyOnceNeeded) {
+  auto engine = std::make_shared<SkipListMap>();
+  ChunkedValueMap plain(engine, smallChunks());
+  auto options = smallChunks();
+  options.external_writes = true;
+  ChunkedValueMap replica(engine, options);
+  // Written below both layers' backs, as a replica's stream does.
+  writeInPieces(*std::make_unique<ChunkedValueMap>(engine, smallChunks()),
+                "k", pattern(2500), 2500);
+  std::string value;
+  EXPECT_FALSE(plain.get("k", value)); // no chunked value through it yet
+  ASSERT_TRUE(replica.get("k", value));
+  EXPECT_EQ(value, pattern(2500));
+}
+
+TEST(ChunkedValueMapTest, SharesChunkedValuesAsRecords) {
+  auto engine = std::make_shared<ShardedHashMap>();
+  ChunkedValueMap map(engine, smallChunks());
+  writeInPieces(map, "k", pattern(2500), 700);
+  RecordPtr record = map.getRecord("k");
+  ASSERT_TRUE(record);
+  EXPECT_EQ(record->key(), "k");
+  EXPECT_EQ(record->value(), pattern(2500));
+
+  // A value missing a chunk isn't handed out.
+  std::string chunk;
+  engine->forEach([&](std::string_view key, std::string_view) {
+    if (key.size() > chunk.size())
+      chunk.assign(key);
+    return true;
+  });
+  ASSERT_TRUE(engine->remove(chunk));
+  EXPECT_FALSE(map.getRecord("k"));
+}
+
+TEST(ChunkedValueMapTest, RejectsReservedKeys) {
+  auto engine = std::make_shared<SkipListMap>();
+  ChunkedValueMap map(engine, smallChunks());
+  writeInPieces(map, "k", pattern(2500), 2500);
+  std::string reserved(ChunkedValueMap::kReservedPrefix);
+  reserved += "x";
+  EXPECT_THROW(map.put(reserved, "v"), std::invalid_argument);
+  EXPECT_THROW(map.remove(reserved), std::invalid_argument);
+  EXPECT_THROW(map.writer(reserved), std::invalid_argument);
+  EXPECT_THROW(map.multiPut({{"a", "1"}, {reserved, "2"}}),
+               std::invalid_argument);
+  std::string value;
+  EXPECT_FALSE(map.get("a", value)); // the batch stored nothing
+
+  // The manifest and chunks of "k" can't be read directly either.
+  size_t stored = 0;
+  engine->forEach([&](std::string_view key, std::string_view) {
+    EXPECT_FALSE(map.get(key, value));
+    ++stored;
+    return true;
+  });
+  EXPECT_EQ(stored, 4u);
+}
+
+TEST(ChunkedValueMapTest, WholeReadsStopAtTheLimit) {
+  auto engine = std::make_shared<ShardedHashMap>();
+  auto options = smallChunks();
+  options.max_assembled_bytes = 3000;
+  ChunkedValueMap map(engine, options);
+  writeInPieces(map, "fits", pattern(3000), 1000);
+  writeInPieces(map, "over", pattern(3001), 1000);
+
+  std::string value;
+  ASSERT_TRUE(map.get("fits", value));
+  EXPECT_EQ(value, pattern(3000));
+  EXPECT_TRUE(map.getRecord("fits"));
+  EXPECT_THROW(map.get("over", value), std::length_error);
+  EXPECT_THROW(map.getRecord("over"), std::length_error);
+  EXPECT_THROW(map.multiGet({"fits", "over"}, [](size_t, std::string_view) {}),
+               std::length_error);
+
+  // It can still be read a chunk at a time.
+  ChunkedValueMap::Manifest manifest;
+  std::string whole, chunk, assembled;
+  ASSERT_TRUE(map.open("over", manifest, whole));
+  for (uint32_t i = 0; i < manifest.chunks; ++i) {
+    ASSERT_TRUE(map.readChunk("over", manifest, i, chunk));
+    assembled += chunk;
+  }
+  EXPECT_EQ(assembled, pattern(3001));
+}
+
+// A server with chunked storage, reached over gRPC.
+class LargeValueServerTest : public ::testing::Test {
+protected:
+  static constexpr const char *kAddress = "127.0.0.1:50080";
+
+  static void SetUpTestSuite() {
+    auto options = smallChunks();
+    options.max_assembled_bytes = 20'000;
+    store_ = std::make_shared<ChunkedValueMap>(std::make_shared<SkipListMap>(),
+                                               options);
+    server_ = new AsyncKVServer(kAddress, store_);
+    server_->EnableLargeValues(store_);
+    runner_ = new std::thread([]() { server_->Run(1, 1); });
+    stub_ = KeyValueStore::NewStub(
+        grpc::CreateChannel(kAddress, grpc::InsecureChannelCredentials()))
+                .release();
+  }
+
+  static void TearDownTestSuite() {
+    server_->Shutdown();
+    runner_->join();
+    delete runner_;
+    delete server_;
+    delete stub_;
+    store_.reset();
+  }
+
+  // Sends value in pieces of `piece` bytes; `last` marks the final one.
+  static grpc::Status PutStream(const std::string &key,
+                                const std::string &value, size_t piece,
+                                bool last = true) {
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    PutResponse response;
+    auto writer = stub_->PutStream(&ctx, &response);
+    size_t pos = 0;
+    do {
+      PutChunk chunk;
+      if (pos == 0)
+        chunk.set_key(key);
+      chunk.set_data(value.substr(pos, piece));
+      pos += piece;
+      chunk.set_last(last && pos >= value.size());
+      EXPECT_TRUE(writer->Write(chunk));
+    } while (pos < value.size());
+    writer->WritesDone();
+    grpc::Status status = writer->Finish();
+    EXPECT_TRUE(!status.ok() || response.success());
+    return status;
+  }
+
+  // Returns the value, or "<missing>"; `messages` counts the responses.
+  static std::string GetStream(const std::string &key,
+                               size_t *messages = nullptr) {
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    GetRequest request;
+    request.set_key(key);
+    auto reader = stub_->GetStream(&ctx, request);
+    GetChunk chunk;
+    std::string value;
+    bool found = false;
+    size_t count = 0;
+    uint64_t total = 0;
+    while (reader->Read(&chunk)) {
+      if (count++ == 0) {
+        found = chunk.found();
+        total = chunk.total_size();
+      }
+      value += chunk.data();
+    }
+    EXPECT_TRUE(reader->Finish().ok());
+    EXPECT_EQ(value.size(), total);
+    if (messages)
+      *messages = count;
+    return found ? value : "<missing>";
+  }
+
+  static std::shared_ptr<ChunkedValueMap> store_;
+  static AsyncKVServer *server_;
+  static std::thread *runner_;
+  static KeyValueStore::Stub *stub_;
+};
+
+std::shared_ptr<ChunkedValueMap> LargeValueServerTest::store_;
+AsyncKVServer *LargeValueServerTest::server_;
+std::thread *LargeValueServerTest::runner_;
+KeyValueStore::Stub *LargeValueServerTest::stub_;
+
+TEST_F(LargeValueServerTest, StreamsRoundTrip) {
+  std::string big = pattern(10'500, 4);
+  ASSERT_TRUE(PutStream("big", big, 256).ok());
+  size_t messages = 0;
+  EXPECT_EQ(GetStream("big", &messages), big);
+  EXPECT_EQ(messages, 11u); // one per chunk
+
+  // Unary Get assembles it.
+  grpc::ClientContext ctx;
+  ctx.set_wait_for_ready(true);
+  GetRequest request;
+  request.set_key("big");
+  GetResponse response;
+  ASSERT_TRUE(stub_->Get(&ctx, request, &response).ok());
+  EXPECT_EQ(response.value(), big);
+
+  ASSERT_TRUE(PutStream("small", "tiny", 100).ok());
+  EXPECT_EQ(GetStream("small", &messages), "tiny");
+  EXPECT_EQ(messages, 1u);
+  EXPECT_EQ(GetStream("missing"), "<missing>");
+}
+
+TEST_F(LargeValueServerTest, GetRefusesValuesPastTheLimit) {
+  std::string big = pattern(25'000, 5);
+  ASSERT_TRUE(PutStream("too_big", big, 4096).ok());
+  grpc::ClientContext ctx;
+  ctx.set_wait_for_ready(true);
+  GetRequest request;
+  request.set_key("too_big");
+  GetResponse response;
+  ASSERT_TRUE(stub_->Get(&ctx, request, &response).ok());
+  EXPECT_FALSE(response.found());
+  EXPECT_NE(response.error().find("GetStream"), std::string::npos);
+  EXPECT_EQ(GetStream("too_big"), big);
+}
+
+TEST_F(LargeValueServerTest, RejectsReservedKeys) {
+  grpc::ClientContext ctx;
+  ctx.set_wait_for_ready(true);
+  PutRequest request;
+  request.set_key(std::string(ChunkedValueMap::kReservedPrefix) + "x");
+  request.set_value("v");
+  PutResponse response;
+  ASSERT_TRUE(stub_->Put(&ctx, request, &response).ok());
+  EXPECT_FALSE(response.success());
+  EXPECT_FALSE(response.error().empty());
+  EXPECT_EQ(GetStream(request.key()), "<missing>");
+}
+
+TEST_F(LargeValueServerTest, UnfinishedStreamsStoreNothing) {
+  grpc::Status status = PutStream("cut", pattern(5000), 500, false);
+  EXPECT_EQ(status.error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+  EXPECT_EQ(GetStream("cut"), "<missing>");
+  std::string value;
+  EXPECT_FALSE(store_->get("cut", value));
+}
@@ -0,0 +1,84 @@
+#include "tests/benchmark/loadgen/Workload.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace kvstore::loadgen;
+
+TEST(LoadgenWorkloadTest, KeyIndexIsAPermutation) {
+  for (uint64_t n : {1u, 2u, 10u, 1000u, 4096u}) {
+    KeyChooser keys("uniform", n);
+    std::set<uint64_t> seen;
+    for (uint64_t rank = 0; rank < n; ++rank)
+      seen.insert(keys.keyIndex(rank));
+    EXPECT_EQ(seen.size(), n);
+    EXPECT_LT(*seen.rbegin(), n);
+  }
+}
+
+TEST(LoadgenWorkloadTest, ZipfFavoursLowRanks) {
+  KeyChooser keys("zipf:0.99", 10000);
+  std::mt19937_64 rng(7);
+  std::vector<int> hits(10000);
+  const int draws = 200000;
+  for (int i = 0; i < draws; ++i)
+    ++hits[keys.nextRank(rng)];
+  // With s = 0.99 over 10k keys rank 0 takes ~10% of draws and rank 1
+  // about half as many.
+  EXPECT_NEAR(hits[0] / double(draws), 0.10, 0.01);
+  EXPECT_NEAR(hits[1] / double(hits[0]), 0.5, 0.05);
+  EXPECT_GT(hits[10], hits[1000]);
+}
+
+TEST(LoadgenWorkloadTest, HotspotSplitsOperations) {
+  KeyChooser keys("hotspot:0.01:0.9", 10000);
+  std::mt19937_64 rng(7);
+  int hot = 0;
+  const int draws = 100000;
+  for (int i = 0; i < draws; ++i)
+    hot += keys.nextRank(rng) < 100;
+  EXPECT_NEAR(hot / double(draws), 0.9, 0.01);
+}
+
+TEST(LoadgenWorkloadTest, ValueSizesStayInRange) {
+  std::mt19937_64 rng(7);
+  ValueSizer fixed("fixed:100");
+  EXPECT_EQ(fixed.next(rng), 100u);
+  ValueSizer uniform("uniform:10:20");
+  ValueSizer exp("exp:256:4096");
+  double sum = 0;
+  for (int i = 0; i < 10000; ++i) {
+    size_t u = uniform.next(rng);
+    EXPECT_GE(u, 10u);
+    EXPECT_LE(u, 20u);
+    size_t e = exp.next(rng);
+    EXPECT_LE(e, 4096u);
+    sum += e;
+  }
+  EXPECT_NEAR(sum / 10000, 256, 20);
+}
+
+TEST(LoadgenWorkloadTest, RejectsBadSpecs) {
+  EXPECT_THROW(KeyChooser("zipf", 10), std::invalid_argument);
+  EXPECT_THROW(KeyChooser("zipf:x", 10), std::invalid_argument);
+  EXPECT_THROW(KeyChooser("hotspot:2:0.5", 10), std::invalid_argument);
+  EXPECT_THROW(KeyChooser("gaussian", 10), std::invalid_argument);
+  EXPECT_THROW(ValueSizer("uniform:20:10"), std::invalid_argument);
+  EXPECT_THROW(ValueSizer("fixed"), std::invalid_argument);
+}
+
+TEST(LoadgenWorkloadTest, ScheduleKeepsTheRate) {
+  std::mt19937_64 rng(7);
+  ArrivalSchedule even(1000, false);
+  EXPECT_EQ(even.next(rng), 0u);
+  EXPECT_EQ(even.next(rng), 1'000'000u);
+  EXPECT_EQ(even.peek(), 2'000'000u);
+
+  ArrivalSchedule poisson(1000, true);
+  uint64_t last = 0;
+  for (int i = 0; i < 10000; ++i)
+    last = poisson.next(rng);
+  // 10k arrivals at 1000/s span about ten seconds.
+  EXPECT_NEAR(last / 1e9, 10.0, 0.3);
+}
@@ -0,0 +1,233 @@
+#include "storage/LsmMap.h"
+#include "storage/SSTable.h"
+#include <cstdio>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace kvstore;
+
+class LsmMapTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    dir_ = "lsm_test_" + std::to_string(::getpid());
+    std::filesystem::remove_all(dir_);
+  }
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  // Tiny sizes so a few thousand keys go through several flushes and
+  // compactions into level 2 and beyond.
+  LsmMap::Options options() const {
+    LsmMap::Options options;
+    options.dir = dir_;
+    options.memtable_bytes = 16 << 10;
+    options.l0_compaction_trigger = 2;
+    options.base_level_bytes = 32 << 10;
+    options.size_multiplier = 4;
+    options.target_table_bytes = 8 << 10;
+    options.block_size = 512;
+    return options;
+  }
+
+  static std::string keyFor(int i) {
+    char key[16];
+    std::snprintf(key, sizeof(key), "key%06d", i);
+    return key;
+  }
+
+  std::string dir_;
+};
+
+TEST_F(LsmMapTest, GetsSeeNewestVersionAcrossLevels) {
+  LsmMap map(options());
+  for (int i = 0; i < 3000; ++i)
+    map.put(keyFor(i), "v1_" + std::to_string(i));
+  map.flush();
+  for (int i = 0; i < 3000; i += 3)
+    map.put(keyFor(i), "v2_" + std::to_string(i));
+  for (int i = 1; i < 3000; i += 3)
+    EXPECT_TRUE(map.remove(keyFor(i)));
+  map.flush();
+
+  auto stats = map.stats();
+  EXPECT_GT(stats.flushes, 0u);
+  EXPECT_GT(stats.compactions, 0u);
+  EXPECT_LT(stats.tables[0], 2u);
+
+  std::string value;
+  for (int i = 0; i < 3000; ++i) {
+    bool found = map.get(keyFor(i), value);
+    if (i % 3 == 0) {
+      ASSERT_TRUE(found) << i;
+      EXPECT_EQ(value, "v2_" + std::to_string(i));
+    } else if (i % 3 == 1) {
+      EXPECT_FALSE(found) << i;
+    } else {
+      ASSERT_TRUE(found) << i;
+      EXPECT_EQ(value, "v1_" + std::to_string(i));
+    }
+  }
+  EXPECT_FALSE(map.get("missing", value));
+}
+
+TEST_F(LsmMapTest, ScanMergesMemtableAndTables) {
+  LsmMap map(options());
+  for (int i = 0; i < 2000; ++i)
+    map.put(keyFor(i), "old");
+  map.flush();
+  map.put(keyFor(5), "new"); // memtable shadows a table entry
+  map.remove(keyFor(6));
+
+  std::vector<std::string> keys;
+  map.scan(keyFor(4), keyFor(9), "", [&](std::string_view key,
+                                         std::string_view value) {
+    keys.emplace_back(std::string(key) + "=" + std::string(value));
+    return true;
+  });
+  std::vector<std::string> expected = {keyFor(4) + "=old", keyFor(5) + "=new",
+                                       keyFor(7) + "=old", keyFor(8) + "=old"};
+  EXPECT_EQ(keys, expected);
+
+  size_t count = 0;
+  std::string last;
+  map.scan("", "", "key001", [&](std::string_view key, std::string_view) {
+    EXPECT_GT(key, last);
+    last = std::string(key);
+    ++count;
+    return true;
+  });
+  EXPECT_EQ(count, 1000u);
+}
+
+TEST_F(LsmMapTest, ReopensFromManifest) {
+  {
+    LsmMap map(options());
+    for (int i = 0; i < 2000; ++i)
+      map.put(keyFor(i), std::to_string(i));
+    map.remove(keyFor(10));
+  } // the destructor flushes the memtable
+  LsmMap map(options());
+  std::string value;
+  ASSERT_TRUE(map.get(keyFor(1999), value));
+  EXPECT_EQ(value, "1999");
+  EXPECT_FALSE(map.get(keyFor(10), value));
+}
+
+TEST_F(LsmMapTest, WritesAreBlind) {
+  LsmMap map(options());
+  EXPECT_TRUE(map.put("k", "v1"));
+  map.flush();
+  EXPECT_TRUE(map.put("k", "v2"));
+  EXPECT_TRUE(map.remove("k"));
+  EXPECT_TRUE(map.remove("missing"));
+  std::string value;
+  EXPECT_FALSE(map.get("k", value));
+  EXPECT_TRUE(map.put("k", "v3")); // over a memtable tombstone
+  ASSERT_TRUE(map.get("k", value));
+  EXPECT_EQ(value, "v3");
+}
+
+TEST_F(LsmMapTest, RecoversUnflushedWritesFromMemtableLogs) {
+  auto logged = options();
+  logged.memtable_bytes = 1 << 20; // no flushes but the explicit one
+  logged.wal.durability = WriteAheadLog::Durability::kSync;
+  std::string crashed = dir_ + "_crashed";
+  {
+    LsmMap map(logged);
+    for (int i = 0; i < 1000; ++i)
+      map.put(keyFor(i), std::to_string(i));
+    map.flush();
+    for (int i = 1000; i < 2000; ++i)
+      map.put(keyFor(i), std::to_string(i));
+    map.remove(keyFor(10));
+    // What a crash now would leave behind: the table flushed so far and
+    // the log of the memtable that wasn't.
+    std::filesystem::remove_all(crashed);
+    std::filesystem::copy(dir_, crashed);
+  }
+  logged.dir = crashed;
+  {
+    LsmMap map(logged);
+    std::string value;
+    for (int i = 0; i < 2000; ++i) {
+      if (i == 10) {
+        EXPECT_FALSE(map.get(keyFor(i), value));
+        continue;
+      }
+      ASSERT_TRUE(map.get(keyFor(i), value)) << i;
+      EXPECT_EQ(value, std::to_string(i));
+    }
+  }
+  std::filesystem::remove_all(crashed);
+}
+
+TEST_F(LsmMapTest, FlushDeletesMemtableLogs) {
+  auto logged = options();
+  logged.wal.durability = WriteAheadLog::Durability::kAsync;
+  LsmMap map(logged);
+  for (int i = 0; i < 2000; ++i)
+    map.put(keyFor(i), std::to_string(i));
+  map.flush();
+  size_t logs = 0;
+  for (const auto &entry : std::filesystem::directory_iterator(dir_))
+    logs += entry.path().extension() == ".log";
+  EXPECT_EQ(logs, 1u); // the current memtable's
+}
+
+TEST_F(LsmMapTest, FailedFlushFailsStalledWrites) {
+  auto stalling = options();
+  stalling.max_immutable_memtables = 1;
+  LsmMap map(stalling);
+  std::filesystem::remove_all(dir_); // flushes can no longer write tables
+  bool failed = false;
+  for (int i = 0; i < 10000 && !failed; ++i) {
+    try {
+      map.put(keyFor(i), std::string(100, 'v'));
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+  }
+  EXPECT_TRUE(failed);
+  std::string value;
+  EXPECT_TRUE(map.get(keyFor(0), value)); // still readable
+}
+
+TEST_F(LsmMapTest, ConcurrentWritersAndReaders) {
+  LsmMap map(options());
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&, t]() {
+      std::string value;
+      for (int i = 0; i < 1000; ++i) {
+        std::string key = keyFor(t * 1000 + i);
+        map.put(key, key);
+        ASSERT_TRUE(map.get(key, value));
+        EXPECT_EQ(value, key);
+      }
+    });
+  for (auto &t : threads)
+    t.join();
+  map.flush();
+  std::string value;
+  for (int i = 0; i < 4000; ++i)
+    ASSERT_TRUE(map.get(keyFor(i), value)) << i;
+}
+
+TEST(BloomFilterTest, FalsePositiveRate) {
+  std::vector<uint64_t> hashes;
+  for (int i = 0; i < 10000; ++i)
+    hashes.push_back(BloomFilter::hash("in" + std::to_string(i)));
+  uint32_t probes = BloomFilter::probesFor(10);
+  std::string filter = BloomFilter::build(hashes, 10, probes);
+  for (uint64_t h : hashes)
+    ASSERT_TRUE(BloomFilter::mayContain(filter, probes, h));
+  int false_positives = 0;
+  for (int i = 0; i < 10000; ++i)
+    false_positives += BloomFilter::mayContain(
+        filter, probes, BloomFilter::hash("out" + std::to_string(i)));
+  EXPECT_LT(false_positives, 300); // ~1% expected at 10 bits per key
+}
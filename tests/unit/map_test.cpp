@@ -7,6 +7,7 @@
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <sstream>
+#include <vector>
 
 using namespace std;
 using namespace kvstore;
@@ -124,6 +125,31 @@ TEST_F(MapTest, BoostMapOrderedOperationsTest) {
   EXPECT_EQ(upper->second, "value3");
 }
 
+TEST_F(MapTest, BoostMapForEachWalksInOrder) {
+  BoostMap<std::string, std::string> map;
+  map.insert("key3", "value3");
+  map.insert("key1", "value1");
+  map.insert("key2", "value2");
+
+  std::vector<std::string> keys;
+  EXPECT_TRUE(map.forEach([&](const std::string &key,
+                              const std::string &value) {
+    EXPECT_EQ(value, "value" + key.substr(3));
+    keys.push_back(key);
+    return true;
+  }));
+  EXPECT_EQ(keys, (std::vector<std::string>{"key1", "key2", "key3"}));
+
+  // Sees writes straight away and stops when asked.
+  map.remove("key1");
+  keys.clear();
+  EXPECT_FALSE(map.forEach([&](const std::string &key, const std::string &) {
+    keys.push_back(key);
+    return false;
+  }));
+  EXPECT_EQ(keys, (std::vector<std::string>{"key2"}));
+}
+
 TEST_F(MapTest, StdMapOrderedOperationsTest) {
   config["map_type"] = "std_map";
   auto map = MapFactory<std::string, std::string>::createMap(config);
@@ -144,4 +170,48 @@ TEST_F(MapTest, StdMapOrderedOperationsTest) {
   auto upper = map->upper_bound("key2");
   EXPECT_EQ(upper->first, "key3");
   EXPECT_EQ(upper->second, "value3");
-}
\ No newline at end of file
+}
+
+TEST_F(MapTest, ConcurrentMapFactoryTest) {
+  config["map_type"] = "skiplist";
+  auto skiplist =
+      MapFactory<std::string, std::string>::createConcurrentMap(config);
+  EXPECT_TRUE(dynamic_cast<SkipListMap *>(skiplist.get()) != nullptr);
+
+  config["map_type"] = "sharded_hash";
+  auto hash = MapFactory<std::string, std::string>::createConcurrentMap(config);
+  EXPECT_TRUE(dynamic_cast<ShardedHashMap *>(hash.get()) != nullptr);
+
+  config["map_type"] = "boost_map";
+  auto striped =
+      MapFactory<std::string, std::string>::createConcurrentMap(config);
+  auto *adapter = dynamic_cast<StripedMap *>(striped.get());
+  ASSERT_NE(adapter, nullptr);
+  EXPECT_EQ(adapter->stripeCount(),
+            config["map_options"]["striped"]["num_stripes"].get<size_t>());
+
+  EXPECT_TRUE(striped->put("key1", "value1"));
+  EXPECT_FALSE(striped->put("key1", "value2"));
+  std::string value;
+  EXPECT_TRUE(striped->get("key1", value));
+  EXPECT_EQ(value, "value2");
+
+  config["map_type"] = "no_such_map";
+  EXPECT_THROW(
+      (MapFactory<std::string, std::string>::createConcurrentMap(config)),
+      std::runtime_error);
+}
+
+TEST_F(MapTest, ConcurrentMapFactoryRejectsBadLoadFactors) {
+  config["map_type"] = "sharded_hash";
+  for (float load_factor : {0.0f, -0.5f, 1.0f, 1.5f}) {
+    SCOPED_TRACE(load_factor);
+    config["map_options"]["sharded_hash"]["load_factor"] = load_factor;
+    EXPECT_THROW(
+        (MapFactory<std::string, std::string>::createConcurrentMap(config)),
+        std::invalid_argument);
+  }
+  config["map_options"]["sharded_hash"]["load_factor"] = 0.9f;
+  EXPECT_NO_THROW(
+      (MapFactory<std::string, std::string>::createConcurrentMap(config)));
+}
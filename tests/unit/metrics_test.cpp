@@ -0,0 +1,120 @@
+#include "metrics/LatencyHistogram.h"
+#include "metrics/PerThread.h"
+#include "metrics/ServerMetrics.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+
+TEST(LatencyHistogramTest, BucketsAreContiguousAndWithinThreePercent) {
+  size_t previous = 0;
+  for (uint64_t v = 1; v < LatencyHistogram::kMaxValue; v = v * 17 / 16 + 1) {
+    size_t bucket = LatencyHistogram::bucketOf(v);
+    ASSERT_LT(bucket, LatencyHistogram::kBuckets);
+    ASSERT_GE(bucket, previous);
+    previous = bucket;
+    uint64_t upper = LatencyHistogram::upperBound(bucket);
+    ASSERT_GE(upper, v);
+    ASSERT_LE(upper - v, v / 32);
+    ASSERT_EQ(LatencyHistogram::bucketOf(upper), bucket);
+    if (bucket + 1 < LatencyHistogram::kBuckets)
+      ASSERT_EQ(LatencyHistogram::bucketOf(upper + 1), bucket + 1);
+  }
+  EXPECT_EQ(LatencyHistogram::bucketOf(~uint64_t{0}),
+            LatencyHistogram::kBuckets - 1);
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram;
+  // 1..10000 us, uniformly.
+  for (uint64_t us = 1; us <= 10000; ++us)
+    histogram.record(us * 1000);
+  LatencyHistogram::Snapshot snapshot;
+  histogram.mergeInto(snapshot);
+  EXPECT_EQ(snapshot.count, 10000u);
+  EXPECT_EQ(snapshot.max, 10'000'000u);
+  EXPECT_NEAR(snapshot.mean(), 5'000'500.0, 1);
+  for (double q : {0.5, 0.9, 0.99, 0.999}) {
+    double exact = q * 10'000'000;
+    EXPECT_NEAR(snapshot.percentile(q), exact, exact / 32) << q;
+  }
+  EXPECT_EQ(snapshot.percentile(1.0), snapshot.max);
+  EXPECT_EQ(snapshot.countAtMost(LatencyHistogram::kMaxValue), 10000u);
+}
+
+TEST(ServerMetricsTest, MergesThreadsAndCountsPerQueue) {
+  ServerMetrics metrics;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      metrics.attach(t % 2);
+      for (int i = 0; i < 1000; ++i)
+        metrics.local().record(ServerMetrics::Rpc::kGet, 1000 + i, 10, 20,
+                               i % 100 == 0);
+      metrics.local().record(ServerMetrics::Rpc::kPut, 5000, 30, 5, false);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  auto snapshot = metrics.snapshot();
+  const auto &gets =
+      snapshot.rpcs[static_cast<size_t>(ServerMetrics::Rpc::kGet)];
+  EXPECT_EQ(gets.requests, 4000u);
+  EXPECT_EQ(gets.errors, 40u);
+  EXPECT_EQ(gets.bytes_in, 40000u);
+  EXPECT_EQ(gets.bytes_out, 80000u);
+  EXPECT_EQ(gets.latency.count, 4000u);
+  EXPECT_EQ(gets.latency.max, 1999u);
+  ASSERT_EQ(snapshot.cq_requests.size(), 2u);
+  EXPECT_EQ(snapshot.cq_requests[0], 2002u);
+  EXPECT_EQ(snapshot.cq_requests[1], 2002u);
+
+  std::string text = ServerMetrics::prometheusText(snapshot);
+  EXPECT_NE(text.find("kvstore_requests_total{rpc=\"get\"} 4000\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("kvstore_request_errors_total{rpc=\"get\"} 40\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("# TYPE kvstore_request_duration_seconds histogram"),
+            std::string::npos);
+  EXPECT_NE(text.find("kvstore_request_duration_seconds_bucket{rpc=\"get\","
+                      "le=\"+Inf\"} 4000\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("kvstore_cq_requests_total{cq=\"1\"} 2002\n"),
+            std::string::npos);
+}
+
+TEST(ServerMetricsTest, UnattachedThreadsAreCountedWithoutQueue) {
+  ServerMetrics metrics;
+  std::thread([&]() {
+    metrics.local().record(ServerMetrics::Rpc::kScan, 1, 1, 1, false);
+  }).join();
+  auto snapshot = metrics.snapshot();
+  EXPECT_EQ(
+      snapshot.rpcs[static_cast<size_t>(ServerMetrics::Rpc::kScan)].requests,
+      1u);
+  EXPECT_TRUE(snapshot.cq_requests.empty());
+}
+
+TEST(PerThreadTest, AlternatingRegistriesKeepOneCopyEach) {
+  PerThread<int> first, second;
+  for (int i = 0; i < 100; ++i) {
+    ++first.local();
+    ++second.local();
+  }
+  int copies = 0, total = 0;
+  first.forEach([&](const int &value) {
+    ++copies;
+    total += value;
+  });
+  EXPECT_EQ(copies, 1);
+  EXPECT_EQ(total, 100);
+
+  std::thread([&]() { ++first.local(); }).join();
+  copies = 0;
+  first.forEach([&](const int &) { ++copies; });
+  EXPECT_EQ(copies, 2);
+}
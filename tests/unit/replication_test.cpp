@@ -0,0 +1,301 @@
+#include "map/ShardedHashMap.h"
+#include "map/SkipListMap.h"
+#include "replication/ChangeLog.h"
+#include "replication/Replica.h"
+#include "server_impl.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace kvstore;
+
+TEST(ChangeLogTest, ReadsEntriesAfterASeqno) {
+  ChangeLog log;
+  EXPECT_EQ(log.lastSeqno(), 0u);
+  EXPECT_EQ(log.append(ChangeLog::Op::kPut, "a", "1"), 1u);
+  EXPECT_EQ(log.append(ChangeLog::Op::kDelete, "a", ""), 2u);
+  EXPECT_EQ(log.append(ChangeLog::Op::kPut, "b", "2"), 3u);
+
+  std::vector<uint64_t> seen;
+  EXPECT_TRUE(log.readAfter(1, 1 << 20, [&](const ChangeLog::Entry &e) {
+    seen.push_back(e.seqno);
+  }));
+  EXPECT_EQ(seen, (std::vector<uint64_t>{2, 3}));
+
+  // A byte limit still yields one entry per read.
+  seen.clear();
+  EXPECT_TRUE(log.readAfter(0, 1, [&](const ChangeLog::Entry &e) {
+    seen.push_back(e.seqno);
+  }));
+  EXPECT_EQ(seen, (std::vector<uint64_t>{1}));
+
+  // Caught up, and past the end.
+  EXPECT_TRUE(log.readAfter(3, 1 << 20, [](const ChangeLog::Entry &) {
+    ADD_FAILURE();
+  }));
+  EXPECT_FALSE(log.readAfter(4, 1 << 20, [](const ChangeLog::Entry &) {}));
+}
+
+TEST(ChangeLogTest, DropsOldEntriesPastItsBudget) {
+  ChangeLog log(4096);
+  for (int i = 0; i < 100; ++i)
+    log.append(ChangeLog::Op::kPut, "key" + std::to_string(i),
+               std::string(100, 'v'));
+  EXPECT_FALSE(log.readAfter(0, 1 << 20, [](const ChangeLog::Entry &) {}));
+  uint64_t last = 0;
+  EXPECT_TRUE(log.readAfter(95, 1 << 20, [&](const ChangeLog::Entry &e) {
+    last = e.seqno;
+  }));
+  EXPECT_EQ(last, 100u);
+}
+
+TEST(ChangeLogTest, WaitAfterWakesOnTheNextAppend) {
+  ChangeLog log;
+  log.append(ChangeLog::Op::kPut, "a", "1");
+  int woken = 0;
+  log.waitAfter(0, [&]() { ++woken; }); // already there
+  EXPECT_EQ(woken, 1);
+  log.waitAfter(1, [&]() { ++woken; });
+  EXPECT_EQ(woken, 1);
+  log.append(ChangeLog::Op::kPut, "b", "2");
+  EXPECT_EQ(woken, 2);
+  log.append(ChangeLog::Op::kPut, "c", "3"); // waiters fire once
+  EXPECT_EQ(woken, 2);
+}
+
+// A primary server with a change log and a replica server following it,
+// in one process. Each test gets fresh servers, so streams don't carry
+// over.
+class ReplicationTest : public ::testing::Test {
+protected:
+  static constexpr const char *kPrimary = "127.0.0.1:50076";
+  static constexpr const char *kReplica = "127.0.0.1:50077";
+
+  void SetUp() override { StartPrimary(std::make_shared<SkipListMap>()); }
+
+  void TearDown() override {
+    StopReplica();
+    primary_server_->Shutdown();
+    primary_runner_.join();
+  }
+
+  void StartPrimary(std::shared_ptr<IConcurrentMap> engine,
+                    size_t log_bytes = size_t{64} << 20) {
+    primary_ = std::make_shared<ChangeLogMap>(
+        engine, std::make_shared<ChangeLog>(log_bytes));
+    primary_server_ = std::make_unique<AsyncKVServer>(kPrimary, primary_);
+    primary_server_->EnableReplication(primary_);
+    primary_runner_ = std::thread([this]() { primary_server_->Run(1, 2); });
+    primary_stub_ = Connect(kPrimary);
+  }
+
+  void StartReplica() {
+    replica_store_ = std::make_shared<SkipListMap>();
+    Replica::Options options;
+    options.primary = kPrimary;
+    options.retry_delay = std::chrono::milliseconds(50);
+    replica_ = std::make_shared<Replica>(replica_store_, options);
+    replica_server_ = std::make_unique<AsyncKVServer>(kReplica, replica_store_);
+    replica_server_->ServeAsReplica(replica_);
+    replica_->start();
+    replica_runner_ = std::thread([this]() { replica_server_->Run(1, 2); });
+    replica_stub_ = Connect(kReplica);
+  }
+
+  void StopReplica() {
+    if (!replica_server_)
+      return;
+    replica_->stop();
+    replica_server_->Shutdown();
+    replica_runner_.join();
+    replica_server_.reset();
+  }
+
+  static std::unique_ptr<KeyValueStore::Stub> Connect(const char *address) {
+    auto stub = KeyValueStore::NewStub(
+        grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+    grpc::ClientContext ctx;
+    ctx.set_wait_for_ready(true);
+    StatsResponse response;
+    stub->Stats(&ctx, StatsRequest(), &response);
+    return stub;
+  }
+
+  static void Put(KeyValueStore::Stub &stub, const std::string &key,
+                  const std::string &value) {
+    grpc::ClientContext ctx;
+    PutRequest request;
+    request.set_key(key);
+    request.set_value(value);
+    PutResponse response;
+    ASSERT_TRUE(stub.Put(&ctx, request, &response).ok());
+    ASSERT_TRUE(response.success()) << response.error();
+  }
+
+  static std::optional<std::string> Get(KeyValueStore::Stub &stub,
+                                        const std::string &key) {
+    grpc::ClientContext ctx;
+    GetRequest request;
+    request.set_key(key);
+    GetResponse response;
+    EXPECT_TRUE(stub.Get(&ctx, request, &response).ok());
+    if (!response.found())
+      return std::nullopt;
+    return response.value();
+  }
+
+  void CatchUp() {
+    ASSERT_TRUE(replica_->waitForSeqno(primary_->log().lastSeqno(),
+                                       std::chrono::seconds(5)));
+  }
+
+  std::shared_ptr<ChangeLogMap> primary_;
+  std::unique_ptr<AsyncKVServer> primary_server_;
+  std::thread primary_runner_;
+  std::unique_ptr<KeyValueStore::Stub> primary_stub_;
+
+  std::shared_ptr<SkipListMap> replica_store_;
+  std::shared_ptr<Replica> replica_;
+  std::unique_ptr<AsyncKVServer> replica_server_;
+  std::thread replica_runner_;
+  std::unique_ptr<KeyValueStore::Stub> replica_stub_;
+};
+
+TEST_F(ReplicationTest, NewReplicaStartsFromASnapshotThenStreams) {
+  for (int i = 0; i < 2000; ++i)
+    primary_->put("old" + std::to_string(i), std::string(100, 'o'));
+  StartReplica();
+  CatchUp();
+  EXPECT_EQ(replica_store_->size(), 2000u);
+  EXPECT_EQ(replica_->status().snapshots, 1u);
+
+  Put(*primary_stub_, "new", "value");
+  grpc::ClientContext ctx;
+  DeleteRequest del;
+  del.set_key("old7");
+  DeleteResponse deleted;
+  ASSERT_TRUE(primary_stub_->Delete(&ctx, del, &deleted).ok());
+  CatchUp();
+  EXPECT_EQ(Get(*replica_stub_, "new"), "value");
+  EXPECT_EQ(Get(*replica_stub_, "old7"), std::nullopt);
+  EXPECT_EQ(Get(*replica_stub_, "old8"), std::string(100, 'o'));
+  EXPECT_EQ(replica_->status().snapshots, 1u);
+}
+
+TEST_F(ReplicationTest, ReplicaRejectsClientWrites) {
+  StartReplica();
+  grpc::ClientContext ctx;
+  PutRequest request;
+  request.set_key("k");
+  request.set_value("v");
+  PutResponse response;
+  ASSERT_TRUE(replica_stub_->Put(&ctx, request, &response).ok());
+  EXPECT_FALSE(response.success());
+  EXPECT_EQ(response.error(), AsyncKVServer::kReadOnlyError);
+  EXPECT_EQ(replica_store_->size(), 0u);
+}
+
+TEST_F(ReplicationTest, ResumesWithoutASnapshotAfterReconnecting) {
+  StartReplica();
+  Put(*primary_stub_, "a", "1");
+  CatchUp();
+  replica_->stop();
+  Put(*primary_stub_, "b", "2");
+  replica_->start();
+  CatchUp();
+  EXPECT_EQ(Get(*replica_stub_, "b"), "2");
+  EXPECT_EQ(replica_->status().snapshots, 1u); // only the first
+}
+
+TEST_F(ReplicationTest, ResnapshotsAfterFallingOutOfTheLog) {
+  // Restart the primary with a log far smaller than the writes below.
+  primary_server_->Shutdown();
+  primary_runner_.join();
+  StartPrimary(std::make_shared<SkipListMap>(), 16 * 1024);
+  StartReplica();
+  Put(*primary_stub_, "gone", "soon");
+  CatchUp();
+  replica_->stop();
+  primary_->remove("gone");
+  for (int i = 0; i < 1000; ++i)
+    primary_->put("k" + std::to_string(i), std::string(100, 'v'));
+  replica_->start();
+  CatchUp();
+  EXPECT_EQ(replica_->status().snapshots, 2u);
+  EXPECT_EQ(replica_store_->size(), 1000u); // "gone" was dropped
+  EXPECT_EQ(Get(*replica_stub_, "k999"), std::string(100, 'v'));
+}
+
+TEST_F(ReplicationTest, SnapshotsUnorderedEngines) {
+  primary_server_->Shutdown();
+  primary_runner_.join();
+  StartPrimary(std::make_shared<ShardedHashMap>());
+  for (int i = 0; i < 3000; ++i)
+    primary_->put("u" + std::to_string(i), std::string(100, 'u'));
+  StartReplica();
+  CatchUp();
+  EXPECT_EQ(replica_store_->size(), 3000u);
+}
+
+TEST_F(ReplicationTest, StatsReportLag) {
+  StartReplica();
+  for (int i = 0; i < 100; ++i)
+    Put(*primary_stub_, "s" + std::to_string(i), "v");
+  CatchUp();
+
+  grpc::ClientContext ctx;
+  StatsRequest request;
+  request.set_prometheus_text(true);
+  StatsResponse stats;
+  ASSERT_TRUE(replica_stub_->Stats(&ctx, request, &stats).ok());
+  EXPECT_EQ(stats.replication().role(), "replica");
+  EXPECT_TRUE(stats.replication().connected());
+  EXPECT_EQ(stats.replication().applied_seqno(), 100u);
+  EXPECT_GT(stats.replication().delay_max_us(), 0);
+  EXPECT_NE(stats.prometheus_text().find("kvstore_replica_lag_entries 0"),
+            std::string::npos);
+
+  grpc::ClientContext primary_ctx;
+  ASSERT_TRUE(
+      primary_stub_->Stats(&primary_ctx, StatsRequest(), &stats).ok());
+  EXPECT_EQ(stats.replication().role(), "primary");
+  EXPECT_EQ(stats.replication().log_seqno(), 100u);
+}
+
+TEST(ReplicaServerTest, RefusesReadsUntilItHasASnapshot) {
+  // Nothing listens on the primary's port, so no snapshot ever arrives.
+  Replica::Options options;
+  options.primary = "127.0.0.1:1";
+  auto replica = std::make_shared<Replica>(std::make_shared<SkipListMap>(),
+                                           options);
+  AsyncKVServer server("127.0.0.1:50081");
+  server.ServeAsReplica(replica);
+  std::thread runner([&]() { server.Run(1, 1); });
+  auto stub = KeyValueStore::NewStub(grpc::CreateChannel(
+      "127.0.0.1:50081", grpc::InsecureChannelCredentials()));
+  grpc::ClientContext ctx;
+  ctx.set_wait_for_ready(true);
+  GetRequest request;
+  request.set_key("k");
+  GetResponse response;
+  EXPECT_TRUE(stub->Get(&ctx, request, &response).ok());
+  EXPECT_FALSE(response.found());
+  EXPECT_EQ(response.error(), AsyncKVServer::kSyncingError);
+  server.Shutdown();
+  runner.join();
+}
+
+TEST(ReplicateRpcTest, FailsOnServersThatAreNotPrimaries) {
+  AsyncKVServer server("127.0.0.1:50078");
+  std::thread runner([&]() { server.Run(1, 1); });
+  auto stub = KeyValueStore::NewStub(grpc::CreateChannel(
+      "127.0.0.1:50078", grpc::InsecureChannelCredentials()));
+  grpc::ClientContext ctx;
+  ctx.set_wait_for_ready(true);
+  auto reader = stub->Replicate(&ctx, ReplicateRequest());
+  ReplicateResponse response;
+  EXPECT_FALSE(reader->Read(&response));
+  EXPECT_EQ(reader->Finish().error_code(),
+            grpc::StatusCode::FAILED_PRECONDITION);
+  server.Shutdown();
+  runner.join();
+}
@@ -1,9 +1,13 @@
 #include "server_impl.h"
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <grpcpp/grpcpp.h>
 #include <gtest/gtest.h>
 #include <kvstore.grpc.pb.h>
 #include <memory>
+#include <nlohmann/json.hpp>
+#include <sstream>
 #include <string>
 #include <thread>
 
@@ -25,6 +29,7 @@ protected:
     // Start server
     server_thread_ = std::thread([]() {
       async_server_ = std::make_unique<AsyncKVServer>("0.0.0.0:50051");
+      async_server_->EnableTracing(1, 256);
       async_server_->Run(4, 2); // 4 CQs, 2 threads each (adjust for your CPU)
     });
     // Wait for server to start (could add a health check here)
@@ -37,11 +42,8 @@ protected:
   }
 
   static void TearDownTestSuite() {
-    // In production you'd signal the server to stop and join thread.
-    // For test runs, just detach/kill the server (or modify AsyncKVServer to
-    // support shutdown). Here we detach to avoid blocking on server_->Run().
-    // server_thread_.detach();
-    // Or use std::terminate if you want to forcibly exit after tests.
+    async_server_->Shutdown();
+    server_thread_.join();
   }
 
   static std::unique_ptr<KeyValueStore::Stub> stub_;
@@ -86,6 +88,342 @@ TEST_F(KeyValueStoreTest, PutAndGet) {
   ASSERT_EQ(get_response.value(), value);
 }
 
+TEST_F(KeyValueStoreTest, PooledCallsStartClean) {
+  // Far more calls than there are pooled CallData objects, alternating hits
+  // and misses and values larger than the inline arena block, so every
+  // recycled call must come back with an empty request and response.
+  for (int i = 0; i < 200; ++i) {
+    std::string key = "pooled_" + std::to_string(i);
+    std::string value(i % 2 ? 4 * AsyncKVServer::kArenaBlockSize : 8, 'x');
+
+    PutRequest put_request;
+    put_request.set_key(key);
+    put_request.set_value(value);
+    PutResponse put_response;
+    ClientContext put_context;
+    ASSERT_TRUE(stub_->Put(&put_context, put_request, &put_response).ok());
+
+    GetRequest get_request;
+    get_request.set_key(key);
+    GetResponse get_response;
+    ClientContext get_context;
+    ASSERT_TRUE(stub_->Get(&get_context, get_request, &get_response).ok());
+    ASSERT_TRUE(get_response.found());
+    ASSERT_EQ(get_response.value(), value);
+
+    GetRequest miss_request;
+    miss_request.set_key("missing_" + std::to_string(i));
+    GetResponse miss_response;
+    ClientContext miss_context;
+    ASSERT_TRUE(stub_->Get(&miss_context, miss_request, &miss_response).ok());
+    ASSERT_FALSE(miss_response.found());
+    ASSERT_TRUE(miss_response.value().empty());
+  }
+}
+
+TEST_F(KeyValueStoreTest, SharedValuesSurviveOverwrites) {
+  // Large values are sent straight from the stored record; overwriting
+  // the key while responses are in flight must not tear them.
+  const size_t kSize = 1 << 20;
+  auto put = [](char fill) {
+    PutRequest request;
+    request.set_key("shared");
+    request.set_value(std::string(kSize, fill));
+    PutResponse response;
+    ClientContext context;
+    return stub_->Put(&context, request, &response).ok();
+  };
+  ASSERT_TRUE(put('a'));
+  std::thread writer([&]() {
+    for (int i = 0; i < 50; ++i)
+      put(static_cast<char>('b' + i % 20));
+  });
+  // EXPECTs, so a failure still reaches the writer's join.
+  for (int i = 0; i < 50; ++i) {
+    GetRequest request;
+    request.set_key("shared");
+    GetResponse response;
+    ClientContext context;
+    EXPECT_TRUE(stub_->Get(&context, request, &response).ok());
+    EXPECT_TRUE(response.found());
+    EXPECT_EQ(response.value().size(), kSize);
+    EXPECT_EQ(response.value().find_first_not_of(response.value()[0]),
+              std::string::npos);
+  }
+  writer.join();
+}
+
+TEST_F(KeyValueStoreTest, MultiPutGetDelete) {
+  kvstore::MultiPutRequest put_request;
+  for (int i = 0; i < 100; ++i) {
+    auto *entry = put_request.add_entries();
+    entry->set_key("multi_" + std::to_string(99 - i));
+    entry->set_value("value_" + std::to_string(99 - i));
+  }
+  kvstore::MultiPutResponse put_response;
+  ClientContext put_context;
+  ASSERT_TRUE(stub_->MultiPut(&put_context, put_request, &put_response).ok());
+  ASSERT_TRUE(put_response.success());
+
+  kvstore::MultiGetRequest get_request;
+  get_request.add_keys("multi_42");
+  get_request.add_keys("multi_missing");
+  get_request.add_keys("multi_7");
+  kvstore::MultiGetResponse get_response;
+  ClientContext get_context;
+  ASSERT_TRUE(stub_->MultiGet(&get_context, get_request, &get_response).ok());
+  ASSERT_EQ(get_response.values_size(), 3);
+  ASSERT_EQ(get_response.found_size(), 3);
+  EXPECT_TRUE(get_response.found(0));
+  EXPECT_EQ(get_response.values(0), "value_42");
+  EXPECT_FALSE(get_response.found(1));
+  EXPECT_TRUE(get_response.values(1).empty());
+  EXPECT_TRUE(get_response.found(2));
+  EXPECT_EQ(get_response.values(2), "value_7");
+
+  kvstore::MultiDeleteRequest delete_request;
+  delete_request.add_keys("multi_7");
+  delete_request.add_keys("multi_missing");
+  kvstore::MultiDeleteResponse delete_response;
+  ClientContext delete_context;
+  ASSERT_TRUE(stub_->MultiDelete(&delete_context, delete_request,
+                                 &delete_response)
+                  .ok());
+  ASSERT_EQ(delete_response.deleted_size(), 2);
+  EXPECT_TRUE(delete_response.deleted(0));
+  EXPECT_FALSE(delete_response.deleted(1));
+}
+
+TEST_F(KeyValueStoreTest, PipelineMatchesResponsesByTag) {
+  // More ops than the server's response window, so reading has to pause
+  // and resume as responses drain.
+  const uint64_t kOps = 3 * AsyncKVServer::kPipelineWindow;
+  ClientContext context;
+  auto stream = stub_->Pipeline(&context);
+  for (uint64_t tag = 0; tag < kOps; ++tag) {
+    kvstore::PipelineRequest request;
+    request.set_tag(tag);
+    std::string key = "pipe_" + std::to_string(tag / 3);
+    switch (tag % 3) {
+    case 0:
+      request.mutable_put()->set_key(key);
+      request.mutable_put()->set_value("value_" + std::to_string(tag));
+      break;
+    case 1:
+      request.mutable_get()->set_key(key);
+      break;
+    case 2:
+      request.mutable_del()->set_key(key);
+      break;
+    }
+    ASSERT_TRUE(stream->Write(request));
+  }
+  kvstore::PipelineRequest empty;
+  empty.set_tag(kOps);
+  ASSERT_TRUE(stream->Write(empty));
+  ASSERT_TRUE(stream->WritesDone());
+
+  std::vector<bool> seen(kOps + 1, false);
+  kvstore::PipelineResponse response;
+  while (stream->Read(&response)) {
+    uint64_t tag = response.tag();
+    ASSERT_LE(tag, kOps);
+    ASSERT_FALSE(seen[tag]);
+    seen[tag] = true;
+    if (tag == kOps) {
+      EXPECT_FALSE(response.error().empty());
+      continue;
+    }
+    switch (tag % 3) {
+    case 0:
+      EXPECT_TRUE(response.put().success());
+      break;
+    case 1:
+      EXPECT_TRUE(response.get().found());
+      EXPECT_EQ(response.get().value(), "value_" + std::to_string(tag - 1));
+      break;
+    case 2:
+      EXPECT_TRUE(response.del().success());
+      break;
+    }
+  }
+  ASSERT_TRUE(stream->Finish().ok());
+  EXPECT_EQ(std::count(seen.begin(), seen.end(), true),
+            static_cast<long>(kOps + 1));
+}
+
+TEST_F(KeyValueStoreTest, PipelineSurvivesDroppedClient) {
+  // Fill the window and the transport without reading any response, then
+  // drop the call so the server's writes fail while reads are still
+  // posted. The call has to finish anyway (a leak shows up under ASan),
+  // and the server keeps serving.
+  for (int round = 0; round < 4; ++round) {
+    ClientContext context;
+    auto stream = stub_->Pipeline(&context);
+    for (uint64_t tag = 0; tag < 4 * AsyncKVServer::kPipelineWindow; ++tag) {
+      kvstore::PipelineRequest request;
+      request.set_tag(tag);
+      request.mutable_put()->set_key("dropped_" + std::to_string(tag));
+      request.mutable_put()->set_value(std::string(1024, 'd'));
+      if (!stream->Write(request))
+        break;
+    }
+    context.TryCancel();
+    stream->Finish();
+  }
+
+  PutRequest put_request;
+  put_request.set_key("after_dropped_pipeline");
+  put_request.set_value("still_serving");
+  PutResponse put_response;
+  ClientContext put_context;
+  ASSERT_TRUE(stub_->Put(&put_context, put_request, &put_response).ok());
+  EXPECT_TRUE(put_response.success());
+}
+
+TEST_F(KeyValueStoreTest, ScanStreamsChunksInOrder) {
+  // Enough data for several chunks.
+  const int kKeys = 40;
+  std::string value(AsyncKVServer::kScanChunkBytes / 8, 's');
+  kvstore::MultiPutRequest put_request;
+  for (int i = 0; i < kKeys; ++i) {
+    auto *entry = put_request.add_entries();
+    char key[16];
+    std::snprintf(key, sizeof(key), "scan/%03d", i);
+    entry->set_key(key);
+    entry->set_value(value);
+  }
+  kvstore::MultiPutResponse put_response;
+  ClientContext put_context;
+  ASSERT_TRUE(stub_->MultiPut(&put_context, put_request, &put_response).ok());
+
+  auto scan = [&](const std::string &start, uint32_t limit) {
+    kvstore::ScanRequest request;
+    request.set_start(start);
+    request.set_prefix("scan/");
+    request.set_limit(limit);
+    ClientContext context;
+    auto reader = stub_->Scan(&context, request);
+    std::vector<std::string> keys;
+    int chunks = 0;
+    kvstore::ScanResponse response;
+    while (reader->Read(&response)) {
+      ++chunks;
+      for (const auto &entry : response.entries()) {
+        EXPECT_EQ(entry.value(), value);
+        keys.push_back(entry.key());
+      }
+    }
+    EXPECT_TRUE(reader->Finish().ok());
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+    return std::make_pair(keys, chunks);
+  };
+
+  auto [all, chunks] = scan("", 0);
+  ASSERT_EQ(all.size(), static_cast<size_t>(kKeys));
+  EXPECT_EQ(all.front(), "scan/000");
+  EXPECT_EQ(all.back(), "scan/039");
+  EXPECT_GE(chunks, 4);
+
+  auto [limited, limited_chunks] = scan("scan/010", 15);
+  ASSERT_EQ(limited.size(), 15u);
+  EXPECT_EQ(limited.front(), "scan/010");
+  EXPECT_EQ(limited.back(), "scan/024");
+}
+
+TEST_F(KeyValueStoreTest, TtlRequiresExpiringStore) {
+  // The fixture's store keeps no deadlines, so a TTL must not be dropped
+  // silently.
+  PutRequest request;
+  request.set_key("ttl_key");
+  request.set_value("v");
+  request.set_ttl_ms(1000);
+  PutResponse response;
+  ClientContext context;
+  ASSERT_TRUE(stub_->Put(&context, request, &response).ok());
+  EXPECT_FALSE(response.success());
+  EXPECT_FALSE(response.error().empty());
+}
+
+TEST_F(KeyValueStoreTest, StatsCountsRequests) {
+  auto stats = [&](bool text) {
+    kvstore::StatsRequest request;
+    request.set_prometheus_text(text);
+    kvstore::StatsResponse response;
+    ClientContext context;
+    EXPECT_TRUE(stub_->Stats(&context, request, &response).ok());
+    return response;
+  };
+  auto count = [](const kvstore::StatsResponse &response, const char *rpc) {
+    for (const auto &stats : response.rpcs())
+      if (stats.rpc() == rpc)
+        return stats;
+    return kvstore::RpcStats();
+  };
+
+  kvstore::StatsResponse before = stats(false);
+  for (int i = 0; i < 10; ++i) {
+    PutRequest put;
+    put.set_key("stats_key" + std::to_string(i));
+    put.set_value("value");
+    PutResponse put_response;
+    ClientContext put_context;
+    ASSERT_TRUE(stub_->Put(&put_context, put, &put_response).ok());
+    GetRequest get;
+    get.set_key(put.key());
+    GetResponse get_response;
+    ClientContext get_context;
+    ASSERT_TRUE(stub_->Get(&get_context, get, &get_response).ok());
+  }
+
+  kvstore::StatsResponse after = stats(true);
+  auto puts = count(after, "put");
+  auto gets = count(after, "get");
+  EXPECT_EQ(puts.requests() - count(before, "put").requests(), 10u);
+  EXPECT_EQ(gets.requests() - count(before, "get").requests(), 10u);
+  EXPECT_GT(gets.bytes_out(), count(before, "get").bytes_out());
+  EXPECT_GT(gets.p50_us(), 0);
+  EXPECT_LE(gets.p50_us(), gets.p99_us());
+  EXPECT_LE(gets.p99_us(), gets.max_us());
+  EXPECT_GE(after.keys(), 10u);
+  uint64_t cq_total = 0;
+  for (const auto &cq : after.cqs())
+    cq_total += cq.requests();
+  EXPECT_GE(cq_total, 20u);
+  EXPECT_NE(after.prometheus_text().find(
+                "kvstore_requests_total{rpc=\"put\"}"),
+            std::string::npos);
+}
+
+TEST_F(KeyValueStoreTest, TracesCallStages) {
+  GetRequest request;
+  request.set_key("traced_key");
+  GetResponse response;
+  ClientContext context;
+  ASSERT_TRUE(stub_->Get(&context, request, &response).ok());
+  // The completion is handled after the client sees the response.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  std::ostringstream out;
+  EXPECT_GT(async_server_->DumpTrace(out), 0u);
+  nlohmann::json trace = nlohmann::json::parse(out.str());
+  bool found_get = false, found_store = false;
+  for (const auto &event : trace["traceEvents"]) {
+    found_get |= event["name"] == "get";
+    found_store |= event["name"] == "store" && event["cat"] == "get";
+    EXPECT_GE(event["dur"].get<double>(), 0);
+  }
+  EXPECT_TRUE(found_get);
+  EXPECT_TRUE(found_store);
+}
+
+TEST(AsyncKVServerTest, ShutdownBeforeRunStopsRun) {
+  AsyncKVServer server("127.0.0.1:50061");
+  server.Shutdown();
+  // Returns at once instead of serving.
+  server.Run(1, 1);
+}
+
 // (Paste the rest of your test cases as before...)
 
 int main(int argc, char **argv) {
@@ -0,0 +1,252 @@
+#include "client/HashRing.h"
+#include "client/ShardedKVClient.h"
+#include "map/ShardedHashMap.h"
+#include "server_impl.h"
+#include <gtest/gtest.h>
+#include <map>
+#include <thread>
+
+using namespace kvstore;
+
+namespace {
+
+std::vector<size_t> owners(const HashRing &ring, int keys) {
+  std::vector<size_t> out;
+  for (int i = 0; i < keys; ++i)
+    out.push_back(ring.nodeFor("key" + std::to_string(i)));
+  return out;
+}
+
+} // namespace
+
+TEST(HashRingTest, VirtualNodesBalanceTheKeys) {
+  HashRing ring({"a:1", "b:1", "c:1", "d:1"});
+  const int keys = 100000;
+  std::vector<int> count(4);
+  for (size_t owner : owners(ring, keys))
+    ++count[owner];
+  for (int c : count) {
+    EXPECT_GT(c, keys / 4 * 0.8);
+    EXPECT_LT(c, keys / 4 * 1.2);
+  }
+}
+
+TEST(HashRingTest, IndependentOfListingOrder) {
+  HashRing forward({"a:1", "b:1", "c:1"});
+  HashRing backward({"c:1", "b:1", "a:1", "b:1"});
+  ASSERT_EQ(forward.nodes(), backward.nodes());
+  EXPECT_EQ(owners(forward, 1000), owners(backward, 1000));
+}
+
+TEST(HashRingTest, AddingANodeMovesOnlyItsShare) {
+  HashRing before({"a:1", "b:1", "c:1", "d:1"});
+  HashRing after({"a:1", "b:1", "c:1", "d:1", "e:1"});
+  const int keys = 100000;
+  auto old_owner = owners(before, keys);
+  auto new_owner = owners(after, keys);
+  int moved = 0;
+  for (int i = 0; i < keys; ++i) {
+    const std::string &was = before.nodes()[old_owner[i]];
+    const std::string &now = after.nodes()[new_owner[i]];
+    if (was != now) {
+      EXPECT_EQ(now, "e:1"); // keys only move to the new node
+      ++moved;
+    }
+  }
+  EXPECT_GT(moved, keys / 5 * 0.8);
+  EXPECT_LT(moved, keys / 5 * 1.2);
+}
+
+class ShardedKVClientTest : public ::testing::Test {
+protected:
+  static constexpr int kServers = 3;
+
+  static void SetUpTestSuite() {
+    for (int i = 0; i < kServers; ++i) {
+      stores_[i] = std::make_shared<ShardedHashMap>();
+      servers_[i] = std::make_unique<AsyncKVServer>(address(i), stores_[i]);
+      runners_[i] = std::thread([i]() { servers_[i]->Run(1, 1); });
+    }
+    for (int i = 0; i < kServers; ++i) {
+      auto stub = KeyValueStore::NewStub(grpc::CreateChannel(
+          address(i), grpc::InsecureChannelCredentials()));
+      grpc::ClientContext ctx;
+      ctx.set_wait_for_ready(true);
+      StatsResponse response;
+      stub->Stats(&ctx, StatsRequest(), &response);
+    }
+  }
+
+  static void TearDownTestSuite() {
+    for (int i = 0; i < kServers; ++i) {
+      servers_[i]->Shutdown();
+      runners_[i].join();
+      servers_[i].reset();
+    }
+  }
+
+  static std::string address(int i) {
+    return "127.0.0.1:" + std::to_string(50073 + i);
+  }
+
+  static ShardedKVClient::Options options(int servers) {
+    ShardedKVClient::Options options;
+    for (int i = 0; i < servers; ++i)
+      options.endpoints.push_back(address(i));
+    options.client.channels = 1;
+    options.client.default_timeout = std::chrono::seconds(5);
+    return options;
+  }
+
+  // The server whose store holds key, or -1.
+  static int holder(const std::string &key) {
+    int found = -1;
+    std::string value;
+    for (int i = 0; i < kServers; ++i)
+      if (stores_[i]->get(key, value)) {
+        EXPECT_EQ(found, -1) << key << " is on two servers";
+        found = i;
+      }
+    return found;
+  }
+
+  static std::shared_ptr<ShardedHashMap> stores_[kServers];
+  static std::unique_ptr<AsyncKVServer> servers_[kServers];
+  static std::thread runners_[kServers];
+};
+
+std::shared_ptr<ShardedHashMap> ShardedKVClientTest::stores_[kServers];
+std::unique_ptr<AsyncKVServer> ShardedKVClientTest::servers_[kServers];
+std::thread ShardedKVClientTest::runners_[kServers];
+
+TEST_F(ShardedKVClientTest, RoutesEachKeyToItsOwner) {
+  ShardedKVClient client(options(kServers));
+  std::map<int, int> per_server;
+  PutRequest put;
+  put.set_value("v");
+  for (int i = 0; i < 300; ++i) {
+    put.set_key("key" + std::to_string(i));
+    ASSERT_TRUE(client.Put(put).get().ok());
+    int on = holder(put.key());
+    ASSERT_GE(on, 0);
+    EXPECT_EQ(address(on), client.EndpointFor(put.key()));
+    ++per_server[on];
+  }
+  EXPECT_EQ(per_server.size(), static_cast<size_t>(kServers));
+
+  GetRequest get;
+  get.set_key("key7");
+  auto reply = client.Get(get).get();
+  ASSERT_TRUE(reply.ok());
+  EXPECT_TRUE(reply.response.found());
+  DeleteRequest del;
+  del.set_key("key7");
+  EXPECT_TRUE(client.Delete(del).get().response.success());
+  EXPECT_EQ(holder("key7"), -1);
+}
+
+TEST_F(ShardedKVClientTest, BatchesAreSplitAndMergedInOrder) {
+  ShardedKVClient client(options(kServers));
+  MultiPutRequest put;
+  for (int i = 0; i < 100; ++i) {
+    auto *entry = put.add_entries();
+    entry->set_key("batch" + std::to_string(i));
+    entry->set_value("value" + std::to_string(i));
+  }
+  auto put_reply = client.MultiPut(put).get();
+  ASSERT_TRUE(put_reply.ok());
+  EXPECT_TRUE(put_reply.response.success());
+  for (int i = 0; i < 100; ++i)
+    EXPECT_EQ(address(holder("batch" + std::to_string(i))),
+              client.EndpointFor("batch" + std::to_string(i)));
+
+  MultiGetRequest get;
+  for (int i = 99; i >= 0; i -= 3)
+    get.add_keys("batch" + std::to_string(i));
+  get.add_keys("missing");
+  auto get_reply = client.MultiGet(get).get();
+  ASSERT_TRUE(get_reply.ok());
+  ASSERT_EQ(get_reply.response.values_size(), get.keys_size());
+  for (int j = 0, i = 99; i >= 0; ++j, i -= 3) {
+    EXPECT_TRUE(get_reply.response.found(j));
+    EXPECT_EQ(get_reply.response.values(j), "value" + std::to_string(i));
+  }
+  EXPECT_FALSE(get_reply.response.found(get.keys_size() - 1));
+
+  MultiDeleteRequest del;
+  del.add_keys("missing");
+  del.add_keys("batch5");
+  auto del_reply = client.MultiDelete(del).get();
+  ASSERT_TRUE(del_reply.ok());
+  ASSERT_EQ(del_reply.response.deleted_size(), 2);
+  EXPECT_FALSE(del_reply.response.deleted(0));
+  EXPECT_TRUE(del_reply.response.deleted(1));
+
+  EXPECT_TRUE(client.MultiGet(MultiGetRequest()).get().ok());
+}
+
+TEST_F(ShardedKVClientTest, MembershipChangeMovesOnlyTheNewServersShare) {
+  ShardedKVClient client(options(2));
+  const int keys = 600;
+  PutRequest put;
+  put.set_value("v");
+  for (int i = 0; i < keys; ++i) {
+    put.set_key("member" + std::to_string(i));
+    ASSERT_TRUE(client.Put(put).get().ok());
+  }
+  client.SetEndpoints(options(3).endpoints);
+  EXPECT_EQ(client.Endpoints().size(), 3u);
+
+  int moved = 0;
+  GetRequest get;
+  for (int i = 0; i < keys; ++i) {
+    get.set_key("member" + std::to_string(i));
+    std::string owner = client.EndpointFor(get.key());
+    auto reply = client.Get(get).get();
+    ASSERT_TRUE(reply.ok());
+    if (owner == address(2)) {
+      EXPECT_FALSE(reply.response.found()); // not migrated
+      ++moved;
+    } else {
+      EXPECT_TRUE(reply.response.found());
+      EXPECT_EQ(address(holder(get.key())), owner);
+    }
+  }
+  EXPECT_GT(moved, keys / 3 / 2);
+  EXPECT_LT(moved, keys / 2);
+
+  // Shrinking back sends those keys to their old owners again.
+  client.SetEndpoints(options(2).endpoints);
+  for (int i = 0; i < keys; ++i) {
+    get.set_key("member" + std::to_string(i));
+    EXPECT_TRUE(client.Get(get).get().response.found());
+  }
+}
+
+TEST_F(ShardedKVClientTest, RemovedServersAreShutDownOnceDrained) {
+  auto opts = options(2);
+  opts.reap_interval = std::chrono::milliseconds(5);
+  ShardedKVClient client(opts);
+  PutRequest put;
+  put.set_key("drain");
+  put.set_value("v");
+  auto pending = client.Put(put);
+  client.SetEndpoints(options(1).endpoints);
+  EXPECT_TRUE(pending.get().ok()); // sent before the removal, still served
+  // No further SetEndpoints call is needed to release the removed client.
+  for (int i = 0; i < 200 && client.Retired() > 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_EQ(client.Retired(), 0u);
+}
+
+TEST_F(ShardedKVClientTest, NoEndpointsIsUnavailable) {
+  ShardedKVClient client(options(0));
+  GetRequest get;
+  get.set_key("k");
+  EXPECT_EQ(client.Get(get).get().status.error_code(),
+            grpc::StatusCode::UNAVAILABLE);
+  MultiGetRequest multi;
+  multi.add_keys("k");
+  EXPECT_EQ(client.MultiGet(multi).get().status.error_code(),
+            grpc::StatusCode::UNAVAILABLE);
+}
@@ -0,0 +1,108 @@
+#include "map/Record.h"
+#include "map/SlabAllocator.h"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+
+TEST(SlabAllocatorTest, SizeClasses) {
+  EXPECT_EQ(SlabAllocator::kClassSizes[SlabAllocator::sizeClass(1)], 16u);
+  EXPECT_EQ(SlabAllocator::kClassSizes[SlabAllocator::sizeClass(16)], 16u);
+  EXPECT_EQ(SlabAllocator::kClassSizes[SlabAllocator::sizeClass(17)], 32u);
+  EXPECT_EQ(SlabAllocator::kClassSizes[SlabAllocator::sizeClass(4096)],
+            4096u);
+  EXPECT_EQ(SlabAllocator::sizeClass(4097), 0);
+}
+
+TEST(SlabAllocatorTest, FreedBlocksAreReused) {
+  auto &slab = SlabAllocator::global();
+  uint8_t c = SlabAllocator::sizeClass(100);
+  void *a = slab.allocate(100, c);
+  slab.deallocate(a, 100, c);
+  void *b = slab.allocate(100, c);
+  EXPECT_EQ(a, b);
+  slab.deallocate(b, 100, c);
+}
+
+TEST(SlabAllocatorTest, AccountsUsedAndAllocatedBytes) {
+  auto &slab = SlabAllocator::global();
+  auto before = slab.stats();
+
+  uint8_t c = SlabAllocator::sizeClass(100); // 128-byte class
+  std::vector<void *> blocks;
+  for (int i = 0; i < 1000; ++i)
+    blocks.push_back(slab.allocate(100, c));
+  void *large = slab.allocate(10000, 0);
+
+  auto during = slab.stats();
+  EXPECT_EQ(during.bytes_used - before.bytes_used, 1000u * 100 + 10000);
+  EXPECT_EQ(during.bytes_allocated - before.bytes_allocated, 1000u * 128);
+  EXPECT_EQ(during.bytes_large - before.bytes_large, 10000u);
+  EXPECT_GE(during.bytes_reserved, during.bytes_used);
+  EXPECT_EQ(during.bytes_wasted, during.bytes_reserved - during.bytes_used);
+  EXPECT_GE(during.fragmentationRatio(), 1.0);
+
+  for (void *b : blocks)
+    slab.deallocate(b, 100, c);
+  slab.deallocate(large, 10000, 0);
+
+  auto after = slab.stats();
+  EXPECT_EQ(after.bytes_used, before.bytes_used);
+  EXPECT_EQ(after.bytes_allocated, before.bytes_allocated);
+  // Pages stay reserved for reuse.
+  EXPECT_EQ(after.pages, during.pages);
+}
+
+TEST(SlabAllocatorTest, CrossThreadFreeAndThreadExit) {
+  auto &slab = SlabAllocator::global();
+  auto before = slab.stats();
+  uint8_t c = SlabAllocator::sizeClass(48);
+
+  std::vector<void *> blocks(5000);
+  std::thread producer([&]() {
+    for (auto &b : blocks)
+      b = slab.allocate(48, c);
+  });
+  producer.join();
+  std::thread consumer([&]() {
+    for (void *b : blocks)
+      slab.deallocate(b, 48, c);
+  });
+  consumer.join();
+
+  // Both threads have exited, folding their counters into the totals.
+  auto after = slab.stats();
+  EXPECT_EQ(after.bytes_used, before.bytes_used);
+  EXPECT_EQ(after.bytes_allocated, before.bytes_allocated);
+}
+
+TEST(SlabAllocatorTest, RecordsUseSlabsWhenEnabled) {
+  auto &slab = SlabAllocator::global();
+  auto before = slab.stats();
+  const Record *small = Record::create("key", std::string(40, 'v'));
+  EXPECT_EQ(small->key(), "key");
+  EXPECT_EQ(small->value(), std::string(40, 'v'));
+  auto during = slab.stats();
+  EXPECT_GT(during.bytes_allocated, before.bytes_allocated);
+  small->release();
+
+  {
+    SlabAllocator::ScopedEnabled disabled(false);
+    const Record *heap = Record::create("key", "value");
+    EXPECT_EQ(slab.stats().bytes_allocated, before.bytes_allocated);
+    heap->release();
+  }
+  EXPECT_EQ(slab.stats().bytes_used, before.bytes_used);
+}
+
+TEST(SlabAllocatorTest, RecordsRefuseValuesPast4GiB) {
+  // Checked before anything is allocated or filled.
+  bool filled = false;
+  EXPECT_THROW(Record::create("key", size_t{1} << 32,
+                              [&](char *) { return filled = true; }),
+               std::length_error);
+  EXPECT_FALSE(filled);
+}
@@ -0,0 +1,147 @@
+#include "map/ShardedHashMap.h"
+#include "map/SkipListMap.h"
+#include "storage/Checkpointer.h"
+#include "storage/SnapshotFile.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace kvstore;
+
+class SnapshotTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    dir_ = "snapshot_test_" + std::to_string(::getpid());
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directory(dir_);
+  }
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  Checkpointer::Options options() const {
+    Checkpointer::Options options;
+    options.snapshot_path = dir_ + "/kv.snap";
+    options.wal_path = dir_ + "/kv.wal";
+    options.wal.durability = WriteAheadLog::Durability::kSync;
+    return options;
+  }
+
+  static std::string keyFor(int i) {
+    char key[16];
+    std::snprintf(key, sizeof(key), "key%06d", i);
+    return key;
+  }
+
+  std::string dir_;
+};
+
+TEST_F(SnapshotTest, RoundTripsAcrossBlocks) {
+  SkipListMap store;
+  std::string value(1000, 'v'); // ~65 entries per block
+  for (int i = 0; i < 1000; ++i)
+    store.put(keyFor(i), value + std::to_string(i));
+  std::string path = dir_ + "/kv.snap";
+  EXPECT_EQ(SnapshotWriter::writeFrom(store, path, 7), 1000u);
+
+  SnapshotReader reader(path);
+  EXPECT_EQ(reader.generation(), 7u);
+  EXPECT_EQ(reader.entries(), 1000u);
+  EXPECT_GT(reader.blocks(), 10u);
+  std::string got;
+  ASSERT_TRUE(reader.get(keyFor(500), got));
+  EXPECT_EQ(got, value + "500");
+  EXPECT_FALSE(reader.get("key", got));
+  EXPECT_FALSE(reader.get("zzz", got));
+
+  SkipListMap loaded;
+  reader.loadInto(loaded, 4);
+  EXPECT_EQ(loaded.size(), 1000u);
+  ASSERT_TRUE(loaded.get(keyFor(999), got));
+  EXPECT_EQ(got, value + "999");
+}
+
+TEST_F(SnapshotTest, ScansLargeStoresInBatches) {
+  SkipListMap store;
+  std::string value(1000, 'v'); // a few scan batches
+  for (int i = 0; i < 3000; ++i)
+    store.put(keyFor(i), value + std::to_string(i));
+  std::string path = dir_ + "/kv.snap";
+  EXPECT_EQ(SnapshotWriter::writeFrom(store, path, 1), 3000u);
+
+  SkipListMap loaded;
+  SnapshotReader(path).loadInto(loaded, 2);
+  EXPECT_EQ(loaded.size(), 3000u);
+  std::string got;
+  for (int i : {0, 1047, 2094, 2999}) {
+    ASSERT_TRUE(loaded.get(keyFor(i), got));
+    EXPECT_EQ(got, value + std::to_string(i));
+  }
+}
+
+TEST_F(SnapshotTest, UnorderedEngineIsSortedOnWrite) {
+  ShardedHashMap store;
+  for (int i = 0; i < 500; ++i)
+    store.put(keyFor(i), std::to_string(i));
+  std::string path = dir_ + "/kv.snap";
+  SnapshotWriter::writeFrom(store, path, 1);
+
+  SnapshotReader reader(path);
+  std::vector<std::string> keys;
+  for (size_t b = 0; b < reader.blocks(); ++b)
+    reader.forEachInBlock(b, [&](std::string_view key, std::string_view) {
+      keys.emplace_back(key);
+    });
+  ASSERT_EQ(keys.size(), 500u);
+  EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+}
+
+TEST_F(SnapshotTest, RejectsCorruptBlock) {
+  SkipListMap store;
+  for (int i = 0; i < 100; ++i)
+    store.put(keyFor(i), "value");
+  std::string path = dir_ + "/kv.snap";
+  SnapshotWriter::writeFrom(store, path, 1);
+  {
+    std::FILE *f = std::fopen(path.c_str(), "r+b");
+    std::fseek(f, 20, SEEK_SET);
+    std::fputc('X', f);
+    std::fclose(f);
+  }
+  SnapshotReader reader(path);
+  SkipListMap loaded;
+  EXPECT_THROW(reader.loadInto(loaded, 2), std::runtime_error);
+}
+
+TEST_F(SnapshotTest, RecoversFromSnapshotPlusNewerSegments) {
+  {
+    Checkpointer checkpointer(std::make_shared<SkipListMap>(), options());
+    auto store = checkpointer.store();
+    for (int i = 0; i < 100; ++i)
+      store->put(keyFor(i), "old");
+    checkpointer.snapshotNow();
+    store->put(keyFor(0), "new");
+    store->remove(keyFor(1));
+    store->put("after", "snapshot");
+  }
+  // Only the segment written after the snapshot is left.
+  EXPECT_FALSE(std::filesystem::exists(dir_ + "/kv.wal.1"));
+  EXPECT_TRUE(std::filesystem::exists(dir_ + "/kv.wal.2"));
+
+  Checkpointer checkpointer(std::make_shared<SkipListMap>(), options());
+  EXPECT_EQ(checkpointer.recoveryStats().snapshot_entries, 100u);
+  EXPECT_EQ(checkpointer.recoveryStats().wal_records, 3u);
+  auto store = checkpointer.store();
+  std::string value;
+  EXPECT_EQ(store->size(), 100u);
+  ASSERT_TRUE(store->get(keyFor(0), value));
+  EXPECT_EQ(value, "new");
+  EXPECT_FALSE(store->get(keyFor(1), value));
+  ASSERT_TRUE(store->get("after", value));
+  EXPECT_EQ(value, "snapshot");
+  ASSERT_TRUE(store->get(keyFor(99), value));
+  EXPECT_EQ(value, "old");
+}
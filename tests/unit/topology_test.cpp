@@ -0,0 +1,74 @@
+#include "runtime/CpuTopology.h"
+#include "server_impl.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace kvstore;
+
+TEST(CpuTopologyTest, ParsesCpuLists) {
+  EXPECT_EQ(parseCpuList("0-3,8,10-11"),
+            (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(parseCpuList(" 5, 1-2 ,2"), (std::vector<int>{1, 2, 5}));
+  EXPECT_TRUE(parseCpuList("").empty());
+  EXPECT_THROW(parseCpuList("3-1"), std::invalid_argument);
+  EXPECT_THROW(parseCpuList("1-x"), std::invalid_argument);
+  EXPECT_THROW(parseCpuList("-1"), std::invalid_argument);
+}
+
+TEST(CpuTopologyTest, SpreadKeepsEachCqOnOneNode) {
+  // Node 1 has no usable CPUs and is skipped.
+  CpuTopology topology({{0, 1, 2, 3}, {}, {4, 5, 6, 7}});
+  ASSERT_EQ(topology.nodes().size(), 2u);
+  EXPECT_EQ(topology.nodeOf(5), 2);
+  EXPECT_EQ(topology.nodeOf(9), -1);
+  auto plan = topology.spread(4, 2);
+  ASSERT_EQ(plan.size(), 8u);
+  std::vector<std::vector<int>> expected = {{0}, {1}, {4}, {5},
+                                            {2}, {3}, {6}, {7}};
+  EXPECT_EQ(plan, expected);
+  // More threads than CPUs wrap around within the node.
+  EXPECT_EQ(CpuTopology({{0, 1}}).spread(1, 3),
+            (std::vector<std::vector<int>>{{0}, {1}, {0}}));
+}
+
+TEST(CpuTopologyTest, PinsTheCallingThread) {
+  int cpu = CpuTopology::allowedCpus().front();
+  std::thread([cpu]() {
+    ASSERT_TRUE(pinThisThread({cpu}));
+    cpu_set_t set;
+    ASSERT_EQ(::sched_getaffinity(0, sizeof(set), &set), 0);
+    EXPECT_EQ(CPU_COUNT(&set), 1);
+    EXPECT_TRUE(CPU_ISSET(cpu, &set));
+  }).join();
+  EXPECT_FALSE(pinThisThread({CPU_SETSIZE}));
+}
+
+TEST(CpuTopologyTest, ServerRunsPinned) {
+  auto store = std::make_shared<SkipListMap>();
+  AsyncKVServer server("127.0.0.1:50071", store);
+  AsyncKVServer::Topology topology;
+  topology.num_cqs = 2;
+  topology.threads_per_cq = 2;
+  topology.thread_cpus =
+      CpuTopology::detect().spread(topology.num_cqs, topology.threads_per_cq);
+  topology.numa_local = true;
+  std::thread runner([&]() { server.Run(topology); });
+  auto stub = KeyValueStore::NewStub(grpc::CreateChannel(
+      "127.0.0.1:50071", grpc::InsecureChannelCredentials()));
+  PutRequest put;
+  put.set_key("pinned");
+  put.set_value("yes");
+  PutResponse put_response;
+  grpc::ClientContext put_ctx;
+  put_ctx.set_wait_for_ready(true);
+  EXPECT_TRUE(stub->Put(&put_ctx, put, &put_response).ok());
+  GetRequest get;
+  get.set_key("pinned");
+  GetResponse get_response;
+  grpc::ClientContext get_ctx;
+  EXPECT_TRUE(stub->Get(&get_ctx, get, &get_response).ok());
+  EXPECT_EQ(get_response.value(), "yes");
+  // EXPECTs above, so a failure still reaches the join.
+  server.Shutdown();
+  runner.join();
+}
@@ -0,0 +1,93 @@
+#include "metrics/StageTracer.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace kvstore;
+
+namespace {
+
+StageTracer::Trace makeTrace(uint64_t start, const char *name) {
+  StageTracer::Trace trace;
+  for (size_t s = 0; s < StageTracer::kStages; ++s)
+    trace.at[s] = start + 1000 * s;
+  trace.thread = StageTracer::threadId();
+  trace.completion_thread = trace.thread;
+  trace.name = name;
+  return trace;
+}
+
+nlohmann::json dump(const StageTracer &tracer) {
+  std::ostringstream out;
+  tracer.writeChromeJson(out);
+  return nlohmann::json::parse(out.str());
+}
+
+} // namespace
+
+TEST(StageTracerTest, SamplesOneInN) {
+  StageTracer tracer(4, 16);
+  int sampled = 0;
+  for (int i = 0; i < 100; ++i)
+    sampled += tracer.sample();
+  EXPECT_EQ(sampled, 25);
+}
+
+TEST(StageTracerTest, WritesChromeTraceSpans) {
+  StageTracer tracer(1, 16);
+  tracer.record(makeTrace(5'000'000, "get"));
+  nlohmann::json trace = dump(tracer);
+  const auto &events = trace["traceEvents"];
+  // The request span and its three stages.
+  ASSERT_EQ(events.size(), 4u);
+  EXPECT_EQ(events[0]["name"], "get");
+  EXPECT_EQ(events[0]["ph"], "X");
+  EXPECT_DOUBLE_EQ(events[0]["ts"].get<double>(), 5000.0);
+  EXPECT_DOUBLE_EQ(events[0]["dur"].get<double>(), 3.0);
+  EXPECT_EQ(events[1]["name"], "arm_next");
+  EXPECT_EQ(events[2]["name"], "store");
+  EXPECT_DOUBLE_EQ(events[2]["ts"].get<double>(), 5001.0);
+  EXPECT_DOUBLE_EQ(events[2]["dur"].get<double>(), 1.0);
+  EXPECT_EQ(events[3]["name"], "respond");
+  EXPECT_EQ(events[0]["args"]["error"], false);
+}
+
+TEST(StageTracerTest, RingKeepsTheLatestTraces) {
+  StageTracer tracer(1, 8);
+  for (uint64_t i = 0; i < 20; ++i)
+    tracer.record(makeTrace(i * 1'000'000, "put"));
+  std::ostringstream out;
+  EXPECT_EQ(tracer.writeChromeJson(out), 8u);
+  nlohmann::json trace = nlohmann::json::parse(out.str());
+  double earliest = 1e18;
+  for (const auto &event : trace["traceEvents"])
+    earliest = std::min(earliest, event["ts"].get<double>());
+  EXPECT_DOUBLE_EQ(earliest, 12'000.0); // traces 12..19 survive
+}
+
+TEST(StageTracerTest, DumpsWhileThreadsRecord) {
+  StageTracer tracer(1, 64);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; ++t) {
+    writers.emplace_back([&]() {
+      uint64_t i = 0;
+      while (!done.load(std::memory_order_relaxed))
+        tracer.record(makeTrace(++i * 1000, "get"));
+    });
+  }
+  for (int i = 0; i < 50; ++i) {
+    nlohmann::json trace = dump(tracer);
+    // Every copied trace is whole: each request span has its stages.
+    EXPECT_EQ(trace["traceEvents"].size() % 4, 0u);
+    for (const auto &event : trace["traceEvents"])
+      EXPECT_DOUBLE_EQ(event["dur"].get<double>(),
+                       event["name"] == "get" ? 3.0 : 1.0);
+  }
+  done = true;
+  for (auto &writer : writers)
+    writer.join();
+}